@@ -0,0 +1,344 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// non-blocking streaming: the user's event loop waits for the sockets we tell it
+// about in WRC_GetPollInfo() and calls WRC_OnSocketEvent()/WRC_OnTimeout(),
+// which let a curl multi handle (one per stream) do the work with curl_multi_socket_action()
+
+#include "internal.h"
+
+struct WRC__AsyncDriver
+{
+	CURLM* multi;
+
+	int numSockets;
+	int socketsSize; // allocated entries of sockets
+	WRC_PollFd* sockets; // handed out by WRC_GetPollInfo()
+
+	uint64_t timerDeadline; // as requested by curlTimerFun(), 0 if there is none
+};
+
+// called by curl to tell us which events to wait for on which socket
+static int curlSocketFun(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp)
+{
+	struct WRC__AsyncDriver* drv = (struct WRC__AsyncDriver*)userp;
+
+	int idx = 0;
+	while(idx < drv->numSockets && drv->sockets[idx].fd != (WRC_Socket)s)
+		++idx;
+
+	if(what == CURL_POLL_REMOVE)
+	{
+		if(idx < drv->numSockets)
+		{
+			// move the last one into the hole
+			--drv->numSockets;
+			drv->sockets[idx] = drv->sockets[drv->numSockets];
+		}
+		return 0;
+	}
+
+	if(idx == drv->numSockets)
+	{
+		if(drv->numSockets == drv->socketsSize)
+		{
+			// a few are enough for a plain stream, HLS prefetching, standby and
+			// racing connections need more
+			int newSize = (drv->socketsSize > 0) ? 2*drv->socketsSize : 4;
+			WRC_PollFd* sockets = realloc(drv->sockets, newSize*sizeof(WRC_PollFd));
+			if(sockets == NULL)
+			{
+				eprintf("libwrclient: Out of Memory!\n");
+				return -1;
+			}
+			drv->sockets = sockets;
+			drv->socketsSize = newSize;
+		}
+		++drv->numSockets;
+		drv->sockets[idx].fd = (WRC_Socket)s;
+	}
+
+	int events = 0;
+	if(what & CURL_POLL_IN)  events |= WRC_POLL_IN;
+	if(what & CURL_POLL_OUT) events |= WRC_POLL_OUT;
+	drv->sockets[idx].events = events;
+
+	return 0;
+}
+
+// called by curl to tell us when it wants curl_multi_socket_action(CURL_SOCKET_TIMEOUT)
+static int curlTimerFun(CURLM* multi, long timeoutMs, void* userp)
+{
+	struct WRC__AsyncDriver* drv = (struct WRC__AsyncDriver*)userp;
+
+	drv->timerDeadline = (timeoutMs < 0) ? 0 : WRC__timeMs() + timeoutMs;
+	return 0;
+}
+
+static void freeDriver(WRC_Stream* ctx)
+{
+	struct WRC__AsyncDriver* drv = ctx->async;
+	ctx->async = NULL;
+
+	curl_multi_cleanup(drv->multi);
+	free(drv->sockets);
+	free(drv);
+}
+
+// stops the stream and returns what WRC_StartStreaming() would have returned
+static int finishAsyncStream(WRC_Stream* ctx, bool transferOK)
+{
+	WRC__stopStandby(ctx); // needs drv->multi
+	WRC__stopRace(ctx);
+	WRC__stopHls(ctx);
+	freeDriver(ctx);
+	return WRC__finishStreaming(ctx, transferOK);
+}
+
+// checks if the transfer is done, returns WRC_STILL_STREAMING if it isn't
+static int handleFinishedTransfer(WRC_Stream* ctx)
+{
+	struct WRC__AsyncDriver* drv = ctx->async;
+
+	if(ctx->userAbort)
+	{
+		curl_multi_remove_handle(drv->multi, ctx->curl);
+		WRC__finishTransfer(ctx, CURLE_ABORTED_BY_CALLBACK);
+		return finishAsyncStream(ctx, false);
+	}
+
+	CURLMsg* msg;
+	int msgsLeft = 0;
+	while((msg = curl_multi_info_read(drv->multi, &msgsLeft)) != NULL)
+	{
+		if(msg->msg != CURLMSG_DONE)
+			continue;
+
+		if(ctx->hls.session != NULL && WRC__hlsFinished(ctx, msg->easy_handle, msg->data.result))
+		{
+			// a segment or the reloaded playlist, WRC__hlsCheck() below handles the rest
+			continue;
+		}
+		if(msg->easy_handle == ctx->standby.curl)
+		{
+			WRC__standbyFinished(ctx);
+			continue;
+		}
+		if(WRC__raceFinished(ctx, msg->easy_handle))
+		{
+			continue;
+		}
+
+		CURLcode res = msg->data.result;
+		curl_multi_remove_handle(drv->multi, ctx->curl);
+
+		if(WRC__standbyTakeOver(ctx, drv->multi))
+		{
+			// the standby connection (already in drv->multi) goes on
+			return WRC_STILL_STREAMING;
+		}
+		if(WRC__raceTakeOver(ctx, drv->multi))
+		{
+			// another URL from the playlist (already in drv->multi) goes on
+			return WRC_STILL_STREAMING;
+		}
+
+		enum WRC__TRANSFER_RESULT tres = WRC__finishTransfer(ctx, res);
+		if(tres == WRC__TRANSFER_RESTART)
+		{
+			// we got a playlist, now ctx->curl is set up for the real stream
+			curl_multi_add_handle(drv->multi, ctx->curl);
+			WRC__startRace(ctx, drv->multi);
+			return WRC_STILL_STREAMING;
+		}
+		if(tres == WRC__TRANSFER_RECONNECT)
+		{
+			// WRC_GetPollInfo() makes the user call WRC_OnTimeout() when it's time
+			return WRC_STILL_STREAMING;
+		}
+		if(tres == WRC__TRANSFER_HLS && WRC__hlsStart(ctx, drv->multi))
+		{
+			// the segments are downloaded in drv->multi
+			break;
+		}
+
+		return finishAsyncStream(ctx, tres == WRC__TRANSFER_OK);
+	}
+
+	if(ctx->hls.session != NULL)
+	{
+		enum WRC__HLS_RESULT hres = WRC__hlsCheck(ctx);
+		if(hres != WRC__HLS_RUNNING)
+		{
+			return finishAsyncStream(ctx, hres == WRC__HLS_DONE);
+		}
+	}
+
+	return WRC_STILL_STREAMING;
+}
+
+// called by WRC_CleanupStream() if the user didn't wait for the stream to finish
+void WRC__abortAsyncStream(WRC_Stream* ctx)
+{
+	ctx->userAbort = true;
+	curl_multi_remove_handle(ctx->async->multi, ctx->curl);
+	WRC__finishTransfer(ctx, CURLE_ABORTED_BY_CALLBACK);
+	finishAsyncStream(ctx, false);
+}
+
+int WRC_BeginStreaming(WRC_Stream* stream)
+{
+	if(stream->group != NULL || stream->curl != NULL)
+	{
+		eprintf("WRC_BeginStreaming(): stream is already streaming!\n");
+		return 0;
+	}
+
+	struct WRC__AsyncDriver* drv = calloc(1, sizeof(struct WRC__AsyncDriver));
+	if(drv == NULL)
+	{
+		eprintf("WRC_BeginStreaming(): Out of Memory!\n");
+		return 0;
+	}
+
+	drv->multi = curl_multi_init();
+	if(drv->multi == NULL)
+	{
+		eprintf("WRC_BeginStreaming(): Initializing cURL multi handle failed!\n");
+		free(drv);
+		return 0;
+	}
+
+	curl_multi_setopt(drv->multi, CURLMOPT_SOCKETFUNCTION, curlSocketFun);
+	curl_multi_setopt(drv->multi, CURLMOPT_SOCKETDATA, drv);
+	curl_multi_setopt(drv->multi, CURLMOPT_TIMERFUNCTION, curlTimerFun);
+	curl_multi_setopt(drv->multi, CURLMOPT_TIMERDATA, drv);
+
+	stream->async = drv;
+
+	if(!WRC__startTransfer(stream))
+	{
+		finishAsyncStream(stream, false);
+		return 0;
+	}
+
+	// this makes curl call curlTimerFun(), so the user will call WRC_OnTimeout() to kick things off
+	curl_multi_add_handle(drv->multi, stream->curl);
+
+	return 1;
+}
+
+void WRC_GetPollInfo(WRC_Stream* stream, WRC_PollInfo* info)
+{
+	struct WRC__AsyncDriver* drv = stream->async;
+
+	memset(info, 0, sizeof(*info));
+	info->timeoutMs = -1;
+
+	if(drv == NULL)
+	{
+		return;
+	}
+
+	info->numFds = drv->numSockets;
+	info->fds = drv->sockets;
+
+	if(stream->userAbort)
+	{
+		// WRC_OnTimeout() will finish the stream
+		info->timeoutMs = 0;
+	}
+	else if(drv->timerDeadline != 0)
+	{
+		uint64_t now = WRC__timeMs();
+		info->timeoutMs = (drv->timerDeadline > now) ? (int)(drv->timerDeadline - now) : 0;
+	}
+
+	if(stream->flowPaused && (info->timeoutMs < 0 || info->timeoutMs > WRC__FLOW_CHECK_MS))
+	{
+		// WRC_OnTimeout() checks if the transfer can be resumed
+		info->timeoutMs = WRC__FLOW_CHECK_MS;
+	}
+
+	if(stream->standby.enabled && (info->timeoutMs < 0 || info->timeoutMs > WRC__STANDBY_CHECK_MS))
+	{
+		// WRC_OnTimeout() checks if the stream stalled
+		info->timeoutMs = WRC__STANDBY_CHECK_MS;
+	}
+
+	if(stream->reconnectPending)
+	{
+		// WRC_OnTimeout() starts the next connection attempt
+		uint64_t now = WRC__timeMs();
+		int ms = (stream->reconnectAt > now) ? (int)(stream->reconnectAt - now) : 0;
+		if(info->timeoutMs < 0 || ms < info->timeoutMs)
+			info->timeoutMs = ms;
+	}
+
+	// WRC_OnTimeout() reloads the HLS playlist or starts the next segments
+	info->timeoutMs = WRC__hlsTimeoutMs(stream, info->timeoutMs);
+}
+
+int WRC_OnSocketEvent(WRC_Stream* stream, WRC_Socket fd, int events)
+{
+	struct WRC__AsyncDriver* drv = stream->async;
+	if(drv == NULL)
+	{
+		eprintf("WRC_OnSocketEvent(): stream isn't streaming, call WRC_BeginStreaming() first!\n");
+		return 0;
+	}
+
+	int flags = 0;
+	if(events & WRC_POLL_IN)  flags |= CURL_CSELECT_IN;
+	if(events & WRC_POLL_OUT) flags |= CURL_CSELECT_OUT;
+	if(events & WRC_POLL_ERR) flags |= CURL_CSELECT_ERR;
+
+	int running = 0;
+	curl_multi_socket_action(drv->multi, (curl_socket_t)fd, flags, &running);
+
+	if(!stream->userAbort)
+	{
+		WRC__standbyCheck(stream, drv->multi);
+		WRC__raceCheck(stream, drv->multi);
+	}
+
+	return handleFinishedTransfer(stream);
+}
+
+int WRC_OnTimeout(WRC_Stream* stream)
+{
+	struct WRC__AsyncDriver* drv = stream->async;
+	if(drv == NULL)
+	{
+		eprintf("WRC_OnTimeout(): stream isn't streaming, call WRC_BeginStreaming() first!\n");
+		return 0;
+	}
+
+	if(!stream->userAbort)
+	{
+		WRC__checkFlowControl(stream);
+
+		if(stream->reconnectPending && WRC__timeMs() >= stream->reconnectAt)
+		{
+			stream->reconnectPending = false;
+			curl_multi_add_handle(drv->multi, stream->curl);
+		}
+
+		WRC__standbyCheck(stream, drv->multi);
+		WRC__raceCheck(stream, drv->multi);
+
+		if(drv->timerDeadline == 0 || WRC__timeMs() >= drv->timerDeadline)
+		{
+			int running = 0;
+			drv->timerDeadline = 0;
+			curl_multi_socket_action(drv->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+		}
+	}
+
+	return handleFinishedTransfer(stream);
+}
@@ -0,0 +1,208 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// optional decoder thread (see WRC_SetDecoderThread()): the network thread only
+// demuxes ICY metadata and pushes the compressed data into a lock-free ring,
+// so a slow decoder or playbackCB doesn't keep it from reading the socket.
+
+#include "internal.h"
+
+// default size of the ring for compressed data, ~16s of a 128kbit/s stream
+#define WRC__DEFAULT_DECODER_RING_SIZE (256*1024)
+
+// how long to sleep at most when waiting for the other thread,
+// so a lost wakeup (which shouldn't happen anyway) can't hang us
+#define WRC__DECODER_THREAD_WAIT_MS 100
+
+static void decoderThreadFun(void* arg)
+{
+	WRC_Stream* ctx = (WRC_Stream*)arg;
+	struct WRC__DecoderThread* dt = &ctx->decThread;
+
+	for(;;)
+	{
+		void* data;
+		size_t size = WRC__ringPeek(&dt->ring, &data);
+
+		if(size == 0)
+		{
+			bool done = false;
+			WRC__mutexLock(&dt->lock);
+			while(WRC__ringFill(&dt->ring) == 0 && !dt->producerDone && !dt->abort)
+			{
+				WRC__condWait(&dt->cond, &dt->lock, WRC__DECODER_THREAD_WAIT_MS);
+			}
+			done = dt->abort || (dt->producerDone && WRC__ringFill(&dt->ring) == 0);
+			WRC__mutexUnlock(&dt->lock);
+
+			if(done)
+				break;
+
+			continue;
+		}
+
+		bool ok = ctx->decode(ctx, data, size);
+
+		WRC__ringConsume(&dt->ring, size);
+
+		WRC__mutexLock(&dt->lock);
+		if(!ok)
+		{
+			// the error has been reported already, make the network thread abort the transfer
+			dt->failed = true;
+		}
+		bool done = !ok || dt->abort;
+		WRC__condSignal(&dt->cond); // the producer might be waiting for free space
+		WRC__mutexUnlock(&dt->lock);
+
+		if(done)
+			break;
+	}
+}
+
+static bool startDecoderThread(WRC_Stream* ctx)
+{
+	struct WRC__DecoderThread* dt = &ctx->decThread;
+
+	if(dt->ring.buf == NULL && !WRC__ringInit(&dt->ring, dt->ringSize))
+	{
+		WRC__errorReset(ctx, WRC_ERR_GENERIC, "Couldn't allocate the decoder thread's buffer!");
+		return false;
+	}
+
+	dt->producerDone = false;
+	dt->abort = false;
+	dt->failed = false;
+
+	if(!WRC__threadCreate(&dt->thread, decoderThreadFun, ctx))
+	{
+		WRC__errorReset(ctx, WRC_ERR_GENERIC, "Couldn't create the decoder thread!");
+		return false;
+	}
+
+	dt->running = true;
+
+	if(dt->name[0] != '\0')
+		WRC__threadSetName(dt->thread, dt->name);
+	if(dt->cpu >= 0)
+		WRC__threadSetAffinity(dt->thread, dt->cpu);
+
+	return true;
+}
+
+bool WRC__decodeInThread(WRC_Stream* ctx, void* data, size_t size)
+{
+	struct WRC__DecoderThread* dt = &ctx->decThread;
+
+	if(!dt->running && !startDecoderThread(ctx))
+	{
+		return false;
+	}
+
+	const unsigned char* remData = data;
+	bool stalled = false;
+
+	for(;;)
+	{
+		size_t written = WRC__ringWrite(&dt->ring, remData, size);
+		remData += written;
+		size -= written;
+
+		size_t fill = WRC__ringFill(&dt->ring);
+		if(fill > dt->ringHighWater)
+			dt->ringHighWater = fill;
+
+		WRC__mutexLock(&dt->lock);
+		WRC__condSignal(&dt->cond); // tell the decoder thread about the new data
+
+		if(size > 0 && !dt->failed && !ctx->userAbort)
+		{
+			// ring is full, wait until the decoder thread made some room
+			if(!stalled)
+			{
+				++dt->producerStalls;
+				stalled = true;
+			}
+			WRC__condWait(&dt->cond, &dt->lock, WRC__DECODER_THREAD_WAIT_MS);
+		}
+
+		bool failed = dt->failed;
+		WRC__mutexUnlock(&dt->lock);
+
+		if(failed)
+			return false;
+
+		if(size == 0 || ctx->userAbort)
+			return true;
+	}
+}
+
+void WRC__stopDecoderThread(WRC_Stream* ctx, bool abort)
+{
+	struct WRC__DecoderThread* dt = &ctx->decThread;
+
+	if(!dt->running)
+		return;
+
+	WRC__mutexLock(&dt->lock);
+	dt->producerDone = true;
+	dt->abort = abort;
+	WRC__condSignal(&dt->cond);
+	WRC__mutexUnlock(&dt->lock);
+
+	WRC__threadJoin(dt->thread);
+	dt->running = false;
+
+	// throw away whatever is left (after an abort) so the ring can be reused
+	dt->ring.readPos = dt->ring.writePos;
+}
+
+void WRC__cleanupDecoderThread(WRC_Stream* ctx)
+{
+	struct WRC__DecoderThread* dt = &ctx->decThread;
+
+	if(!dt->enabled)
+		return;
+
+	WRC__stopDecoderThread(ctx, true);
+	WRC__ringDestroy(&dt->ring);
+	WRC__condDestroy(&dt->cond);
+	WRC__mutexDestroy(&dt->lock);
+	dt->enabled = false;
+}
+
+int WRC_SetDecoderThread(WRC_Stream* stream, size_t ringSize, const char* threadName, int cpu)
+{
+	struct WRC__DecoderThread* dt = &stream->decThread;
+
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetDecoderThread(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(!dt->enabled)
+	{
+		WRC__mutexInit(&dt->lock);
+		WRC__condInit(&dt->cond);
+		dt->enabled = true;
+	}
+	else if(dt->ring.buf != NULL)
+	{
+		// the size might change
+		WRC__ringDestroy(&dt->ring);
+	}
+
+	dt->ringSize = (ringSize != 0) ? ringSize : WRC__DEFAULT_DECODER_RING_SIZE;
+	dt->cpu = cpu;
+	dt->name[0] = '\0';
+	if(threadName != NULL)
+		WRC__snprintf(dt->name, sizeof(dt->name), "%s", threadName);
+
+	return 1;
+}
@@ -0,0 +1,141 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// clock drift compensation (see WRC_SetDriftCompensation()): the server's encoder
+// and the local audio device don't run at exactly the same samplerate, so the amount
+// of buffered audio slowly grows or shrinks. Once per second the (smoothed) fill
+// level is compared to the target and a PI controller adjusts the resampler's ratio
+// by a few ppm. The integral part converges to the actual drift, it's the estimate
+// reported in WRC_StreamStats.
+
+#include "internal.h"
+
+// how often the correction is updated
+#define WRC__DRIFT_INTERVAL_MS 1000
+// weight of a new measurement in the smoothed fill level (time constant ~10 seconds)
+#define WRC__DRIFT_SMOOTHING 0.1
+// ppm per millisecond of deviation from the target (1ppm changes the buffer by 1ms in
+// ~17 minutes), KP and KI are chosen so the fill level settles without overshooting much
+#define WRC__DRIFT_KP 2.0
+// ppm per millisecond and second, how fast the drift estimate follows
+#define WRC__DRIFT_KI 0.001
+
+// how many milliseconds of audio are buffered, -1 if that's unknown
+static int bufferedMs(WRC_Stream* ctx)
+{
+	struct WRC__Drift* d = &ctx->drift;
+
+	if(d->queuedCB != NULL)
+	{
+		return d->queuedCB(ctx->userdata);
+	}
+	if(ctx->pcmBuf.running)
+	{
+		return WRC__pcmBufferedMs(ctx);
+	}
+	if(ctx->shm.hdr != NULL)
+	{
+		return WRC__shmBufferedMs(ctx);
+	}
+	return -1;
+}
+
+static double clampPpm(struct WRC__Drift* d, double ppm)
+{
+	if(ppm > d->maxPpm)
+		return d->maxPpm;
+	if(ppm < -d->maxPpm)
+		return -d->maxPpm;
+	return ppm;
+}
+
+void WRC__driftUpdate(WRC_Stream* ctx)
+{
+	struct WRC__Drift* d = &ctx->drift;
+
+	if(!d->enabled)
+		return;
+
+	uint64_t now = WRC__timeMs();
+	if(d->lastUpdate != 0 && now - d->lastUpdate < WRC__DRIFT_INTERVAL_MS)
+		return;
+
+	// the jitter buffer is prebuffering or the consumer isn't playing yet,
+	// that isn't a drift
+	int ms = bufferedMs(ctx);
+	if(ms <= 0 || ctx->reconnecting)
+	{
+		d->lastUpdate = 0;
+		return;
+	}
+
+	double elapsed = (d->lastUpdate != 0) ? (now - d->lastUpdate) / 1000.0 : 0.0;
+	d->lastUpdate = now;
+
+	if(d->smoothedMs < 0.0)
+		d->smoothedMs = ms;
+	else
+		d->smoothedMs += WRC__DRIFT_SMOOTHING * (ms - d->smoothedMs);
+
+	// more buffered than wanted => the consumer is slower than the server, so
+	// produce fewer samples by advancing faster through the input
+	double error = d->smoothedMs - d->targetMs;
+	d->estimatePpm = clampPpm(d, d->estimatePpm + WRC__DRIFT_KI * error * elapsed);
+	d->correctionPpm = clampPpm(d, d->estimatePpm + WRC__DRIFT_KP * error);
+
+	WRC__setResamplerRatio(ctx, d->correctionPpm);
+}
+
+void WRC__resetDrift(WRC_Stream* ctx)
+{
+	struct WRC__Drift* d = &ctx->drift;
+
+	// the estimate is kept, the clocks don't change with the stream
+	d->lastUpdate = 0;
+	d->smoothedMs = -1.0;
+	d->correctionPpm = d->estimatePpm;
+}
+
+int WRC_SetDriftCompensation(WRC_Stream* stream, int targetMs, int maxPpm, WRC_queuedMsCB queuedFn)
+{
+	struct WRC__Drift* d = &stream->drift;
+
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetDriftCompensation(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(targetMs <= 0)
+	{
+		d->enabled = false;
+		WRC__updateResamplerMode(stream);
+		return 1;
+	}
+
+	if(maxPpm <= 0)
+	{
+		eprintf("WRC_SetDriftCompensation(): maxPpm must be > 0!\n");
+		return 0;
+	}
+
+	d->enabled = true;
+	d->targetMs = targetMs;
+	d->maxPpm = maxPpm;
+	d->queuedCB = queuedFn;
+	d->estimatePpm = 0.0;
+	WRC__resetDrift(stream);
+	if(!WRC__updateResamplerMode(stream))
+	{
+		d->enabled = false;
+		eprintf("WRC_SetDriftCompensation(): Out of Memory!\n");
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,662 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// WRC_StreamGroup: drives many streams from one thread with a curl multi handle,
+// instead of one curl_easy_perform() (and thus one thread) per stream.
+// On Linux epoll + curl_multi_socket_action() are used, so the cost of a loop
+// iteration only depends on the number of sockets with activity,
+// other platforms use curl_multi_poll().
+
+#include "internal.h"
+
+#ifdef __linux__
+#define WRC__GROUP_USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// max number of events handled per epoll_wait()
+#define WRC__GROUP_MAX_EVENTS 64
+
+// protects the group member of all streams: WRC_StopStreaming() might be called from
+// another thread while the group's thread finishes the stream (and then maybe frees
+// the group, see WRC__streamInPrivateGroup()). A group is only freed once all its
+// streams are finished, so it can be used as long as this is locked.
+static WRC__Mutex streamGroupLock;
+
+struct WRC__StreamGroup
+{
+	CURLM* multi;
+	WRC_streamFinishedCB finishedCB;
+
+	WRC__Mutex lock; // protects the next four members, they're used by other threads
+	WRC_Stream* pending; // added with WRC_AddStreamToGroup(), but not started yet (linked by groupNext)
+	bool stop;
+	bool running;
+	bool checkUserAborts; // WRC_StopStreaming() was called for one of the streams
+
+	// the following are only used by the thread in WRC_RunStreamGroup()
+
+	WRC_Stream* streams; // currently streaming, linked by groupPrev/groupNext
+
+	// for WRC__streamInPrivateGroup(): WRC_RunStreamGroup() returns when no streams are left
+	bool stopWhenEmpty;
+	int lastResult; // what finishGroupStream() got from WRC__finishStreaming()
+
+#ifdef WRC__GROUP_USE_EPOLL
+	int epollFd;
+	int wakeupFd; // eventfd to interrupt epoll_wait() when streams are added etc
+	uint64_t timerDeadline; // as requested by curlTimerFun(), 0 if there is none
+#endif
+};
+
+#ifdef WRC__GROUP_USE_EPOLL
+
+// called by curl to tell us which events to wait for on which socket
+static int curlSocketFun(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp)
+{
+	WRC_StreamGroup* group = (WRC_StreamGroup*)userp;
+
+	if(what == CURL_POLL_REMOVE)
+	{
+		epoll_ctl(group->epollFd, EPOLL_CTL_DEL, s, NULL);
+		return 0;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = s;
+	if(what & CURL_POLL_IN)  ev.events |= EPOLLIN;
+	if(what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+
+	// socketp is only NULL if we haven't seen this socket yet
+	if(socketp == NULL)
+	{
+		if(epoll_ctl(group->epollFd, EPOLL_CTL_ADD, s, &ev) != 0 && errno == EEXIST)
+		{
+			epoll_ctl(group->epollFd, EPOLL_CTL_MOD, s, &ev);
+		}
+		curl_multi_assign(group->multi, s, group);
+	}
+	else
+	{
+		epoll_ctl(group->epollFd, EPOLL_CTL_MOD, s, &ev);
+	}
+	return 0;
+}
+
+// called by curl to tell us when it wants curl_multi_socket_action(CURL_SOCKET_TIMEOUT)
+static int curlTimerFun(CURLM* multi, long timeoutMs, void* userp)
+{
+	WRC_StreamGroup* group = (WRC_StreamGroup*)userp;
+
+	group->timerDeadline = (timeoutMs < 0) ? 0 : WRC__timeMs() + timeoutMs;
+	return 0;
+}
+
+#endif // WRC__GROUP_USE_EPOLL
+
+void WRC__wakeupGroup(WRC_StreamGroup* group)
+{
+#ifdef WRC__GROUP_USE_EPOLL
+	uint64_t one = 1;
+	if(write(group->wakeupFd, &one, sizeof(one)) < 0)
+	{
+		// can only fail if the counter overflows, so there is a wakeup pending anyway
+	}
+#else
+	curl_multi_wakeup(group->multi);
+#endif
+}
+
+static void unlinkStream(WRC_StreamGroup* group, WRC_Stream* ctx)
+{
+	if(ctx->groupPrev != NULL)
+		ctx->groupPrev->groupNext = ctx->groupNext;
+	else
+		group->streams = ctx->groupNext;
+
+	if(ctx->groupNext != NULL)
+		ctx->groupNext->groupPrev = ctx->groupPrev;
+
+	ctx->groupPrev = NULL;
+	ctx->groupNext = NULL;
+}
+
+// the stream is done (its curl handle must not be in group->multi anymore)
+// => remove it from the group and tell the user
+static void finishGroupStream(WRC_StreamGroup* group, WRC_Stream* ctx, bool transferOK)
+{
+	// the user might want to add the stream again in the callback, so detach it first
+	WRC__mutexLock(&streamGroupLock);
+	ctx->group = NULL;
+	WRC__mutexUnlock(&streamGroupLock);
+
+	int ret = WRC__finishStreaming(ctx, transferOK);
+	group->lastResult = ret;
+
+	if(ctx->warm.pool != NULL)
+	{
+		WRC__warmStreamFinished(ctx, ret);
+	}
+	else if(group->finishedCB != NULL)
+	{
+		group->finishedCB(ctx->userdata, ret);
+	}
+}
+
+// for streams that haven't been started or must be stopped right now (ctx->userAbort is set)
+static void abortPendingStreams(WRC_StreamGroup* group, WRC_Stream* pending)
+{
+	while(pending != NULL)
+	{
+		WRC_Stream* ctx = pending;
+		pending = ctx->groupNext;
+		ctx->groupNext = NULL;
+
+		ctx->userAbort = true;
+		finishGroupStream(group, ctx, false);
+	}
+}
+
+static void abortRunningStream(WRC_StreamGroup* group, WRC_Stream* ctx)
+{
+	unlinkStream(group, ctx);
+
+	ctx->userAbort = true;
+	curl_multi_remove_handle(group->multi, ctx->curl);
+	WRC__finishTransfer(ctx, CURLE_ABORTED_BY_CALLBACK);
+	finishGroupStream(group, ctx, false);
+}
+
+// curl only notices userAbort once it calls one of our callbacks for the stream,
+// which might take a while if the server doesn't send anything, so do it here
+static void abortStoppedStreams(WRC_StreamGroup* group)
+{
+	WRC_Stream* ctx = group->streams;
+	while(ctx != NULL)
+	{
+		WRC_Stream* next = ctx->groupNext;
+		if(ctx->userAbort)
+		{
+			abortRunningStream(group, ctx);
+		}
+		ctx = next;
+	}
+}
+
+static void startPendingStreams(WRC_StreamGroup* group, WRC_Stream* pending)
+{
+	while(pending != NULL)
+	{
+		WRC_Stream* ctx = pending;
+		pending = ctx->groupNext;
+		ctx->groupNext = NULL;
+
+		if(!WRC__startTransfer(ctx))
+		{
+			finishGroupStream(group, ctx, false);
+			continue;
+		}
+
+		ctx->groupNext = group->streams;
+		if(group->streams != NULL)
+			group->streams->groupPrev = ctx;
+		group->streams = ctx;
+
+		curl_multi_add_handle(group->multi, ctx->curl);
+	}
+}
+
+static void handleFinishedTransfers(WRC_StreamGroup* group)
+{
+	CURLMsg* msg;
+	int msgsLeft = 0;
+	while((msg = curl_multi_info_read(group->multi, &msgsLeft)) != NULL)
+	{
+		if(msg->msg != CURLMSG_DONE)
+			continue;
+
+		// msg is invalid after curl_multi_remove_handle(), so copy what we need
+		CURL* easy = msg->easy_handle;
+		CURLcode res = msg->data.result;
+
+		char* priv = NULL;
+		curl_easy_getinfo(easy, CURLINFO_PRIVATE, &priv);
+		WRC_Stream* ctx = (WRC_Stream*)priv;
+
+		if(ctx->hls.session != NULL && WRC__hlsFinished(ctx, easy, res))
+		{
+			// a segment or the reloaded playlist, checkHlsStreams() handles the rest
+			continue;
+		}
+		if(easy == ctx->standby.curl)
+		{
+			WRC__standbyFinished(ctx);
+			continue;
+		}
+		if(WRC__raceFinished(ctx, easy))
+		{
+			continue;
+		}
+
+		curl_multi_remove_handle(group->multi, easy);
+
+		if(WRC__standbyTakeOver(ctx, group->multi))
+		{
+			// the standby connection (already in group->multi) goes on
+			continue;
+		}
+		if(WRC__raceTakeOver(ctx, group->multi))
+		{
+			// another URL from the playlist (already in group->multi) goes on
+			continue;
+		}
+
+		enum WRC__TRANSFER_RESULT tres = WRC__finishTransfer(ctx, res);
+		if(tres == WRC__TRANSFER_RESTART)
+		{
+			// we got a playlist, now ctx->curl is set up for the real stream
+			curl_multi_add_handle(group->multi, ctx->curl);
+			WRC__startRace(ctx, group->multi);
+			continue;
+		}
+		if(tres == WRC__TRANSFER_RECONNECT)
+		{
+			// stays in group->streams, startReconnects() adds the handle again when it's time
+			continue;
+		}
+		if(tres == WRC__TRANSFER_HLS && WRC__hlsStart(ctx, group->multi))
+		{
+			// the segments are downloaded in group->multi, see checkHlsStreams()
+			continue;
+		}
+
+		unlinkStream(group, ctx);
+		finishGroupStream(group, ctx, tres == WRC__TRANSFER_OK);
+	}
+}
+
+// decodes the HLS segments that arrived and finishes the HLS streams that are done
+static void checkHlsStreams(WRC_StreamGroup* group)
+{
+	WRC_Stream* ctx = group->streams;
+	while(ctx != NULL)
+	{
+		WRC_Stream* next = ctx->groupNext;
+		if(ctx->hls.session != NULL)
+		{
+			enum WRC__HLS_RESULT hres = WRC__hlsCheck(ctx);
+			if(hres != WRC__HLS_RUNNING)
+			{
+				unlinkStream(group, ctx);
+				finishGroupStream(group, ctx, hres == WRC__HLS_DONE);
+			}
+		}
+		ctx = next;
+	}
+}
+
+// true if one of the streams is paused by WRC_SetFlowControl(), so we must check regularly
+// if it can be resumed
+static bool anyStreamPaused(WRC_StreamGroup* group)
+{
+	for(WRC_Stream* ctx = group->streams; ctx != NULL; ctx = ctx->groupNext)
+	{
+		if(ctx->flowPaused)
+			return true;
+	}
+	return false;
+}
+
+// limits timeoutMs (-1 for none) so we wake up for the next reconnect of a stream
+// (and regularly for streams with a standby connection or waiting in a WRC_WarmPool,
+// and when HLS streams must reload their playlist)
+static int reconnectTimeout(WRC_StreamGroup* group, int timeoutMs)
+{
+	uint64_t now = WRC__timeMs();
+	for(WRC_Stream* ctx = group->streams; ctx != NULL; ctx = ctx->groupNext)
+	{
+		if(ctx->standby.enabled && (timeoutMs < 0 || timeoutMs > WRC__STANDBY_CHECK_MS))
+		{
+			timeoutMs = WRC__STANDBY_CHECK_MS;
+		}
+		if(ctx->warm.holding && (timeoutMs < 0 || timeoutMs > WRC__WARM_CHECK_MS))
+		{
+			timeoutMs = WRC__WARM_CHECK_MS;
+		}
+		if(ctx->reconnectPending)
+		{
+			int ms = (ctx->reconnectAt > now) ? (int)(ctx->reconnectAt - now) : 0;
+			if(timeoutMs < 0 || ms < timeoutMs)
+				timeoutMs = ms;
+		}
+		timeoutMs = WRC__hlsTimeoutMs(ctx, timeoutMs);
+	}
+	return timeoutMs;
+}
+
+// performs the transfers of streams again whose reconnect delay is over
+static void startReconnects(WRC_StreamGroup* group)
+{
+	uint64_t now = WRC__timeMs();
+	for(WRC_Stream* ctx = group->streams; ctx != NULL; ctx = ctx->groupNext)
+	{
+		if(ctx->reconnectPending && now >= ctx->reconnectAt)
+		{
+			ctx->reconnectPending = false;
+			curl_multi_add_handle(group->multi, ctx->curl);
+		}
+	}
+}
+
+// waits for socket activity (or timeouts or WRC__wakeupGroup()) and lets curl handle it
+static void runGroupIteration(WRC_StreamGroup* group)
+{
+	int running = 0;
+
+#ifdef WRC__GROUP_USE_EPOLL
+	struct epoll_event events[WRC__GROUP_MAX_EVENTS];
+
+	int timeoutMs = -1;
+	if(group->timerDeadline != 0)
+	{
+		uint64_t now = WRC__timeMs();
+		timeoutMs = (group->timerDeadline > now) ? (int)(group->timerDeadline - now) : 0;
+	}
+	if(anyStreamPaused(group) && (timeoutMs < 0 || timeoutMs > WRC__FLOW_CHECK_MS))
+	{
+		timeoutMs = WRC__FLOW_CHECK_MS;
+	}
+	timeoutMs = reconnectTimeout(group, timeoutMs);
+
+	int numEvents = epoll_wait(group->epollFd, events, WRC__GROUP_MAX_EVENTS, timeoutMs);
+
+	for(int i=0; i < numEvents; ++i)
+	{
+		int fd = events[i].data.fd;
+		if(fd == group->wakeupFd)
+		{
+			uint64_t val;
+			if(read(fd, &val, sizeof(val)) < 0)
+			{
+				// nothing to do, eventfd is non-blocking and was reset already
+			}
+			continue;
+		}
+
+		uint32_t ev = events[i].events;
+		int flags = 0;
+		if(ev & EPOLLIN)  flags |= CURL_CSELECT_IN;
+		if(ev & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+		if(ev & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+
+		curl_multi_socket_action(group->multi, fd, flags, &running);
+	}
+
+	// also check the timer if there were events, so a busy socket can't starve the others
+	if(group->timerDeadline != 0 && WRC__timeMs() >= group->timerDeadline)
+	{
+		group->timerDeadline = 0;
+		curl_multi_socket_action(group->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	}
+#else
+	int timeoutMs = reconnectTimeout(group, anyStreamPaused(group) ? WRC__FLOW_CHECK_MS : 1000);
+	curl_multi_poll(group->multi, NULL, 0, timeoutMs, NULL);
+	curl_multi_perform(group->multi, &running);
+#endif // WRC__GROUP_USE_EPOLL
+
+	startReconnects(group);
+
+	for(WRC_Stream* ctx = group->streams; ctx != NULL; ctx = ctx->groupNext)
+	{
+		WRC__checkFlowControl(ctx);
+		WRC__standbyCheck(ctx, group->multi);
+		WRC__raceCheck(ctx, group->multi);
+		WRC__warmCheck(ctx);
+	}
+
+	handleFinishedTransfers(group);
+	checkHlsStreams(group);
+}
+
+WRC_StreamGroup* WRC_CreateStreamGroup(WRC_streamFinishedCB finishedFn)
+{
+	WRC_StreamGroup* ret = calloc(1, sizeof(struct WRC__StreamGroup));
+	if(ret == NULL)
+	{
+		eprintf("WRC_CreateStreamGroup(): Out of Memory!\n");
+		return NULL;
+	}
+
+	ret->multi = curl_multi_init();
+	if(ret->multi == NULL)
+	{
+		eprintf("WRC_CreateStreamGroup(): Initializing cURL multi handle failed!\n");
+		free(ret);
+		return NULL;
+	}
+
+#ifdef WRC__GROUP_USE_EPOLL
+	ret->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	ret->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = ret->wakeupFd;
+
+	if(ret->epollFd < 0 || ret->wakeupFd < 0
+	   || epoll_ctl(ret->epollFd, EPOLL_CTL_ADD, ret->wakeupFd, &ev) != 0)
+	{
+		eprintf("WRC_CreateStreamGroup(): Setting up epoll failed!\n");
+		if(ret->epollFd >= 0) close(ret->epollFd);
+		if(ret->wakeupFd >= 0) close(ret->wakeupFd);
+		curl_multi_cleanup(ret->multi);
+		free(ret);
+		return NULL;
+	}
+
+	curl_multi_setopt(ret->multi, CURLMOPT_SOCKETFUNCTION, curlSocketFun);
+	curl_multi_setopt(ret->multi, CURLMOPT_SOCKETDATA, ret);
+	curl_multi_setopt(ret->multi, CURLMOPT_TIMERFUNCTION, curlTimerFun);
+	curl_multi_setopt(ret->multi, CURLMOPT_TIMERDATA, ret);
+#endif // WRC__GROUP_USE_EPOLL
+
+	WRC__mutexInit(&ret->lock);
+	ret->finishedCB = finishedFn;
+
+	return ret;
+}
+
+int WRC_AddStreamToGroup(WRC_StreamGroup* group, WRC_Stream* stream)
+{
+	WRC__mutexLock(&streamGroupLock);
+	WRC__mutexLock(&group->lock);
+
+	if(stream->group != NULL || stream->curl != NULL)
+	{
+		WRC__mutexUnlock(&group->lock);
+		WRC__mutexUnlock(&streamGroupLock);
+		eprintf("WRC_AddStreamToGroup(): stream is already streaming!\n");
+		return 0;
+	}
+
+	stream->group = group;
+	stream->groupPrev = NULL;
+	stream->groupNext = group->pending;
+	group->pending = stream;
+
+	WRC__mutexUnlock(&group->lock);
+	WRC__mutexUnlock(&streamGroupLock);
+
+	WRC__wakeupGroup(group);
+
+	return 1;
+}
+
+// streams might have been added by finishedCB (e.g. in probe.c) since group->pending was checked
+static bool hasPendingStreams(WRC_StreamGroup* group)
+{
+	WRC__mutexLock(&group->lock);
+	bool ret = (group->pending != NULL);
+	WRC__mutexUnlock(&group->lock);
+	return ret;
+}
+
+int WRC_RunStreamGroup(WRC_StreamGroup* group)
+{
+	WRC__mutexLock(&group->lock);
+	if(group->running)
+	{
+		WRC__mutexUnlock(&group->lock);
+		eprintf("WRC_RunStreamGroup(): the group is already running in another thread!\n");
+		return 0;
+	}
+	group->running = true;
+	WRC__mutexUnlock(&group->lock);
+
+	for(;;)
+	{
+		WRC__mutexLock(&group->lock);
+		bool stop = group->stop;
+		bool checkUserAborts = group->checkUserAborts;
+		WRC_Stream* pending = group->pending;
+		group->pending = NULL;
+		group->checkUserAborts = false;
+		WRC__mutexUnlock(&group->lock);
+
+		if(stop)
+		{
+			abortPendingStreams(group, pending);
+			break;
+		}
+
+		startPendingStreams(group, pending);
+
+		if(checkUserAborts)
+		{
+			abortStoppedStreams(group);
+		}
+
+		if(group->stopWhenEmpty && group->streams == NULL && !hasPendingStreams(group))
+		{
+			break;
+		}
+
+		runGroupIteration(group);
+	}
+
+	// abort all streams that are still running
+	while(group->streams != NULL)
+	{
+		abortRunningStream(group, group->streams);
+	}
+
+	WRC__mutexLock(&group->lock);
+	group->running = false;
+	group->stop = false;
+	WRC__mutexUnlock(&group->lock);
+
+	return 1;
+}
+
+void WRC_StopStreamGroup(WRC_StreamGroup* group)
+{
+	WRC__mutexLock(&group->lock);
+	group->stop = true;
+	WRC__mutexUnlock(&group->lock);
+
+	WRC__wakeupGroup(group);
+}
+
+bool WRC__stopGroupStream(WRC_Stream* stream)
+{
+	WRC__mutexLock(&streamGroupLock);
+
+	// only read once, the group's thread might finish the stream any time
+	// (but it waits for streamGroupLock before it detaches it)
+	WRC_StreamGroup* group = stream->group;
+	if(group != NULL)
+	{
+		stream->userAbort = true;
+
+		WRC__mutexLock(&group->lock);
+		group->checkUserAborts = true;
+		WRC__mutexUnlock(&group->lock);
+
+		WRC__wakeupGroup(group);
+	}
+
+	WRC__mutexUnlock(&streamGroupLock);
+	return group != NULL;
+}
+
+void WRC__initStreamGroups(void)
+{
+	WRC__mutexInit(&streamGroupLock);
+}
+
+void WRC__cleanupStreamGroups(void)
+{
+	WRC__mutexDestroy(&streamGroupLock);
+}
+
+void WRC__stopGroupWhenEmpty(WRC_StreamGroup* group)
+{
+	group->stopWhenEmpty = true;
+}
+
+// WRC_StartStreaming() for a stream that needs a curl multi handle: runs it in a group of its own
+int WRC__streamInPrivateGroup(WRC_Stream* stream)
+{
+	WRC_StreamGroup* group = WRC_CreateStreamGroup(NULL);
+	if(group == NULL)
+	{
+		return 0;
+	}
+	group->stopWhenEmpty = true;
+
+	int ret = 0;
+	if(WRC_AddStreamToGroup(group, stream))
+	{
+		WRC_RunStreamGroup(group);
+		ret = group->lastResult;
+	}
+
+	WRC_CleanupStreamGroup(group);
+	return ret;
+}
+
+void WRC_CleanupStreamGroup(WRC_StreamGroup* group)
+{
+	if(group == NULL)
+		return;
+
+	if(group->running)
+	{
+		eprintf("WRC_CleanupStreamGroup(): group still running, call WRC_StopStreamGroup() and wait for WRC_RunStreamGroup() to return first!\n");
+		return;
+	}
+
+	// streams that were added after WRC_RunStreamGroup() returned were never started
+	WRC_Stream* pending = group->pending;
+	group->pending = NULL;
+	abortPendingStreams(group, pending);
+
+#ifdef WRC__GROUP_USE_EPOLL
+	close(group->epollFd);
+	close(group->wakeupFd);
+#endif
+
+	curl_multi_cleanup(group->multi);
+	WRC__mutexDestroy(&group->lock);
+	free(group);
+}
@@ -0,0 +1,985 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// HLS (HTTP Live Streaming): when the playlist of a stream turns out to be an HLS
+// playlist (it has #EXT-X- tags, see playlist.c), the stream plays its segments
+// instead of connecting to a stream URL. ctx->curl is used to reload the media
+// playlist, the next segments (up to WRC_SetHlsPrefetch()) are downloaded in parallel
+// by their own curl handles in the same multi handle (so they reuse its connections).
+// They're decoded in order, as soon as their data arrives.
+// Segments can be MPEG-TS or packed audio, but only with MPEG audio because that's
+// what we have a decoder for; AAC is reported as unsupported format.
+// WRC_StreamGroup and WRC_BeginStreaming() drive this with their multi handle,
+// WRC_StartStreaming() uses WRC__runHls().
+
+#include "internal.h"
+
+#define WRC__HLS_MAX_PLAYLIST_SIZE (1024*1024)
+#define WRC__HLS_MAX_SEGMENT_SIZE (16*1024*1024)
+#define WRC__HLS_DEFAULT_PREFETCH 3
+// reloading the playlist or a segment failed, try again after this long (or give up after
+// that many tries)
+#define WRC__HLS_RETRY_MS 1000
+#define WRC__HLS_MAX_REFRESH_FAILS 5
+#define WRC__HLS_MAX_SEGMENT_RETRIES 2
+// a live stream starts this many segments before the end of the playlist (as the spec says)
+#define WRC__HLS_LIVE_START_SEGMENTS 3
+// how often a master playlist may lead to another master playlist
+#define WRC__HLS_MAX_MASTER_HOPS 3
+
+#define WRC__TS_PACKET_SIZE 188
+
+struct WRC__HlsSegment
+{
+	WRC_Stream* stream;
+	int64_t seq; // media sequence number
+	char* url;
+	CURL* curl; // NULL once it's done
+	struct curl_slist* headers;
+	char* data;
+	size_t len;
+	size_t cap;
+	size_t fed; // how much of data was passed to the decoder
+	bool done; // downloaded completely (or given up)
+	int retries;
+	uint64_t retryAt; // != 0: failed, WRC__hlsCheck() downloads it again then
+	uint64_t startMs;
+};
+
+// a segment from the media playlist that isn't downloaded yet
+struct WRC__HlsKnown
+{
+	int64_t seq;
+	char* url;
+};
+
+enum WRC__HLS_SEGMENT_FORMAT {
+	WRC__HLS_SEG_UNKNOWN = 0, // not enough data yet
+	WRC__HLS_SEG_TS,
+	WRC__HLS_SEG_RAW // packed audio, just MPEG audio frames
+};
+
+struct WRC__Hls
+{
+	CURLM* multi;
+
+	// the playlist, loaded with ctx->curl
+	char* playlistURL; // after redirects, relative URLs are resolved against it
+	bool loading;
+	char* body;
+	size_t bodyLen;
+	size_t bodyCap;
+	uint64_t nextRefresh;
+	int refreshFails;
+	int masterHops;
+	bool started; // got a media playlist
+	bool endList; // not live, the playlist won't change anymore
+	int targetDurationMs;
+	int64_t lastSeq; // of the last segment in the playlist
+
+	int64_t nextSeq; // the next segment to download
+	struct WRC__HlsKnown* known; // from the media playlist, starting at nextSeq
+	int numKnown;
+
+	// being downloaded or not completely decoded yet, ordered by seq
+	struct WRC__HlsSegment* segs[WRC__HLS_MAX_PREFETCH];
+	int numSegs;
+
+	// demuxing of the segment that's currently decoded
+	enum WRC__HLS_SEGMENT_FORMAT segFormat;
+	unsigned char packet[WRC__TS_PACKET_SIZE];
+	size_t packetLen;
+	int pmtPid; // 0 until the PAT was parsed
+	int audioPid; // 0 until the PMT was parsed
+
+	bool failed; // the error was reported
+};
+
+static char* copyStrLen(const char* str, size_t len)
+{
+	char* ret = malloc(len+1);
+	if(ret != NULL)
+	{
+		memcpy(ret, str, len);
+		ret[len] = '\0';
+	}
+	return ret;
+}
+
+// returns ref (which might be relative) as absolute URL, must be free()d
+static char* resolveURL(const char* base, const char* ref)
+{
+	char* ret = NULL;
+	CURLU* u = curl_url();
+	if(u != NULL && curl_url_set(u, CURLUPART_URL, base, 0) == CURLUE_OK
+	   && curl_url_set(u, CURLUPART_URL, ref, 0) == CURLUE_OK)
+	{
+		char* url = NULL;
+		if(curl_url_get(u, CURLUPART_URL, &url, 0) == CURLUE_OK)
+		{
+			ret = copyStrLen(url, strlen(url));
+			curl_free(url);
+		}
+	}
+	curl_url_cleanup(u);
+	return ret;
+}
+
+static bool append(char** buf, size_t* len, size_t* cap, const void* data, size_t size, size_t maxSize)
+{
+	if(*len + size > *cap)
+	{
+		size_t newCap = (*cap > 0) ? *cap : 16*1024;
+		while(newCap < *len + size)
+			newCap *= 2;
+		if(newCap > maxSize)
+			return false;
+		char* newBuf = realloc(*buf, newCap);
+		if(newBuf == NULL)
+			return false;
+		*buf = newBuf;
+		*cap = newCap;
+	}
+	memcpy(*buf + *len, data, size);
+	*len += size;
+	return true;
+}
+
+static size_t ignoreHeaderFun(char* buffer, size_t size, size_t nitems, void* context)
+{
+	return size*nitems;
+}
+
+static size_t playlistWriteFun(void* data, size_t size, size_t nmemb, void* context)
+{
+	WRC_Stream* ctx = (WRC_Stream*)context;
+	struct WRC__Hls* hls = ctx->hls.session;
+
+	if(ctx->userAbort || !append(&hls->body, &hls->bodyLen, &hls->bodyCap, data, size*nmemb, WRC__HLS_MAX_PLAYLIST_SIZE))
+		return 0;
+	return size*nmemb;
+}
+
+static size_t segmentWriteFun(void* data, size_t size, size_t nmemb, void* context)
+{
+	struct WRC__HlsSegment* seg = (struct WRC__HlsSegment*)context;
+
+	if(seg->stream->userAbort || !append(&seg->data, &seg->len, &seg->cap, data, size*nmemb, WRC__HLS_MAX_SEGMENT_SIZE))
+		return 0;
+	return size*nmemb;
+}
+
+static void fail(WRC_Stream* ctx, int errCode, const char* msg)
+{
+	struct WRC__Hls* hls = ctx->hls.session;
+	if(!hls->failed)
+	{
+		hls->failed = true;
+		WRC__errorReset(ctx, errCode, "%s", msg);
+	}
+}
+
+static void clearKnown(struct WRC__Hls* hls)
+{
+	for(int i=0; i < hls->numKnown; ++i)
+		free(hls->known[i].url);
+	free(hls->known);
+	hls->known = NULL;
+	hls->numKnown = 0;
+}
+
+static bool attrContains(const char* attrs, const char* str)
+{
+	return attrs != NULL && strstr(attrs, str) != NULL;
+}
+
+// parses the media (or master) playlist in hls->body
+static bool parsePlaylist(WRC_Stream* ctx, struct WRC__Hls* hls)
+{
+	int64_t mediaSeq = 0;
+	int targetDuration = 0;
+	bool endList = false;
+	bool master = false;
+
+	// the segments (or for a master playlist the variants) in the order of the playlist
+	struct WRC__HlsKnown* entries = NULL;
+	int numEntries = 0;
+	int maxEntries = 0;
+	// the variant we want: MPEG audio, otherwise unspecified codecs, otherwise the first
+	int bestVariant = -1;
+	int bestVariantScore = -1;
+	int variantScore = -1; // of the #EXT-X-STREAM-INF we just saw, -1 if the next line isn't a variant
+
+	bool ok = true;
+	const char* p = hls->body;
+	const char* end = hls->body + hls->bodyLen;
+	while(p < end && ok)
+	{
+		const char* nl = memchr(p, '\n', end - p);
+		const char* lineEnd = (nl != NULL) ? nl : end;
+		const char* next = (nl != NULL) ? nl+1 : end;
+		while(p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+			++p;
+		while(lineEnd > p && (lineEnd[-1] == ' ' || lineEnd[-1] == '\t' || lineEnd[-1] == '\r'))
+			--lineEnd;
+
+		char line[4096];
+		size_t len = lineEnd - p;
+		if(len == 0 || len >= sizeof(line))
+		{
+			p = next;
+			continue;
+		}
+		memcpy(line, p, len);
+		line[len] = '\0';
+		p = next;
+
+		if(line[0] == '#')
+		{
+			if(strncmp(line, "#EXT-X-TARGETDURATION:", 22) == 0)
+				targetDuration = atoi(line+22);
+			else if(strncmp(line, "#EXT-X-MEDIA-SEQUENCE:", 22) == 0)
+				mediaSeq = strtoll(line+22, NULL, 10);
+			else if(strcmp(line, "#EXT-X-ENDLIST") == 0)
+				endList = true;
+			else if(strncmp(line, "#EXT-X-KEY:", 11) == 0 && !attrContains(line, "METHOD=NONE"))
+			{
+				fail(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "encrypted HLS streams are not supported");
+				ok = false;
+			}
+			else if(strncmp(line, "#EXT-X-STREAM-INF:", 18) == 0)
+			{
+				master = true;
+				if(attrContains(line, "mp4a.40.34") || attrContains(line, "mp3"))
+					variantScore = 2;
+				else if(!attrContains(line, "CODECS="))
+					variantScore = 1;
+				else
+					variantScore = 0;
+			}
+			continue;
+		}
+
+		// a URI: a segment or (after #EXT-X-STREAM-INF) a variant
+		if(master && variantScore < 0)
+			continue;
+
+		char* url = resolveURL(hls->playlistURL, line);
+		if(url == NULL)
+			continue;
+
+		if(numEntries == maxEntries)
+		{
+			int newMax = (maxEntries > 0) ? maxEntries*2 : 16;
+			struct WRC__HlsKnown* newEntries = realloc(entries, newMax * sizeof(*entries));
+			if(newEntries == NULL)
+			{
+				free(url);
+				break;
+			}
+			entries = newEntries;
+			maxEntries = newMax;
+		}
+		if(master && variantScore > bestVariantScore)
+		{
+			bestVariant = numEntries;
+			bestVariantScore = variantScore;
+		}
+		variantScore = -1;
+		entries[numEntries].seq = mediaSeq + numEntries;
+		entries[numEntries].url = url;
+		++numEntries;
+	}
+
+	if(ok && master && bestVariant >= 0)
+	{
+		if(++hls->masterHops > WRC__HLS_MAX_MASTER_HOPS)
+		{
+			fail(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "HLS master playlists lead to more master playlists");
+			ok = false;
+		}
+		else
+		{
+			// load the media playlist of that variant right away
+			free(hls->playlistURL);
+			hls->playlistURL = entries[bestVariant].url;
+			entries[bestVariant].url = NULL;
+			hls->nextRefresh = 0;
+		}
+	}
+	else if(ok && !master)
+	{
+		if(numEntries == 0 && !hls->started)
+		{
+			fail(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "HLS playlist contains no segments");
+			ok = false;
+		}
+		else
+		{
+			int64_t lastSeq = mediaSeq + numEntries - 1;
+			if(!hls->started)
+			{
+				hls->started = true;
+				hls->nextSeq = mediaSeq;
+				if(!endList && numEntries > WRC__HLS_LIVE_START_SEGMENTS)
+					hls->nextSeq = lastSeq - WRC__HLS_LIVE_START_SEGMENTS + 1;
+			}
+			else if(hls->nextSeq < mediaSeq)
+			{
+				// we fell behind the live window, skip what's gone
+				hls->nextSeq = mediaSeq;
+			}
+
+			hls->targetDurationMs = (targetDuration > 0) ? targetDuration*1000 : 10000;
+			hls->endList = endList;
+
+			// the spec says: reload after the target duration, or after half of it
+			// if the playlist didn't change
+			uint64_t now = WRC__timeMs();
+			hls->nextRefresh = now + ((lastSeq > hls->lastSeq) ? hls->targetDurationMs : hls->targetDurationMs/2);
+			hls->lastSeq = lastSeq;
+
+			// the segments at nextSeq and after are the ones still to download
+			clearKnown(hls);
+			int first = 0;
+			while(first < numEntries && entries[first].seq < hls->nextSeq)
+				++first;
+			if(first < numEntries)
+			{
+				hls->known = malloc((numEntries - first) * sizeof(*entries));
+				if(hls->known != NULL)
+				{
+					for(int i=first; i < numEntries; ++i)
+					{
+						hls->known[hls->numKnown++] = entries[i];
+						entries[i].url = NULL;
+					}
+				}
+			}
+		}
+	}
+	else if(ok)
+	{
+		fail(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "HLS master playlist contains no variants");
+		ok = false;
+	}
+
+	for(int i=0; i < numEntries; ++i)
+		free(entries[i].url);
+	free(entries);
+	return ok;
+}
+
+static void startPlaylistLoad(WRC_Stream* ctx, struct WRC__Hls* hls)
+{
+	hls->bodyLen = 0;
+	hls->loading = true;
+	curl_easy_setopt(ctx->curl, CURLOPT_URL, hls->playlistURL);
+	curl_multi_add_handle(hls->multi, ctx->curl);
+}
+
+static void playlistLoaded(WRC_Stream* ctx, struct WRC__Hls* hls, CURLcode res)
+{
+	hls->loading = false;
+
+	long respCode = 0;
+	curl_easy_getinfo(ctx->curl, CURLINFO_RESPONSE_CODE, &respCode);
+	if(res == CURLE_OK && respCode >= 200 && respCode < 300)
+	{
+		hls->refreshFails = 0;
+		parsePlaylist(ctx, hls);
+		return;
+	}
+
+	if(++hls->refreshFails >= WRC__HLS_MAX_REFRESH_FAILS)
+	{
+		fail(ctx, WRC_ERR_UNAVAILABLE, "Loading the HLS playlist failed");
+		return;
+	}
+	hls->nextRefresh = WRC__timeMs() + WRC__HLS_RETRY_MS;
+}
+
+static void closeSegment(struct WRC__Hls* hls, struct WRC__HlsSegment* seg)
+{
+	if(seg->curl != NULL)
+	{
+		curl_multi_remove_handle(hls->multi, seg->curl);
+		curl_easy_cleanup(seg->curl);
+		seg->curl = NULL;
+	}
+	if(seg->headers != NULL)
+	{
+		curl_slist_free_all(seg->headers);
+		seg->headers = NULL;
+	}
+}
+
+static void freeSegment(struct WRC__Hls* hls, struct WRC__HlsSegment* seg)
+{
+	closeSegment(hls, seg);
+	free(seg->url);
+	free(seg->data);
+	free(seg);
+}
+
+static int segmentTimeoutMs(WRC_Stream* ctx, struct WRC__Hls* hls)
+{
+	if(ctx->hls.segmentTimeoutMs > 0)
+		return ctx->hls.segmentTimeoutMs;
+	// a segment that takes longer than that can't keep up anyway
+	return (3*hls->targetDurationMs > 10000) ? 3*hls->targetDurationMs : 10000;
+}
+
+// downloads the first of hls->known
+static bool startSegment(WRC_Stream* ctx, struct WRC__Hls* hls)
+{
+	struct WRC__HlsSegment* seg = calloc(1, sizeof(struct WRC__HlsSegment));
+	if(seg == NULL)
+		return false;
+
+	seg->stream = ctx;
+	seg->seq = hls->known[0].seq;
+	seg->url = hls->known[0].url;
+	--hls->numKnown;
+	memmove(hls->known, hls->known+1, hls->numKnown * sizeof(hls->known[0]));
+	hls->nextSeq = seg->seq + 1;
+
+	seg->curl = WRC__createEasyHandle(ctx, seg->url, &seg->headers);
+	if(seg->curl == NULL)
+	{
+		freeSegment(hls, seg);
+		return false;
+	}
+
+	// our own callbacks, CURLOPT_PRIVATE stays ctx so the drivers find the stream for it
+	curl_easy_setopt(seg->curl, CURLOPT_WRITEFUNCTION, segmentWriteFun);
+	curl_easy_setopt(seg->curl, CURLOPT_WRITEDATA, seg);
+	curl_easy_setopt(seg->curl, CURLOPT_HEADERFUNCTION, ignoreHeaderFun);
+	curl_easy_setopt(seg->curl, CURLOPT_NOPROGRESS, 1L);
+	curl_easy_setopt(seg->curl, CURLOPT_TIMEOUT_MS, (long)segmentTimeoutMs(ctx, hls));
+
+	seg->startMs = WRC__timeMs();
+	hls->segs[hls->numSegs++] = seg;
+	curl_multi_add_handle(hls->multi, seg->curl);
+	return true;
+}
+
+// downloads the failed segments again once their retryAt is reached
+static void retrySegments(struct WRC__Hls* hls)
+{
+	uint64_t now = WRC__timeMs();
+	for(int i=0; i < hls->numSegs; ++i)
+	{
+		struct WRC__HlsSegment* seg = hls->segs[i];
+		if(seg->retryAt != 0 && now >= seg->retryAt)
+		{
+			seg->retryAt = 0;
+			seg->startMs = now;
+			curl_multi_add_handle(hls->multi, seg->curl);
+		}
+	}
+}
+
+static void segmentLoaded(WRC_Stream* ctx, struct WRC__Hls* hls, struct WRC__HlsSegment* seg, CURLcode res)
+{
+	curl_multi_remove_handle(hls->multi, seg->curl);
+
+	long respCode = 0;
+	curl_easy_getinfo(seg->curl, CURLINFO_RESPONSE_CODE, &respCode);
+	if(res == CURLE_OK && respCode >= 200 && respCode < 300)
+	{
+		uint64_t ms = WRC__timeMs() - seg->startMs;
+		struct WRC__HlsState* st = &ctx->hls;
+		st->avgSegmentMs = (st->segments == 0) ? ms : (st->avgSegmentMs*7 + ms) / 8;
+		st->lastSegmentMs = ms;
+		++st->segments;
+
+		seg->done = true;
+		closeSegment(hls, seg);
+		return;
+	}
+
+	if(seg->fed == 0 && seg->retries < WRC__HLS_MAX_SEGMENT_RETRIES)
+	{
+		// the same handle again (the connection might still be alive), but not right away
+		// or a server that's overloaded or restarting fails it again
+		++seg->retries;
+		++ctx->hls.segmentRetries;
+		seg->len = 0;
+		seg->retryAt = WRC__timeMs() + WRC__HLS_RETRY_MS;
+		return;
+	}
+
+	// skip (the rest of) it, the decoder resyncs on the next segment
+	seg->done = true;
+	seg->len = seg->fed;
+	closeSegment(hls, seg);
+}
+
+// passes MPEG audio to the decoder, like curlWriteFun() does for normal streams
+static bool feedAudio(WRC_Stream* ctx, const unsigned char* data, size_t size)
+{
+	if(size == 0 || ctx->streamState >= WRC__STREAM_ABORT_GRACEFULLY)
+		return true; // WRC__hlsCheck() notices the abort
+
+	if(ctx->streamState != WRC__STREAM_MUSIC)
+	{
+		ctx->streamState = WRC__STREAM_MUSIC;
+		WRC__resolveCacheStore(ctx);
+		if(ctx->warm.holding)
+			ctx->warm.stationInfoPending = true;
+		else
+			WRC__sendStationInfo(ctx);
+
+		if(ctx->playbackCB == NULL && ctx->playbackFmtCB == NULL && ctx->acquireOutputCB == NULL
+		   && ctx->shm.hdr == NULL && !ctx->pcmBuf.pull && !ctx->metadataOnly && ctx->probe == NULL)
+		{
+			// like in curlWriteFun(): probably the user only wanted the metadata
+			ctx->streamState = WRC__STREAM_ABORT_GRACEFULLY;
+			return true;
+		}
+	}
+	ctx->lastDataTime = WRC__timeMs();
+
+	return WRC__decodeMusic(ctx, (void*)data, size);
+}
+
+// PSI section (PAT or PMT) at the start of payload
+static const unsigned char* tsSection(const unsigned char* payload, size_t len, size_t* sectionLen)
+{
+	if(len < 1 || 1u + payload[0] + 3 > len)
+		return NULL;
+	const unsigned char* sec = payload + 1 + payload[0];
+	size_t avail = len - 1 - payload[0];
+	size_t secLen = 3 + (((sec[1] & 0x0f) << 8) | sec[2]);
+	if(secLen > avail || secLen < 12)
+		return NULL;
+	*sectionLen = secLen - 4; // without the CRC
+	return sec;
+}
+
+static bool tsPacket(WRC_Stream* ctx, struct WRC__Hls* hls, const unsigned char* pkt)
+{
+	bool unitStart = (pkt[1] & 0x40) != 0;
+	int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+	int adaptation = (pkt[3] >> 4) & 3;
+
+	size_t off = 4;
+	if(adaptation & 2)
+		off += 1 + pkt[4];
+	if(!(adaptation & 1) || off >= WRC__TS_PACKET_SIZE)
+		return true; // no payload
+
+	const unsigned char* payload = pkt + off;
+	size_t len = WRC__TS_PACKET_SIZE - off;
+	size_t secLen = 0;
+
+	if(pid == 0 && unitStart)
+	{
+		// PAT: the PID of the first program's PMT
+		const unsigned char* sec = tsSection(payload, len, &secLen);
+		for(size_t i=8; sec != NULL && i+4 <= secLen; i += 4)
+		{
+			int program = (sec[i] << 8) | sec[i+1];
+			if(program != 0)
+			{
+				hls->pmtPid = ((sec[i+2] & 0x1f) << 8) | sec[i+3];
+				break;
+			}
+		}
+	}
+	else if(pid == hls->pmtPid && unitStart && hls->audioPid == 0)
+	{
+		// PMT: the PID of the audio
+		const unsigned char* sec = tsSection(payload, len, &secLen);
+		if(sec == NULL)
+			return true;
+
+		bool aac = false;
+		size_t i = 12 + (((sec[10] & 0x0f) << 8) | sec[11]);
+		while(i+5 <= secLen)
+		{
+			int type = sec[i];
+			int esPid = ((sec[i+1] & 0x1f) << 8) | sec[i+2];
+			if(type == 0x03 || type == 0x04) // MPEG-1/2 audio
+			{
+				hls->audioPid = esPid;
+				break;
+			}
+			if(type == 0x0f || type == 0x11) // AAC (ADTS or LATM)
+				aac = true;
+			i += 5 + (((sec[i+3] & 0x0f) << 8) | sec[i+4]);
+		}
+
+		if(hls->audioPid == 0)
+		{
+			fail(ctx, WRC_ERR_UNSUPPORTED_FORMAT, aac ? "HLS stream uses AAC, which is not supported"
+			                                          : "HLS stream contains no supported audio");
+			return false;
+		}
+	}
+	else if(pid == hls->audioPid && pid != 0)
+	{
+		if(unitStart)
+		{
+			// skip the PES header
+			if(len < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1)
+				return true;
+			size_t hdrLen = 9 + payload[8];
+			if(hdrLen >= len)
+				return true;
+			payload += hdrLen;
+			len -= hdrLen;
+		}
+		return feedAudio(ctx, payload, len);
+	}
+	return true;
+}
+
+static bool feedTS(WRC_Stream* ctx, struct WRC__Hls* hls, const unsigned char* data, size_t size)
+{
+	while(size > 0)
+	{
+		if(hls->packetLen == 0 && data[0] != 0x47)
+		{
+			// lost sync, skip to the next packet
+			const unsigned char* sync = memchr(data, 0x47, size);
+			if(sync == NULL)
+				return true;
+			size -= sync - data;
+			data = sync;
+		}
+
+		size_t n = WRC__TS_PACKET_SIZE - hls->packetLen;
+		if(n > size)
+			n = size;
+		memcpy(hls->packet + hls->packetLen, data, n);
+		hls->packetLen += n;
+		data += n;
+		size -= n;
+
+		if(hls->packetLen == WRC__TS_PACKET_SIZE)
+		{
+			hls->packetLen = 0;
+			if(!tsPacket(ctx, hls, hls->packet))
+				return false;
+		}
+	}
+	return true;
+}
+
+// size of the ID3 tag at the start of packed audio segments (it has the timestamp), 0 if there is none
+static size_t id3Size(const unsigned char* data, size_t len)
+{
+	if(len < 10 || memcmp(data, "ID3", 3) != 0)
+		return 0;
+	size_t size = 10 + (((size_t)(data[6] & 0x7f) << 21) | ((data[7] & 0x7f) << 14)
+	                    | ((data[8] & 0x7f) << 7) | (data[9] & 0x7f));
+	if(data[5] & 0x10)
+		size += 10; // footer
+	return size;
+}
+
+// decodes the data of the first segment that has arrived so far
+static bool feedSegment(WRC_Stream* ctx, struct WRC__Hls* hls, struct WRC__HlsSegment* seg)
+{
+	if(hls->segFormat == WRC__HLS_SEG_UNKNOWN)
+	{
+		const unsigned char* d = (const unsigned char*)seg->data + seg->fed;
+		size_t avail = seg->len - seg->fed;
+		if(avail < 10 && !seg->done)
+			return true; // wait for more
+
+		size_t skip = id3Size(d, avail);
+		if(skip > 0)
+		{
+			if(skip > avail && !seg->done)
+				return true;
+			seg->fed += (skip < avail) ? skip : avail;
+			return feedSegment(ctx, hls, seg);
+		}
+
+		if(avail > 0 && d[0] == 0x47)
+		{
+			hls->segFormat = WRC__HLS_SEG_TS;
+			hls->packetLen = 0;
+		}
+		else if(avail >= 2 && d[0] == 0xff && (d[1] & 0xf6) == 0xf0)
+		{
+			// ADTS (layer 0), mpg123 would just skip it
+			fail(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "HLS stream uses AAC, which is not supported");
+			return false;
+		}
+		else
+		{
+			hls->segFormat = WRC__HLS_SEG_RAW;
+		}
+	}
+
+	const unsigned char* data = (const unsigned char*)seg->data + seg->fed;
+	size_t size = seg->len - seg->fed;
+	seg->fed = seg->len;
+
+	if(hls->segFormat == WRC__HLS_SEG_TS)
+		return feedTS(ctx, hls, data, size);
+	return feedAudio(ctx, data, size);
+}
+
+static bool feedSegments(WRC_Stream* ctx, struct WRC__Hls* hls)
+{
+	while(hls->numSegs > 0)
+	{
+		struct WRC__HlsSegment* seg = hls->segs[0];
+		if(seg->fed < seg->len && !feedSegment(ctx, hls, seg))
+			return false;
+		if(!seg->done || seg->fed < seg->len)
+			break;
+
+		// completely decoded, the next one might have arrived already
+		freeSegment(hls, seg);
+		--hls->numSegs;
+		memmove(hls->segs, hls->segs+1, hls->numSegs * sizeof(hls->segs[0]));
+		hls->segFormat = WRC__HLS_SEG_UNKNOWN;
+	}
+	return true;
+}
+
+static int prefetchDepth(WRC_Stream* ctx)
+{
+	return (ctx->hls.prefetch > 0) ? ctx->hls.prefetch : WRC__HLS_DEFAULT_PREFETCH;
+}
+
+bool WRC__hlsStart(WRC_Stream* ctx, CURLM* multi)
+{
+	struct WRC__Hls* hls = calloc(1, sizeof(struct WRC__Hls));
+	if(hls == NULL)
+	{
+		WRC__errorReset(ctx, WRC_ERR_GENERIC, "Out of Memory!");
+		return false;
+	}
+	hls->multi = multi;
+	ctx->hls.session = hls;
+
+	char* url = NULL;
+	curl_easy_getinfo(ctx->curl, CURLINFO_EFFECTIVE_URL, &url);
+	hls->playlistURL = copyStrLen(url != NULL ? url : ctx->url, strlen(url != NULL ? url : ctx->url));
+
+	// the playlist we got is parsed right away, ctx->curl reloads it from now on
+	struct WRC__Playlist* pl = &ctx->playlist;
+	hls->body = pl->body;
+	hls->bodyLen = pl->bodyLen;
+	hls->bodyCap = pl->bodyCap;
+	pl->body = NULL;
+	pl->bodyLen = pl->bodyCap = 0;
+
+	curl_easy_setopt(ctx->curl, CURLOPT_WRITEFUNCTION, playlistWriteFun);
+	curl_easy_setopt(ctx->curl, CURLOPT_HEADERFUNCTION, ignoreHeaderFun);
+
+	WRC__resetConnection(ctx);
+	ctx->resolvedPlaylist = true;
+
+#ifdef WRC_MP3
+	// the segments contain MPEG audio, set up the decoder like for a stream with that content-type
+	static const char contentType[] = "Content-Type: audio/mpeg\r\n";
+	WRC__handleHeaderLine(ctx, contentType, sizeof(contentType)-1);
+#else
+	fail(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "HLS needs mp3 support");
+	return false;
+#endif
+
+	if(hls->playlistURL == NULL || !parsePlaylist(ctx, hls))
+	{
+		return false;
+	}
+
+	WRC__hlsCheck(ctx);
+	return !hls->failed;
+}
+
+enum WRC__HLS_RESULT WRC__hlsCheck(WRC_Stream* ctx)
+{
+	struct WRC__Hls* hls = ctx->hls.session;
+
+	if(hls->failed || ctx->streamState == WRC__STREAM_ABORT_ERROR)
+		return WRC__HLS_FAILED;
+
+	if(!feedSegments(ctx, hls))
+	{
+		hls->failed = true;
+		return WRC__HLS_FAILED;
+	}
+	if(ctx->streamState == WRC__STREAM_ABORT_GRACEFULLY)
+	{
+		// e.g. the user only wanted the station info, or the probe is done
+		return WRC__HLS_DONE;
+	}
+
+	if(!hls->loading && !hls->endList && WRC__timeMs() >= hls->nextRefresh)
+	{
+		startPlaylistLoad(ctx, hls);
+	}
+	retrySegments(hls);
+
+	int depth = prefetchDepth(ctx);
+	while(hls->numSegs < depth && hls->numKnown > 0)
+	{
+		if(!startSegment(ctx, hls))
+			break;
+	}
+	ctx->hls.prefetched = hls->numSegs;
+
+	if(hls->started && hls->endList && hls->numKnown == 0 && hls->numSegs == 0)
+	{
+		// not a live stream and everything is played
+		return WRC__HLS_DONE;
+	}
+	return WRC__HLS_RUNNING;
+}
+
+bool WRC__hlsFinished(WRC_Stream* ctx, CURL* easy, CURLcode res)
+{
+	struct WRC__Hls* hls = ctx->hls.session;
+
+	if(easy == ctx->curl)
+	{
+		curl_multi_remove_handle(hls->multi, easy);
+		playlistLoaded(ctx, hls, res);
+		return true;
+	}
+
+	for(int i=0; i < hls->numSegs; ++i)
+	{
+		if(hls->segs[i]->curl == easy)
+		{
+			segmentLoaded(ctx, hls, hls->segs[i], res);
+			return true;
+		}
+	}
+	return false;
+}
+
+int WRC__hlsTimeoutMs(WRC_Stream* ctx, int timeoutMs)
+{
+	struct WRC__Hls* hls = ctx->hls.session;
+	if(hls == NULL)
+		return timeoutMs;
+
+	int ms = -1;
+	if(hls->failed || (hls->numSegs < prefetchDepth(ctx) && hls->numKnown > 0)
+	   || (hls->numSegs > 0 && hls->segs[0]->done))
+	{
+		ms = 0;
+	}
+	else
+	{
+		uint64_t now = WRC__timeMs();
+		if(!hls->loading && !hls->endList)
+		{
+			ms = (hls->nextRefresh > now) ? (int)(hls->nextRefresh - now) : 0;
+		}
+		for(int i=0; i < hls->numSegs; ++i)
+		{
+			uint64_t retryAt = hls->segs[i]->retryAt;
+			if(retryAt == 0)
+				continue;
+			int retryMs = (retryAt > now) ? (int)(retryAt - now) : 0;
+			if(ms < 0 || retryMs < ms)
+				ms = retryMs;
+		}
+	}
+
+	if(ms >= 0 && (timeoutMs < 0 || ms < timeoutMs))
+		timeoutMs = ms;
+	return timeoutMs;
+}
+
+void WRC__stopHls(WRC_Stream* ctx)
+{
+	struct WRC__Hls* hls = ctx->hls.session;
+	if(hls == NULL)
+		return;
+
+	for(int i=0; i < hls->numSegs; ++i)
+		freeSegment(hls, hls->segs[i]);
+	clearKnown(hls);
+
+	if(ctx->curl != NULL)
+	{
+		// might not be in it, that's ok
+		curl_multi_remove_handle(hls->multi, ctx->curl);
+	}
+	if(ctx->headers != NULL)
+	{
+		curl_slist_free_all(ctx->headers);
+		ctx->headers = NULL;
+	}
+
+	free(hls->playlistURL);
+	free(hls->body);
+	free(hls);
+	ctx->hls.session = NULL;
+	ctx->hls.prefetched = 0;
+}
+
+bool WRC__runHls(WRC_Stream* ctx)
+{
+	CURLM* multi = curl_multi_init();
+	if(multi == NULL)
+	{
+		eprintf("Initializing cURL multi handle failed!\n");
+		return false;
+	}
+
+	enum WRC__HLS_RESULT state = WRC__hlsStart(ctx, multi) ? WRC__HLS_RUNNING : WRC__HLS_FAILED;
+	while(state == WRC__HLS_RUNNING && !ctx->userAbort)
+	{
+		// wake up regularly so WRC_StopStreaming() works
+		int timeoutMs = WRC__hlsTimeoutMs(ctx, WRC__FLOW_CHECK_MS);
+		curl_multi_poll(multi, NULL, 0, timeoutMs, NULL);
+
+		int running = 0;
+		curl_multi_perform(multi, &running);
+
+		CURLMsg* msg;
+		int msgsLeft = 0;
+		while((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL)
+		{
+			if(msg->msg == CURLMSG_DONE)
+			{
+				// msg is invalid after curl_multi_remove_handle()
+				CURL* easy = msg->easy_handle;
+				WRC__hlsFinished(ctx, easy, msg->data.result);
+			}
+		}
+
+		state = WRC__hlsCheck(ctx);
+	}
+
+	WRC__stopHls(ctx); // needs multi
+	curl_multi_cleanup(multi);
+	return state == WRC__HLS_DONE;
+}
+
+int WRC_SetHlsPrefetch(WRC_Stream* stream, int numSegments, int segmentTimeoutMs)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetHlsPrefetch(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(numSegments < 1 || numSegments > WRC__HLS_MAX_PREFETCH || segmentTimeoutMs < 0)
+	{
+		eprintf("WRC_SetHlsPrefetch(): numSegments must be between 1 and %d!\n", WRC__HLS_MAX_PREFETCH);
+		return 0;
+	}
+
+	stream->hls.prefetch = numSegments;
+	stream->hls.segmentTimeoutMs = segmentTimeoutMs;
+	return 1;
+}
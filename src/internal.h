@@ -29,6 +29,46 @@
 #define strncasecmp _strnicmp
 #endif
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef CRITICAL_SECTION WRC__Mutex;
+typedef CONDITION_VARIABLE WRC__Cond;
+typedef HANDLE WRC__Thread;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t WRC__Mutex;
+typedef pthread_cond_t WRC__Cond;
+typedef pthread_t WRC__Thread;
+#endif
+
+#define WRC__CACHELINE_SIZE 64
+
+// load/store for values shared between two threads without a lock (see ring.c)
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline size_t WRC__loadAcquire(const size_t* ptr)
+{
+	size_t ret = *(const volatile size_t*)ptr;
+	_ReadWriteBarrier(); // x86 and x64 don't reorder loads with other loads or stores
+	return ret;
+}
+static inline void WRC__storeRelease(size_t* ptr, size_t val)
+{
+	_ReadWriteBarrier();
+	*(volatile size_t*)ptr = val;
+}
+#else // gcc and clang
+static inline size_t WRC__loadAcquire(const size_t* ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+static inline void WRC__storeRelease(size_t* ptr, size_t val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+#endif // _MSC_VER
+
 enum WRC__CONTENT_TYPE {
 	WRC_CONTENT_UNKNOWN = 0,
 	WRC_CONTENT_PLAYLIST,
@@ -46,6 +86,17 @@ enum WRC__STREAM_STATE {
 	WRC__STREAM_ABORT_ERROR
 };
 
+// returned by WRC__finishTransfer()
+enum WRC__TRANSFER_RESULT {
+	WRC__TRANSFER_FAILED = 0,
+	WRC__TRANSFER_OK,
+	WRC__TRANSFER_RESTART, // got a playlist, ctx->curl is prepared for the stream URL from it
+	// the connection dropped, perform ctx->curl again at ctx->reconnectAt (see reconnect.c)
+	WRC__TRANSFER_RECONNECT,
+	// got an HLS playlist, the segments are streamed with WRC__hlsStart() (see hls.c)
+	WRC__TRANSFER_HLS
+};
+
 enum WRC__OGG_DECODE_STATE {
 	WRC_OGGDEC_PREINIT = 0,
 	WRC_OGGDEC_VORBISINFO,
@@ -58,17 +109,39 @@ enum WRC__OGG_DECODE_STATE {
 // => not more than WRC__decBufSize samples will be sent to the user at once
 //static const int WRC__decBufSize = 4096;
 #define WRC__decBufSize 4096
+// vorbis supports up to 255 channels
+#define WRC__MAX_CHANNELS 256
+
+// a decoding buffer for WRC__decBufSize samples in any of the formats of WRC_SetOutputFormat()
+union WRC__SampleBuf
+{
+	int16_t s16[WRC__decBufSize];
+	int32_t s32[WRC__decBufSize];
+	float f32[WRC__decBufSize];
+};
+
+// the size of one sample in a format of WRC_SetOutputFormat()
+static inline size_t WRC__sampleSize(int format)
+{
+	return (format == WRC_FMT_S16) ? sizeof(int16_t) : 4;
+}
 
 #ifdef WRC_MP3
 #include <mpg123.h>
 
 bool WRC__decodeMP3(WRC_Stream* ctx, void* data, size_t size);
+bool WRC__ingestMP3(WRC_Stream* ctx, const void* data, size_t size);
 #endif // WRC_MP3
 
 #ifdef WRC_OGG
 #include <vorbis/codec.h>
 
 bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size);
+bool WRC__ingestOGG(WRC_Stream* ctx, const void* data, size_t size);
+char* WRC__ingestBufferOGG(WRC_Stream* ctx, size_t size);
+void WRC__ingestWroteOGG(WRC_Stream* ctx, size_t size);
+// used instead of WRC__decodeOGG() by WRC_SetMetadataOnly(), only parses the comment headers
+bool WRC__decodeOGGMetadata(WRC_Stream* ctx, void* data, size_t size);
 
 struct WRC__oggVorbisContext
 {
@@ -84,6 +157,8 @@ struct WRC__oggVorbisContext
 
 	enum WRC__OGG_DECODE_STATE state;
 	int maxBufSamplesPerChan;
+	bool haveFirstPage; // og already contains the first page of a new logical stream
+	int numHeaders; // WRC_SetMetadataOnly(): how many headers of the current stream were parsed
 };
 
 #endif // WRC_OGG
@@ -92,6 +167,626 @@ static inline int WRC__min(int a, int b) { return a < b ? a : b; }
 
 void WRC__errorReset(WRC_Stream* ctx, int errorCode, const char* format, ...);
 
+// threads.c - thin wrappers around the platform's threading primitives
+void WRC__mutexInit(WRC__Mutex* mutex);
+void WRC__mutexDestroy(WRC__Mutex* mutex);
+void WRC__mutexLock(WRC__Mutex* mutex);
+void WRC__mutexUnlock(WRC__Mutex* mutex);
+void WRC__condInit(WRC__Cond* cond);
+void WRC__condDestroy(WRC__Cond* cond);
+void WRC__condSignal(WRC__Cond* cond);
+void WRC__condBroadcast(WRC__Cond* cond);
+// mutex must be locked, returns false on timeout
+bool WRC__condWait(WRC__Cond* cond, WRC__Mutex* mutex, int timeoutMs);
+bool WRC__threadCreate(WRC__Thread* thread, void (*threadFun)(void* arg), void* arg);
+void WRC__threadJoin(WRC__Thread thread);
+// name may be truncated (Linux only supports 15 chars), ignored where not supported
+void WRC__threadSetName(WRC__Thread thread, const char* name);
+void WRC__threadSetAffinity(WRC__Thread thread, int cpu);
+// milliseconds from a monotonic clock
+uint64_t WRC__timeMs(void);
+void WRC__sleepMs(int ms);
+
+// pcmconv.c - converts planar float samples (-1.0 .. 1.0) to interleaved int16_t samples,
+// with SIMD if possible. WRC__initPcmConv() picks the implementation for the CPU.
+void WRC__initPcmConv(void);
+void WRC__floatToInt16(int16_t* dst, float** src, int numChannels, int numFrames);
+// the same for the other formats of WRC_SetOutputFormat()
+void WRC__floatToInt32(int32_t* dst, float** src, int numChannels, int numFrames);
+void WRC__interleaveFloat(float* dst, float** src, int numChannels, int numFrames);
+// interleaved samples of sampleSize bytes => one array per channel
+void WRC__deinterleave(void** dst, const void* src, size_t sampleSize, int numChannels, size_t numFrames);
+// sum of a[i]*b[i] for the resampler, n must be a multiple of 8
+float WRC__dotProduct(const float* a, const float* b, int n);
+
+// ring.c - lock-free ring buffer for one producer and one consumer thread
+struct WRC__SpscRing
+{
+	unsigned char* buf;
+	size_t size; // capacity in bytes, always a power of two
+
+	// the positions only ever increase (and wrap around at SIZE_MAX), buf index is pos & (size-1)
+	// they're on different cache lines so producer and consumer don't slow each other down
+	char pad0[WRC__CACHELINE_SIZE];
+	size_t writePos; // only modified by the producer
+	char pad1[WRC__CACHELINE_SIZE];
+	size_t readPos; // only modified by the consumer
+	char pad2[WRC__CACHELINE_SIZE];
+};
+
+// size is rounded up to the next power of two
+bool WRC__ringInit(struct WRC__SpscRing* ring, size_t size);
+void WRC__ringDestroy(struct WRC__SpscRing* ring);
+// the number of bytes that can be read, from either thread (may be outdated already)
+size_t WRC__ringFill(struct WRC__SpscRing* ring);
+// for the producer: copies up to size bytes into the ring, returns how many were written
+size_t WRC__ringWrite(struct WRC__SpscRing* ring, const void* data, size_t size);
+// for the consumer: returns the longest readable contiguous block of data
+// (which might not be all readable data if it wraps around), without consuming it
+size_t WRC__ringPeek(struct WRC__SpscRing* ring, void** data);
+// for the consumer: marks size bytes as read, so the producer may overwrite them
+void WRC__ringConsume(struct WRC__SpscRing* ring, size_t size);
+// for the consumer: copies up to size bytes out of the ring, returns how many were read
+size_t WRC__ringRead(struct WRC__SpscRing* ring, void* data, size_t size);
+
+// decthread.c - optional decoder thread, see WRC_SetDecoderThread()
+struct WRC__DecoderThread
+{
+	// settings from WRC_SetDecoderThread()
+	bool enabled;
+	size_t ringSize;
+	char name[16];
+	int cpu;
+
+	struct WRC__SpscRing ring; // compressed data from the network thread
+	WRC__Thread thread;
+	bool running;
+
+	WRC__Mutex lock; // only used to sleep/wake up with cond, the ring itself is lock-free
+	WRC__Cond cond;
+	bool producerDone; // no more data will come, decode the rest and exit
+	bool abort; // exit without decoding the rest
+	bool failed; // decoding failed, the decoder thread has exited
+
+	// statistics
+	size_t ringHighWater;
+	unsigned long producerStalls;
+};
+
+// the network thread's replacement for calling ctx->decode()
+bool WRC__decodeInThread(WRC_Stream* ctx, void* data, size_t size);
+// lets the decoder thread finish (decoding the remaining data unless abort is set) and joins it
+void WRC__stopDecoderThread(WRC_Stream* ctx, bool abort);
+void WRC__cleanupDecoderThread(WRC_Stream* ctx);
+
+// pcmbuf.c - optional jitter buffer for the decoded audio, see WRC_SetJitterBuffer()
+struct WRC__PcmBuffer
+{
+	// settings from WRC_SetJitterBuffer()
+	bool enabled;
+	int targetMs;
+	int maxMs;
+	// settings from WRC_SetPullMode()
+	bool pull;
+	bool fillSilence;
+
+	struct WRC__SpscRing ring; // interleaved samples from the decoder, in the output format
+	WRC__Thread thread; // the playout thread, calls playbackCB
+	bool running;
+
+	// format of the samples in the ring and the fill levels in bytes for it
+	int sampleRate;
+	int numChannels;
+	size_t sampleSize;
+	size_t targetFill;
+	size_t maxFill;
+
+	WRC__Mutex lock; // only used to sleep/wake up with cond, the ring itself is lock-free
+	WRC__Cond cond;
+	bool producerDone; // no more samples will come, play the rest and exit
+	bool abort; // exit without playing the rest
+
+	// pull mode: shared with WRC_ReadSamples() without a lock, so use WRC__loadAcquire()/WRC__storeRelease()
+	size_t draining; // 1 if no more samples will come (for now), so the rest may be read without prebuffering
+	size_t discardPos; // WRC_ReadSamples() throws away the samples before this ring position
+	// pull mode: only used by WRC_ReadSamples()
+	bool prebuffering;
+	uint64_t stallStart;
+
+	// statistics
+	unsigned long underruns;
+	uint64_t stalledMs;
+};
+
+// WRC_SetCallbackBlockSize(): small outputs of the decoders are collected in buf until
+// there are minSize frames, so playbackCB isn't called that often. only used by the
+// thread that calls playbackCB (the playout thread if there is one)
+struct WRC__Blocks
+{
+	bool enabled;
+	int minSize;
+	int maxSize;
+	bool inMs; // minSize and maxSize are in milliseconds instead of frames
+
+	unsigned char* buf;
+	unsigned char* planar; // for deinterleaving blocks bigger than WRC__decBufSize samples
+	size_t cap; // of buf and planar, in bytes
+	size_t frames; // in buf
+	int numChannels; // of the frames in buf
+};
+
+// used by the decoders instead of calling playbackCB directly, the samples are interleaved
+// and in WRC__decodeFormat(ctx). returns false if the jitter buffer couldn't be started
+// or resampling failed (the error has been reported then)
+bool WRC__sendSamples(WRC_Stream* ctx, void* samples, size_t numSamples);
+// the same for planar float samples (from vorbis), converted to the output format
+// unless they can be passed to the user as they are
+bool WRC__sendFloatSamples(WRC_Stream* ctx, float** samples, int numFrames);
+// the format the decoders should pass to WRC__sendSamples(): the output format,
+// or float if it's resampled anyway
+int WRC__decodeFormat(WRC_Stream* ctx);
+// true if the decoders can write right into the memory of WRC_SetOutputProvider()
+// or WRC_SetSharedMemorySink()
+bool WRC__directOutput(WRC_Stream* ctx);
+// calls acquireOutputCB (or WRC__shmAcquire()), returns NULL if the user has no room
+void* WRC__acquireOutput(WRC_Stream* ctx, size_t maxFrames, size_t* numFrames);
+// calls commitOutputCB (or finishes the WRC__acquireOutput() of the shared memory sink)
+void WRC__commitOutput(WRC_Stream* ctx, void* data, size_t numFrames);
+// passes samples in the output format (ctx->outFormat, ctx->outChannels) to the user
+// or the jitter buffer, used by WRC__sendSamples() and the resampler
+bool WRC__outputSamples(WRC_Stream* ctx, void* samples, size_t numSamples);
+// used by the decoders to call initAudioCB with ctx->sampleRate and ctx->numChannels
+// (after the buffered samples in the old format have been played), or to set up the
+// resampler for them (see WRC_SetFixedOutput()).
+// returns false (after reporting the error) if the user doesn't support the format
+bool WRC__initAudio(WRC_Stream* ctx);
+// lets the playout thread finish (playing the remaining samples unless abort is set) and joins it
+void WRC__stopPcmBuffer(WRC_Stream* ctx, bool abort);
+// passes the samples collected for the next block (see WRC_SetCallbackBlockSize())
+// to the user unless abort is set. the playout thread must not be running.
+void WRC__flushBlocks(WRC_Stream* ctx, bool abort);
+void WRC__cleanupBlocks(WRC_Stream* ctx);
+void WRC__cleanupPcmBuffer(WRC_Stream* ctx);
+// how many milliseconds of audio are currently in the ring (from any thread)
+int WRC__pcmBufferedMs(WRC_Stream* ctx);
+
+// resample.c - converts the decoded audio to the format set with WRC_SetFixedOutput()
+struct WRC__Resampler
+{
+	bool enabled; // WRC_SetFixedOutput() or WRC_SetDriftCompensation() is used
+	// settings from WRC_SetFixedOutput()
+	bool fixed;
+	int outRate;
+	int outChannels;
+	int quality;
+	// only drift compensation: the output format is the input format
+	bool followInput;
+
+	// the format of the decoded samples it's set up for, 0 if none yet
+	int inRate;
+	int inChannels;
+	// channels that are filtered, the others are copies of the first one (mono input) or silent
+	int workChannels;
+	bool passthrough; // inRate == outRate, only the channels are converted
+
+	int taps;
+	int phaseBits;
+	float* filter; // (1 << phaseBits) phases with taps coefficients each
+	float* hist; // input samples, workChannels arrays of histCap samples
+	size_t histCap;
+	size_t histLen;
+	uint64_t pos; // position of the next output sample in hist, 32.32 fixed point
+	uint64_t baseStep; // inRate/outRate, 32.32 fixed point
+	uint64_t step; // baseStep adjusted by the drift compensation
+
+	float* out; // WRC__decBufSize interleaved output samples, allocated while enabled
+	size_t outLen; // frames in out
+
+	bool audioInitDone; // initAudioCB has been called with the output format
+};
+
+// sets the resampler up for ctx->sampleRate and ctx->numChannels, after resampling
+// the rest of the samples in the old format. returns false after reporting the error
+bool WRC__setResamplerInput(WRC_Stream* ctx);
+// resamples numFrames frames, either planar or interleaved, and passes them on with WRC__outputSamples()
+bool WRC__resample(WRC_Stream* ctx, float** planar, const float* interleaved, size_t numFrames);
+// changes the ratio by ppm (for the drift compensation)
+void WRC__setResamplerRatio(WRC_Stream* ctx, double ppm);
+// enables/disables the resampler after the settings of WRC_SetFixedOutput() or
+// WRC_SetDriftCompensation() changed, returns false if it's out of memory
+bool WRC__updateResamplerMode(WRC_Stream* ctx);
+// forgets the current stream's samples and format
+void WRC__resetResampler(WRC_Stream* ctx);
+void WRC__cleanupResampler(WRC_Stream* ctx);
+
+// drift.c - clock drift compensation, see WRC_SetDriftCompensation()
+struct WRC__Drift
+{
+	// settings from WRC_SetDriftCompensation()
+	bool enabled;
+	int targetMs;
+	int maxPpm;
+	WRC_queuedMsCB queuedCB;
+
+	uint64_t lastUpdate; // 0 if the next measurement starts over
+	double smoothedMs; // the buffer's fill level, < 0 if there's no measurement yet
+	double estimatePpm; // the drift between the server's and the consumer's clock
+	double correctionPpm; // the currently applied change of the resampling ratio
+};
+
+// called by the resampler before each block, updates the ratio once per WRC__DRIFT_INTERVAL_MS
+void WRC__driftUpdate(WRC_Stream* ctx);
+void WRC__resetDrift(WRC_Stream* ctx);
+
+// shmring.c - shared memory sink, see WRC_SetSharedMemorySink()
+struct WRC__ShmHeader;
+struct WRC__ShmSink
+{
+	struct WRC__ShmHeader* hdr; // start of the shared memory, NULL if not used
+	unsigned char* data; // the ring after the header
+	size_t size; // of the ring, a power of two
+	int fd;
+
+	WRC__Mutex lock; // the records are written by different threads
+	unsigned char* pending; // the record started by WRC__shmAcquire()
+	size_t bytesPerSec; // of the samples in the current format
+};
+
+// like WRC__acquireOutput() for the sink, but waits until the reader made room (or
+// WRC_StopStreaming() is called). Every successful call must be followed by WRC__shmCommit().
+void* WRC__shmAcquire(WRC_Stream* ctx, size_t maxFrames, size_t* numFrames);
+void WRC__shmCommit(WRC_Stream* ctx, size_t numFrames);
+// write a record for the format last passed to initAudioCB, for metadata and for the end of the stream
+void WRC__shmFormat(WRC_Stream* ctx);
+void WRC__shmTitle(WRC_Stream* ctx, const char* title);
+void WRC__shmStationInfo(WRC_Stream* ctx);
+void WRC__shmEnd(WRC_Stream* ctx);
+// how many milliseconds of audio the reader hasn't read yet
+int WRC__shmBufferedMs(WRC_Stream* ctx);
+void WRC__cleanupShm(WRC_Stream* ctx);
+
+// the following are implemented in main.c and used by the different
+// ways of driving the curl transfers (WRC_StartStreaming(), group.c)
+
+// creates ctx->curl, configured for ctx->url
+bool WRC__startTransfer(WRC_Stream* ctx);
+enum WRC__TRANSFER_RESULT WRC__finishTransfer(WRC_Stream* ctx, CURLcode res);
+// returns what WRC_StartStreaming() would return and resets the stream
+int WRC__finishStreaming(WRC_Stream* ctx, bool transferOK);
+// resumes the transfer if it was paused by WRC_SetFlowControl() and the consumer
+// has drained enough. group.c and async.c call this every WRC__FLOW_CHECK_MS
+// while a stream is paused, WRC_StartStreaming() relies on curl's progress callback.
+void WRC__checkFlowControl(WRC_Stream* ctx);
+#define WRC__FLOW_CHECK_MS 100
+
+// clears the state of the current connection (headers, ICY metadata), but not the decoder
+void WRC__resetConnection(WRC_Stream* ctx);
+void WRC__sendStationInfo(WRC_Stream* ctx);
+// passes a new title to currentTitleCB and the shared memory sink
+void WRC__sendTitle(WRC_Stream* ctx, const char* title);
+// creates a curl handle for a connection of ctx to url, *headers must be freed with it
+CURL* WRC__createEasyHandle(WRC_Stream* ctx, const char* url, struct curl_slist** headers);
+// makes curl call the callbacks that handle the data of ctx (and sets CURLOPT_PRIVATE)
+void WRC__setStreamCallbacks(WRC_Stream* ctx, CURL* curl);
+// true if the transfer of ctx->curl ended (without the user stopping it) before it
+// delivered any audio, so trying another URL makes sense
+bool WRC__failedBeforeAudio(WRC_Stream* ctx);
+// parses one HTTP header line (len includes the line break)
+void WRC__handleHeaderLine(WRC_Stream* ctx, const char* line, size_t len);
+// parses header lines that were kept for the standby connection (see standby.c)
+void WRC__handleHeaderLines(WRC_Stream* ctx, const char* lines, size_t len);
+// called with the first audio of a connection: tells the user about the station (or about
+// the reconnect). returns false if the transfer must be aborted
+bool WRC__beginMusic(WRC_Stream* ctx);
+// passes the audio data (without ICY metadata) to the decoder (or decoder thread),
+// returns false on error (after reporting it)
+bool WRC__decodeMusic(WRC_Stream* ctx, void* data, size_t size);
+
+// reconnect.c - automatic reconnects, see WRC_SetReconnectPolicy()
+// called when a transfer ended, returns true if the connection should be made again
+// (with the same ctx->curl) at ctx->reconnectAt
+bool WRC__prepareReconnect(WRC_Stream* ctx);
+// called once the new connection delivers data, returns false if it isn't usable
+// (so the transfer must be aborted and retried)
+bool WRC__reconnected(WRC_Stream* ctx);
+void WRC__resetReconnect(WRC_Stream* ctx);
+// for a new connection of a stream that was playing: keeps the decoder and the station info
+// (until WRC__reconnected()), but resets everything else about the connection.
+// The decoder thread decodes the data it still has and exits before that.
+void WRC__beginConnectionSwitch(WRC_Stream* ctx);
+// called with the content-type of a new connection before its decoder is set,
+// shuts down the old decoder if the format changed
+void WRC__reconnectContentType(WRC_Stream* ctx, enum WRC__CONTENT_TYPE contentType);
+
+// standby.c - hot-standby connection, see WRC_SetStandby()
+struct WRC__Standby
+{
+	// settings from WRC_SetStandby()
+	bool enabled;
+	int stallMs;
+	char* mirrorURL; // NULL if none
+	WRC_failoverCB failoverCB;
+
+	CURL* curl; // the standby connection, its audio is read and thrown away until it takes over
+	struct curl_slist* headers;
+	CURLM* multi; // the multi handle curl is in
+	bool ready; // audio starts on a frame (or page), so it can take over
+	// the headers of the standby connection (and an ICY header in its body), parsed when
+	// it takes over. WRC__STANDBY_HEADER_SIZE bytes, allocated while enabled
+	char* headerLines;
+	size_t headerLinesLen;
+	bool gotData;
+	bool icyHeaderInBody; // still collecting it
+	enum WRC__CONTENT_TYPE contentType; // MP3 or Ogg, otherwise it can't be used
+	// its ICY metadata is stripped like in main.c, curlWriteFun() continues where this is
+	int icyMetaInt;
+	int icyMetaBytesMissing;
+	int icyMetaBytesWritten;
+	int dataReadSinceLastIcyMeta;
+	char* icyMetadata; // 256*16 bytes, allocated while enabled
+	// the newest audio, from the last frame (or page) on that's known to be one, so the
+	// decoder can start with it. WRC__STANDBY_AUDIO_SIZE bytes, allocated while enabled
+	char* audio;
+	size_t audioLen;
+	bool aligned; // audio starts on a frame (or page)
+	// Ogg: the header pages of its logical stream, in case the decoder has another one.
+	// allocated when needed, up to WRC__STANDBY_AUDIO_SIZE bytes
+	char* oggHeaders;
+	size_t oggHeadersLen;
+	size_t oggHeadersSize;
+	bool oggInHeaders; // the pages after a BOS page until the first audio page
+	uint64_t retryAt; // don't connect again before this
+
+	bool failingOver; // switched to the standby connection, until WRC__failoverDone()
+	uint64_t failoverStart;
+
+	// statistics
+	unsigned long failovers;
+	uint64_t lastFailoverMs;
+};
+
+// called by group.c and async.c for each stream at least every WRC__STANDBY_CHECK_MS
+// while standby.enabled: opens the standby connection or switches to it if the stream stalled
+void WRC__standbyCheck(WRC_Stream* ctx, CURLM* multi);
+#define WRC__STANDBY_CHECK_MS 100
+#define WRC__STANDBY_HEADER_SIZE 8192
+// more than the biggest Ogg page (65307 bytes) and the header of the next one
+#define WRC__STANDBY_AUDIO_SIZE (66*1024)
+// called when the transfer of ctx->curl ended (and it was removed from multi), before
+// WRC__finishTransfer(). returns true if the standby connection took over, then ctx->curl
+// is the (already added) standby handle and the transfer goes on.
+bool WRC__standbyTakeOver(WRC_Stream* ctx, CURLM* multi);
+// called when the transfer of ctx->standby.curl ended
+void WRC__standbyFinished(WRC_Stream* ctx);
+// called by WRC__reconnected() once the standby connection delivers data
+void WRC__failoverDone(WRC_Stream* ctx);
+// closes the standby connection, must be called before its multi handle is cleaned up
+void WRC__stopStandby(WRC_Stream* ctx);
+// frees the memory of WRC_SetStandby()
+void WRC__cleanupStandby(WRC_Stream* ctx);
+
+// playlist.c - the stream URLs from a playlist and WRC_SetMirrorRace()
+#define WRC__MAX_PLAYLIST_ENTRIES 16
+// the longest line (or XML tag with the text before it) that's parsed
+#define WRC__MAX_PLAYLIST_TOKEN (2048+256)
+// the most connections WRC_SetMirrorRace() allows at once (including ctx->curl)
+#define WRC__MAX_RACE_CONNS 4
+
+enum WRC__PLAYLIST_FORMAT {
+	WRC__PLAYLIST_UNKNOWN = 0, // nothing but whitespace yet
+	WRC__PLAYLIST_TEXT, // PLS or M3U
+	WRC__PLAYLIST_XML // XSPF or ASX
+};
+
+struct WRC__Playlist
+{
+	enum WRC__PLAYLIST_FORMAT format;
+	// the current line (or XML tag with the text before it), not terminated.
+	// WRC__MAX_PLAYLIST_TOKEN bytes, allocated when a playlist is parsed
+	char* token;
+	size_t tokenLen;
+	bool tokenTooLong;
+	bool inLocation; // after an XSPF <location> tag
+	size_t totalSize;
+
+	char* entries[WRC__MAX_PLAYLIST_ENTRIES]; // the stream URLs, in the playlist's order
+	int numEntries;
+	bool used[WRC__MAX_PLAYLIST_ENTRIES]; // streamed (or failed), not tried again
+
+	bool hls; // it has #EXT-X- tags, so it's streamed by hls.c
+	char* body; // the whole playlist, hls.c needs it
+	size_t bodyLen;
+	size_t bodyCap;
+};
+
+// a connection to another entry of the playlist, paused once it delivers audio
+struct WRC__RaceConn
+{
+	CURL* curl;
+	struct curl_slist* headers;
+	int entry; // index in ctx->playlist.entries
+	bool ready; // curl got audio data (and is paused)
+	char headerLines[8192]; // parsed when it wins
+	size_t headerLinesLen;
+};
+
+struct WRC__MirrorRace
+{
+	int numParallel; // from WRC_SetMirrorRace()
+	bool pending; // a playlist was resolved, WRC__startRace() opens the connections
+	CURLM* multi; // the multi handle the connections are in
+	struct WRC__RaceConn* conns; // numParallel-1 of them while racing, otherwise NULL
+	int numConns;
+};
+
+// used as ctx->decode for playlists, collects the entries
+bool WRC__decodePlaylist(WRC_Stream* ctx, void* data, size_t size);
+// called when the playlist transfer is done: puts the first entry in ctx->url
+// (and the second in ctx->playlistMirror). if there is none, the error is reported
+// and false is returned. for HLS playlists (ctx->playlist.hls) it just returns true
+bool WRC__endPlaylist(WRC_Stream* ctx);
+// called when the transfer of the URL from a playlist failed: if it never delivered
+// audio, the next entry that hasn't been tried yet is put in ctx->url and true is returned
+bool WRC__nextPlaylistEntry(WRC_Stream* ctx);
+// forgets the entries and the mirror (for a new playlist or when the stream is reset)
+void WRC__resetPlaylist(WRC_Stream* ctx);
+// called by group.c and async.c when ctx->curl was added again for the first entry of
+// a playlist: connects to the next entries if WRC_SetMirrorRace() wants that
+void WRC__startRace(WRC_Stream* ctx, CURLM* multi);
+// called by group.c and async.c after curl handled socket events or timeouts:
+// switches to the connection that got audio first, cancels the others
+void WRC__raceCheck(WRC_Stream* ctx, CURLM* multi);
+// like WRC__standbyTakeOver(), for a racing connection that's ready
+bool WRC__raceTakeOver(WRC_Stream* ctx, CURLM* multi);
+// called when the transfer of easy ended, returns false if it's not a racing connection
+bool WRC__raceFinished(WRC_Stream* ctx, CURL* easy);
+// closes the racing connections, must be called before their multi handle is cleaned up
+void WRC__stopRace(WRC_Stream* ctx);
+
+// rescache.c - WRC_EnableResolveCache()
+struct WRC__Resolve
+{
+	char* url; // ctx->url when the stream was started, ctx->url is set to it again afterwards
+	bool fromCache; // ctx->url is the stream URL from the cache
+	bool stored; // the first connection with audio was put in the cache
+};
+
+// called by WRC_Init() and WRC_Shutdown()
+void WRC__initResolveCache(void);
+void WRC__cleanupResolveCache(void);
+// called before the first connection: remembers ctx->url and replaces it with the
+// cached stream URL (if any)
+void WRC__beginResolve(WRC_Stream* ctx);
+// called once audio arrives: puts where ctx->curl ended up in the cache
+void WRC__resolveCacheStore(WRC_Stream* ctx);
+// called when a transfer failed: if ctx->url came from the cache and didn't deliver
+// audio, the entry is dropped, ctx->url is the original URL again and true is returned
+bool WRC__resolveCacheFallback(WRC_Stream* ctx);
+// called when the stream is reset: ctx->url is the original URL again
+void WRC__endResolve(WRC_Stream* ctx);
+
+// hls.c - HLS playlists, see WRC_SetHlsPrefetch()
+// the most segments that are downloaded at once
+#define WRC__HLS_MAX_PREFETCH 8
+
+enum WRC__HLS_RESULT {
+	WRC__HLS_RUNNING = 0,
+	WRC__HLS_DONE, // the playlist ended or the stream was aborted gracefully
+	WRC__HLS_FAILED // the error was reported
+};
+
+struct WRC__HlsState
+{
+	// from WRC_SetHlsPrefetch(), 0 for the defaults
+	int prefetch;
+	int segmentTimeoutMs;
+
+	struct WRC__Hls* session; // set while streaming HLS
+
+	// statistics
+	unsigned long segments; // downloaded successfully
+	unsigned long segmentRetries;
+	int prefetched; // segments currently downloaded or waiting to be decoded
+	uint64_t lastSegmentMs; // how long downloading the last segment took
+	uint64_t avgSegmentMs;
+};
+
+// called when WRC__finishTransfer() returned WRC__TRANSFER_HLS: ctx->curl is done with
+// the playlist and not in multi anymore. starts downloading the segments in multi,
+// returns false if that failed (the error was reported)
+bool WRC__hlsStart(WRC_Stream* ctx, CURLM* multi);
+// called by group.c and async.c after curl handled socket events or timeouts:
+// decodes what arrived, reloads the playlist and starts the next downloads
+enum WRC__HLS_RESULT WRC__hlsCheck(WRC_Stream* ctx);
+// called when the transfer of easy ended, returns false if it's not one of ctx's HLS transfers
+bool WRC__hlsFinished(WRC_Stream* ctx, CURL* easy, CURLcode res);
+// lowers timeoutMs (< 0 for none) to when WRC__hlsCheck() has something to do
+int WRC__hlsTimeoutMs(WRC_Stream* ctx, int timeoutMs);
+// closes the HLS transfers, must be called before their multi handle is cleaned up
+void WRC__stopHls(WRC_Stream* ctx);
+// WRC__hlsStart() and WRC__hlsCheck() with a multi handle of its own for WRC_StartStreaming(),
+// returns true if the stream ended without error
+bool WRC__runHls(WRC_Stream* ctx);
+
+// probe.c - WRC_ProbeStations(), each probe is a stream with ctx->probe set
+struct WRC__Probe
+{
+	struct WRC__ProbeBatch* batch;
+	size_t index; // of the URL
+	WRC_Stream* stream;
+	int timeoutMs;
+	uint64_t startTime;
+
+	unsigned char* buf; // the start of the audio data, WRC__PROBE_MAX_BYTES
+	size_t len;
+
+	WRC_ProbeResult result; // filled while probing, the strings are malloc()ed
+	char errorMsg[256];
+};
+
+// called by WRC__decodeMusic() instead of decoding, returns false once the format is
+// known (with ctx->streamState set to WRC__STREAM_ABORT_GRACEFULLY) or on error
+bool WRC__probeData(WRC_Stream* ctx, const void* data, size_t size);
+// called by WRC__finishStreaming() while the stream's headers and curl handle are still there
+void WRC__probeFinish(WRC_Stream* ctx);
+
+// group.c - makes WRC_RunStreamGroup() return once it has no streams left
+void WRC__stopGroupWhenEmpty(WRC_StreamGroup* group);
+// group.c - if the stream is in a WRC_StreamGroup, sets userAbort and makes sure the group
+// notices it. returns false if it isn't (anymore), then userAbort isn't touched
+bool WRC__stopGroupStream(WRC_Stream* stream);
+// group.c - called by WRC_Init() and WRC_Shutdown()
+void WRC__initStreamGroups(void);
+void WRC__cleanupStreamGroups(void);
+// warm.c - prefetching streams in a WRC_WarmPool, see WRC_Prefetch()
+struct WRC__Warm
+{
+	// set by WRC_Prefetch(), NULL again once the stream is done in the pool
+	WRC_WarmPool* pool;
+	WRC_Stream* next; // in the pool's list of streams that haven't been started yet
+	int bufferMs;
+	uint64_t prefetchTime;
+
+	// only used by the pool's thread
+	bool holding; // not started yet, so the audio data is held back
+	bool paused; // the transfer is paused because enough data is held
+	bool stationInfoPending; // WRC__sendStationInfo() must be called when it's started
+	unsigned char* held; // the held back audio data
+	size_t heldLen;
+	size_t heldCap;
+	size_t maxHeld; // in bytes, calculated from bufferMs once the bitrate is known
+	char* title; // the last ICY title while holding
+
+	// protected by the pool's lock
+	bool activate; // WRC_StartStreaming() was called
+	bool evicting; // was stopped to make room in the pool or because it waited too long
+	bool done; // the pool's thread is done with the stream
+	int result; // what WRC_StartStreaming() would've returned
+};
+
+// called by WRC__decodeMusic() instead of decoding while ctx->warm.holding
+bool WRC__warmHold(WRC_Stream* ctx, void* data, size_t size);
+// called instead of currentTitleCB while ctx->warm.holding
+void WRC__warmHoldTitle(WRC_Stream* ctx, const char* title);
+// called by group.c for each stream at least every WRC__WARM_CHECK_MS while
+// ctx->warm.holding: starts the stream once WRC_StartStreaming() was called, evicts idle ones
+void WRC__warmCheck(WRC_Stream* ctx);
+#define WRC__WARM_CHECK_MS 1000
+// called by group.c instead of the group's finishedCB for streams of a WRC_WarmPool
+void WRC__warmStreamFinished(WRC_Stream* ctx, int result);
+// WRC_StartStreaming() for a prefetched stream: waits until it's done and returns the result.
+// *started is false (and the result meaningless) if it failed or was evicted before it was started.
+int WRC__startWarmStream(WRC_Stream* ctx, bool* started);
+// stops a stream in the pool that hasn't been started and waits for it
+void WRC__cancelWarmStream(WRC_Stream* ctx);
+
+// group.c - wakes up WRC_RunStreamGroup(), e.g. to make it call WRC__warmCheck()
+void WRC__wakeupGroup(WRC_StreamGroup* group);
+// group.c - WRC_StartStreaming() for streams that need a curl multi handle (see WRC_SetStandby())
+int WRC__streamInPrivateGroup(WRC_Stream* stream);
+// async.c - stops a stream started with WRC_BeginStreaming() right away
+void WRC__abortAsyncStream(WRC_Stream* ctx);
+
 #ifdef _WIN32
 int WRC__vsnprintf(char *dst, size_t size, const char *format, va_list ap);
 int WRC__snprintf(char *dst, size_t size, const char *format, ...);
@@ -111,15 +806,27 @@ struct WRC__Stream
 
 	enum WRC__STREAM_STATE streamState;
 	bool userAbort;
+	bool metadataOnly; // see WRC_SetMetadataOnly()
+	bool resolvedPlaylist; // true once the URL from a playlist is used
+	char* playlistMirror; // another stream URL from the playlist for the standby connection, or NULL
+	uint64_t lastDataTime; // when curl last gave us data
+
+	// set while the stream is driven by a WRC_StreamGroup (see group.c)
+	struct WRC__StreamGroup* group;
+	WRC_Stream* groupPrev;
+	WRC_Stream* groupNext;
+
+	// set while the stream is driven by the user's event loop (see async.c)
+	struct WRC__AsyncDriver* async;
 
 	char headerBuf[8192];
 	int headerBufAfterEndIdx;
 
 	int  icyMetaInt;
-	// the metadata sent periodically, cannot be more than this
-	// two buffers to swap between them (metadata could be split up into multiple packets)
-	char icyMetadata[2][256*16];
-	char icyMetadataIdx; // 0 or 1 - the currently valid index, will write to the other one, then swap
+	int  icyBitrate; // kbit/s from icy-br, 0 if unknown
+	// the metadata sent periodically, cannot be more than this.
+	// only used if it's split up into multiple packets, otherwise it's parsed in place
+	char icyMetadata[256*16];
 	int  icyMetaBytesMissing;
 	int  icyMetaBytesWritten;
 	int  dataReadSinceLastIcyMeta;
@@ -127,11 +834,74 @@ struct WRC__Stream
 	int sampleRate;
 	int numChannels;
 
+	// set with WRC_SetOutputFormat()
+	int outFormat;
+	bool outPlanar;
+	// the format last passed to initAudioCB, the same as sampleRate and numChannels
+	// unless WRC_SetFixedOutput() is used
+	int outRate;
+	int outChannels;
+	struct WRC__Resampler resampler;
+	struct WRC__Drift drift;
+
 	char* icyName;
 	char* icyGenre;
 	char* icyURL;
 	char* icyDescription;
 
+	struct WRC__DecoderThread decThread;
+	struct WRC__PcmBuffer pcmBuf;
+	struct WRC__Blocks blocks;
+
+	// automatic reconnects, see WRC_SetReconnectPolicy() and reconnect.c
+	int reconnectMaxAttempts; // 0 if disabled, < 0 for no limit
+	int reconnectInitialDelayMs;
+	int reconnectMaxDelayMs;
+	int reconnectJitterPercent;
+	bool reconnecting; // the connection dropped and we're trying to get it back
+	bool reconnectPending; // waiting for reconnectAt before performing ctx->curl again
+	uint64_t reconnectAt;
+	uint64_t reconnectDropTime;
+	int reconnectAttempt; // since the connection dropped
+	uint32_t reconnectRandom;
+	// what we had before the connection dropped
+	enum WRC__CONTENT_TYPE prevContentType;
+	char* prevIcyName;
+	char* prevIcyGenre;
+	char* prevIcyURL;
+	char* prevIcyDescription;
+	// statistics
+	unsigned long reconnects;
+	unsigned long reconnectAttempts;
+	uint64_t lastRecoveryMs;
+
+	// flow control, see WRC_SetFlowControl()
+	int flowHighMs; // 0 if disabled
+	int flowLowMs;
+	bool flowPaused; // the transfer is paused with CURL_WRITEFUNC_PAUSE
+	uint64_t flowPauseStart;
+	unsigned long flowPauses;
+	uint64_t flowPausedMs;
+
+	// hot-standby connection, see WRC_SetStandby() and standby.c
+	struct WRC__Standby standby;
+
+	// prefetching, see WRC_Prefetch() and warm.c
+	struct WRC__Warm warm;
+
+	// see rescache.c
+	struct WRC__Resolve resolve;
+
+	// the entries of the last playlist and WRC_SetMirrorRace(), see playlist.c
+	struct WRC__Playlist playlist;
+	struct WRC__MirrorRace race;
+
+	// see WRC_SetHlsPrefetch() and hls.c
+	struct WRC__HlsState hls;
+
+	// set for the streams of WRC_ProbeStations(), see probe.c
+	struct WRC__Probe* probe;
+
 #ifdef WRC_MP3
 	mpg123_handle* handle;
 #endif
@@ -145,7 +915,17 @@ struct WRC__Stream
 	// decode returns true if decoding was successful or if it just needs more data
 	//    and false, if there was a non-recoverable error
 	bool (*decode)(struct WRC__Stream* ctx, void* data, size_t size);
+	// optional: only adds the data to the decoder's input buffer, decode(ctx, NULL, 0)
+	// then decodes it. so pieces of data can be decoded at once without copying them together.
+	bool (*ingest)(struct WRC__Stream* ctx, const void* data, size_t size);
+	// optional, with ingest: room for size bytes in the decoder's input buffer itself (NULL on
+	// error), so the ICY demuxer can write the audio right there. ingestWrote() says how much it wrote
+	char* (*ingestBuffer)(struct WRC__Stream* ctx, size_t size);
+	void (*ingestWrote)(struct WRC__Stream* ctx, size_t size);
 	void (*shutdown)(struct WRC__Stream* ctx);
+	// set with shutdown: drops the input that wasn't decoded yet (i.e. the start of a frame
+	// or page), so the data of another connection can follow (see standby.c)
+	void (*discardInput)(struct WRC__Stream* ctx);
 
 	// function pointers for callbacks to user-code, so the user can play the decoded music
 	// and display (changed) metadata etc
@@ -153,11 +933,19 @@ struct WRC__Stream
 	void* userdata; // this will be passed to the user-specified callbacks
 
 	WRC_playbackCB playbackCB;
+	WRC_playbackFmtCB playbackFmtCB; // used instead of playbackCB if set
+	// WRC_SetOutputProvider(), used instead of playbackCB/playbackFmtCB if set
+	WRC_acquireOutputCB acquireOutputCB;
+	WRC_commitOutputCB commitOutputCB;
+	uint64_t droppedFrames; // acquireOutputCB had no room for them
+	// WRC_SetSharedMemorySink(), used instead of all of the above if set
+	struct WRC__ShmSink shm;
 	WRC_initAudioCB initAudioCB;
 
 	WRC_stationInfoCB stationInfoCB;
 	WRC_currentTitleCB currentTitleCB;
 	WRC_reportErrorCB reportErrorCB;
+	WRC_queuedMsCB queuedMsCB;
 };
 
 
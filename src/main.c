@@ -12,8 +12,6 @@
 #include <stdarg.h>
 #include <assert.h>
 
-// TODO: some buffering before starting to decode?
-
 /*	Takes input from <src> and decodes into <dest>, which should be a buffer
 	large enough to hold <strlen(src) + 1> characters.
 
@@ -166,73 +164,13 @@ static bool decodeDummyFail(WRC_Stream* ctx, void* data, size_t size)
 	return false;
 }
 
-static bool decodePlaylist(WRC_Stream* ctx, void* data, size_t size)
+// used as ctx->decode with WRC_SetMetadataOnly(), the titles are in the ICY metadata
+static bool skipAudio(WRC_Stream* ctx, void* data, size_t size)
 {
-	char format[20];
-	// create a format for scanf'ing to end of line with correct size
-	snprintf(format, sizeof(format), "%%%zu[^\n]", sizeof(ctx->url) -1);
-
-	// make sure it always terminates
-	((char*)data)[size -1] = 0;
-
-	// check for .pls file type
-	if(strstr(data, "[playlist]") != NULL)
-	{
-		char * file1 = NULL;
-		//check for File1
-		file1 = strstr(data, "File1");
-		if(file1 != NULL)
-		{
-			char * equal = NULL;
-			equal = strstr(file1, "=");
-			if(equal != NULL)
-			{
-				equal ++; // skip "="
-				sscanf(equal, format, ctx->url);
-			}
-		}
-	}
-	else
-	// check for extended .m3u file type
-	if(strstr(data,"#EXTM3U")!= NULL)
-	{
-		//OK, this is a rather brute force way of parsing it...
-		char * http;
-		http = strstr(data, "http://");
-		if(http != NULL)
-		{
-			sscanf(http, format, ctx->url);
-		}
-	}
-	else
-	// undetectable format. Trying raw
-	{
-		char * http;
-		//printf(".raw (simple .m3u) found\n");
-		//printf("--snip--\n %s \n--snip--\n",(char *)data);
-		http = strstr(data, "http://");
-		if(http != NULL)
-		{
-			sscanf(http, format, ctx->url);
-		}
-	}
-
-	if(ctx->url[0] == 0)
-	{
-		WRC__errorReset(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "playlist contains no url");
-		return false;
-	}
-
-	// eliminate CR if present
-	if(ctx->url[strlen(ctx->url)-1] == 0x0D)
-	{
-		ctx->url[strlen(ctx->url)-1] = 0;
-	}
-	//printf("Got URL: \"%s\"\n", ctx->url);
 	return true;
 }
 
-static void handleHeaderLine(WRC_Stream* ctx, const char* line, size_t len)
+void WRC__handleHeaderLine(WRC_Stream* ctx, const char* line, size_t len)
 {
 	const char* lineAfterEnd = line+len;
 	const char* str;
@@ -242,16 +180,22 @@ static void handleHeaderLine(WRC_Stream* ctx, const char* line, size_t len)
 #ifdef WRC_MP3
 		if(strCmpToNL(str, "audio/mpeg") == 0)
 		{
+			WRC__reconnectContentType(ctx, WRC_CONTENT_MP3);
 			ctx->contentType = WRC_CONTENT_MP3;
-			ctx->decode = WRC__decodeMP3;
+			ctx->decode = ctx->metadataOnly ? skipAudio : WRC__decodeMP3;
+			ctx->ingest = ctx->metadataOnly ? NULL : WRC__ingestMP3;
 		}
 		else
 #endif // WRC_MP3
 #ifdef WRC_OGG
 		if(strCmpToNL(str, "application/ogg") == 0 || strCmpToNL(str, "audio/ogg") == 0)
 		{
+			WRC__reconnectContentType(ctx, WRC_CONTENT_OGGVORBIS);
 			ctx->contentType = WRC_CONTENT_OGGVORBIS;
-			ctx->decode = WRC__decodeOGG;
+			ctx->decode = ctx->metadataOnly ? WRC__decodeOGGMetadata : WRC__decodeOGG;
+			ctx->ingest = WRC__ingestOGG;
+			ctx->ingestBuffer = WRC__ingestBufferOGG;
+			ctx->ingestWrote = WRC__ingestWroteOGG;
 		}
 		else
 #endif // WRC_OGG
@@ -261,17 +205,27 @@ static void handleHeaderLine(WRC_Stream* ctx, const char* line, size_t len)
 			strCmpToNL(str, "audio/mpeg-url") == 0 ||
 			strCmpToNL(str, "audio/playlist") == 0 ||
 			strCmpToNL(str, "audio/scpls") == 0 ||
-			strCmpToNL(str, "audio/x-scpls") == 0)
+			strCmpToNL(str, "audio/x-scpls") == 0 ||
+			strCmpToNL(str, "application/x-mpegurl") == 0 ||
+			strCmpToNL(str, "application/vnd.apple.mpegurl") == 0 ||
+			strCmpToNL(str, "application/xspf+xml") == 0 ||
+			strCmpToNL(str, "video/x-ms-asf") == 0 ||
+			strCmpToNL(str, "video/x-ms-asx") == 0 ||
+			strCmpToNL(str, "audio/x-ms-asx") == 0 ||
+			strCmpToNL(str, "audio/x-ms-wax") == 0)
 		{
 			// reset stream url, as this could cause loop if actual playlist result
 			// contains no url
 			ctx->url[0] = 0;
+			WRC__resetPlaylist(ctx); // and the mirror
+			WRC__reconnectContentType(ctx, WRC_CONTENT_PLAYLIST);
 			ctx->contentType = WRC_CONTENT_PLAYLIST;
-			ctx->decode = decodePlaylist;
+			ctx->decode = WRC__decodePlaylist;
 			ctx->streamState = WRC__STREAM_PLAYLIST;
 		}
 		else
 		{
+			WRC__reconnectContentType(ctx, WRC_CONTENT_UNKNOWN);
 			ctx->contentType = WRC_CONTENT_UNKNOWN;
 			ctx->decode = decodeDummyFail; // this returns false so curlWriteFun() will abort
 			WRC__errorReset(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "unknown content type: %s", str);
@@ -297,6 +251,23 @@ static void handleHeaderLine(WRC_Stream* ctx, const char* line, size_t len)
 	{
 		ctx->icyMetaInt = atoi(str);
 	}
+	else if((str = remLineIfStartsWith(line, "icy-br:")))
+	{
+		ctx->icyBitrate = atoi(str);
+	}
+}
+
+void WRC__handleHeaderLines(WRC_Stream* ctx, const char* lines, size_t len)
+{
+	const char* line = lines;
+	const char* end = lines + len;
+	while(line < end)
+	{
+		const char* lineEnd = memchr(line, '\n', end - line);
+		lineEnd = (lineEnd != NULL) ? lineEnd+1 : end;
+		WRC__handleHeaderLine(ctx, line, lineEnd - line);
+		line = lineEnd;
+	}
 }
 
 static void parseInBodyIcyHeader(WRC_Stream* ctx)
@@ -321,7 +292,7 @@ static void parseInBodyIcyHeader(WRC_Stream* ctx)
 
 	while(lineEnd && lineEnd <= headerEnd)
 	{
-		handleHeaderLine(ctx, line, lineEnd - line);
+		WRC__handleHeaderLine(ctx, line, lineEnd - line);
 
 		line = (lineEnd[1] == '\n') ? (lineEnd+2) : (lineEnd+1);
 		remsize = headerEnd - line;
@@ -329,6 +300,28 @@ static void parseInBodyIcyHeader(WRC_Stream* ctx)
 	}
 }
 
+// returns the end of the ICY header (after its "\r\n\r\n") in data, which is the next
+// part of it after what's in ctx->headerBuf, or NULL if it doesn't end in data.
+// The "\r\n\r\n" might be split between both.
+static char* icyHeaderEnd(WRC_Stream* ctx, char* data, size_t size)
+{
+	const char* term = "\r\n\r\n";
+	size_t bufLen = ctx->headerBufAfterEndIdx;
+
+	for(size_t inBuf=3; inBuf > 0; --inBuf)
+	{
+		if(bufLen >= inBuf && size >= 4-inBuf
+		   && memcmp(ctx->headerBuf + bufLen - inBuf, term, inBuf) == 0
+		   && memcmp(data, term + inBuf, 4-inBuf) == 0)
+		{
+			return data + 4-inBuf;
+		}
+	}
+
+	char* end = WRC__memmem(data, size, term, 4);
+	return (end != NULL) ? end+4 : NULL;
+}
+
 void WRC__errorReset(WRC_Stream* ctx, int errCode, const char* format, ...)
 {
 	if(ctx->reportErrorCB != NULL)
@@ -352,59 +345,271 @@ void WRC__errorReset(WRC_Stream* ctx, int errCode, const char* format, ...)
 	ctx->streamState = WRC__STREAM_ABORT_ERROR;
 }
 
-static bool decodeMusic(WRC_Stream* ctx, void* data, size_t size)
+static bool useDecoderThread(WRC_Stream* ctx)
+{
+	return ctx->decThread.enabled && !ctx->metadataOnly && (ctx->contentType == WRC_CONTENT_MP3
+	                                  || ctx->contentType == WRC_CONTENT_OGGVORBIS);
+}
+
+bool WRC__decodeMusic(WRC_Stream* ctx, void* data, size_t size)
 {
 	if(ctx->decode != NULL)
 	{
+		if(ctx->probe != NULL && (ctx->contentType == WRC_CONTENT_MP3
+		                          || ctx->contentType == WRC_CONTENT_OGGVORBIS))
+		{
+			// WRC_ProbeStations() only wants to know the format
+			return WRC__probeData(ctx, data, size);
+		}
+		if(ctx->warm.holding && (ctx->contentType == WRC_CONTENT_MP3
+		                         || ctx->contentType == WRC_CONTENT_OGGVORBIS))
+		{
+			// prefetched stream that hasn't been started yet, see warm.c
+			return WRC__warmHold(ctx, data, size);
+		}
+		if(useDecoderThread(ctx))
+		{
+			return WRC__decodeInThread(ctx, data, size);
+		}
 		return ctx->decode(ctx, data, size);
 	}
 
 	return false;
 }
 
-static void sendStationInfo(WRC_Stream* ctx)
+void WRC__sendStationInfo(WRC_Stream* ctx)
 {
 	if(ctx->stationInfoCB != NULL)
 	{
 		ctx->stationInfoCB(ctx->userdata, ctx->icyName, ctx->icyGenre, ctx->icyDescription, ctx->icyURL);
 	}
+	WRC__shmStationInfo(ctx);
+}
+
+void WRC__sendTitle(WRC_Stream* ctx, const char* title)
+{
+	if(ctx->currentTitleCB != NULL)
+	{
+		ctx->currentTitleCB(ctx->userdata, title);
+	}
+	WRC__shmTitle(ctx, title);
 }
 
-// strips crap from the icy metadata string from the periodic updates,
+// gets the title from the icy metadata string from the periodic updates,
 // which looks like:
 // "StreamTitle='Norma Jean - Opposite Of Left And Wrong | WackenRadio.com';StreamUrl='';"
-// and then calls ctx->currentTitleCB(), if any
-static void stripIcyMetaBufAndTellUser(WRC_Stream* ctx, char* str)
+// (padded with '\0' to a multiple of 16 bytes, not necessarily terminated)
+// and then passes it to the user with WRC__sendTitle()
+static void tellUserIcyTitle(WRC_Stream* ctx, const char* meta, size_t len)
 {
-	static const int bufLen = 256*16;
-
-	str[bufLen-1] = '\0'; // make sure it's terminated.
+	const char* metaEnd = memchr(meta, '\0', len);
+	if(metaEnd == NULL)
+	{
+		metaEnd = meta + len;
+	}
 
-	char* streamTitleStart = strstr(str, "StreamTitle=\'");
-	char* streamTitleEnd = NULL;
+	const char* streamTitleStart = WRC__memmem(meta, metaEnd - meta, "StreamTitle=\'", 13);
 	if(streamTitleStart == NULL)
 	{
-		streamTitleStart = str;
+		streamTitleStart = meta;
 	}
 	else
 	{
-		streamTitleStart += strlen("StreamTitle=\'");
+		streamTitleStart += 13;
 	}
 
-	streamTitleEnd = strstr(streamTitleStart, "\';");
+	const char* streamTitleEnd = WRC__memmem(streamTitleStart, metaEnd - streamTitleStart, "\';", 2);
 	if(streamTitleEnd == NULL)
 	{
-		streamTitleEnd = str + strlen(str);
+		streamTitleEnd = metaEnd;
 	}
 
-	*streamTitleEnd = '\0'; // cut off "';"
+	// metadata is at most 255*16 bytes
+	char title[256*16];
+	size_t titleLen = streamTitleEnd - streamTitleStart;
+	memcpy(title, streamTitleStart, titleLen);
+	title[titleLen] = '\0'; // cut off "';"
 
-	if(ctx->currentTitleCB != NULL)
+	if(ctx->warm.holding)
 	{
-		ctx->currentTitleCB(ctx->userdata, streamTitleStart);
+		// told the user once the prefetched stream is started
+		WRC__warmHoldTitle(ctx, title);
+	}
+	else
+	{
+		WRC__sendTitle(ctx, title);
 	}
 }
 
+// splits the data of one curlWriteFun() call into audio and ICY metadata: after every
+// ctx->icyMetaInt bytes of audio there's one byte with the length of the metadata / 16,
+// followed by the metadata. The audio of the whole chunk is decoded at once in the end:
+// if the decoder has its own input buffer (Ogg), the audio is written right into it,
+// if it can only ingest (MP3) each piece is fed to it, otherwise (the decoder thread,
+// warm.c and probe.c, that take one span of audio) it's moved together in place.
+// Metadata is parsed right from data, unless it's split between calls.
+// Returns false if decoding failed.
+static bool demuxIcyMetadata(WRC_Stream* ctx, char* data, size_t size)
+{
+	bool ingest = ctx->ingest != NULL && !ctx->warm.holding && !useDecoderThread(ctx) && ctx->probe == NULL;
+	// where the audio is moved to, NULL if it's ingested piece by piece
+	char* audio = data;
+	if(ingest && ctx->ingestBuffer != NULL)
+	{
+		audio = ctx->ingestBuffer(ctx, size);
+		if(audio == NULL)
+			return false;
+	}
+	else if(ingest)
+	{
+		audio = NULL;
+	}
+	size_t audioSize = 0;
+	size_t pos = 0;
+
+	while(pos < size)
+	{
+		if(ctx->icyMetaBytesMissing > 0)
+		{
+			size_t n = ctx->icyMetaBytesMissing;
+			if(n > size - pos)
+				n = size - pos;
+
+			if(ctx->icyMetaBytesWritten == 0 && n == ctx->icyMetaBytesMissing)
+			{
+				// all of it is here
+				tellUserIcyTitle(ctx, data + pos, n);
+			}
+			else
+			{
+				// collect it until it's complete
+				memcpy(ctx->icyMetadata + ctx->icyMetaBytesWritten, data + pos, n);
+				ctx->icyMetaBytesWritten += n;
+				if(n == ctx->icyMetaBytesMissing)
+				{
+					tellUserIcyTitle(ctx, ctx->icyMetadata, ctx->icyMetaBytesWritten);
+					ctx->icyMetaBytesWritten = 0;
+				}
+			}
+			ctx->icyMetaBytesMissing -= n;
+			pos += n;
+		}
+		else if(ctx->dataReadSinceLastIcyMeta >= ctx->icyMetaInt)
+		{
+			// the length byte, often 0 (no new metadata)
+			ctx->icyMetaBytesMissing = ((unsigned char*)data)[pos] * 16;
+			ctx->icyMetaBytesWritten = 0;
+			ctx->dataReadSinceLastIcyMeta = 0;
+			++pos;
+		}
+		else
+		{
+			size_t n = ctx->icyMetaInt - ctx->dataReadSinceLastIcyMeta;
+			if(n > size - pos)
+				n = size - pos;
+
+			if(audio == NULL)
+			{
+				if(!ctx->ingest(ctx, data + pos, n))
+					return false;
+			}
+			else if(audio + audioSize != data + pos)
+			{
+				memmove(audio + audioSize, data + pos, n);
+			}
+			audioSize += n;
+			pos += n;
+			ctx->dataReadSinceLastIcyMeta += n;
+		}
+	}
+
+	if(audioSize == 0)
+	{
+		// only metadata in this chunk
+		return true;
+	}
+
+	// all the audio of this chunk at once
+	if(!ingest)
+	{
+		return WRC__decodeMusic(ctx, audio, audioSize);
+	}
+	if(ctx->ingestWrote != NULL)
+	{
+		ctx->ingestWrote(ctx, audioSize);
+	}
+	return ctx->decode(ctx, NULL, 0);
+}
+
+// how many milliseconds of audio the consumer has queued for WRC_SetFlowControl(),
+// -1 if that's unknown
+static int queuedAudioMs(WRC_Stream* ctx)
+{
+	if(ctx->queuedMsCB != NULL)
+	{
+		return ctx->queuedMsCB(ctx->userdata);
+	}
+	if(ctx->pcmBuf.running)
+	{
+		return WRC__pcmBufferedMs(ctx);
+	}
+	if(ctx->shm.hdr != NULL)
+	{
+		return WRC__shmBufferedMs(ctx);
+	}
+	return -1;
+}
+
+// resumes the transfer paused by curlWriteFun() once the consumer has less than flowLowMs queued
+void WRC__checkFlowControl(WRC_Stream* ctx)
+{
+	if(!ctx->flowPaused || ctx->curl == NULL)
+		return;
+
+	if(queuedAudioMs(ctx) < ctx->flowLowMs)
+	{
+		ctx->flowPaused = false;
+		ctx->flowPausedMs += WRC__timeMs() - ctx->flowPauseStart;
+		// this might call curlWriteFun() right away with the data curl kept for us
+		curl_easy_pause(ctx->curl, CURLPAUSE_CONT);
+	}
+}
+
+bool WRC__beginMusic(WRC_Stream* ctx)
+{
+	// remember where the audio came from, see rescache.c
+	WRC__resolveCacheStore(ctx);
+
+	if(ctx->reconnecting)
+	{
+		// tells the user about changed station info itself
+		if(!WRC__reconnected(ctx))
+		{
+			// this doesn't look like the stream anymore, try again
+			return false;
+		}
+	}
+	else if(ctx->warm.holding)
+	{
+		// prefetched stream, tell the user once it's started
+		ctx->warm.stationInfoPending = true;
+	}
+	else
+	{
+		// tell the user about the station info via his callback
+		WRC__sendStationInfo(ctx);
+	}
+
+	if(ctx->playbackCB == NULL && ctx->playbackFmtCB == NULL && ctx->acquireOutputCB == NULL
+	   && ctx->shm.hdr == NULL && !ctx->pcmBuf.pull && !ctx->metadataOnly && ctx->probe == NULL)
+	{
+		// abort stream gracefully - probably the user only wanted the metadata
+		ctx->streamState = WRC__STREAM_ABORT_GRACEFULLY;
+		return false;
+	}
+	return true;
+}
+
 static size_t curlWriteFun(void* freshData, size_t size, size_t nmemb, void* context)
 {
 	const size_t freshDataSize = size*nmemb;
@@ -414,12 +619,30 @@ static size_t curlWriteFun(void* freshData, size_t size, size_t nmemb, void* con
 
 	char* remData = freshData;
 
+	ctx->lastDataTime = WRC__timeMs(); // for detecting stalls, see standby.c
+
 	if(ctx->streamState >= WRC__STREAM_ABORT_GRACEFULLY || ctx->userAbort)
 	{
 		// if this function doesn't return size*nmemb,
 		// cURL will assume an error and abort.
 		return 0;
 	}
+	else if(ctx->streamState == WRC__STREAM_MUSIC && ctx->flowHighMs > 0
+	        && queuedAudioMs(ctx) > ctx->flowHighMs)
+	{
+		// the consumer has enough, curl keeps the data and calls us again
+		// after curlProgressFun() resumed the transfer
+		ctx->flowPaused = true;
+		ctx->flowPauseStart = WRC__timeMs();
+		++ctx->flowPauses;
+		return CURL_WRITEFUNC_PAUSE;
+	}
+	else if(ctx->warm.holding && ctx->warm.maxHeld > 0 && ctx->warm.heldLen >= ctx->warm.maxHeld)
+	{
+		// prefetched enough, the transfer is resumed when the stream is started (see warm.c)
+		ctx->warm.paused = true;
+		return CURL_WRITEFUNC_PAUSE;
+	}
 	else if(ctx->streamState < WRC__STREAM_MUSIC)
 	{
 		if(ctx->streamState == WRC__STREAM_FRESH)
@@ -439,13 +662,12 @@ static size_t curlWriteFun(void* freshData, size_t size, size_t nmemb, void* con
 
 		if(ctx->streamState == WRC__STREAM_ICY_HEADER_IN_BODY)
 		{
-			char* headerEnd = WRC__memmem(remData, remDataSize, "\r\n\r\n", 4);
+			char* headerEnd = icyHeaderEnd(ctx, remData, remDataSize);
 			const int bufSize = sizeof(ctx->headerBuf);
 			size_t headerDataSize = remDataSize;
 
 			if(headerEnd != NULL)
 			{
-				headerEnd += 4; // \r\n\r\n
 				headerDataSize = headerEnd - remData;
 			}
 
@@ -470,144 +692,26 @@ static size_t curlWriteFun(void* freshData, size_t size, size_t nmemb, void* con
 			remDataSize -= headerDataSize;
 		}
 
-		// tell the user about the station info via his callback
-		sendStationInfo(ctx);
-
-		if(ctx->playbackCB == NULL)
+		if(!WRC__beginMusic(ctx))
 		{
-			// abort stream gracefully - probably the user only wanted the metadata
-			ctx->streamState = WRC__STREAM_ABORT_GRACEFULLY;
 			return 0;
 		}
 	}
 	// ICY stream is samples multiplexed with ICY meta data. Frequency of meta data
 	// comes in icy-metaint http header. So if not set or zero, just decode the raw
-	// stream
-	if(ctx->icyMetaInt == 0)
+	// stream, otherwise strip the metadata first.
+	if(ctx->icyMetaInt > 0)
 	{
-		// decode raw stream
-		if(!decodeMusic(ctx, remData, remDataSize))
+		if(!demuxIcyMetadata(ctx, remData, remDataSize))
 		{
 			// there was an error, abort download
 			return 0;
 		}
 	}
-	else
+	else if(!WRC__decodeMusic(ctx, remData, remDataSize))
 	{
-		// Server say'd it sends ICY meta data. Metedata comes after each 
-		// ctx->icyMetaInt processed bytes. It's first byte contains the number
-		// of meta data bytes following.
-
-		if(ctx->icyMetaBytesMissing > 0)
-		{
-			// Data ended last time while in meta data: continue reading the
-			// meta data. Then proceed.
-
-			size_t metaToRead = ctx->icyMetaBytesMissing;
-
-			// just for paranoia:
-			ctx->dataReadSinceLastIcyMeta = 0;
-
-			if(metaToRead > remDataSize)
-			metaToRead = remDataSize;
-
-			if(remDataSize > 0)
-			{
-				// Still data left. Read meta data
-				char * mdBuf = ctx->icyMetadata[!ctx->icyMetadataIdx];
-				size_t metaToRead = ctx->icyMetaBytesMissing;
-				if(metaToRead > remDataSize)
-				metaToRead = remDataSize;
-				if(metaToRead > 0)
-				{
-					memcpy(mdBuf + ctx->icyMetaBytesWritten, remData, metaToRead);
-					remDataSize -= metaToRead;
-					remData += metaToRead;
-					ctx->icyMetaBytesMissing -= metaToRead;
-					ctx->icyMetaBytesWritten += metaToRead;
-				}
-				if(ctx->icyMetaBytesMissing <= 0)
-				{
-					// process meta data
-					stripIcyMetaBufAndTellUser(ctx, mdBuf);
-					// switch buffer
-					ctx->icyMetadataIdx = !ctx->icyMetadataIdx;
-					// done reading meta data
-					ctx->icyMetaBytesMissing = 0;
-					ctx->icyMetaBytesWritten = 0;
-				}
-			}
-		}
-
-		while (remDataSize > 0)
-		{
-			// contuinue reading the stream data until next header
-			size_t dataToRead = ctx->icyMetaInt - ctx->dataReadSinceLastIcyMeta;
-			// just for paranoia
-			if(dataToRead < 0)
-				dataToRead = 0;
-
-			if(dataToRead > remDataSize)
-				dataToRead = remDataSize;
-
-			if(dataToRead > 0)
-			{
-				// just for paranoia
-				ctx->icyMetaBytesMissing = 0;
-
-				if(!decodeMusic(ctx, remData, dataToRead))
-				{
-					// there was an error, abort downloading stream
-					return 0;
-				}
-				ctx->dataReadSinceLastIcyMeta += dataToRead;
-				remData += dataToRead;
-				remDataSize -= dataToRead;
-			}
-
-			if((remDataSize > 0) && (ctx->dataReadSinceLastIcyMeta >= ctx->icyMetaInt))
-			{
-				// done reading data
-				ctx->dataReadSinceLastIcyMeta = 0;
-				ctx->icyMetaBytesWritten = 0;
-
-				// next byte is meta data size.
-				ctx->icyMetaBytesMissing = ((unsigned char*)remData)[0] * 16;
-				// skip meta data size byte
-				remData ++;
-				remDataSize --;
-				if((remDataSize > 0) && (ctx->icyMetaBytesMissing > 0))
-				{
-					// Still data left. Read meta data
-					char * mdBuf = ctx->icyMetadata[!ctx->icyMetadataIdx];
-					size_t metaToRead = ctx->icyMetaBytesMissing;
-					if(metaToRead > remDataSize)
-					metaToRead = remDataSize;
-
-					if(metaToRead > 0)
-					{
-						memcpy(mdBuf + ctx->icyMetaBytesWritten, remData, metaToRead);
-						remDataSize -= metaToRead;
-						remData += metaToRead;
-						ctx->icyMetaBytesMissing -= metaToRead;
-						ctx->icyMetaBytesWritten += metaToRead;
-					}
-
-					if(ctx->icyMetaBytesMissing <= 0)
-					{
-						// process meta data
-						stripIcyMetaBufAndTellUser(ctx, mdBuf);
-						// switch buffer
-						ctx->icyMetadataIdx = !ctx->icyMetadataIdx;
-						// done reading meta data
-						ctx->icyMetaBytesMissing = 0;
-						ctx->icyMetaBytesWritten = 0;
-					}
-				}
-			}
-			// continue if still something left
-		}
-
+		// there was an error, abort download
+		return 0;
 	}
 	return freshDataSize;
 }
@@ -633,71 +737,225 @@ static size_t curlHeaderFun(char *buffer, size_t size, size_t nitems, void *user
 	if(respCode >= 200 && respCode < 300)
 	{
 		// don't parse headers of forwardings, errorpages etc
-		handleHeaderLine(ctx, buffer, dataSize);
+		WRC__handleHeaderLine(ctx, buffer, dataSize);
 	}
 	return dataSize;
 }
 
-static bool prepareCURL(WRC_Stream* ctx)
+// called by curl regularly (roughly once per second) even if no data arrives
+static int curlProgressFun(void* context, curl_off_t dltotal, curl_off_t dlnow,
+                           curl_off_t ultotal, curl_off_t ulnow)
+{
+	WRC_Stream* ctx = (WRC_Stream*)context;
+
+	// returning non-0 aborts the transfer, so WRC_StopStreaming() also works
+	// if the server currently doesn't send anything
+	if(ctx->userAbort)
+		return 1;
+
+	// curl_easy_perform() doesn't give us another chance to resume a paused transfer
+	WRC__checkFlowControl(ctx);
+
+	return 0;
+}
+
+// shared by all curl handles (created in WRC_Init()), so streams share the DNS cache
+// and TLS sessions. Not the connection cache: curl doesn't support using shared
+// connections from several threads at once, and the streams run in different threads
+// (WRC_StartStreaming(), stream groups, the warm pool). The handles of one multi handle
+// (e.g. a WRC_StreamGroup) share its connection cache anyway.
+static CURLSH* share = NULL;
+static WRC__Mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+static void shareLockFun(CURL* curl, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+	WRC__mutexLock(&shareLocks[data]);
+}
+
+static void shareUnlockFun(CURL* curl, curl_lock_data data, void* userptr)
+{
+	WRC__mutexUnlock(&shareLocks[data]);
+}
+
+static void initShare(void)
+{
+	share = curl_share_init();
+	if(share == NULL)
+	{
+		// not fatal, the streams just don't share anything then
+		eprintf("Initializing cURL share handle failed!\n");
+		return;
+	}
+
+	for(int i=0; i < CURL_LOCK_DATA_LAST; ++i)
+		WRC__mutexInit(&shareLocks[i]);
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, shareLockFun);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, shareUnlockFun);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+static void cleanupShare(void)
+{
+	if(share == NULL)
+		return;
+
+	curl_share_cleanup(share);
+	share = NULL;
+	for(int i=0; i < CURL_LOCK_DATA_LAST; ++i)
+		WRC__mutexDestroy(&shareLocks[i]);
+}
+
+// makes curl call our callbacks for ctx
+void WRC__setStreamCallbacks(WRC_Stream* ctx, CURL* curl)
+{
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteFun);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, ctx);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeaderFun);
+	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, ctx);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curlProgressFun);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, ctx);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, ctx); // so group.c can find the stream of an easy handle
+}
+
+// creates a curl handle for a connection of ctx to url, *headers must be freed
+// once the handle is cleaned up
+CURL* WRC__createEasyHandle(WRC_Stream* ctx, const char* url, struct curl_slist** headers)
 {
 	CURL* curl = curl_easy_init();
 
 	if(curl == NULL)
 	{
 		eprintf("Initializing cURL failed!\n");
-		return false;
+		return NULL;
 	}
 
-	struct curl_slist* headers = NULL;
-
-	headers = curl_slist_append(headers, "Icy-MetaData:1");
+	*headers = curl_slist_append(NULL, "Icy-MetaData:1");
 
-	curl_easy_setopt(curl, CURLOPT_URL, ctx->url);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1 );
 	curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
 	curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1); // follow http 3xx redirects
 	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *headers);
+	if(share != NULL)
+	{
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	}
+	if(ctx->probe != NULL && ctx->probe->timeoutMs > 0)
+	{
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)ctx->probe->timeoutMs);
+	}
 
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteFun);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, ctx);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeaderFun);
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, ctx);
+	WRC__setStreamCallbacks(ctx, curl);
+
+	return curl;
+}
+
+static bool prepareCURL(WRC_Stream* ctx)
+{
+	WRC__beginResolve(ctx);
+
+	struct curl_slist* headers = NULL;
+	CURL* curl = WRC__createEasyHandle(ctx, ctx->url, &headers);
+
+	if(curl == NULL)
+	{
+		return false;
+	}
 
 	ctx->curl = curl;
 	ctx->headers = headers;
+	ctx->lastDataTime = WRC__timeMs();
 
 	return true;
 }
 
 static void resetStreamIntern(WRC_Stream* ctx);
 
-static bool execCurlRequest(WRC_Stream* ctx)
+bool WRC__failedBeforeAudio(WRC_Stream* ctx)
+{
+	if(ctx->userAbort || ctx->reconnecting || ctx->streamState >= WRC__STREAM_ABORT_GRACEFULLY)
+		return false;
+
+	// once audio arrived, it's a drop (see reconnect.c), not a bad URL.
+	// without a decoder it was an error page.
+	return ctx->streamState != WRC__STREAM_MUSIC || ctx->decode == NULL;
+}
+
+// performs ctx->curl again with the (new) ctx->url, e.g. from the playlist.
+// keeps the curl handle, the stream is often on the same host as the playlist
+// and curl can reuse the connection then
+static enum WRC__TRANSFER_RESULT restartTransfer(WRC_Stream* ctx, bool resolvedPlaylist)
 {
-	CURLcode res = curl_easy_perform(ctx->curl);
+	CURL* curl = ctx->curl;
+	struct curl_slist* headers = ctx->headers;
+	ctx->curl = NULL;
+	ctx->headers = NULL;
 
-	if(ctx->headers != NULL)
+	resetStreamIntern(ctx); // keep userAbort if set
+	ctx->resolvedPlaylist = resolvedPlaylist; // only follow one playlist, like before
+
+	ctx->curl = curl;
+	ctx->headers = headers;
+	curl_easy_setopt(curl, CURLOPT_URL, ctx->url);
+	ctx->lastDataTime = WRC__timeMs();
+	return WRC__TRANSFER_RESTART;
+}
+
+bool WRC__startTransfer(WRC_Stream* ctx)
+{
+	return prepareCURL(ctx);
+}
+
+// to be called once curl is done with the transfer of ctx->curl, no matter
+// if that happened in curl_easy_perform() or in a curl multi handle (see group.c)
+// Returns WRC__TRANSFER_RESTART if the transfer got us a playlist (or the stream URL from
+// it didn't work) and ctx->curl has been prepared for the (next) stream URL from it,
+// so it must be performed again.
+// Returns WRC__TRANSFER_HLS if it was an HLS playlist, then WRC__hlsStart() takes over.
+// Otherwise the transfer is over and WRC__TRANSFER_OK or WRC__TRANSFER_FAILED is returned.
+enum WRC__TRANSFER_RESULT WRC__finishTransfer(WRC_Stream* ctx, CURLcode res)
+{
+	if(res != CURLE_OK && WRC__resolveCacheFallback(ctx))
 	{
-		curl_slist_free_all(ctx->headers);
-		ctx->headers = NULL;
+		// the cached stream URL doesn't work (anymore), resolve the URL again
+		return restartTransfer(ctx, false);
 	}
-	if(res == CURLE_OK)
+	if(res != CURLE_OK && WRC__nextPlaylistEntry(ctx))
 	{
-		if(ctx->streamState == WRC__STREAM_PLAYLIST)
-		{
-			// url was playlist. Now we should have the real stream in ctx->url
-			resetStreamIntern(ctx); // keep userAbort if set
-			prepareCURL(ctx);
+		// that URL from the playlist didn't work, try the next one
+		return restartTransfer(ctx, true);
+	}
 
-			res = curl_easy_perform(ctx->curl);
+	if(WRC__prepareReconnect(ctx))
+	{
+		// ctx->curl (and ctx->headers) are used again for the new connection
+		return WRC__TRANSFER_RECONNECT;
+	}
 
-			if(ctx->headers != NULL)
+	if(res == CURLE_OK && ctx->streamState == WRC__STREAM_PLAYLIST && !ctx->resolvedPlaylist)
+	{
+		// url was playlist. Now we should have the real stream in ctx->url.
+		if(WRC__endPlaylist(ctx))
+		{
+			if(ctx->playlist.hls)
 			{
-				curl_slist_free_all(ctx->headers);
-				ctx->headers = NULL;
+				// ctx->curl (and ctx->headers) are kept to reload the playlist
+				return WRC__TRANSFER_HLS;
 			}
+			return restartTransfer(ctx, true);
 		}
+		res = CURLE_WRITE_ERROR; // like a failed decoder, the error was reported already
+	}
+
+	if(ctx->headers != NULL)
+	{
+		curl_slist_free_all(ctx->headers);
+		ctx->headers = NULL;
 	}
 
 	if(res != CURLE_OK)
@@ -709,53 +967,119 @@ static bool execCurlRequest(WRC_Stream* ctx)
 			//       (404, 403, domain not found, no server at that port, ...)
 			WRC__errorReset(ctx, WRC_ERR_UNAVAILABLE, "Downloading failed, cURL error: %s\n", curl_easy_strerror(res));
 		}
-		return false;
+		return WRC__TRANSFER_FAILED;
 	}
 
-	return true;
+	return WRC__TRANSFER_OK;
 }
 
-#define WRC_CTX_FREE(x) free(ctx->x); ctx->x = NULL;
-static void resetStreamIntern(WRC_Stream* ctx)
+// waits for the reconnect backoff delay, returns false if WRC_StopStreaming() was called meanwhile
+static bool waitForReconnect(WRC_Stream* ctx)
 {
-	// basically, we wanna clear everything except for the URL and the user supplied callbacks
-	if(ctx->curl != NULL)
+	uint64_t now = WRC__timeMs();
+	while(!ctx->userAbort && now < ctx->reconnectAt)
 	{
-		curl_easy_cleanup(ctx->curl);
-		ctx->curl = NULL;
+		uint64_t remaining = ctx->reconnectAt - now;
+		WRC__sleepMs(remaining < WRC__FLOW_CHECK_MS ? (int)remaining : WRC__FLOW_CHECK_MS);
+		now = WRC__timeMs();
+	}
+	ctx->reconnectPending = false;
+	return !ctx->userAbort;
+}
 
-		// the header are already taken care of in execCurlRequest()
+static bool execCurlRequest(WRC_Stream* ctx)
+{
+	enum WRC__TRANSFER_RESULT res = WRC__finishTransfer(ctx, curl_easy_perform(ctx->curl));
+	while(res == WRC__TRANSFER_RESTART || res == WRC__TRANSFER_RECONNECT)
+	{
+		if(res == WRC__TRANSFER_RECONNECT && !waitForReconnect(ctx))
+		{
+			res = WRC__finishTransfer(ctx, CURLE_ABORTED_BY_CALLBACK);
+			break;
+		}
+		res = WRC__finishTransfer(ctx, curl_easy_perform(ctx->curl));
 	}
-	ctx->contentType = WRC_CONTENT_UNKNOWN;
-	WRC_CTX_FREE(contentTypeHeaderVal);
 
-	if(ctx->shutdown != NULL)
+	if(res == WRC__TRANSFER_HLS)
 	{
-		ctx->shutdown(ctx);
-		ctx->shutdown = NULL;
+		return WRC__runHls(ctx);
 	}
+	return res == WRC__TRANSFER_OK;
+}
+
+#define WRC_CTX_FREE(x) free(ctx->x); ctx->x = NULL;
+
+// clears everything we got from the server over the current connection,
+// but not the decoder state
+void WRC__resetConnection(WRC_Stream* ctx)
+{
+	WRC_CTX_FREE(contentTypeHeaderVal);
 
 	ctx->streamState = WRC__STREAM_FRESH;
 
+	if(ctx->flowPaused)
+	{
+		ctx->flowPaused = false;
+		ctx->flowPausedMs += WRC__timeMs() - ctx->flowPauseStart;
+	}
+
 	memset(ctx->headerBuf, 0, sizeof(ctx->headerBuf));
 	ctx->headerBufAfterEndIdx = 0;
 
 	ctx->icyMetaInt = 0;
+	ctx->icyBitrate = 0;
 	memset(ctx->icyMetadata, 0, sizeof(ctx->icyMetadata));
-	ctx->icyMetadataIdx = 0;
 	ctx->icyMetaBytesMissing = 0;
 	ctx->icyMetaBytesWritten = 0;
 	ctx->dataReadSinceLastIcyMeta = 0;
 
-	ctx->sampleRate = 44100;
-	ctx->numChannels = 2;
-
 	WRC_CTX_FREE(icyName);
 	WRC_CTX_FREE(icyGenre);
 	WRC_CTX_FREE(icyURL);
 	WRC_CTX_FREE(icyDescription);
+}
+
+static void resetStreamIntern(WRC_Stream* ctx)
+{
+	// basically, we wanna clear everything except for the URL and the user supplied callbacks
+	WRC__stopStandby(ctx);
+	WRC__stopRace(ctx);
+	WRC__stopHls(ctx);
+	if(ctx->curl != NULL)
+	{
+		curl_easy_cleanup(ctx->curl);
+		ctx->curl = NULL;
+
+		// the header are already taken care of in execCurlRequest()
+	}
+	// the decoder thread might still be using the decoder, so stop it before shutting that down.
+	// unless the user aborted (or there was an error), it decodes all data received until now.
+	WRC__stopDecoderThread(ctx, ctx->userAbort || ctx->streamState >= WRC__STREAM_ABORT_GRACEFULLY);
+	// same for the samples in the jitter buffer
+	WRC__stopPcmBuffer(ctx, ctx->userAbort || ctx->streamState >= WRC__STREAM_ABORT_GRACEFULLY);
+	WRC__flushBlocks(ctx, ctx->userAbort || ctx->streamState >= WRC__STREAM_ABORT_GRACEFULLY);
+
+	ctx->contentType = WRC_CONTENT_UNKNOWN;
+
+	if(ctx->shutdown != NULL)
+	{
+		ctx->shutdown(ctx);
+		ctx->shutdown = NULL;
+		ctx->discardInput = NULL;
+	}
+
+	WRC__resetConnection(ctx);
+	WRC__resetReconnect(ctx);
+	WRC__resetResampler(ctx);
+	WRC__resetDrift(ctx);
+
+	ctx->sampleRate = 44100;
+	ctx->numChannels = 2;
 
 	ctx->decode = NULL;
+	ctx->ingest = NULL;
+	ctx->ingestBuffer = NULL;
+	ctx->ingestWrote = NULL;
 
 	// the rest is userdata, which can remain as it is
 }
@@ -764,6 +1088,34 @@ static void resetStream(WRC_Stream* ctx)
 {
 	resetStreamIntern(ctx);
 	ctx->userAbort = false;
+	ctx->resolvedPlaylist = false;
+	WRC__resetPlaylist(ctx);
+	WRC__endResolve(ctx);
+}
+
+// transferOK is the result of execCurlRequest() or the last WRC__finishTransfer()
+// returns what WRC_StartStreaming() is documented to return
+int WRC__finishStreaming(WRC_Stream* ctx, bool transferOK)
+{
+	int ret = transferOK;
+	if((ctx->userAbort) || (ctx->streamState == WRC__STREAM_ABORT_GRACEFULLY))
+	{
+		// transferOK might be false even if we tried to shut down gracefully - after all,
+		// curl assumes an error when the callback returns 0..
+		ret = 1;
+	}
+
+	if(ctx->probe != NULL)
+	{
+		WRC__probeFinish(ctx);
+	}
+
+	// also clear userAbort etc, so the stream can be started again
+	resetStream(ctx);
+	// after the rest of the samples
+	WRC__shmEnd(ctx);
+
+	return ret;
 }
 
 
@@ -783,6 +1135,10 @@ int WRC_Init()
 		return 0;
 	}
 #endif // WRC_MP3
+	WRC__initPcmConv();
+	initShare();
+	WRC__initResolveCache();
+	WRC__initStreamGroups();
 	return 1;
 }
 
@@ -790,6 +1146,9 @@ int WRC_Init()
 // or before shutting down your application
 void WRC_Shutdown()
 {
+	cleanupShare();
+	WRC__cleanupResolveCache();
+	WRC__cleanupStreamGroups();
 #ifdef WRC_MP3
 	mpg123_exit();
 #endif // WRC_MP3
@@ -862,6 +1221,18 @@ void WRC_SetMetadataCallbacks(WRC_Stream* stream, WRC_stationInfoCB stationInfoF
 	stream->currentTitleCB = currentTitleFn;
 }
 
+int WRC_SetMetadataOnly(WRC_Stream* stream, int enabled)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetMetadataOnly(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	stream->metadataOnly = (enabled != 0);
+	return 1;
+}
+
 // If you set this callback, unrecoverable errors will be reported to you via reportErrorFn.
 void WRC_SetErrorReportingCallback(WRC_Stream* stream, WRC_reportErrorCB reportErrorFn)
 {
@@ -876,25 +1247,41 @@ void WRC_SetErrorReportingCallback(WRC_Stream* stream, WRC_reportErrorCB reportE
 // Returns 1 if there was no error and streaming stopped only because you called
 //   WRC_StopStreaming(). After that you may call WRC_StartStreaming() with the same
 //   stream again to connect to the same server again and start streaming again.
+// If the stream was prefetched with WRC_Prefetch(), it starts playing right away.
 int WRC_StartStreaming(WRC_Stream* stream)
 {
-	if(!prepareCURL(stream))
+	if(stream->warm.pool != NULL)
 	{
+		// prefetched with WRC_Prefetch(), keeps streaming in the pool's thread
+		bool started = false;
+		int ret = WRC__startWarmStream(stream, &started);
+		if(started)
+		{
+			return ret;
+		}
+		// it failed or was evicted before, so start it normally
+	}
+
+	if(stream->group != NULL || stream->curl != NULL)
+	{
+		eprintf("WRC_StartStreaming(): stream is already streaming!\n");
 		return 0;
 	}
 
-	int ret = execCurlRequest(stream);
+	if(stream->standby.enabled || stream->race.numParallel > 1)
+	{
+		// the standby connection and racing mirrors need a curl multi handle
+		return WRC__streamInPrivateGroup(stream);
+	}
 
-	if((stream->userAbort) || (stream->streamState == WRC__STREAM_ABORT_GRACEFULLY))
+	if(!prepareCURL(stream))
 	{
-		// ret might be 0 even if we tried to shut down gracefully - after all,
-		// curl assumes an error when the callback returns 0..
-		return 1;
+		return 0;
 	}
 
-	resetStream(stream);
+	bool ok = execCurlRequest(stream);
 
-	return ret;
+	return WRC__finishStreaming(stream, ok);
 }
 
 // Stop the current stream by disconnecting from the server.
@@ -903,7 +1290,11 @@ void WRC_StopStreaming(WRC_Stream* stream)
 {
 	if(!stream->userAbort)
 	{
-		stream->userAbort = true;
+		// may be called from another thread, while the group's thread detaches the stream
+		if(!WRC__stopGroupStream(stream))
+		{
+			stream->userAbort = true;
+		}
 	}
 }
 
@@ -912,7 +1303,88 @@ void WRC_CleanupStream(WRC_Stream* stream)
 {
 	if(stream != NULL)
 	{
+		if(stream->async != NULL)
+		{
+			WRC__abortAsyncStream(stream);
+		}
+		if(stream->warm.pool != NULL)
+		{
+			WRC__cancelWarmStream(stream);
+		}
 		resetStream(stream);
+		WRC__cleanupDecoderThread(stream);
+		WRC__cleanupPcmBuffer(stream);
+		WRC__cleanupResampler(stream);
+		WRC__cleanupStandby(stream);
+		WRC__cleanupBlocks(stream);
+		WRC__cleanupShm(stream);
 		free(stream);
 	}
 }
+
+// Fills stats with the current statistics of the stream.
+void WRC_GetStreamStats(WRC_Stream* stream, WRC_StreamStats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	stats->decoderRingSize = stream->decThread.ring.size;
+	stats->decoderRingHighWater = stream->decThread.ringHighWater;
+	stats->decoderRingStalls = stream->decThread.producerStalls;
+
+	struct WRC__PcmBuffer* pb = &stream->pcmBuf;
+	if(pb->running)
+	{
+		stats->jitterBufferMs = WRC__pcmBufferedMs(stream);
+	}
+	stats->jitterBufferUnderruns = pb->underruns;
+	stats->jitterBufferStalledMs = pb->stalledMs;
+
+	stats->reconnects = stream->reconnects;
+	stats->reconnectAttempts = stream->reconnectAttempts;
+	stats->lastRecoveryMs = stream->lastRecoveryMs;
+
+	stats->flowPauses = stream->flowPauses;
+	stats->flowPausedMs = stream->flowPausedMs;
+	if(stream->flowPaused)
+	{
+		stats->flowPausedMs += WRC__timeMs() - stream->flowPauseStart;
+	}
+
+	stats->failovers = stream->standby.failovers;
+	stats->lastFailoverMs = stream->standby.lastFailoverMs;
+
+	stats->hlsSegments = stream->hls.segments;
+	stats->hlsSegmentRetries = stream->hls.segmentRetries;
+	stats->hlsPrefetched = stream->hls.prefetched;
+	stats->hlsLastSegmentMs = stream->hls.lastSegmentMs;
+	stats->hlsAvgSegmentMs = stream->hls.avgSegmentMs;
+
+	stats->outputDroppedFrames = stream->droppedFrames;
+
+	stats->driftPpm = stream->drift.estimatePpm;
+	stats->driftCorrectionPpm = stream->drift.correctionPpm;
+	stats->driftBufferMs = (stream->drift.smoothedMs >= 0.0) ? (int)stream->drift.smoothedMs : 0;
+}
+
+// Pauses receiving data while the consumer has more than highMs milliseconds of
+// audio queued, until it has less than lowMs.
+int WRC_SetFlowControl(WRC_Stream* stream, int highMs, int lowMs, WRC_queuedMsCB queuedFn)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetFlowControl(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(highMs > 0 && (lowMs < 0 || lowMs >= highMs))
+	{
+		eprintf("WRC_SetFlowControl(): lowMs must be between 0 and highMs!\n");
+		return 0;
+	}
+
+	stream->flowHighMs = (highMs > 0) ? highMs : 0;
+	stream->flowLowMs = lowMs;
+	stream->queuedMsCB = queuedFn;
+
+	return 1;
+}
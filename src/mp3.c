@@ -22,11 +22,21 @@ static void shutdownMP3(WRC_Stream* ctx)
 	}
 }
 
+// opening the feed again drops what mpg123 buffered, the output format stays
+static void discardInputMP3(WRC_Stream* ctx)
+{
+	if(ctx->handle != NULL)
+	{
+		mpg123_open_feed(ctx->handle);
+	}
+}
+
 static bool initMP3(WRC_Stream* ctx)
 {
 	mpg123_handle* h = mpg123_new(NULL, NULL);
 	ctx->handle = h;
 	ctx->shutdown = shutdownMP3;
+	ctx->discardInput = discardInputMP3;
 
 	if(h == NULL)
 	{
@@ -34,66 +44,137 @@ static bool initMP3(WRC_Stream* ctx)
 		return false;
 	}
 
+	// decode right to the output format of WRC_SetOutputFormat() (or float for the resampler)
+	int encoding = MPG123_ENC_SIGNED_16;
+	int format = WRC__decodeFormat(ctx);
+	if(format == WRC_FMT_S32)
+		encoding = MPG123_ENC_SIGNED_32;
+	else if(format == WRC_FMT_F32)
+		encoding = MPG123_ENC_FLOAT_32;
+
+	// allow all samplerates and mono, so mpg123 doesn't need to resample or
+	// duplicate the channel (mono needs half the work)
+	const long* rates;
+	size_t numRates;
+	mpg123_rates(&rates, &numRates);
+
 	mpg123_format_none(h);
-	if(mpg123_format(h, 44100, MPG123_STEREO, MPG123_ENC_SIGNED_16) != MPG123_OK)
+	for(size_t i=0; i < numRates; ++i)
 	{
-		eprintf("setting ouput format for mpg123 failed!\n");
-		return false;
+		if(mpg123_format(h, rates[i], MPG123_MONO | MPG123_STEREO, encoding) != MPG123_OK)
+		{
+			eprintf("setting ouput format for mpg123 failed!\n");
+			return false;
+		}
 	}
 
-	ctx->numChannels = 2;
-	ctx->sampleRate = 44100;
+	// these are set by WRC__decodeMP3() once the first frame has been parsed
+	ctx->sampleRate = 0;
+	ctx->numChannels = 0;
 
-	if(!ctx->initAudioCB(ctx->userdata, ctx->sampleRate, ctx->numChannels))
-	{
-		WRC__errorReset(ctx, WRC_ERR_INIT_AUDIO_FAILED,
-				"calling initAudioCB(userdata, %d, %d) failed - samplerate/numchannels not supported?!",
-				ctx->sampleRate, ctx->numChannels);
+	mpg123_open_feed(h);
 
-		return false;
+	return true;
+}
+
+// called when mpg123 parsed the first frame or the format changed
+static bool handleNewFormat(WRC_Stream* ctx)
+{
+	long rate;
+	int channels, encoding;
+	if(mpg123_getformat(ctx->handle, &rate, &channels, &encoding) != MPG123_OK)
+	{
+		eprintf("mpg123_getformat failed: %s\n", mpg123_strerror(ctx->handle));
+		return true;
 	}
 
-	mpg123_open_feed(h);
+	// after a reconnect it's usually the same as before
+	if(rate != ctx->sampleRate || channels != ctx->numChannels)
+	{
+		ctx->sampleRate = rate;
+		ctx->numChannels = channels;
 
+		// re-initialize audio backend for new sampleRate/numChannels
+		if(!WRC__initAudio(ctx))
+		{
+			return false;
+		}
+	}
 	return true;
 }
 
-bool WRC__decodeMP3(WRC_Stream* ctx, void* data, size_t size)
+bool WRC__ingestMP3(WRC_Stream* ctx, const void* data, size_t size)
 {
-	unsigned char decBuf[WRC__decBufSize*sizeof(int16_t)];
-
 	if(ctx->handle == NULL && !initMP3(ctx))
 	{
 		return false;
 	}
 
-	if(size == 0)
+	if(size != 0 && mpg123_feed(ctx->handle, data, size) != MPG123_OK)
 	{
-		return true;
+		// it only fails if it's out of memory
+		WRC__errorReset(ctx, WRC_ERR_GENERIC, "mpg123_feed failed: %s", mpg123_strerror(ctx->handle));
+		return false;
 	}
 
-	size_t decSize=0;
-	int mRet = mpg123_decode(ctx->handle, data, size, decBuf, sizeof(decBuf), &decSize);
-	if(mRet == MPG123_ERR)
-	{
-		eprintf("mpg123_decode failed: %s\n", mpg123_strerror(ctx->handle)); // TODO: remove
-		return true; // TODO: is there any chance the next try will succeed?
-	}
+	return true;
+}
+
+bool WRC__decodeMP3(WRC_Stream* ctx, void* data, size_t size)
+{
+	union WRC__SampleBuf decBuf;
+	size_t sampleSize = WRC__sampleSize(WRC__decodeFormat(ctx));
 
-	if(decSize != 0)
+	if(!WRC__ingestMP3(ctx, data, size))
 	{
-		ctx->playbackCB(ctx->userdata, (int16_t*)decBuf, decSize/sizeof(int16_t));
+		return false;
 	}
 
-	while(mRet != MPG123_ERR && mRet != MPG123_NEED_MORE)
+	size_t decSize=0;
+	int mRet;
+	do
 	{
-		// get as much decoded audio as available from last feed
-		mRet = mpg123_decode(ctx->handle, NULL, 0, decBuf, sizeof(decBuf), &decSize);
-		if(decSize != 0)
+		unsigned char* out = (unsigned char*)&decBuf;
+		size_t outSize = WRC__decBufSize*sampleSize;
+		size_t frameSize = ctx->numChannels*sampleSize; // 0 until the format is known
+
+		// with WRC_SetOutputProvider() or WRC_SetSharedMemorySink() decode right into the user's memory
+		bool direct = false;
+		if(frameSize != 0 && WRC__directOutput(ctx))
 		{
-			ctx->playbackCB(ctx->userdata, (int16_t*)decBuf, decSize/sizeof(int16_t));
+			size_t numFrames;
+			void* dst = WRC__acquireOutput(ctx, outSize/frameSize, &numFrames);
+			if(dst != NULL)
+			{
+				out = dst;
+				outSize = numFrames*frameSize;
+				direct = true;
+			}
 		}
-	}
+
+		// get as much decoded audio as available from what was fed
+		mRet = mpg123_decode(ctx->handle, NULL, 0, out, outSize, &decSize);
+		if(direct)
+		{
+			// also if nothing was decoded, so acquire and commit are always called in pairs
+			WRC__commitOutput(ctx, out, decSize/frameSize);
+			decSize = 0;
+		}
+
+		if(mRet == MPG123_ERR)
+		{
+			eprintf("mpg123_decode failed: %s\n", mpg123_strerror(ctx->handle)); // TODO: remove
+			return true; // TODO: is there any chance the next try will succeed?
+		}
+		if(mRet == MPG123_NEW_FORMAT && !handleNewFormat(ctx))
+		{
+			return false;
+		}
+		if(decSize != 0 && !WRC__sendSamples(ctx, &decBuf, decSize/sampleSize))
+		{
+			return false;
+		}
+	} while(mRet != MPG123_NEED_MORE);
 
 	/*
 	struct mpg123_frameinfo fi;
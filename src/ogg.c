@@ -12,6 +12,15 @@
 
 #ifdef WRC_OGG
 
+// frees the decoder state of the current logical stream (vorbis_synthesis_init() and
+// vorbis_block_init()). also fine if they weren't called, e.g. for WRC_SetMetadataOnly(),
+// they only free what's set and zero the structs
+static void clearDecoder(WRC_Stream* ctx)
+{
+	vorbis_block_clear(&ctx->ogg.vb);
+	vorbis_dsp_clear(&ctx->ogg.vd);
+}
+
 static void shutdownOGG(WRC_Stream* ctx)
 {
 	enum WRC__OGG_DECODE_STATE state = ctx->ogg.state;
@@ -23,6 +32,7 @@ static void shutdownOGG(WRC_Stream* ctx)
 
 	if(state == WRC_OGGDEC_STREAMDEC)
 	{
+		clearDecoder(ctx);
 		ogg_stream_clear(&ctx->ogg.os);
 	}
 	if(state > WRC_OGGDEC_COMMENT)
@@ -41,6 +51,17 @@ static void shutdownOGG(WRC_Stream* ctx)
 	memset(&ctx->ogg, 0, sizeof(struct WRC__oggVorbisContext));
 }
 
+// drops the part of a page in oy, the logical stream and the decoder stay
+// (libogg notices the missing pages)
+static void discardInputOGG(WRC_Stream* ctx)
+{
+	if(ctx->ogg.state != WRC_OGGDEC_PREINIT)
+	{
+		ogg_sync_reset(&ctx->ogg.oy);
+		ctx->ogg.haveFirstPage = false;
+	}
+}
+
 static bool initOGG(WRC_Stream* ctx)
 {
 	ogg_sync_init(&ctx->ogg.oy);
@@ -48,6 +69,7 @@ static bool initOGG(WRC_Stream* ctx)
 	ctx->ogg.state = WRC_OGGDEC_VORBISINFO;
 
 	ctx->shutdown = shutdownOGG;
+	ctx->discardInput = discardInputOGG;
 
 	// these must be set by WRC__decodeOGG()
 	ctx->sampleRate = 0;
@@ -58,42 +80,33 @@ static bool initOGG(WRC_Stream* ctx)
 
 static void sendCurrentTitleToUser(WRC_Stream* ctx, const char* artist, const char* title)
 {
-	if(ctx->currentTitleCB != NULL)
+	if(artist == NULL)
 	{
-		if(artist == NULL)
+		if(title == NULL)
 		{
-			if(title == NULL)
-			{
-				ctx->currentTitleCB(ctx->userdata, "???");
-			}
-			else
-			{
-				ctx->currentTitleCB(ctx->userdata, title);
-			}
-		}
-		else if(title == NULL)
-		{
-			title = "Unknown Title";
-			ctx->currentTitleCB(ctx->userdata, artist);
+			WRC__sendTitle(ctx, "???");
 		}
 		else
 		{
-			char buf[512];
-			WRC__snprintf(buf, sizeof(buf), "%s - %s", artist, title);
-			ctx->currentTitleCB(ctx->userdata, buf);
+			WRC__sendTitle(ctx, title);
 		}
 	}
-}
-
-bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
-{
-	if(size == 0) return true;
-
-	if(ctx->ogg.state == WRC_OGGDEC_PREINIT)
+	else if(title == NULL)
 	{
-		initOGG(ctx);
+		title = "Unknown Title";
+		WRC__sendTitle(ctx, artist);
 	}
+	else
+	{
+		char buf[512];
+		WRC__snprintf(buf, sizeof(buf), "%s - %s", artist, title);
+		WRC__sendTitle(ctx, buf);
+	}
+}
 
+// decodes as much as possible of the data in ctx->ogg.oy
+static bool decodePages(WRC_Stream* ctx)
+{
 	// these variable names are not very descriptive..
 	// but at least consistent with documentation (API docs + examples)
 	ogg_sync_state*   oy = &ctx->ogg.oy;
@@ -106,22 +119,18 @@ bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
 	vorbis_dsp_state* vd = &ctx->ogg.vd;
 	vorbis_block*     vb = &ctx->ogg.vb;
 
-
-	// whatever OGG_DECODE_STATE we're in, first add the current data to the internal buffer
-	char* buffer = ogg_sync_buffer(oy, size);
-	memcpy(buffer, data, size);
-	ogg_sync_wrote(oy, size);
-
 	// decode the first ogg-vorbis header: "vorbis stream initial header"
 	// from the first page that's transmitted
 	if(ctx->ogg.state == WRC_OGGDEC_VORBISINFO)
 	{
 		// get the first page, should contain the "vorbis stream initial header"
-		if(ogg_sync_pageout(oy, og) != 1)
+		// (unless the STREAMDEC state below already got it)
+		if(!ctx->ogg.haveFirstPage && ogg_sync_pageout(oy, og) != 1)
 		{
 			// data for page missing, try again with more data later
 			return true;
 		}
+		ctx->ogg.haveFirstPage = false;
 
 		// set up a logical stream with the serialno
 		ogg_stream_init(os, ogg_page_serialno(og));
@@ -216,12 +225,8 @@ bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
 				ctx->ogg.maxBufSamplesPerChan = WRC__decBufSize/vi->channels;
 
 				// re-initialize audio backend for new sampleRate/numChannels
-				if(!ctx->initAudioCB(ctx->userdata, ctx->sampleRate, ctx->numChannels))
+				if(!WRC__initAudio(ctx))
 				{
-					WRC__errorReset(ctx, WRC_ERR_INIT_AUDIO_FAILED,
-							"calling initAudioCB(userdata, %d, %d) failed - samplerate/numchannels not supported?!",
-							ctx->sampleRate, ctx->numChannels);
-
 					return false;
 				}
 			}
@@ -233,7 +238,6 @@ bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
 	if(ctx->ogg.state == WRC_OGGDEC_STREAMDEC)
 	{
 		bool eos = false;
-		ogg_int16_t decBuf[WRC__decBufSize];
 
 		// this loop iterates the pages in the current buffer/ogg_sync_state (oy)
 		while(!eos)
@@ -251,6 +255,28 @@ bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
 				continue;
 			}
 
+			if(ogg_page_serialno(og) != os->serialno)
+			{
+				if(!ogg_page_bos(og))
+				{
+					// belongs to a logical stream we're not decoding
+					continue;
+				}
+
+				// a new stream starts before the old one ended, e.g. after
+				// a reconnect (see reconnect.c) => continue with its headers
+				clearDecoder(ctx);
+				ogg_stream_clear(os);
+				vorbis_comment_clear(vc);
+				vorbis_info_clear(vi);
+
+				ctx->ogg.state = WRC_OGGDEC_VORBISINFO;
+				ctx->ogg.haveFirstPage = true;
+
+				// og points into oy's buffer, so it must be used before more data is added
+				return decodePages(ctx);
+			}
+
 			ogg_stream_pagein(os, og);
 
 			// this loop iterates the packets of the current page
@@ -288,37 +314,11 @@ bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
 				while( (samples = vorbis_synthesis_pcmout(vd, &pcm)) > 0 )
 				{
 					int numOutSamples = WRC__min(samples, ctx->ogg.maxBufSamplesPerChan);
-					int numChannels = ctx->numChannels;
 
-					// convert floats to 16bit signed ints and interleave
-					for(int chanIdx=0; chanIdx < numChannels; ++chanIdx)
+					// converts the floats to the output format (usually 16bit signed ints) and interleaves them
+					if(!WRC__sendFloatSamples(ctx, pcm, numOutSamples))
 					{
-						float* curChan = pcm[chanIdx];
-						ogg_int16_t* curOutSample = decBuf + chanIdx;
-
-						for(int sampleIdx=0; sampleIdx < numOutSamples; ++sampleIdx)
-						{
-							//int sample = floorf(curChan[sampleIdx]*32767.0f + 0.5f);
-							int sample = (curChan[sampleIdx]*32767.0f + 0.5f);
-
-							// prevent int overflows aka clipping
-							if(sample < -32768) // INT16_MIN
-							{
-								sample = -32768;
-							}
-							else if(sample > 32767) // INT16_MAX
-							{
-								sample = 32767;
-							}
-
-							*curOutSample = sample;
-							curOutSample += numChannels;
-						}
-					}
-
-					if(ctx->playbackCB != NULL)
-					{
-						ctx->playbackCB(ctx->userdata, decBuf, numOutSamples*numChannels);
+						return false;
 					}
 
 					// inform the vorbis decoder how many samples from last
@@ -340,6 +340,7 @@ bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
 				ctx->ogg.state = WRC_OGGDEC_VORBISINFO;
 
 				// clear the current stream and metadata, it'll be replaced
+				clearDecoder(ctx);
 				ogg_stream_clear(os);
 				vorbis_comment_clear(vc);
 				vorbis_info_clear(vi);  // decoder_example.c says, this must be called last
@@ -351,4 +352,154 @@ bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
 	return true;
 }
 
+// like decodePages(), but for WRC_SetMetadataOnly(): only the identification and the
+// comment header of each logical stream are parsed (for the title), the setup header
+// and the audio packets are skipped without even assembling them from the pages
+static bool parseMetadataPages(WRC_Stream* ctx)
+{
+	ogg_sync_state*   oy = &ctx->ogg.oy;
+	ogg_page*         og = &ctx->ogg.og;
+	ogg_stream_state* os = &ctx->ogg.os;
+	ogg_packet*       op = &ctx->ogg.op;
+
+	vorbis_info*      vi = &ctx->ogg.vi;
+	vorbis_comment*   vc = &ctx->ogg.vc;
+
+	for(;;)
+	{
+		if(!ctx->ogg.haveFirstPage)
+		{
+			int res = ogg_sync_pageout(oy, og);
+			if(res == 0)
+			{
+				return true; // more data is needed for the page, try again later
+			}
+			if(res < 0)
+			{
+				continue; // missing or corrupt data, try the next page
+			}
+		}
+		ctx->ogg.haveFirstPage = false;
+
+		if(ctx->ogg.state == WRC_OGGDEC_VORBISINFO)
+		{
+			ogg_stream_init(os, ogg_page_serialno(og));
+			vorbis_info_init(vi);
+			vorbis_comment_init(vc);
+			// ogg_stream_clear() and vorbis_*_clear() are called for this state by shutdownOGG()
+			ctx->ogg.state = WRC_OGGDEC_STREAMDEC;
+			ctx->ogg.numHeaders = 0;
+		}
+		else if(ogg_page_serialno(og) != os->serialno)
+		{
+			if(!ogg_page_bos(og))
+			{
+				// belongs to a logical stream we're not interested in
+				continue;
+			}
+			// a new stream starts, e.g. after a reconnect
+			ogg_stream_clear(os);
+			vorbis_comment_clear(vc);
+			vorbis_info_clear(vi);
+			ctx->ogg.state = WRC_OGGDEC_VORBISINFO;
+			ctx->ogg.haveFirstPage = true;
+			continue;
+		}
+
+		// the first two headers are usually on the first two pages, after them there's
+		// nothing more to parse until the stream ends
+		if(ctx->ogg.numHeaders < 2)
+		{
+			ogg_stream_pagein(os, og);
+			while(ctx->ogg.numHeaders < 2)
+			{
+				int res = ogg_stream_packetout(os, op);
+				if(res == 0)
+					break;
+				if(res < 0 || vorbis_synthesis_headerin(vi, vc, op) < 0)
+				{
+					WRC__errorReset(ctx, WRC_ERR_CORRUPT_STREAM, "Corrupt Vorbis comment or info header!");
+					return false;
+				}
+				if(++ctx->ogg.numHeaders == 2)
+				{
+					sendCurrentTitleToUser(ctx, vorbis_comment_query(vc, "ARTIST", 0),
+					                       vorbis_comment_query(vc, "TITLE", 0));
+				}
+			}
+		}
+
+		if(ogg_page_eos(og))
+		{
+			// the next track comes with its own headers
+			ogg_stream_clear(os);
+			vorbis_comment_clear(vc);
+			vorbis_info_clear(vi);
+			ctx->ogg.state = WRC_OGGDEC_VORBISINFO;
+		}
+	}
+}
+
+bool WRC__decodeOGGMetadata(WRC_Stream* ctx, void* data, size_t size)
+{
+	WRC__ingestOGG(ctx, data, size);
+
+	if(ctx->ogg.state == WRC_OGGDEC_PREINIT)
+	{
+		// no data yet
+		return true;
+	}
+
+	return parseMetadataPages(ctx);
+}
+
+char* WRC__ingestBufferOGG(WRC_Stream* ctx, size_t size)
+{
+	if(ctx->ogg.state == WRC_OGGDEC_PREINIT)
+	{
+		initOGG(ctx);
+	}
+
+	// whatever OGG_DECODE_STATE we're in, the data is added to the internal buffer
+	char* buffer = ogg_sync_buffer(&ctx->ogg.oy, size);
+	if(buffer == NULL)
+	{
+		WRC__errorReset(ctx, WRC_ERR_GENERIC, "Out of Memory!");
+	}
+	return buffer;
+}
+
+void WRC__ingestWroteOGG(WRC_Stream* ctx, size_t size)
+{
+	ogg_sync_wrote(&ctx->ogg.oy, size);
+}
+
+bool WRC__ingestOGG(WRC_Stream* ctx, const void* data, size_t size)
+{
+	if(size == 0) return true;
+
+	char* buffer = WRC__ingestBufferOGG(ctx, size);
+	if(buffer == NULL)
+	{
+		return false;
+	}
+	memcpy(buffer, data, size);
+	WRC__ingestWroteOGG(ctx, size);
+
+	return true;
+}
+
+bool WRC__decodeOGG(WRC_Stream* ctx, void* data, size_t size)
+{
+	WRC__ingestOGG(ctx, data, size);
+
+	if(ctx->ogg.state == WRC_OGGDEC_PREINIT)
+	{
+		// no data yet
+		return true;
+	}
+
+	return decodePages(ctx);
+}
+
 #endif // WRC_OGG
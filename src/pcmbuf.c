@@ -0,0 +1,919 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// optional jitter buffer for the decoded audio (see WRC_SetJitterBuffer()):
+// the decoders put their samples into a ring and a playout thread passes them
+// to playbackCB at the pace of the samplerate, so the user doesn't get the
+// network's hiccups. After an underrun it waits for the buffer to fill up again.
+// In pull mode (see WRC_SetPullMode()) there is no playout thread, the user
+// reads from the ring with WRC_ReadSamples() instead.
+
+#include "internal.h"
+
+// the playout thread wakes up this often to pass the samples that are due to playbackCB
+#define WRC__PLAYOUT_INTERVAL_MS 10
+// and passes the samples of this many milliseconds in advance, so the user's
+// audio device doesn't run dry between two wakeups
+#define WRC__PLAYOUT_LEAD_MS 20
+
+// how long to sleep at most when waiting for the other thread (see decthread.c)
+#define WRC__PCM_BUFFER_WAIT_MS 100
+// in pull mode WRC_ReadSamples() doesn't wake up the decoder (so it never takes a lock),
+// so the decoder checks this often if there is free space in the ring again
+#define WRC__PCM_PULL_POLL_MS 5
+
+// in pull mode the ring is allocated once (WRC_ReadSamples() might be reading from it
+// at any time), big enough for maxMs of audio in this format
+#define WRC__PCM_PULL_RATE 48000
+#define WRC__PCM_PULL_CHANNELS 2
+
+static size_t msToBytes(int ms, int sampleRate, int numChannels, size_t sampleSize)
+{
+	return (size_t)((uint64_t)ms * sampleRate / 1000) * numChannels * sampleSize;
+}
+
+bool WRC__directOutput(WRC_Stream* ctx)
+{
+	return (ctx->acquireOutputCB != NULL || ctx->shm.hdr != NULL) && !ctx->pcmBuf.enabled
+	       && !ctx->resampler.enabled && !ctx->blocks.enabled;
+}
+
+void* WRC__acquireOutput(WRC_Stream* ctx, size_t maxFrames, size_t* numFrames)
+{
+	if(ctx->shm.hdr != NULL)
+	{
+		return WRC__shmAcquire(ctx, maxFrames, numFrames);
+	}
+
+	*numFrames = 0;
+	void* ret = ctx->acquireOutputCB(ctx->userdata, maxFrames, numFrames);
+	if(ret == NULL || *numFrames == 0)
+	{
+		return NULL;
+	}
+	if(*numFrames > maxFrames)
+	{
+		*numFrames = maxFrames;
+	}
+	return ret;
+}
+
+void WRC__commitOutput(WRC_Stream* ctx, void* data, size_t numFrames)
+{
+	if(ctx->shm.hdr != NULL)
+	{
+		WRC__shmCommit(ctx, numFrames);
+		return;
+	}
+	ctx->commitOutputCB(ctx->userdata, data, numFrames);
+}
+
+// writes numFrames frames to the memory of WRC_SetOutputProvider() (or the shared
+// memory sink), either converted
+// from planar floats or copied from interleaved samples in the output format
+static void writeToProvider(WRC_Stream* ctx, float** planar, const void* interleaved,
+                            size_t numFrames, int numChannels)
+{
+	size_t frameSize = numChannels * WRC__sampleSize(ctx->outFormat);
+	size_t done = 0;
+
+	while(done < numFrames)
+	{
+		size_t n;
+		void* dst = WRC__acquireOutput(ctx, numFrames - done, &n);
+		if(dst == NULL)
+		{
+			// the user has no room, like a playbackCB that throws the samples away
+			ctx->droppedFrames += numFrames - done;
+			return;
+		}
+
+		if(planar != NULL)
+		{
+			float* src[WRC__MAX_CHANNELS];
+			for(int c=0; c < numChannels; ++c)
+				src[c] = planar[c] + done;
+
+			switch(ctx->outFormat)
+			{
+				case WRC_FMT_S32:
+					WRC__floatToInt32((int32_t*)dst, src, numChannels, (int)n);
+					break;
+				case WRC_FMT_F32:
+					WRC__interleaveFloat((float*)dst, src, numChannels, (int)n);
+					break;
+				default:
+					WRC__floatToInt16((int16_t*)dst, src, numChannels, (int)n);
+					break;
+			}
+		}
+		else
+		{
+			memcpy(dst, (const unsigned char*)interleaved + done * frameSize, n * frameSize);
+		}
+
+		WRC__commitOutput(ctx, dst, n);
+		done += n;
+	}
+}
+
+// passes numFrames interleaved frames in the output format to the user
+static void deliverSamples(WRC_Stream* ctx, void* samples, size_t numFrames, int numChannels)
+{
+	if(ctx->acquireOutputCB != NULL || ctx->shm.hdr != NULL)
+	{
+		writeToProvider(ctx, NULL, samples, numFrames, numChannels);
+		return;
+	}
+
+	if(ctx->playbackFmtCB == NULL)
+	{
+		ctx->playbackCB(ctx->userdata, (int16_t*)samples, numFrames * numChannels);
+		return;
+	}
+
+	if(!ctx->outPlanar || numChannels == 1)
+	{
+		ctx->playbackFmtCB(ctx->userdata, &samples, numFrames);
+		return;
+	}
+
+	// only blocks from WRC_SetCallbackBlockSize() can be bigger than WRC__decBufSize samples
+	union WRC__SampleBuf planarBuf;
+	unsigned char* planarMem = (unsigned char*)&planarBuf;
+	if(numFrames * numChannels > WRC__decBufSize)
+		planarMem = ctx->blocks.planar;
+
+	void* planes[WRC__MAX_CHANNELS];
+	size_t sampleSize = WRC__sampleSize(ctx->outFormat);
+	for(int i=0; i < numChannels; ++i)
+	{
+		planes[i] = planarMem + i * numFrames * sampleSize;
+	}
+
+	WRC__deinterleave(planes, samples, sampleSize, numChannels, numFrames);
+	ctx->playbackFmtCB(ctx->userdata, planes, numFrames);
+}
+
+static size_t blockFrames(WRC_Stream* ctx, int size)
+{
+	struct WRC__Blocks* b = &ctx->blocks;
+	size_t frames = b->inMs ? (size_t)((uint64_t)size * ctx->outRate / 1000) : (size_t)size;
+	return (frames > 0) ? frames : 1;
+}
+
+// makes sure the buffers have room for maxFrames frames of numChannels channels
+static bool allocBlocks(WRC_Stream* ctx, size_t maxFrames, int numChannels)
+{
+	struct WRC__Blocks* b = &ctx->blocks;
+	size_t size = maxFrames * numChannels * WRC__sampleSize(ctx->outFormat);
+
+	if(size > b->cap)
+	{
+		unsigned char* buf = realloc(b->buf, size);
+		if(buf == NULL)
+			return false;
+		b->buf = buf;
+
+		if(ctx->outPlanar)
+		{
+			unsigned char* planar = realloc(b->planar, size);
+			if(planar == NULL)
+				return false;
+			b->planar = planar;
+		}
+		b->cap = size;
+	}
+	return true;
+}
+
+// passes numFrames interleaved frames in the output format to the user,
+// in blocks of the size set with WRC_SetCallbackBlockSize()
+static void playSamples(WRC_Stream* ctx, void* samples, size_t numFrames, int numChannels)
+{
+	struct WRC__Blocks* b = &ctx->blocks;
+
+	if(!b->enabled)
+	{
+		deliverSamples(ctx, samples, numFrames, numChannels);
+		return;
+	}
+
+	size_t minFrames = blockFrames(ctx, b->minSize);
+	size_t maxFrames = blockFrames(ctx, b->maxSize);
+	if(maxFrames < minFrames)
+		maxFrames = minFrames;
+
+	if(!allocBlocks(ctx, maxFrames, numChannels))
+	{
+		// better unsuitable blocks than none at all
+		deliverSamples(ctx, samples, numFrames, numChannels);
+		return;
+	}
+
+	size_t frameSize = numChannels * WRC__sampleSize(ctx->outFormat);
+	const unsigned char* in = (const unsigned char*)samples;
+	b->numChannels = numChannels;
+
+	while(numFrames > 0)
+	{
+		if(b->frames == 0 && numFrames >= minFrames)
+		{
+			// big enough to be passed on without copying it
+			size_t n = (numFrames < maxFrames) ? numFrames : maxFrames;
+			deliverSamples(ctx, (void*)in, n, numChannels);
+			in += n * frameSize;
+			numFrames -= n;
+			continue;
+		}
+
+		size_t n = maxFrames - b->frames;
+		if(n > numFrames)
+			n = numFrames;
+		memcpy(b->buf + b->frames * frameSize, in, n * frameSize);
+		b->frames += n;
+		in += n * frameSize;
+		numFrames -= n;
+
+		if(b->frames >= minFrames)
+		{
+			deliverSamples(ctx, b->buf, b->frames, numChannels);
+			b->frames = 0;
+		}
+	}
+}
+
+void WRC__flushBlocks(WRC_Stream* ctx, bool abort)
+{
+	struct WRC__Blocks* b = &ctx->blocks;
+
+	if(b->frames > 0 && !abort)
+	{
+		deliverSamples(ctx, b->buf, b->frames, b->numChannels);
+	}
+	b->frames = 0;
+}
+
+static void playoutThreadFun(void* arg)
+{
+	WRC_Stream* ctx = (WRC_Stream*)arg;
+	struct WRC__PcmBuffer* pb = &ctx->pcmBuf;
+
+	int numChannels = pb->numChannels;
+	size_t frameSize = numChannels * pb->sampleSize;
+	union WRC__SampleBuf outBuf;
+	size_t maxFramesPerCall = WRC__decBufSize / numChannels;
+
+	bool prebuffering = true;
+	uint64_t stallStart = 0; // when the last underrun happened, 0 while prebuffering initially
+	uint64_t playStart = 0;
+	uint64_t framesPlayed = 0; // since playStart
+
+	for(;;)
+	{
+		if(prebuffering)
+		{
+			WRC__mutexLock(&pb->lock);
+			while(WRC__ringFill(&pb->ring) < pb->targetFill && !pb->producerDone && !pb->abort)
+			{
+				WRC__condWait(&pb->cond, &pb->lock, WRC__PCM_BUFFER_WAIT_MS);
+			}
+			bool done = pb->abort || (pb->producerDone && WRC__ringFill(&pb->ring) < frameSize);
+			WRC__mutexUnlock(&pb->lock);
+
+			if(done)
+				break;
+
+			prebuffering = false;
+			playStart = WRC__timeMs();
+			framesPlayed = 0;
+			if(stallStart != 0)
+			{
+				pb->stalledMs += playStart - stallStart;
+			}
+		}
+
+		uint64_t now = WRC__timeMs();
+		uint64_t framesDue = (now - playStart + WRC__PLAYOUT_LEAD_MS) * pb->sampleRate / 1000;
+
+		while(framesPlayed < framesDue)
+		{
+			size_t numFrames = WRC__ringFill(&pb->ring) / frameSize;
+			if(numFrames > framesDue - framesPlayed)
+				numFrames = framesDue - framesPlayed;
+			if(numFrames > maxFramesPerCall)
+				numFrames = maxFramesPerCall;
+
+			if(numFrames == 0)
+			{
+				WRC__mutexLock(&pb->lock);
+				bool producerDone = pb->producerDone;
+				WRC__mutexUnlock(&pb->lock);
+
+				if(!producerDone)
+				{
+					// the decoder didn't deliver in time
+					++pb->underruns;
+					stallStart = now;
+				}
+				// else the remaining samples have been played, the prebuffering loop above exits
+				prebuffering = true;
+				break;
+			}
+
+			WRC__ringRead(&pb->ring, &outBuf, numFrames * frameSize);
+			framesPlayed += numFrames;
+
+			playSamples(ctx, &outBuf, numFrames, numChannels);
+
+			WRC__mutexLock(&pb->lock);
+			WRC__condSignal(&pb->cond); // the producer might be waiting for free space
+			WRC__mutexUnlock(&pb->lock);
+		}
+
+		if(!prebuffering)
+		{
+			WRC__mutexLock(&pb->lock);
+			if(!pb->abort)
+			{
+				WRC__condWait(&pb->cond, &pb->lock, WRC__PLAYOUT_INTERVAL_MS);
+			}
+			bool abort = pb->abort;
+			WRC__mutexUnlock(&pb->lock);
+
+			if(abort)
+				break;
+		}
+	}
+
+	// the last (smaller) block
+	WRC__mutexLock(&pb->lock);
+	bool abort = pb->abort;
+	WRC__mutexUnlock(&pb->lock);
+	WRC__flushBlocks(ctx, abort);
+}
+
+static bool startPcmBuffer(WRC_Stream* ctx)
+{
+	struct WRC__PcmBuffer* pb = &ctx->pcmBuf;
+
+	pb->sampleRate = ctx->outRate;
+	pb->numChannels = ctx->outChannels;
+	pb->sampleSize = WRC__sampleSize(ctx->outFormat);
+
+	size_t frameSize = pb->numChannels * pb->sampleSize;
+	pb->targetFill = msToBytes(pb->targetMs, pb->sampleRate, pb->numChannels, pb->sampleSize);
+	pb->maxFill = msToBytes(pb->maxMs, pb->sampleRate, pb->numChannels, pb->sampleSize);
+	// the decoders pass up to WRC__decBufSize samples at once, that must fit in
+	// addition to the prebuffered samples
+	if(pb->maxFill < pb->targetFill + 2 * WRC__decBufSize * pb->sampleSize)
+		pb->maxFill = pb->targetFill + 2 * WRC__decBufSize * pb->sampleSize;
+
+	if(pb->pull)
+	{
+		// can't reallocate the ring, so this format gets less buffering
+		if(pb->maxFill > pb->ring.size)
+			pb->maxFill = pb->ring.size;
+		if(pb->targetFill > pb->maxFill / 2)
+			pb->targetFill = pb->maxFill / 2;
+	}
+	else if(pb->ring.size < pb->maxFill)
+	{
+		WRC__ringDestroy(&pb->ring);
+		if(!WRC__ringInit(&pb->ring, pb->maxFill))
+		{
+			WRC__errorReset(ctx, WRC_ERR_GENERIC, "Couldn't allocate the jitter buffer!");
+			return false;
+		}
+	}
+	pb->maxFill -= pb->maxFill % frameSize;
+
+	pb->producerDone = false;
+	pb->abort = false;
+
+	if(pb->pull)
+	{
+		// the format and fill levels must be visible to WRC_ReadSamples() before the first samples
+		WRC__storeRelease(&pb->draining, 0);
+		pb->running = true;
+		return true;
+	}
+
+	if(!WRC__threadCreate(&pb->thread, playoutThreadFun, ctx))
+	{
+		WRC__errorReset(ctx, WRC_ERR_GENERIC, "Couldn't create the playout thread!");
+		return false;
+	}
+
+	pb->running = true;
+	return true;
+}
+
+int WRC__decodeFormat(WRC_Stream* ctx)
+{
+	return ctx->resampler.enabled ? WRC_FMT_F32 : ctx->outFormat;
+}
+
+bool WRC__sendSamples(WRC_Stream* ctx, void* samples, size_t numSamples)
+{
+	if(ctx->resampler.enabled)
+	{
+		return WRC__resample(ctx, NULL, (const float*)samples, numSamples / ctx->numChannels);
+	}
+	return WRC__outputSamples(ctx, samples, numSamples);
+}
+
+bool WRC__outputSamples(WRC_Stream* ctx, void* samples, size_t numSamples)
+{
+	struct WRC__PcmBuffer* pb = &ctx->pcmBuf;
+
+	if(!pb->enabled)
+	{
+		playSamples(ctx, samples, numSamples / ctx->outChannels, ctx->outChannels);
+		return true;
+	}
+
+	if(!pb->running && !startPcmBuffer(ctx))
+	{
+		return false;
+	}
+
+	size_t frameSize = pb->numChannels * pb->sampleSize;
+	const unsigned char* remData = (const unsigned char*)samples;
+	size_t size = numSamples * pb->sampleSize;
+
+	while(size > 0 && !ctx->userAbort)
+	{
+		size_t fill = WRC__ringFill(&pb->ring);
+		size_t space = (fill < pb->maxFill) ? (pb->maxFill - fill) : 0;
+		space -= space % frameSize; // only whole frames, so the playout thread never sees half of one
+		if(space > size)
+			space = size;
+
+		size_t written = WRC__ringWrite(&pb->ring, remData, space);
+		remData += written;
+		size -= written;
+
+		WRC__mutexLock(&pb->lock);
+		WRC__condSignal(&pb->cond); // the playout thread might be waiting for the prebuffer to fill
+		if(size > 0)
+		{
+			// buffer is at maxMs, wait until the playout thread or WRC_ReadSamples() made some room
+			WRC__condWait(&pb->cond, &pb->lock, pb->pull ? WRC__PCM_PULL_POLL_MS : WRC__PCM_BUFFER_WAIT_MS);
+		}
+		WRC__mutexUnlock(&pb->lock);
+	}
+
+	return true;
+}
+
+bool WRC__sendFloatSamples(WRC_Stream* ctx, float** samples, int numFrames)
+{
+	int numChannels = ctx->numChannels;
+
+	if(ctx->resampler.enabled)
+	{
+		return WRC__resample(ctx, samples, NULL, numFrames);
+	}
+
+	if(WRC__directOutput(ctx))
+	{
+		// converted right into the user's memory
+		writeToProvider(ctx, samples, NULL, numFrames, numChannels);
+		return true;
+	}
+
+	if(ctx->outFormat == WRC_FMT_F32 && ctx->outPlanar && ctx->playbackFmtCB != NULL
+	   && ctx->acquireOutputCB == NULL && ctx->shm.hdr == NULL
+	   && !ctx->pcmBuf.enabled && !ctx->blocks.enabled)
+	{
+		// exactly what the user wants, no need to copy them
+		ctx->playbackFmtCB(ctx->userdata, (void* const*)samples, numFrames);
+		return true;
+	}
+
+	union WRC__SampleBuf decBuf;
+	switch(ctx->outFormat)
+	{
+		case WRC_FMT_S32:
+			WRC__floatToInt32(decBuf.s32, samples, numChannels, numFrames);
+			break;
+		case WRC_FMT_F32:
+			WRC__interleaveFloat(decBuf.f32, samples, numChannels, numFrames);
+			break;
+		default:
+			// see pcmconv.c
+			WRC__floatToInt16(decBuf.s16, samples, numChannels, numFrames);
+			break;
+	}
+
+	return WRC__outputSamples(ctx, &decBuf, (size_t)numFrames * numChannels);
+}
+
+// pull mode version of WRC__stopPcmBuffer()
+static void stopPullBuffer(WRC_Stream* ctx, bool abort)
+{
+	struct WRC__PcmBuffer* pb = &ctx->pcmBuf;
+
+	// from now on WRC_ReadSamples() returns whatever is left, even if it's less than targetMs
+	WRC__storeRelease(&pb->draining, 1);
+
+	if(!abort)
+	{
+		// wait until the user has read the rest
+		WRC__mutexLock(&pb->lock);
+		while(WRC__ringFill(&pb->ring) > 0 && !ctx->userAbort)
+		{
+			WRC__condWait(&pb->cond, &pb->lock, WRC__PCM_PULL_POLL_MS);
+		}
+		WRC__mutexUnlock(&pb->lock);
+	}
+
+	// only WRC_ReadSamples() may modify the ring's readPos, so tell it what to throw away
+	WRC__storeRelease(&pb->discardPos, pb->ring.writePos);
+	pb->running = false;
+}
+
+void WRC__stopPcmBuffer(WRC_Stream* ctx, bool abort)
+{
+	struct WRC__PcmBuffer* pb = &ctx->pcmBuf;
+
+	if(!pb->running)
+		return;
+
+	if(pb->pull)
+	{
+		stopPullBuffer(ctx, abort);
+		return;
+	}
+
+	WRC__mutexLock(&pb->lock);
+	pb->producerDone = true;
+	pb->abort = abort;
+	WRC__condSignal(&pb->cond);
+	WRC__mutexUnlock(&pb->lock);
+
+	WRC__threadJoin(pb->thread);
+	pb->running = false;
+
+	// throw away whatever is left (after an abort) so the ring can be reused
+	pb->ring.readPos = pb->ring.writePos;
+}
+
+bool WRC__initAudio(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+	int sampleRate = ctx->sampleRate;
+	int numChannels = ctx->numChannels;
+
+	if(rs->enabled)
+	{
+		if(!WRC__setResamplerInput(ctx))
+			return false;
+
+		// the user always gets the same format, so there's nothing to tell
+		// and the buffered samples can just stay
+		if(rs->audioInitDone)
+			return true;
+
+		sampleRate = rs->outRate;
+		numChannels = rs->outChannels;
+	}
+
+	// the samples in the old format must be played before the user switches
+	// the audio device to the new one. this also makes sure playbackCB isn't
+	// called while initAudioCB runs.
+	WRC__stopPcmBuffer(ctx, ctx->userAbort);
+	WRC__flushBlocks(ctx, ctx->userAbort);
+
+	ctx->outRate = sampleRate;
+	ctx->outChannels = numChannels;
+
+	if(!ctx->initAudioCB(ctx->userdata, sampleRate, numChannels))
+	{
+		WRC__errorReset(ctx, WRC_ERR_INIT_AUDIO_FAILED,
+				"calling initAudioCB(userdata, %d, %d) failed - samplerate/numchannels not supported?!",
+				sampleRate, numChannels);
+
+		return false;
+	}
+
+	rs->audioInitDone = rs->enabled;
+	// the following samples are in the new format
+	WRC__shmFormat(ctx);
+	return true;
+}
+
+int WRC__pcmBufferedMs(WRC_Stream* ctx)
+{
+	struct WRC__PcmBuffer* pb = &ctx->pcmBuf;
+
+	if(pb->sampleRate <= 0 || pb->numChannels <= 0)
+		return 0;
+
+	size_t bytesPerSec = (size_t)pb->sampleRate * pb->numChannels * pb->sampleSize;
+	return (int)((uint64_t)WRC__ringFill(&pb->ring) * 1000 / bytesPerSec);
+}
+
+void WRC__cleanupPcmBuffer(WRC_Stream* ctx)
+{
+	struct WRC__PcmBuffer* pb = &ctx->pcmBuf;
+
+	if(!pb->enabled)
+		return;
+
+	WRC__stopPcmBuffer(ctx, true);
+	WRC__ringDestroy(&pb->ring);
+	WRC__condDestroy(&pb->cond);
+	WRC__mutexDestroy(&pb->lock);
+	pb->enabled = false;
+}
+
+static bool setPcmBuffer(WRC_Stream* stream, int targetMs, int maxMs, bool pull)
+{
+	struct WRC__PcmBuffer* pb = &stream->pcmBuf;
+
+	if(!pb->enabled)
+	{
+		WRC__mutexInit(&pb->lock);
+		WRC__condInit(&pb->cond);
+		pb->enabled = true;
+	}
+	else if(pb->ring.buf != NULL)
+	{
+		// the size might change
+		WRC__ringDestroy(&pb->ring);
+	}
+
+	pb->pull = pull;
+	pb->sampleSize = WRC__sampleSize(stream->outFormat);
+	pb->targetMs = targetMs;
+	pb->maxMs = (maxMs > targetMs) ? maxMs : 2 * targetMs;
+
+	pb->prebuffering = true;
+	pb->stallStart = 0;
+	pb->draining = 1; // until the first samples are there
+	pb->discardPos = 0;
+
+	if(pull && !WRC__ringInit(&pb->ring, msToBytes(pb->maxMs, WRC__PCM_PULL_RATE, WRC__PCM_PULL_CHANNELS, pb->sampleSize)))
+	{
+		WRC__cleanupPcmBuffer(stream);
+		return false;
+	}
+
+	return true;
+}
+
+int WRC_SetJitterBuffer(WRC_Stream* stream, int targetMs, int maxMs)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetJitterBuffer(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(targetMs <= 0)
+	{
+		WRC__cleanupPcmBuffer(stream);
+		return 1;
+	}
+
+	return setPcmBuffer(stream, targetMs, maxMs, false);
+}
+
+int WRC_SetPullMode(WRC_Stream* stream, int targetMs, int maxMs, int fillSilence)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetPullMode(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(stream->shm.hdr != NULL)
+	{
+		eprintf("WRC_SetPullMode(): can't be used with WRC_SetSharedMemorySink()!\n");
+		return 0;
+	}
+
+	if(targetMs < 0)
+		targetMs = 0;
+	if(maxMs <= 0)
+		maxMs = (targetMs > 0) ? 2 * targetMs : 500;
+
+	if(!setPcmBuffer(stream, targetMs, maxMs, true))
+		return 0;
+
+	stream->pcmBuf.fillSilence = (fillSilence != 0);
+	return 1;
+}
+
+// for WRC_SetPullMode()'s fillSilence: clears the numFrames frames at dst.
+// numChannels is 0 until the first samples were decoded, then it's one sample per frame
+static void clearFrames(struct WRC__PcmBuffer* pb, size_t sampleSize, void* dst, size_t numFrames)
+{
+	size_t frameSize = ((pb->numChannels > 0) ? pb->numChannels : 1) * sampleSize;
+	// all bits 0 is silence for float, too
+	memset(dst, 0, numFrames * frameSize);
+}
+
+size_t WRC_ReadSamples(WRC_Stream* stream, void* dst, size_t numFrames, int timeoutMs)
+{
+	struct WRC__PcmBuffer* pb = &stream->pcmBuf;
+	struct WRC__SpscRing* ring = &pb->ring;
+
+	if(!pb->enabled || !pb->pull)
+	{
+		// e.g. WRC_SetJitterBuffer() was called after WRC_SetPullMode()
+		if(pb->fillSilence)
+			clearFrames(pb, WRC__sampleSize(stream->outFormat), dst, numFrames);
+		return 0;
+	}
+
+	uint64_t now = WRC__timeMs();
+	uint64_t deadline = now + ((timeoutMs > 0) ? timeoutMs : 0);
+	size_t framesRead = 0;
+	bool draining = false;
+	unsigned char* out = (unsigned char*)dst;
+
+	for(;;)
+	{
+		// the samples of a stopped stream that haven't been read yet
+		size_t discard = WRC__loadAcquire(&pb->discardPos) - ring->readPos;
+		size_t fill = WRC__ringFill(ring);
+		if(discard != 0 && discard <= fill)
+		{
+			WRC__ringConsume(ring, discard);
+			fill -= discard;
+		}
+
+		// the format is set before the samples are written, so read it after the fill level
+		draining = WRC__loadAcquire(&pb->draining) != 0;
+		// numChannels is 0 until the first samples were decoded, but then fill is 0, too
+		size_t frameSize = ((pb->numChannels > 0) ? pb->numChannels : 1) * pb->sampleSize;
+
+		if(pb->prebuffering && fill > 0 && (fill >= pb->targetFill || draining))
+		{
+			pb->prebuffering = false;
+			if(pb->stallStart != 0)
+			{
+				pb->stalledMs += now - pb->stallStart;
+				pb->stallStart = 0;
+			}
+		}
+
+		if(!pb->prebuffering)
+		{
+			size_t n = fill / frameSize;
+			if(n > numFrames - framesRead)
+				n = numFrames - framesRead;
+
+			WRC__ringRead(ring, out, n * frameSize);
+			out += n * frameSize;
+			framesRead += n;
+		}
+
+		if(framesRead == numFrames || now >= deadline)
+			break;
+
+		// wait for the decoder to deliver more
+		WRC__mutexLock(&pb->lock);
+		WRC__condWait(&pb->cond, &pb->lock, (int)(deadline - now));
+		WRC__mutexUnlock(&pb->lock);
+		now = WRC__timeMs();
+	}
+
+	if(framesRead < numFrames && !pb->prebuffering)
+	{
+		if(draining)
+		{
+			// the stream (or the current format) is over, not an underrun:
+			// start prebuffering again for whatever comes next
+			pb->prebuffering = true;
+		}
+		else
+		{
+			++pb->underruns;
+			pb->prebuffering = true;
+			pb->stallStart = now;
+		}
+	}
+
+	if(framesRead < numFrames && pb->fillSilence)
+	{
+		clearFrames(pb, pb->sampleSize, out, numFrames - framesRead);
+	}
+
+	return framesRead;
+}
+
+void WRC__cleanupBlocks(WRC_Stream* ctx)
+{
+	struct WRC__Blocks* b = &ctx->blocks;
+
+	free(b->buf);
+	free(b->planar);
+	b->buf = NULL;
+	b->planar = NULL;
+	b->cap = 0;
+	b->frames = 0;
+}
+
+int WRC_SetCallbackBlockSize(WRC_Stream* stream, int minSize, int maxSize, int inMs)
+{
+	struct WRC__Blocks* b = &stream->blocks;
+
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetCallbackBlockSize(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(minSize <= 0)
+	{
+		b->enabled = false;
+		WRC__cleanupBlocks(stream);
+		return 1;
+	}
+
+	if(maxSize < minSize)
+	{
+		eprintf("WRC_SetCallbackBlockSize(): maxSize must be >= minSize!\n");
+		return 0;
+	}
+
+	b->enabled = true;
+	b->minSize = minSize;
+	b->maxSize = maxSize;
+	b->inMs = (inMs != 0);
+	// the buffers are allocated for the format once it's known
+	WRC__cleanupBlocks(stream);
+
+	return 1;
+}
+
+int WRC_SetOutputProvider(WRC_Stream* stream, WRC_acquireOutputCB acquireFn, WRC_commitOutputCB commitFn)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetOutputProvider(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if((acquireFn == NULL) != (commitFn == NULL))
+	{
+		eprintf("WRC_SetOutputProvider(): acquireFn and commitFn must both be set or both be NULL!\n");
+		return 0;
+	}
+
+	if(acquireFn != NULL && stream->initAudioCB == NULL)
+	{
+		eprintf("WRC_SetOutputProvider(): the stream has no initAudioFn!\n");
+		return 0;
+	}
+
+	stream->acquireOutputCB = acquireFn;
+	stream->commitOutputCB = commitFn;
+	return 1;
+}
+
+int WRC_SetOutputFormat(WRC_Stream* stream, int format, int planar, WRC_playbackFmtCB playbackFn)
+{
+	struct WRC__PcmBuffer* pb = &stream->pcmBuf;
+
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetOutputFormat(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(format != WRC_FMT_S16 && format != WRC_FMT_S32 && format != WRC_FMT_F32)
+	{
+		eprintf("WRC_SetOutputFormat(): invalid format %d!\n", format);
+		return 0;
+	}
+
+	if(playbackFn != NULL && stream->initAudioCB == NULL)
+	{
+		eprintf("WRC_SetOutputFormat(): the stream has no initAudioFn!\n");
+		return 0;
+	}
+
+	stream->outFormat = format;
+	stream->outPlanar = (planar != 0);
+	WRC__cleanupBlocks(stream); // they might be too small for the new format
+	stream->playbackFmtCB = playbackFn;
+	stream->playbackCB = NULL;
+
+	if(pb->enabled && pb->pull && WRC__sampleSize(format) != pb->sampleSize)
+	{
+		// the pull mode ring has been allocated for the old format
+		return setPcmBuffer(stream, pb->targetMs, pb->maxMs, true);
+	}
+
+	return 1;
+}
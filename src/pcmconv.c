@@ -0,0 +1,408 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// converts the planar float samples from vorbis to interleaved int16_t samples.
+// there are SSE2, AVX2 and NEON versions for mono and stereo (the common cases),
+// the best one for the CPU is chosen in WRC__initPcmConv().
+// All versions give exactly the same results as convertScalar(): the sample is
+// multiplied with 32767, 0.5 is added, it's clamped to -32768 .. 32767 (still as float,
+// converting a float that doesn't fit into an int is undefined) and truncated towards
+// zero. NaN becomes 0.
+// The other output formats of WRC_SetOutputFormat() are converted at the end of the file.
+// The dot products of the resampler's filter (see resample.c) are done here, too.
+
+#include "internal.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WRC__PCMCONV_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define WRC__TARGET_AVX2
+#else
+#define WRC__TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WRC__PCMCONV_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*WRC__convertFun)(int16_t* dst, float** src, int numChannels, int numFrames);
+typedef float (*WRC__dotFun)(const float* a, const float* b, int n);
+
+static inline int16_t convertSample(float f)
+{
+	float sample = f*32767.0f + 0.5f;
+
+	// clipping, before the conversion so it's always in range
+	if(sample < -32768.0f) // INT16_MIN
+	{
+		sample = -32768.0f;
+	}
+	else if(sample > 32767.0f) // INT16_MAX
+	{
+		sample = 32767.0f;
+	}
+	else if(sample != sample) // NaN
+	{
+		sample = 0.0f;
+	}
+	return (int16_t)sample;
+}
+
+// converts frames startFrame .. numFrames-1
+static void convertScalarFrom(int16_t* dst, float** src, int numChannels, int startFrame, int numFrames)
+{
+	for(int chanIdx=0; chanIdx < numChannels; ++chanIdx)
+	{
+		float* curChan = src[chanIdx];
+		int16_t* curOutSample = dst + startFrame*numChannels + chanIdx;
+
+		for(int sampleIdx=startFrame; sampleIdx < numFrames; ++sampleIdx)
+		{
+			*curOutSample = convertSample(curChan[sampleIdx]);
+			curOutSample += numChannels;
+		}
+	}
+}
+
+static void convertScalar(int16_t* dst, float** src, int numChannels, int numFrames)
+{
+	convertScalarFrom(dst, src, numChannels, 0, numFrames);
+}
+
+// the dot products for the resampler's filter (see resample.c), n is a multiple of 8
+static float dotScalar(const float* a, const float* b, int n)
+{
+	float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+	for(int i=0; i < n; i += 4)
+	{
+		s0 += a[i] * b[i];
+		s1 += a[i+1] * b[i+1];
+		s2 += a[i+2] * b[i+2];
+		s3 += a[i+3] * b[i+3];
+	}
+	return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef WRC__PCMCONV_X86
+
+// 4 floats => 4 int32s, like convertSample(). cvttps turns everything that doesn't fit
+// (and NaN) into INT32_MIN, so the clamping must be done before
+static inline __m128i cvt4SSE2(const float* src)
+{
+	__m128 f = _mm_loadu_ps(src);
+	f = _mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(32767.0f)), _mm_set1_ps(0.5f));
+	f = _mm_and_ps(f, _mm_cmpord_ps(f, f)); // NaN => 0
+	f = _mm_max_ps(_mm_min_ps(f, _mm_set1_ps(32767.0f)), _mm_set1_ps(-32768.0f));
+	return _mm_cvttps_epi32(f);
+}
+
+static void convertSSE2(int16_t* dst, float** src, int numChannels, int numFrames)
+{
+	int i = 0;
+	if(numChannels == 1)
+	{
+		const float* m = src[0];
+		for(; i+8 <= numFrames; i += 8)
+		{
+			__m128i s = _mm_packs_epi32(cvt4SSE2(m+i), cvt4SSE2(m+i+4));
+			_mm_storeu_si128((__m128i*)(dst+i), s);
+		}
+	}
+	else if(numChannels == 2)
+	{
+		const float* l = src[0];
+		const float* r = src[1];
+		for(; i+8 <= numFrames; i += 8)
+		{
+			__m128i ls = _mm_packs_epi32(cvt4SSE2(l+i), cvt4SSE2(l+i+4));
+			__m128i rs = _mm_packs_epi32(cvt4SSE2(r+i), cvt4SSE2(r+i+4));
+			_mm_storeu_si128((__m128i*)(dst+2*i), _mm_unpacklo_epi16(ls, rs));
+			_mm_storeu_si128((__m128i*)(dst+2*i+8), _mm_unpackhi_epi16(ls, rs));
+		}
+	}
+
+	convertScalarFrom(dst, src, numChannels, i, numFrames);
+}
+
+WRC__TARGET_AVX2
+static inline __m256i cvt8AVX2(const float* src)
+{
+	__m256 f = _mm256_loadu_ps(src);
+	f = _mm256_add_ps(_mm256_mul_ps(f, _mm256_set1_ps(32767.0f)), _mm256_set1_ps(0.5f));
+	f = _mm256_and_ps(f, _mm256_cmp_ps(f, f, _CMP_ORD_Q)); // NaN => 0
+	f = _mm256_max_ps(_mm256_min_ps(f, _mm256_set1_ps(32767.0f)), _mm256_set1_ps(-32768.0f));
+	return _mm256_cvttps_epi32(f);
+}
+
+// 16 floats => 16 int16s (in order, packs works per 128bit lane)
+WRC__TARGET_AVX2
+static inline __m256i cvt16AVX2(const float* src)
+{
+	__m256i s = _mm256_packs_epi32(cvt8AVX2(src), cvt8AVX2(src+8));
+	return _mm256_permute4x64_epi64(s, 0xD8);
+}
+
+WRC__TARGET_AVX2
+static void convertAVX2(int16_t* dst, float** src, int numChannels, int numFrames)
+{
+	int i = 0;
+	if(numChannels == 1)
+	{
+		const float* m = src[0];
+		for(; i+16 <= numFrames; i += 16)
+		{
+			_mm256_storeu_si256((__m256i*)(dst+i), cvt16AVX2(m+i));
+		}
+	}
+	else if(numChannels == 2)
+	{
+		const float* l = src[0];
+		const float* r = src[1];
+		for(; i+16 <= numFrames; i += 16)
+		{
+			__m256i ls = cvt16AVX2(l+i);
+			__m256i rs = cvt16AVX2(r+i);
+			// per lane: lo has frames 0-3 and 8-11, hi has 4-7 and 12-15
+			__m256i lo = _mm256_unpacklo_epi16(ls, rs);
+			__m256i hi = _mm256_unpackhi_epi16(ls, rs);
+			_mm256_storeu_si256((__m256i*)(dst+2*i), _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i*)(dst+2*i+16), _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+	}
+
+	convertScalarFrom(dst, src, numChannels, i, numFrames);
+}
+
+static float dotSSE2(const float* a, const float* b, int n)
+{
+	__m128 s0 = _mm_setzero_ps();
+	__m128 s1 = _mm_setzero_ps();
+	for(int i=0; i < n; i += 8)
+	{
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+	}
+	__m128 s = _mm_add_ps(s0, s1);
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+WRC__TARGET_AVX2
+static float dotAVX2(const float* a, const float* b, int n)
+{
+	__m256 s = _mm256_setzero_ps();
+	for(int i=0; i < n; i += 8)
+	{
+		s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i)));
+	}
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+	h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+	h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+	return _mm_cvtss_f32(h);
+}
+
+static bool cpuHasAVX2(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, and the OS saves the YMM registers
+	if((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool cpuHasSSE2(void)
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+	return true;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif // WRC__PCMCONV_X86
+
+#ifdef WRC__PCMCONV_NEON
+
+// 4 floats => 4 int32s like convertSample(), vcvtq_s32_f32() truncates and turns NaN into 0
+// (vminq/vmaxq keep the NaN)
+static inline int32x4_t cvt4NEON(const float* src)
+{
+	float32x4_t f = vld1q_f32(src);
+	f = vaddq_f32(vmulq_f32(f, vdupq_n_f32(32767.0f)), vdupq_n_f32(0.5f));
+	f = vmaxq_f32(vminq_f32(f, vdupq_n_f32(32767.0f)), vdupq_n_f32(-32768.0f));
+	return vcvtq_s32_f32(f);
+}
+
+// 8 floats => 8 int16s, already in range
+static inline int16x8_t cvt8NEON(const float* src)
+{
+	return vcombine_s16(vqmovn_s32(cvt4NEON(src)), vqmovn_s32(cvt4NEON(src+4)));
+}
+
+static void convertNEON(int16_t* dst, float** src, int numChannels, int numFrames)
+{
+	int i = 0;
+	if(numChannels == 1)
+	{
+		const float* m = src[0];
+		for(; i+8 <= numFrames; i += 8)
+		{
+			vst1q_s16(dst+i, cvt8NEON(m+i));
+		}
+	}
+	else if(numChannels == 2)
+	{
+		const float* l = src[0];
+		const float* r = src[1];
+		for(; i+8 <= numFrames; i += 8)
+		{
+			int16x8x2_t s;
+			s.val[0] = cvt8NEON(l+i);
+			s.val[1] = cvt8NEON(r+i);
+			vst2q_s16(dst+2*i, s); // interleaves
+		}
+	}
+
+	convertScalarFrom(dst, src, numChannels, i, numFrames);
+}
+
+static float dotNEON(const float* a, const float* b, int n)
+{
+	float32x4_t s0 = vdupq_n_f32(0.0f);
+	float32x4_t s1 = vdupq_n_f32(0.0f);
+	for(int i=0; i < n; i += 8)
+	{
+		s0 = vmlaq_f32(s0, vld1q_f32(a+i), vld1q_f32(b+i));
+		s1 = vmlaq_f32(s1, vld1q_f32(a+i+4), vld1q_f32(b+i+4));
+	}
+	float32x4_t s = vaddq_f32(s0, s1);
+	float32x2_t h = vadd_f32(vget_low_f32(s), vget_high_f32(s));
+	return vget_lane_f32(vpadd_f32(h, h), 0);
+}
+
+#endif // WRC__PCMCONV_NEON
+
+static WRC__convertFun convertFun = convertScalar;
+static WRC__dotFun dotFun = dotScalar;
+
+void WRC__initPcmConv(void)
+{
+	convertFun = convertScalar;
+	dotFun = dotScalar;
+#ifdef WRC__PCMCONV_X86
+	if(cpuHasAVX2())
+	{
+		convertFun = convertAVX2;
+		dotFun = dotAVX2;
+	}
+	else if(cpuHasSSE2())
+	{
+		convertFun = convertSSE2;
+		dotFun = dotSSE2;
+	}
+#elif defined(WRC__PCMCONV_NEON)
+	convertFun = convertNEON;
+	dotFun = dotNEON;
+#endif
+}
+
+float WRC__dotProduct(const float* a, const float* b, int n)
+{
+	return dotFun(a, b, n);
+}
+
+void WRC__floatToInt16(int16_t* dst, float** src, int numChannels, int numFrames)
+{
+	convertFun(dst, src, numChannels, numFrames);
+}
+
+// for WRC_SetOutputFormat(), these are rarely used so there are no SIMD versions
+
+void WRC__floatToInt32(int32_t* dst, float** src, int numChannels, int numFrames)
+{
+	for(int chanIdx=0; chanIdx < numChannels; ++chanIdx)
+	{
+		float* curChan = src[chanIdx];
+		int32_t* curOutSample = dst + chanIdx;
+
+		for(int sampleIdx=0; sampleIdx < numFrames; ++sampleIdx)
+		{
+			// in double, because a float can't represent INT32_MAX
+			double sample = curChan[sampleIdx] * 2147483647.0 + 0.5;
+			if(sample < -2147483648.0)
+				sample = -2147483648.0;
+			else if(sample > 2147483647.0)
+				sample = 2147483647.0;
+			else if(sample != sample) // NaN
+				sample = 0.0;
+
+			*curOutSample = (int32_t)sample;
+			curOutSample += numChannels;
+		}
+	}
+}
+
+void WRC__interleaveFloat(float* dst, float** src, int numChannels, int numFrames)
+{
+	if(numChannels == 1)
+	{
+		memcpy(dst, src[0], numFrames * sizeof(float));
+		return;
+	}
+
+	for(int chanIdx=0; chanIdx < numChannels; ++chanIdx)
+	{
+		float* curChan = src[chanIdx];
+		float* curOutSample = dst + chanIdx;
+
+		for(int sampleIdx=0; sampleIdx < numFrames; ++sampleIdx)
+		{
+			*curOutSample = curChan[sampleIdx];
+			curOutSample += numChannels;
+		}
+	}
+}
+
+void WRC__deinterleave(void** dst, const void* src, size_t sampleSize, int numChannels, size_t numFrames)
+{
+	for(int chanIdx=0; chanIdx < numChannels; ++chanIdx)
+	{
+		if(sampleSize == sizeof(int16_t))
+		{
+			const int16_t* in = (const int16_t*)src + chanIdx;
+			int16_t* out = (int16_t*)dst[chanIdx];
+			for(size_t i=0; i < numFrames; ++i)
+				out[i] = in[i*numChannels];
+		}
+		else // int32_t and float are both moved as 32bit values
+		{
+			const uint32_t* in = (const uint32_t*)src + chanIdx;
+			uint32_t* out = (uint32_t*)dst[chanIdx];
+			for(size_t i=0; i < numFrames; ++i)
+				out[i] = in[i*numChannels];
+		}
+	}
+}
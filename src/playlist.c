@@ -0,0 +1,628 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// playlists: PLS, M3U (and M3U8), XSPF and ASX are parsed while they arrive, all
+// http(s) URLs in them are collected in ctx->playlist.entries. The first one is
+// streamed; if connecting to it fails before any audio arrived, the next one is tried.
+// With WRC_SetMirrorRace(), the next entries are connected to at the same time
+// (like "happy eyeballs") and the first one that delivers audio is kept. The other
+// connections are paused as soon as their first data arrives, so this needs a curl
+// multi handle (group.c or async.c).
+
+#include "internal.h"
+
+#include <ctype.h>
+
+// a playlist bigger than this is probably something else
+#define WRC__MAX_PLAYLIST_SIZE (1024*1024)
+
+static bool startsWithNoCase(const char* str, const char* prefix)
+{
+	return strncasecmp(str, prefix, strlen(prefix)) == 0;
+}
+
+static void addEntry(WRC_Stream* ctx, const char* url, size_t len)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+
+	while(len > 0 && isspace((unsigned char)*url))
+	{
+		++url;
+		--len;
+	}
+	while(len > 0 && isspace((unsigned char)url[len-1]))
+	{
+		--len;
+	}
+
+	if(len == 0 || len >= sizeof(ctx->url) || pl->numEntries == WRC__MAX_PLAYLIST_ENTRIES)
+		return;
+	if(!startsWithNoCase(url, "http://") && !startsWithNoCase(url, "https://"))
+		return; // a relative URL, a local file or whatever
+
+	char* entry = malloc(len+1);
+	if(entry == NULL)
+		return;
+
+	// XML escapes &amp; (and it's the only one that can appear in a sane URL)
+	size_t entryLen = 0;
+	for(size_t i=0; i < len; ++i)
+	{
+		entry[entryLen++] = url[i];
+		if(pl->format == WRC__PLAYLIST_XML && url[i] == '&' && len-i > 4 && strncmp(url+i, "&amp;", 5) == 0)
+			i += 4;
+	}
+	entry[entryLen] = '\0';
+
+	// some list the same URL twice (e.g. with different titles)
+	for(int i=0; i < pl->numEntries; ++i)
+	{
+		if(strcmp(pl->entries[i], entry) == 0)
+		{
+			free(entry);
+			return;
+		}
+	}
+
+	pl->entries[pl->numEntries++] = entry;
+}
+
+// a line of a PLS or M3U file
+static void parseTextLine(WRC_Stream* ctx, const char* line, size_t len)
+{
+	while(len > 0 && isspace((unsigned char)*line))
+	{
+		++line;
+		--len;
+	}
+
+	if(len > 4 && startsWithNoCase(line, "file"))
+	{
+		// PLS: File1=http://...
+		size_t i = 4;
+		while(i < len && isdigit((unsigned char)line[i]))
+			++i;
+		if(i > 4 && i < len && line[i] == '=')
+		{
+			addEntry(ctx, line+i+1, len-i-1);
+		}
+		return;
+	}
+
+	// HLS playlists are M3U files with #EXT-X- tags, hls.c streams their segments
+	if(len > 7 && memcmp(line, "#EXT-X-", 7) == 0)
+	{
+		ctx->playlist.hls = true;
+		return;
+	}
+
+	// M3U: comments and #EXTINF etc start with '#', the rest are URLs.
+	// addEntry() ignores the "[playlist]", "Title1=" etc lines of PLS
+	if(len > 0 && line[0] != '#')
+	{
+		addEntry(ctx, line, len);
+	}
+}
+
+// an XML tag (ending with '>') together with the text before it
+static void parseXMLToken(WRC_Stream* ctx, const char* token, size_t len)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+
+	const char* tag = memchr(token, '<', len);
+	if(tag == NULL)
+		return;
+
+	if(pl->inLocation)
+	{
+		// XSPF: <location>http://...</location>
+		pl->inLocation = false;
+		addEntry(ctx, token, tag - token);
+	}
+
+	size_t tagLen = len - (tag - token);
+	if(tagLen > 9 && startsWithNoCase(tag, "<location") && (tag[9] == '>' || isspace((unsigned char)tag[9])))
+	{
+		pl->inLocation = (tag[tagLen-2] != '/');
+	}
+	else if(tagLen > 4 && startsWithNoCase(tag, "<ref") && isspace((unsigned char)tag[4]))
+	{
+		// ASX: <ref href="http://..." />
+		for(size_t i=4; i+4 < tagLen; ++i)
+		{
+			if(!startsWithNoCase(tag+i, "href") || !isspace((unsigned char)tag[i-1]))
+				continue;
+
+			const char* val = tag+i+4;
+			const char* end = tag+tagLen;
+			while(val < end && (isspace((unsigned char)*val) || *val == '='))
+				++val;
+			if(val < end && (*val == '"' || *val == '\''))
+			{
+				const char* valEnd = memchr(val+1, *val, end - (val+1));
+				if(valEnd != NULL)
+				{
+					addEntry(ctx, val+1, valEnd - (val+1));
+				}
+			}
+			break;
+		}
+	}
+}
+
+static void parseToken(WRC_Stream* ctx)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+
+	if(!pl->tokenTooLong)
+	{
+		if(pl->format == WRC__PLAYLIST_XML)
+			parseXMLToken(ctx, pl->token, pl->tokenLen);
+		else
+			parseTextLine(ctx, pl->token, pl->tokenLen);
+	}
+
+	pl->tokenLen = 0;
+	pl->tokenTooLong = false;
+}
+
+// the playlist can arrive in any number of chunks, so only complete lines (or XML tags)
+// are parsed, the rest is kept in pl->token until the next chunk
+bool WRC__decodePlaylist(WRC_Stream* ctx, void* data, size_t size)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+	const unsigned char* bytes = data;
+
+	pl->totalSize += size;
+	if(pl->totalSize > WRC__MAX_PLAYLIST_SIZE)
+	{
+		WRC__errorReset(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "playlist is too big");
+		return false;
+	}
+
+	if(pl->token == NULL)
+	{
+		pl->token = malloc(WRC__MAX_PLAYLIST_TOKEN);
+		if(pl->token == NULL)
+		{
+			WRC__errorReset(ctx, WRC_ERR_GENERIC, "Out of Memory!");
+			return false;
+		}
+	}
+
+	// the whole playlist is kept as well, in case it's an HLS playlist
+	if(pl->bodyLen + size > pl->bodyCap)
+	{
+		size_t newCap = (pl->bodyCap > 0) ? pl->bodyCap : 4096;
+		while(newCap < pl->bodyLen + size)
+			newCap *= 2;
+		char* newBody = realloc(pl->body, newCap);
+		if(newBody == NULL)
+		{
+			WRC__errorReset(ctx, WRC_ERR_GENERIC, "Out of Memory!");
+			return false;
+		}
+		pl->body = newBody;
+		pl->bodyCap = newCap;
+	}
+	memcpy(pl->body + pl->bodyLen, data, size);
+	pl->bodyLen += size;
+
+	for(size_t i=0; i < size; ++i)
+	{
+		unsigned char c = bytes[i];
+
+		if(pl->format == WRC__PLAYLIST_UNKNOWN)
+		{
+			// skip whitespace and an UTF-8 byte order mark, then the first char tells
+			if(isspace(c) || c == 0xEF || c == 0xBB || c == 0xBF)
+				continue;
+			pl->format = (c == '<') ? WRC__PLAYLIST_XML : WRC__PLAYLIST_TEXT;
+		}
+
+		bool tokenEnd;
+		if(pl->format == WRC__PLAYLIST_XML)
+		{
+			// tags can be split over several lines
+			if(c == '\r' || c == '\n' || c == '\t')
+				c = ' ';
+			tokenEnd = (c == '>');
+		}
+		else
+		{
+			tokenEnd = (c == '\r' || c == '\n');
+			if(tokenEnd && pl->tokenLen == 0)
+				continue;
+		}
+
+		if(!tokenEnd || pl->format == WRC__PLAYLIST_XML)
+		{
+			if(pl->tokenLen < WRC__MAX_PLAYLIST_TOKEN)
+				pl->token[pl->tokenLen++] = (char)c;
+			else
+				pl->tokenTooLong = true; // nothing we could use
+		}
+
+		if(tokenEnd)
+		{
+			parseToken(ctx);
+		}
+	}
+
+	return true;
+}
+
+// the first entry that hasn't been used yet (and isn't racing), -1 if there is none
+static int nextUnusedEntry(WRC_Stream* ctx, int after)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+	struct WRC__MirrorRace* race = &ctx->race;
+
+	for(int i=after+1; i < pl->numEntries; ++i)
+	{
+		if(pl->used[i])
+			continue;
+
+		bool racing = false;
+		for(int c=0; race->conns != NULL && c < race->numConns; ++c)
+		{
+			if(race->conns[c].curl != NULL && race->conns[c].entry == i)
+				racing = true;
+		}
+		if(!racing)
+			return i;
+	}
+	return -1;
+}
+
+// url is NULL if there is no mirror. without memory there's none either, that's ok
+static void setPlaylistMirror(WRC_Stream* ctx, const char* url)
+{
+	free(ctx->playlistMirror);
+	ctx->playlistMirror = NULL;
+	if(url != NULL)
+	{
+		ctx->playlistMirror = malloc(strlen(url) + 1);
+		if(ctx->playlistMirror != NULL)
+			strcpy(ctx->playlistMirror, url);
+	}
+}
+
+// makes entry the stream URL, another one from the playlist is the mirror for standby.c
+static void useEntry(WRC_Stream* ctx, int entry)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+
+	pl->used[entry] = true;
+	strcpy(ctx->url, pl->entries[entry]);
+
+	int mirror = (entry == 0) ? 1 : 0;
+	setPlaylistMirror(ctx, (mirror < pl->numEntries) ? pl->entries[mirror] : NULL);
+}
+
+bool WRC__endPlaylist(WRC_Stream* ctx)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+
+	// the last line doesn't need a line break
+	if(pl->tokenLen > 0)
+	{
+		parseToken(ctx);
+	}
+
+	if(pl->hls)
+	{
+		// the segment URLs are relative most of the time, hls.c takes over
+		return true;
+	}
+
+	if(pl->numEntries == 0)
+	{
+		WRC__errorReset(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "playlist contains no url");
+		return false;
+	}
+
+	useEntry(ctx, 0);
+	ctx->race.pending = (ctx->race.numParallel > 1 && pl->numEntries > 1);
+	return true;
+}
+
+bool WRC__nextPlaylistEntry(WRC_Stream* ctx)
+{
+	if(!ctx->resolvedPlaylist || !WRC__failedBeforeAudio(ctx))
+		return false;
+
+	// the connections that are still racing start over, ctx->curl connects to
+	// the first entry that's left
+	WRC__stopRace(ctx);
+
+	int entry = nextUnusedEntry(ctx, -1);
+	if(entry < 0)
+		return false;
+
+	useEntry(ctx, entry);
+	return true;
+}
+
+void WRC__resetPlaylist(WRC_Stream* ctx)
+{
+	struct WRC__Playlist* pl = &ctx->playlist;
+
+	for(int i=0; i < pl->numEntries; ++i)
+	{
+		free(pl->entries[i]);
+	}
+	free(pl->body);
+	free(pl->token);
+	memset(pl, 0, sizeof(*pl));
+	setPlaylistMirror(ctx, NULL);
+	ctx->race.pending = false;
+}
+
+// true for the content-types we have a decoder for, see WRC__handleHeaderLine()
+static bool isAudioType(const char* type)
+{
+	if(type == NULL)
+		return false;
+
+	static const char* types[] = {
+#ifdef WRC_MP3
+		"audio/mpeg",
+#endif
+#ifdef WRC_OGG
+		"application/ogg",
+		"audio/ogg",
+#endif
+		NULL
+	};
+
+	for(int i=0; types[i] != NULL; ++i)
+	{
+		size_t len = strlen(types[i]);
+		if(strncasecmp(type, types[i], len) == 0 && (type[len] == '\0' || type[len] == ';' || isspace((unsigned char)type[len])))
+			return true;
+	}
+	return false;
+}
+
+static size_t raceWriteFun(void* data, size_t size, size_t nmemb, void* context)
+{
+	struct WRC__RaceConn* conn = (struct WRC__RaceConn*)context;
+
+	long respCode = 0;
+	curl_easy_getinfo(conn->curl, CURLINFO_RESPONSE_CODE, &respCode);
+	if(respCode != 0 && (respCode < 200 || respCode >= 300))
+	{
+		// an error page, this one lost
+		return 0;
+	}
+
+	char* type = NULL;
+	curl_easy_getinfo(conn->curl, CURLINFO_CONTENT_TYPE, &type);
+	if(!isAudioType(type) && !(size*nmemb >= 10 && memcmp(data, "ICY 200 OK", 10) == 0))
+	{
+		// not a stream we could play (maybe another playlist)
+		return 0;
+	}
+
+	// curl keeps this data for us until the transfer is resumed in switchToConn()
+	conn->ready = true;
+	return CURL_WRITEFUNC_PAUSE;
+}
+
+static size_t raceHeaderFun(char* buffer, size_t size, size_t nitems, void* context)
+{
+	size_t dataSize = size*nitems;
+	struct WRC__RaceConn* conn = (struct WRC__RaceConn*)context;
+
+	long respCode = 0;
+	curl_easy_getinfo(conn->curl, CURLINFO_RESPONSE_CODE, &respCode);
+	if(respCode >= 200 && respCode < 300 && conn->headerLinesLen + dataSize <= sizeof(conn->headerLines))
+	{
+		// the lines are parsed once this connection wins
+		memcpy(conn->headerLines + conn->headerLinesLen, buffer, dataSize);
+		conn->headerLinesLen += dataSize;
+	}
+	return dataSize;
+}
+
+static void closeConn(struct WRC__RaceConn* conn, CURLM* multi)
+{
+	if(conn->curl != NULL)
+	{
+		curl_multi_remove_handle(multi, conn->curl);
+		curl_easy_cleanup(conn->curl);
+		conn->curl = NULL;
+	}
+	if(conn->headers != NULL)
+	{
+		curl_slist_free_all(conn->headers);
+		conn->headers = NULL;
+	}
+}
+
+void WRC__startRace(WRC_Stream* ctx, CURLM* multi)
+{
+	struct WRC__MirrorRace* race = &ctx->race;
+
+	if(!race->pending)
+		return;
+	race->pending = false;
+
+	// ctx->curl already connects to the first entry (probably reusing the connection of the playlist)
+	race->conns = calloc(race->numParallel - 1, sizeof(struct WRC__RaceConn));
+	if(race->conns == NULL)
+		return;
+	race->multi = multi;
+	race->numConns = 0;
+
+	int entry = -1;
+	while(race->numConns < race->numParallel - 1 && (entry = nextUnusedEntry(ctx, entry)) >= 0)
+	{
+		struct WRC__RaceConn* conn = &race->conns[race->numConns];
+
+		CURL* curl = WRC__createEasyHandle(ctx, ctx->playlist.entries[entry], &conn->headers);
+		if(curl == NULL)
+		{
+			if(conn->headers != NULL)
+			{
+				curl_slist_free_all(conn->headers);
+				conn->headers = NULL;
+			}
+			break;
+		}
+
+		// our own callbacks until it wins, CURLOPT_PRIVATE stays ctx
+		// so the drivers find the stream for it
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, raceWriteFun);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, conn);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, raceHeaderFun);
+		curl_easy_setopt(curl, CURLOPT_WRITEHEADER, conn);
+		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+
+		conn->curl = curl;
+		conn->entry = entry;
+		++race->numConns;
+
+		curl_multi_add_handle(multi, curl);
+	}
+}
+
+void WRC__stopRace(WRC_Stream* ctx)
+{
+	struct WRC__MirrorRace* race = &ctx->race;
+
+	if(race->conns == NULL)
+		return;
+
+	// the entries of cancelled connections stay available, see WRC__nextPlaylistEntry()
+	for(int i=0; i < race->numConns; ++i)
+	{
+		closeConn(&race->conns[i], race->multi);
+	}
+	free(race->conns);
+	race->conns = NULL;
+	race->numConns = 0;
+}
+
+// replaces ctx->curl (which hasn't delivered any audio) with conn
+static void switchToConn(WRC_Stream* ctx, CURLM* multi, struct WRC__RaceConn* conn)
+{
+	curl_multi_remove_handle(multi, ctx->curl); // might have been removed already, that's ok
+	curl_easy_cleanup(ctx->curl);
+	if(ctx->headers != NULL)
+		curl_slist_free_all(ctx->headers);
+
+	// nothing was decoded yet, so this is like a fresh connection
+	WRC__resetConnection(ctx);
+	ctx->contentType = WRC_CONTENT_UNKNOWN;
+	ctx->decode = NULL;
+	ctx->ingest = NULL;
+	ctx->ingestBuffer = NULL;
+	ctx->ingestWrote = NULL;
+
+	ctx->curl = conn->curl;
+	ctx->headers = conn->headers;
+	conn->curl = NULL;
+	conn->headers = NULL;
+
+	// the one that lost is a good mirror for the standby connection
+	setPlaylistMirror(ctx, ctx->url);
+	ctx->playlist.used[conn->entry] = true;
+	strcpy(ctx->url, ctx->playlist.entries[conn->entry]);
+
+	WRC__setStreamCallbacks(ctx, ctx->curl);
+	WRC__handleHeaderLines(ctx, conn->headerLines, conn->headerLinesLen);
+
+	WRC__stopRace(ctx);
+
+	ctx->lastDataTime = WRC__timeMs();
+
+	// this might call curlWriteFun() right away with the data curl kept for us
+	curl_easy_pause(ctx->curl, CURLPAUSE_CONT);
+}
+
+static struct WRC__RaceConn* readyConn(WRC_Stream* ctx)
+{
+	struct WRC__MirrorRace* race = &ctx->race;
+
+	for(int i=0; race->conns != NULL && i < race->numConns; ++i)
+	{
+		if(race->conns[i].curl != NULL && race->conns[i].ready)
+			return &race->conns[i];
+	}
+	return NULL;
+}
+
+void WRC__raceCheck(WRC_Stream* ctx, CURLM* multi)
+{
+	if(ctx->race.conns == NULL || ctx->userAbort)
+		return;
+
+	if(ctx->streamState == WRC__STREAM_MUSIC && ctx->decode != NULL)
+	{
+		// ctx->curl delivered audio first
+		WRC__stopRace(ctx);
+		return;
+	}
+
+	struct WRC__RaceConn* conn = readyConn(ctx);
+	if(conn != NULL)
+	{
+		switchToConn(ctx, multi, conn);
+	}
+}
+
+bool WRC__raceTakeOver(WRC_Stream* ctx, CURLM* multi)
+{
+	if(ctx->race.conns == NULL || ctx->userAbort)
+		return false;
+
+	struct WRC__RaceConn* conn = readyConn(ctx);
+	if(conn == NULL)
+		return false; // WRC__nextPlaylistEntry() will try one of the others
+
+	switchToConn(ctx, multi, conn);
+	return true;
+}
+
+bool WRC__raceFinished(WRC_Stream* ctx, CURL* easy)
+{
+	struct WRC__MirrorRace* race = &ctx->race;
+
+	for(int i=0; race->conns != NULL && i < race->numConns; ++i)
+	{
+		struct WRC__RaceConn* conn = &race->conns[i];
+		if(conn->curl == easy)
+		{
+			// connecting failed (or it wasn't audio), don't try that one again
+			ctx->playlist.used[conn->entry] = true;
+			closeConn(conn, race->multi);
+			return true;
+		}
+	}
+	return false;
+}
+
+int WRC_SetMirrorRace(WRC_Stream* stream, int numParallel)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetMirrorRace(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(numParallel < 1 || numParallel > WRC__MAX_RACE_CONNS)
+	{
+		eprintf("WRC_SetMirrorRace(): numParallel must be between 1 and %d!\n", WRC__MAX_RACE_CONNS);
+		return 0;
+	}
+
+	stream->race.numParallel = numParallel;
+	return 1;
+}
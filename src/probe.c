@@ -0,0 +1,418 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// WRC_ProbeStations(): connects to many streams at once (in a WRC_StreamGroup) and
+// reads only as much of each as is needed to find out its format. Each probe is a
+// normal stream (so playlists, redirects and ICY headers are handled as usual),
+// but WRC__decodeMusic() passes the audio data to WRC__probeData() instead of the
+// decoder, which looks for the first MP3 frame header or the Vorbis identification
+// header and then ends the transfer.
+
+#include "internal.h"
+
+// give up if the format isn't found in this many bytes of audio data
+#define WRC__PROBE_MAX_BYTES (64*1024)
+
+struct WRC__ProbeBatch
+{
+	const char* const* urls;
+	size_t numURLs;
+	size_t nextURL;
+	int timeoutMs;
+	WRC_probeResultCB resultCB;
+	void* userdata;
+	WRC_StreamGroup* group;
+};
+
+// MPEG audio frame header tables, indexed by [version == 1 ? 0 : 1][layer-1][bitrate index]
+static const short mp3Bitrates[2][3][16] = {
+	{ // MPEG 1
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 }
+	},
+	{ // MPEG 2 and 2.5
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 }
+	}
+};
+
+// indexed by the version bits (0: MPEG 2.5, 1: reserved, 2: MPEG 2, 3: MPEG 1)
+static const int mp3SampleRates[4][3] = {
+	{ 11025, 12000, 8000 },
+	{ 0, 0, 0 },
+	{ 22050, 24000, 16000 },
+	{ 44100, 48000, 32000 }
+};
+
+struct WRC__Mp3Header
+{
+	int version; // bits from the header
+	int layer; // 1-3
+	int sampleRate;
+	int numChannels;
+	int bitrate; // kbit/s
+	size_t frameSize; // in bytes
+};
+
+// parses the 4 byte frame header at p, returns false if it isn't one
+static bool parseMp3Header(const unsigned char* p, struct WRC__Mp3Header* hdr)
+{
+	if(p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+		return false;
+
+	int version = (p[1] >> 3) & 3;
+	int layerBits = (p[1] >> 1) & 3;
+	int bitrateIdx = p[2] >> 4;
+	int rateIdx = (p[2] >> 2) & 3;
+	if(version == 1 || layerBits == 0 || bitrateIdx == 0 || bitrateIdx == 15 || rateIdx == 3)
+		return false; // reserved or free format
+
+	hdr->version = version;
+	hdr->layer = 4 - layerBits;
+	hdr->sampleRate = mp3SampleRates[version][rateIdx];
+	hdr->numChannels = ((p[3] >> 6) == 3) ? 1 : 2;
+	hdr->bitrate = mp3Bitrates[version == 3 ? 0 : 1][hdr->layer - 1][bitrateIdx];
+
+	int padding = (p[2] >> 1) & 1;
+	int bps = hdr->bitrate * 1000;
+	if(hdr->layer == 1)
+		hdr->frameSize = (12 * bps / hdr->sampleRate + padding) * 4;
+	else if(hdr->layer == 3 && version != 3)
+		hdr->frameSize = 72 * bps / hdr->sampleRate + padding;
+	else
+		hdr->frameSize = 144 * bps / hdr->sampleRate + padding;
+
+	return true;
+}
+
+// returns 1 if a frame header was found (and another one of the same kind right after it,
+// so it isn't just some bytes that look like one), 0 if more data is needed
+static int findMp3Header(struct WRC__Probe* p, struct WRC__Mp3Header* hdr)
+{
+	for(size_t i=0; i + 4 <= p->len; ++i)
+	{
+		if(!parseMp3Header(p->buf + i, hdr))
+			continue;
+
+		size_t next = i + hdr->frameSize;
+		if(next + 4 > p->len)
+		{
+			// if the buffer is full, one has to do
+			return (p->len >= WRC__PROBE_MAX_BYTES) ? 1 : 0;
+		}
+
+		struct WRC__Mp3Header nextHdr;
+		if(parseMp3Header(p->buf + next, &nextHdr) && nextHdr.version == hdr->version
+		   && nextHdr.layer == hdr->layer && nextHdr.sampleRate == hdr->sampleRate)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static uint32_t readLE32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// returns 1 if the Vorbis identification header was found, 0 if more data is needed,
+// -1 if the first packet of the Ogg stream is something else (e.g. Opus)
+static int findVorbisHeader(struct WRC__Probe* p)
+{
+	const unsigned char* buf = p->buf;
+
+	for(size_t i=0; i + 27 <= p->len; ++i)
+	{
+		// the first page of a logical stream ("beginning of stream" flag set)
+		if(memcmp(buf + i, "OggS", 4) != 0 || buf[i+4] != 0 || !(buf[i+5] & 0x02))
+			continue;
+
+		size_t numSegments = buf[i+26];
+		if(i + 27 + numSegments > p->len)
+			return 0;
+
+		// the identification header is the first packet, always shorter than one segment
+		size_t packetStart = i + 27 + numSegments;
+		size_t packetLen = buf[i+27];
+		if(packetStart + packetLen > p->len)
+			return 0;
+
+		const unsigned char* pkt = buf + packetStart;
+		if(packetLen < 30 || pkt[0] != 1 || memcmp(pkt + 1, "vorbis", 6) != 0)
+			return -1;
+
+		p->result.codec = WRC_CODEC_VORBIS;
+		p->result.numChannels = pkt[11];
+		p->result.sampleRate = (int)readLE32(pkt + 12);
+		int nominal = (int)readLE32(pkt + 20);
+		if(nominal > 0)
+			p->result.bitrate = nominal / 1000;
+		return 1;
+	}
+	return 0;
+}
+
+bool WRC__probeData(WRC_Stream* ctx, const void* data, size_t size)
+{
+	struct WRC__Probe* p = ctx->probe;
+
+	size_t n = WRC__PROBE_MAX_BYTES - p->len;
+	if(n > size)
+		n = size;
+	memcpy(p->buf + p->len, data, n);
+	p->len += n;
+
+	int found = 0;
+	if(ctx->contentType == WRC_CONTENT_MP3)
+	{
+		struct WRC__Mp3Header hdr;
+		found = findMp3Header(p, &hdr);
+		if(found > 0)
+		{
+			p->result.codec = WRC_CODEC_MP3;
+			p->result.sampleRate = hdr.sampleRate;
+			p->result.numChannels = hdr.numChannels;
+			p->result.bitrate = hdr.bitrate;
+		}
+	}
+	else
+	{
+		found = findVorbisHeader(p);
+		if(found < 0)
+		{
+			WRC__errorReset(ctx, WRC_ERR_UNSUPPORTED_FORMAT, "Ogg stream doesn't contain Vorbis");
+			return false;
+		}
+	}
+
+	if(found > 0)
+	{
+		// that's all we wanted to know, end the transfer without reporting an error
+		ctx->streamState = WRC__STREAM_ABORT_GRACEFULLY;
+		return false;
+	}
+
+	if(p->len >= WRC__PROBE_MAX_BYTES)
+	{
+		WRC__errorReset(ctx, WRC_ERR_CORRUPT_STREAM, "No %s header found in the first %d bytes",
+		                ctx->contentType == WRC_CONTENT_MP3 ? "MP3 frame" : "Vorbis", WRC__PROBE_MAX_BYTES);
+		return false;
+	}
+
+	return true;
+}
+
+static char* copyStr(const char* str)
+{
+	if(str == NULL)
+		return NULL;
+
+	size_t len = strlen(str) + 1;
+	char* ret = malloc(len);
+	if(ret != NULL)
+		memcpy(ret, str, len);
+	return ret;
+}
+
+// curl's times are in microseconds since the transfer started
+static int transferTimeMs(CURL* curl, CURLINFO info)
+{
+	curl_off_t us = 0;
+	if(curl_easy_getinfo(curl, info, &us) != CURLE_OK || us <= 0)
+		return -1;
+	return (int)(us / 1000);
+}
+
+void WRC__probeFinish(WRC_Stream* ctx)
+{
+	struct WRC__Probe* p = ctx->probe;
+	WRC_ProbeResult* r = &p->result;
+
+	r->streamURL = copyStr(ctx->url);
+	r->viaPlaylist = ctx->resolvedPlaylist;
+	r->contentType = copyStr(ctx->contentTypeHeaderVal);
+	r->icyName = copyStr(ctx->icyName);
+	r->icyGenre = copyStr(ctx->icyGenre);
+	r->icyDescription = copyStr(ctx->icyDescription);
+	r->icyURL = copyStr(ctx->icyURL);
+	r->icyMetaInt = ctx->icyMetaInt;
+	if(r->bitrate == 0)
+		r->bitrate = ctx->icyBitrate;
+
+	r->dnsMs = r->connectMs = r->tlsMs = r->firstByteMs = -1;
+	if(ctx->curl != NULL)
+	{
+		r->dnsMs = transferTimeMs(ctx->curl, CURLINFO_NAMELOOKUP_TIME_T);
+		r->connectMs = transferTimeMs(ctx->curl, CURLINFO_CONNECT_TIME_T);
+		r->tlsMs = transferTimeMs(ctx->curl, CURLINFO_APPCONNECT_TIME_T);
+		r->firstByteMs = transferTimeMs(ctx->curl, CURLINFO_STARTTRANSFER_TIME_T);
+	}
+	r->totalMs = (int)(WRC__timeMs() - p->startTime);
+
+	if(r->codec != WRC_CODEC_UNKNOWN)
+	{
+		r->error = WRC_ERR_NOERROR;
+	}
+	else if(r->error == WRC_ERR_NOERROR)
+	{
+		// the server closed the connection before sending enough
+		r->error = WRC_ERR_UNAVAILABLE;
+		WRC__snprintf(p->errorMsg, sizeof(p->errorMsg), "The stream ended before its format was known");
+	}
+}
+
+static void probeErrorFun(void* userdata, int errorCode, const char* errormsg)
+{
+	struct WRC__Probe* p = (struct WRC__Probe*)userdata;
+
+	// the first error is the interesting one
+	if(p->result.error == WRC_ERR_NOERROR)
+	{
+		p->result.error = errorCode;
+		WRC__snprintf(p->errorMsg, sizeof(p->errorMsg), "%s", errormsg);
+	}
+}
+
+static void freeResult(WRC_ProbeResult* r)
+{
+	free((char*)r->streamURL);
+	free((char*)r->contentType);
+	free((char*)r->icyName);
+	free((char*)r->icyGenre);
+	free((char*)r->icyDescription);
+	free((char*)r->icyURL);
+}
+
+static void deliverResult(struct WRC__Probe* p)
+{
+	struct WRC__ProbeBatch* batch = p->batch;
+
+	p->result.url = batch->urls[p->index];
+	p->result.errorMsg = (p->result.error != WRC_ERR_NOERROR) ? p->errorMsg : NULL;
+	batch->resultCB(batch->userdata, p->index, &p->result);
+	freeResult(&p->result);
+}
+
+// starts probing the next URL with p, returns false if there are no more URLs
+static bool startNextProbe(struct WRC__Probe* p);
+
+static void probeFinishedFun(void* userdata, int result)
+{
+	struct WRC__Probe* p = (struct WRC__Probe*)userdata;
+
+	deliverResult(p);
+
+	// the group doesn't use the stream anymore after calling this
+	WRC_CleanupStream(p->stream);
+	p->stream = NULL;
+
+	if(!startNextProbe(p))
+	{
+		free(p->buf);
+		free(p);
+	}
+}
+
+static bool startNextProbe(struct WRC__Probe* p)
+{
+	struct WRC__ProbeBatch* batch = p->batch;
+
+	while(batch->nextURL < batch->numURLs)
+	{
+		unsigned char* buf = p->buf;
+		memset(p, 0, sizeof(*p));
+		p->batch = batch;
+		p->buf = buf;
+		p->index = batch->nextURL++;
+		p->timeoutMs = batch->timeoutMs;
+		p->startTime = WRC__timeMs();
+
+		p->stream = WRC_CreateStream(batch->urls[p->index], NULL, NULL, p);
+		if(p->stream != NULL)
+		{
+			p->stream->probe = p;
+			WRC_SetErrorReportingCallback(p->stream, probeErrorFun);
+			if(WRC_AddStreamToGroup(batch->group, p->stream))
+				return true;
+
+			WRC_CleanupStream(p->stream);
+			p->stream = NULL;
+		}
+
+		p->result.error = WRC_ERR_GENERIC;
+		WRC__snprintf(p->errorMsg, sizeof(p->errorMsg), "Couldn't create the stream (URL too long?)");
+		deliverResult(p);
+	}
+	return false;
+}
+
+int WRC_ProbeStations(const char* const* urls, size_t numURLs, int maxConcurrent, int timeoutMs,
+                      WRC_probeResultCB resultFn, void* userdata)
+{
+	if(resultFn == NULL || maxConcurrent <= 0)
+	{
+		eprintf("WRC_ProbeStations(): resultFn must be set and maxConcurrent must be > 0!\n");
+		return 0;
+	}
+
+	struct WRC__ProbeBatch batch;
+	memset(&batch, 0, sizeof(batch));
+	batch.urls = urls;
+	batch.numURLs = numURLs;
+	batch.timeoutMs = timeoutMs;
+	batch.resultCB = resultFn;
+	batch.userdata = userdata;
+
+	batch.group = WRC_CreateStreamGroup(probeFinishedFun);
+	if(batch.group == NULL)
+	{
+		return 0;
+	}
+	WRC__stopGroupWhenEmpty(batch.group);
+
+	int started = 0;
+	for(int i=0; i < maxConcurrent && batch.nextURL < numURLs; ++i)
+	{
+		struct WRC__Probe* p = calloc(1, sizeof(struct WRC__Probe));
+		if(p != NULL)
+			p->buf = malloc(WRC__PROBE_MAX_BYTES);
+		if(p == NULL || p->buf == NULL)
+		{
+			eprintf("WRC_ProbeStations(): Out of Memory!\n");
+			free(p);
+			break;
+		}
+
+		p->batch = &batch;
+		if(startNextProbe(p))
+		{
+			++started;
+		}
+		else
+		{
+			free(p->buf);
+			free(p);
+		}
+	}
+
+	if(started == 0 && batch.nextURL < numURLs)
+	{
+		// couldn't even allocate one probe
+		WRC_CleanupStreamGroup(batch.group);
+		return 0;
+	}
+
+	// returns once all probes are done, each one frees itself after the last URL
+	WRC_RunStreamGroup(batch.group);
+	WRC_CleanupStreamGroup(batch.group);
+
+	return 1;
+}
@@ -0,0 +1,220 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// automatic reconnects (see WRC_SetReconnectPolicy()): when the connection of a
+// stream that was already playing drops, the same curl handle is performed again
+// after a backoff delay. The decoder and jitter buffer are kept (the decoder thread
+// finishes the old connection's data and is started again), so the user doesn't
+// notice more than a short gap.
+
+#include "internal.h"
+
+// decides how to handle the end of a transfer
+static bool shouldReconnect(WRC_Stream* ctx)
+{
+	if(ctx->reconnectMaxAttempts == 0 || ctx->userAbort || ctx->curl == NULL)
+		return false;
+
+	if(ctx->streamState >= WRC__STREAM_ABORT_GRACEFULLY)
+		return false; // a decoding error or the user only wanted the metadata
+
+	if(ctx->reconnecting)
+		return true; // the last reconnect attempt failed, try again (if attempts are left)
+
+	// only reconnect if we were already playing, connection failures at the beginning
+	// (wrong URL etc) are reported right away. a radio stream never ends, so when
+	// the server closes the connection without an error that's a drop, too.
+	return ctx->streamState == WRC__STREAM_MUSIC;
+}
+
+// a simple xorshift, so we don't mess with the user's rand() state
+static uint32_t nextRandom(WRC_Stream* ctx)
+{
+	uint32_t x = ctx->reconnectRandom;
+	if(x == 0)
+		x = (uint32_t)WRC__timeMs() ^ (uint32_t)(uintptr_t)ctx ^ 0x9E3779B9u;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	ctx->reconnectRandom = x;
+	return x;
+}
+
+static int backoffDelayMs(WRC_Stream* ctx, int attempt)
+{
+	uint64_t delay = (uint64_t)ctx->reconnectInitialDelayMs;
+	for(int i=1; i < attempt && delay < (uint64_t)ctx->reconnectMaxDelayMs; ++i)
+		delay *= 2;
+
+	if(delay > (uint64_t)ctx->reconnectMaxDelayMs)
+		delay = ctx->reconnectMaxDelayMs;
+
+	if(ctx->reconnectJitterPercent > 0 && delay > 0)
+	{
+		// +/- jitterPercent, so many clients of a restarted server don't all come back at once
+		uint64_t range = delay * ctx->reconnectJitterPercent / 100;
+		uint64_t offset = nextRandom(ctx) % (2 * range + 1);
+		delay = delay - range + offset;
+	}
+
+	return (int)delay;
+}
+
+static bool strEqual(const char* a, const char* b)
+{
+	if(a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static void freePrevStationInfo(WRC_Stream* ctx)
+{
+	free(ctx->prevIcyName);
+	free(ctx->prevIcyGenre);
+	free(ctx->prevIcyURL);
+	free(ctx->prevIcyDescription);
+	ctx->prevIcyName = NULL;
+	ctx->prevIcyGenre = NULL;
+	ctx->prevIcyURL = NULL;
+	ctx->prevIcyDescription = NULL;
+}
+
+void WRC__beginConnectionSwitch(WRC_Stream* ctx)
+{
+	if(!ctx->reconnecting)
+	{
+		ctx->reconnecting = true;
+		ctx->reconnectDropTime = WRC__timeMs();
+		ctx->reconnectAttempt = 0;
+
+		// remember what we had, so WRC__reconnected() can tell if anything changed
+		freePrevStationInfo(ctx);
+		ctx->prevIcyName = ctx->icyName;
+		ctx->prevIcyGenre = ctx->icyGenre;
+		ctx->prevIcyURL = ctx->icyURL;
+		ctx->prevIcyDescription = ctx->icyDescription;
+		ctx->icyName = NULL;
+		ctx->icyGenre = NULL;
+		ctx->icyURL = NULL;
+		ctx->icyDescription = NULL;
+		ctx->prevContentType = ctx->contentType;
+	}
+
+	// the decoder thread must be done with the old connection's data before ctx->decode
+	// changes below, so it decodes what's left in the ring and exits. the new connection's
+	// data starts it again
+	WRC__stopDecoderThread(ctx, false);
+
+	// the new connection sends its own headers, until then we don't know what it is
+	WRC__resetConnection(ctx);
+	ctx->contentType = WRC_CONTENT_UNKNOWN;
+	ctx->decode = NULL;
+	ctx->ingest = NULL;
+	ctx->ingestBuffer = NULL;
+	ctx->ingestWrote = NULL;
+}
+
+void WRC__reconnectContentType(WRC_Stream* ctx, enum WRC__CONTENT_TYPE contentType)
+{
+	if(!ctx->reconnecting || contentType == ctx->prevContentType)
+		return;
+
+	// the decoder for the old format must go before the new one is set up (and calls
+	// initAudioCB). WRC__beginConnectionSwitch() let the decoder thread finish already
+	WRC__stopDecoderThread(ctx, false);
+	if(ctx->shutdown != NULL)
+	{
+		ctx->shutdown(ctx);
+		ctx->shutdown = NULL;
+		ctx->discardInput = NULL;
+	}
+}
+
+bool WRC__prepareReconnect(WRC_Stream* ctx)
+{
+	if(!shouldReconnect(ctx))
+		return false;
+
+	if(ctx->reconnecting && ctx->reconnectMaxAttempts > 0
+	   && ctx->reconnectAttempt >= ctx->reconnectMaxAttempts)
+	{
+		// give up, the error is reported like without reconnects
+		return false;
+	}
+
+	WRC__beginConnectionSwitch(ctx);
+
+	++ctx->reconnectAttempt;
+	++ctx->reconnectAttempts;
+
+	ctx->reconnectAt = WRC__timeMs() + backoffDelayMs(ctx, ctx->reconnectAttempt);
+	ctx->reconnectPending = true;
+
+	return true;
+}
+
+bool WRC__reconnected(WRC_Stream* ctx)
+{
+	if(ctx->decode == NULL)
+	{
+		// no (supported) content-type, probably an error page of a server that's restarting
+		return false;
+	}
+
+	if(!strEqual(ctx->icyName, ctx->prevIcyName) || !strEqual(ctx->icyGenre, ctx->prevIcyGenre)
+	   || !strEqual(ctx->icyURL, ctx->prevIcyURL) || !strEqual(ctx->icyDescription, ctx->prevIcyDescription))
+	{
+		WRC__sendStationInfo(ctx);
+	}
+	freePrevStationInfo(ctx);
+
+	ctx->reconnecting = false;
+
+	if(ctx->standby.failingOver)
+	{
+		WRC__failoverDone(ctx);
+	}
+	else
+	{
+		++ctx->reconnects;
+		ctx->lastRecoveryMs = WRC__timeMs() - ctx->reconnectDropTime;
+	}
+
+	return true;
+}
+
+void WRC__resetReconnect(WRC_Stream* ctx)
+{
+	freePrevStationInfo(ctx);
+	ctx->reconnecting = false;
+	ctx->reconnectPending = false;
+	ctx->reconnectAttempt = 0;
+}
+
+int WRC_SetReconnectPolicy(WRC_Stream* stream, int maxAttempts, int initialDelayMs,
+                           int maxDelayMs, int jitterPercent)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetReconnectPolicy(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(initialDelayMs < 0 || maxDelayMs < initialDelayMs || jitterPercent < 0 || jitterPercent > 100)
+	{
+		eprintf("WRC_SetReconnectPolicy(): invalid arguments!\n");
+		return 0;
+	}
+
+	stream->reconnectMaxAttempts = maxAttempts;
+	stream->reconnectInitialDelayMs = initialDelayMs;
+	stream->reconnectMaxDelayMs = maxDelayMs;
+	stream->reconnectJitterPercent = jitterPercent;
+
+	return 1;
+}
@@ -0,0 +1,411 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// fixed output format (see WRC_SetFixedOutput()): the decoded samples are converted
+// to the requested number of channels and resampled with a polyphase windowed-sinc
+// filter (Blackman window), the dot products are done with SIMD (see pcmconv.c).
+// The input samples are kept in hist (one array per channel), for each output sample
+// the filter phase closest to its position between two input samples is used.
+// Drift compensation (see drift.c) also uses the resampler, then the output format
+// follows the stream's format unless WRC_SetFixedOutput() is used, and the ratio is
+// adjusted by a few ppm.
+
+#include "internal.h"
+
+#include <math.h>
+
+#define WRC__PI 3.14159265358979323846
+
+// taps must be a multiple of 8 for WRC__dotProduct()
+static const struct { int taps; int phaseBits; } qualities[] = {
+	{  8,  6 }, // WRC_RESAMPLE_FAST
+	{ 16,  8 }, // WRC_RESAMPLE_MEDIUM
+	{ 32, 10 }  // WRC_RESAMPLE_BEST
+};
+
+// the right channel of vorbis' channel layouts with more than 2 channels (the left one is always 0)
+static const int vorbisRight[9] = { 0, 0, 1, 2, 1, 2, 2, 2, 2 };
+
+static double sinc(double x)
+{
+	return (x == 0.0) ? 1.0 : sin(WRC__PI*x) / (WRC__PI*x);
+}
+
+static void buildFilter(struct WRC__Resampler* rs)
+{
+	int numPhases = 1 << rs->phaseBits;
+	int half = rs->taps / 2;
+	// relative to the input's nyquist frequency, lower when downsampling to prevent aliasing.
+	// a bit below that, because the transition band of short filters is wide
+	double cutoff = (rs->outRate < rs->inRate) ? (double)rs->outRate / rs->inRate : 1.0;
+	cutoff *= 0.92;
+
+	for(int p=0; p < numPhases; ++p)
+	{
+		// phase p is for output samples at half-1 + p/numPhases
+		double frac = (double)p / numPhases;
+		float* coeffs = rs->filter + p * rs->taps;
+		double sum = 0.0;
+
+		for(int k=0; k < rs->taps; ++k)
+		{
+			double d = k - (half - 1) - frac; // distance of input sample k from the output sample
+			double x = d / half;
+			double window = 0.42 + 0.5*cos(WRC__PI*x) + 0.08*cos(2.0*WRC__PI*x);
+			double h = cutoff * sinc(cutoff * d) * window;
+			coeffs[k] = (float)h;
+			sum += h;
+		}
+
+		// so each phase has a gain of 1 for DC
+		for(int k=0; k < rs->taps; ++k)
+		{
+			coeffs[k] = (float)(coeffs[k] / sum);
+		}
+	}
+}
+
+// passes the resampled samples in out on in the output format
+static bool flushOut(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+
+	if(rs->outLen == 0)
+		return true;
+
+	size_t numSamples = rs->outLen * rs->outChannels;
+	rs->outLen = 0;
+
+	if(ctx->outFormat == WRC_FMT_F32)
+	{
+		return WRC__outputSamples(ctx, rs->out, numSamples);
+	}
+
+	// interleaved samples are just one long channel for the converters
+	union WRC__SampleBuf buf;
+	float* src[1] = { rs->out };
+	if(ctx->outFormat == WRC_FMT_S32)
+		WRC__floatToInt32(buf.s32, src, 1, (int)numSamples);
+	else
+		WRC__floatToInt16(buf.s16, src, 1, (int)numSamples);
+
+	return WRC__outputSamples(ctx, &buf, numSamples);
+}
+
+// calculates all output samples that hist has enough input for
+static bool produce(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+	int numWork = rs->workChannels;
+	int numOut = rs->outChannels;
+	size_t maxOutFrames = WRC__decBufSize / numOut;
+
+	while((size_t)(rs->pos >> 32) + rs->taps <= rs->histLen)
+	{
+		size_t base = (size_t)(rs->pos >> 32);
+		uint32_t phase = (rs->phaseBits > 0) ? ((uint32_t)rs->pos >> (32 - rs->phaseBits)) : 0;
+		const float* coeffs = rs->filter + phase * rs->taps;
+		float* dst = rs->out + rs->outLen * numOut;
+
+		for(int c=0; c < numWork; ++c)
+		{
+			const float* in = rs->hist + c * rs->histCap + base;
+			dst[c] = rs->passthrough ? in[0] : WRC__dotProduct(in, coeffs, rs->taps);
+		}
+		for(int c=numWork; c < numOut; ++c)
+		{
+			// mono is played on all channels, additional channels are silent otherwise
+			dst[c] = (numWork == 1) ? dst[0] : 0.0f;
+		}
+
+		rs->pos += rs->step;
+		if(++rs->outLen == maxOutFrames && !flushOut(ctx))
+			return false;
+	}
+
+	// throw away the input samples that aren't needed anymore
+	size_t consumed = (size_t)(rs->pos >> 32);
+	if(consumed > rs->histLen)
+		consumed = rs->histLen;
+
+	if(consumed > 0)
+	{
+		for(int c=0; c < numWork; ++c)
+		{
+			float* h = rs->hist + c * rs->histCap;
+			memmove(h, h + consumed, (rs->histLen - consumed) * sizeof(float));
+		}
+		rs->histLen -= consumed;
+		rs->pos -= (uint64_t)consumed << 32;
+	}
+	return true;
+}
+
+// the input channel used for work channel c
+static int inputChannel(struct WRC__Resampler* rs, int c)
+{
+	if(c == 1 && rs->outChannels == 2 && rs->inChannels > 2 && rs->inChannels <= 8)
+		return vorbisRight[rs->inChannels];
+	return c;
+}
+
+// appends numFrames frames (from start on) to hist
+static void appendInput(struct WRC__Resampler* rs, float** planar, const float* interleaved,
+                        size_t start, size_t numFrames)
+{
+	int inCh = rs->inChannels;
+
+	for(int c=0; c < rs->workChannels; ++c)
+	{
+		float* dst = rs->hist + c * rs->histCap + rs->histLen;
+
+		if(rs->workChannels == 1 && inCh > 1)
+		{
+			// downmix to mono
+			float scale = 1.0f / inCh;
+			for(size_t i=0; i < numFrames; ++i)
+			{
+				float sum = 0.0f;
+				for(int ic=0; ic < inCh; ++ic)
+					sum += planar ? planar[ic][start+i] : interleaved[(start+i)*inCh + ic];
+				dst[i] = sum * scale;
+			}
+			continue;
+		}
+
+		int ic = inputChannel(rs, c);
+		if(planar != NULL)
+		{
+			memcpy(dst, planar[ic] + start, numFrames * sizeof(float));
+		}
+		else
+		{
+			for(size_t i=0; i < numFrames; ++i)
+				dst[i] = interleaved[(start+i)*inCh + ic];
+		}
+	}
+	rs->histLen += numFrames;
+}
+
+bool WRC__resample(WRC_Stream* ctx, float** planar, const float* interleaved, size_t numFrames)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+	size_t done = 0;
+
+	WRC__driftUpdate(ctx);
+
+	while(done < numFrames)
+	{
+		size_t n = rs->histCap - rs->histLen;
+		if(n > numFrames - done)
+			n = numFrames - done;
+
+		appendInput(rs, planar, interleaved, done, n);
+		done += n;
+
+		if(!produce(ctx))
+			return false;
+	}
+
+	return flushOut(ctx);
+}
+
+// resamples the samples still in hist, so the end of the old format isn't cut off
+static bool drain(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+
+	if(!rs->passthrough)
+	{
+		int pad = rs->taps / 2;
+		for(int c=0; c < rs->workChannels; ++c)
+		{
+			memset(rs->hist + c * rs->histCap + rs->histLen, 0, pad * sizeof(float));
+		}
+		rs->histLen += pad;
+
+		if(!produce(ctx))
+			return false;
+	}
+	return flushOut(ctx);
+}
+
+// the buffers that depend on the input format
+static void freeFormat(struct WRC__Resampler* rs)
+{
+	free(rs->filter);
+	free(rs->hist);
+	rs->filter = NULL;
+	rs->hist = NULL;
+}
+
+bool WRC__setResamplerInput(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+
+	if(ctx->sampleRate == rs->inRate && ctx->numChannels == rs->inChannels)
+		return true;
+
+	if(rs->inRate != 0 && !drain(ctx))
+		return false;
+
+	if(rs->followInput && (rs->outRate != ctx->sampleRate || rs->outChannels != ctx->numChannels))
+	{
+		// only for drift compensation, the user must be told about the new format
+		rs->outRate = ctx->sampleRate;
+		rs->outChannels = ctx->numChannels;
+		rs->audioInitDone = false;
+	}
+
+	rs->inRate = ctx->sampleRate;
+	rs->inChannels = ctx->numChannels;
+	rs->workChannels = WRC__min(rs->inChannels, rs->outChannels);
+	// with drift compensation the ratio is never exactly 1
+	rs->passthrough = (rs->inRate == rs->outRate) && !ctx->drift.enabled;
+	rs->taps = rs->passthrough ? 1 : qualities[rs->quality].taps;
+	rs->phaseBits = rs->passthrough ? 0 : qualities[rs->quality].phaseBits;
+	rs->histCap = rs->taps + WRC__decBufSize;
+
+	freeFormat(rs);
+	rs->filter = malloc(((size_t)1 << rs->phaseBits) * rs->taps * sizeof(float));
+	rs->hist = malloc(rs->workChannels * rs->histCap * sizeof(float));
+	if(rs->filter == NULL || rs->hist == NULL)
+	{
+		freeFormat(rs);
+		WRC__resetResampler(ctx);
+		WRC__errorReset(ctx, WRC_ERR_GENERIC, "Out of Memory when setting up the resampler!");
+		return false;
+	}
+
+	if(rs->passthrough)
+	{
+		rs->filter[0] = 1.0f;
+		rs->histLen = 0;
+	}
+	else
+	{
+		buildFilter(rs);
+		// the first output sample is at position half-1 of the filter, so the first
+		// input sample must be there, too
+		rs->histLen = rs->taps/2 - 1;
+		for(int c=0; c < rs->workChannels; ++c)
+		{
+			memset(rs->hist + c * rs->histCap, 0, rs->histLen * sizeof(float));
+		}
+	}
+
+	rs->pos = 0;
+	rs->baseStep = ((uint64_t)rs->inRate << 32) / rs->outRate;
+	rs->step = rs->baseStep;
+	rs->outLen = 0;
+	WRC__setResamplerRatio(ctx, ctx->drift.correctionPpm);
+
+	return true;
+}
+
+void WRC__setResamplerRatio(WRC_Stream* ctx, double ppm)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+
+	if(rs->passthrough || rs->inRate == 0)
+		return;
+
+	// positive ppm => advance faster through the input => fewer output samples
+	rs->step = rs->baseStep + (int64_t)(rs->baseStep * ppm * 1e-6);
+}
+
+bool WRC__updateResamplerMode(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+
+	rs->enabled = rs->fixed || ctx->drift.enabled;
+	rs->followInput = !rs->fixed;
+	if(rs->followInput)
+	{
+		// the ratio only changes by a few ppm, this is plenty
+		rs->quality = WRC_RESAMPLE_MEDIUM;
+	}
+
+	if(!rs->enabled)
+	{
+		// most streams don't use it, so they don't need the memory
+		WRC__cleanupResampler(ctx);
+		return true;
+	}
+
+	if(rs->out == NULL)
+	{
+		rs->out = malloc(WRC__decBufSize * sizeof(float));
+		if(rs->out == NULL)
+		{
+			rs->enabled = false;
+			return false;
+		}
+	}
+	WRC__resetResampler(ctx);
+	return true;
+}
+
+void WRC__resetResampler(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+
+	rs->inRate = 0;
+	rs->inChannels = 0;
+	rs->histLen = 0;
+	rs->outLen = 0;
+	rs->audioInitDone = false;
+}
+
+void WRC__cleanupResampler(WRC_Stream* ctx)
+{
+	struct WRC__Resampler* rs = &ctx->resampler;
+
+	freeFormat(rs);
+	free(rs->out);
+	rs->out = NULL;
+	WRC__resetResampler(ctx);
+}
+
+int WRC_SetFixedOutput(WRC_Stream* stream, int sampleRate, int numChannels, int quality)
+{
+	struct WRC__Resampler* rs = &stream->resampler;
+
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetFixedOutput(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	if(sampleRate <= 0)
+	{
+		rs->fixed = false;
+		WRC__updateResamplerMode(stream);
+		return 1;
+	}
+
+	if(numChannels < 1 || numChannels > WRC__MAX_CHANNELS-1
+	   || quality < WRC_RESAMPLE_FAST || quality > WRC_RESAMPLE_BEST)
+	{
+		eprintf("WRC_SetFixedOutput(): invalid arguments!\n");
+		return 0;
+	}
+
+	rs->fixed = true;
+	rs->outRate = sampleRate;
+	rs->outChannels = numChannels;
+	rs->quality = quality;
+	if(!WRC__updateResamplerMode(stream))
+	{
+		rs->fixed = false;
+		eprintf("WRC_SetFixedOutput(): Out of Memory!\n");
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,341 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// resolution cache (see WRC_EnableResolveCache()): remembers which stream URL a
+// stream's URL led to (through a playlist and/or redirects), so the next time
+// the stream is started it connects there right away. If that fails before any
+// audio arrived, the entry is dropped and the URL is resolved again.
+// The cache is shared by all streams and optionally kept in a file:
+// one line per entry, "<expiry (unix time)>\t<URL>\t<stream URL>\t<content-type>"
+
+#include "internal.h"
+
+#include <time.h>
+
+#define WRC__RESOLVE_CACHE_SIZE 256
+
+struct WRC__ResolveEntry
+{
+	char* url; // what the stream was created with
+	char* target; // where the audio came from
+	char* contentType;
+	int64_t expires; // unix time
+};
+
+static struct
+{
+	WRC__Mutex lock; // the cache is used by the threads of all streams
+	bool enabled;
+	int ttlSeconds;
+	char* path; // NULL if it's only kept in memory
+	struct WRC__ResolveEntry entries[WRC__RESOLVE_CACHE_SIZE];
+	int numEntries;
+} cache;
+
+static char* copyStr(const char* str)
+{
+	size_t len = strlen(str);
+	char* ret = malloc(len+1);
+	if(ret != NULL)
+		memcpy(ret, str, len+1);
+	return ret;
+}
+
+static void freeEntry(struct WRC__ResolveEntry* e)
+{
+	free(e->url);
+	free(e->target);
+	free(e->contentType);
+	memset(e, 0, sizeof(*e));
+}
+
+static void removeEntry(int idx)
+{
+	freeEntry(&cache.entries[idx]);
+	cache.entries[idx] = cache.entries[--cache.numEntries];
+	memset(&cache.entries[cache.numEntries], 0, sizeof(cache.entries[0]));
+}
+
+static void clearEntries(void)
+{
+	for(int i=0; i < cache.numEntries; ++i)
+		freeEntry(&cache.entries[i]);
+	cache.numEntries = 0;
+}
+
+// the entry for url that hasn't expired yet, -1 if there is none
+static int findEntry(const char* url, int64_t now)
+{
+	for(int i=0; i < cache.numEntries; ++i)
+	{
+		if(strcmp(cache.entries[i].url, url) == 0)
+			return (cache.entries[i].expires > now) ? i : -1;
+	}
+	return -1;
+}
+
+static int findAnyEntry(const char* url)
+{
+	for(int i=0; i < cache.numEntries; ++i)
+	{
+		if(strcmp(cache.entries[i].url, url) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static bool addEntry(const char* url, const char* target, const char* contentType, int64_t expires)
+{
+	int idx = findAnyEntry(url);
+	if(idx < 0)
+	{
+		if(cache.numEntries == WRC__RESOLVE_CACHE_SIZE)
+		{
+			// make room by dropping the one that expires first
+			int oldest = 0;
+			for(int i=1; i < cache.numEntries; ++i)
+			{
+				if(cache.entries[i].expires < cache.entries[oldest].expires)
+					oldest = i;
+			}
+			removeEntry(oldest);
+		}
+		idx = cache.numEntries;
+	}
+
+	struct WRC__ResolveEntry e;
+	e.url = copyStr(url);
+	e.target = copyStr(target);
+	e.contentType = copyStr(contentType);
+	e.expires = expires;
+	if(e.url == NULL || e.target == NULL || e.contentType == NULL)
+	{
+		freeEntry(&e);
+		return false;
+	}
+
+	if(idx == cache.numEntries)
+		++cache.numEntries;
+	else
+		freeEntry(&cache.entries[idx]);
+	cache.entries[idx] = e;
+	return true;
+}
+
+static void loadFile(void)
+{
+	FILE* f = fopen(cache.path, "r");
+	if(f == NULL)
+		return; // not written yet
+
+	int64_t now = (int64_t)time(NULL);
+	char line[3*2048 + 256];
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		char* fields[4];
+		int numFields = 1;
+		fields[0] = line;
+		for(char* c = line; *c != '\0' && numFields < 4; ++c)
+		{
+			if(*c == '\t')
+			{
+				*c = '\0';
+				fields[numFields++] = c+1;
+			}
+		}
+		if(numFields < 4)
+			continue; // broken (or too long) line
+		fields[3][strcspn(fields[3], "\r\n")] = '\0';
+
+		int64_t expires = strtoll(fields[0], NULL, 10);
+		if(expires > now)
+		{
+			addEntry(fields[1], fields[2], fields[3], expires);
+		}
+	}
+	fclose(f);
+}
+
+// writes the entries to a temporary file first, so a crash never leaves a half-written cache
+static void saveFile(void)
+{
+	if(cache.path == NULL)
+		return;
+
+	size_t pathLen = strlen(cache.path);
+	char* tmpPath = malloc(pathLen + 5);
+	if(tmpPath == NULL)
+		return;
+	memcpy(tmpPath, cache.path, pathLen);
+	memcpy(tmpPath + pathLen, ".tmp", 5);
+
+	FILE* f = fopen(tmpPath, "w");
+	if(f == NULL)
+	{
+		eprintf("Writing resolve cache %s failed!\n", tmpPath);
+		free(tmpPath);
+		return;
+	}
+
+	int64_t now = (int64_t)time(NULL);
+	for(int i=0; i < cache.numEntries; ++i)
+	{
+		struct WRC__ResolveEntry* e = &cache.entries[i];
+		if(e->expires > now)
+			fprintf(f, "%lld\t%s\t%s\t%s\n", (long long)e->expires, e->url, e->target, e->contentType);
+	}
+
+	bool ok = (fclose(f) == 0);
+#ifdef _WIN32
+	remove(cache.path); // rename() doesn't replace files on windows
+#endif
+	if(!ok || rename(tmpPath, cache.path) != 0)
+	{
+		eprintf("Writing resolve cache %s failed!\n", cache.path);
+		remove(tmpPath);
+	}
+	free(tmpPath);
+}
+
+void WRC__initResolveCache(void)
+{
+	WRC__mutexInit(&cache.lock);
+}
+
+void WRC__cleanupResolveCache(void)
+{
+	clearEntries();
+	free(cache.path);
+	cache.path = NULL;
+	cache.enabled = false;
+	WRC__mutexDestroy(&cache.lock);
+}
+
+void WRC__beginResolve(WRC_Stream* ctx)
+{
+	struct WRC__Resolve* res = &ctx->resolve;
+
+	// remembered even without the cache, so the stream starts from it again next time
+	free(res->url);
+	res->url = copyStr(ctx->url);
+	res->fromCache = false;
+	res->stored = false;
+
+	if(res->url == NULL)
+		return;
+
+	WRC__mutexLock(&cache.lock);
+	if(cache.enabled)
+	{
+		int idx = findEntry(ctx->url, (int64_t)time(NULL));
+		if(idx >= 0 && strlen(cache.entries[idx].target) < sizeof(ctx->url))
+		{
+			strcpy(ctx->url, cache.entries[idx].target);
+			res->fromCache = true;
+		}
+	}
+	WRC__mutexUnlock(&cache.lock);
+}
+
+void WRC__resolveCacheStore(WRC_Stream* ctx)
+{
+	struct WRC__Resolve* res = &ctx->resolve;
+
+	if(res->url == NULL || res->stored || ctx->reconnecting || ctx->decode == NULL || ctx->curl == NULL)
+		return;
+	res->stored = true; // only for the first connection that delivers audio
+
+	char* target = NULL;
+	curl_easy_getinfo(ctx->curl, CURLINFO_EFFECTIVE_URL, &target);
+	if(target == NULL || strcmp(target, res->url) == 0 || strlen(target) >= sizeof(ctx->url))
+		return; // nothing to skip next time
+
+	const char* contentType = (ctx->contentTypeHeaderVal != NULL) ? ctx->contentTypeHeaderVal : "";
+
+	WRC__mutexLock(&cache.lock);
+	if(cache.enabled)
+	{
+		int64_t expires = (int64_t)time(NULL) + cache.ttlSeconds;
+		int idx = findAnyEntry(res->url);
+		if(idx >= 0 && strcmp(cache.entries[idx].target, target) == 0
+		   && strcmp(cache.entries[idx].contentType, contentType) == 0)
+		{
+			// still right, the file is only rewritten when something changed
+			cache.entries[idx].expires = expires;
+		}
+		else if(addEntry(res->url, target, contentType, expires))
+		{
+			saveFile();
+		}
+	}
+	WRC__mutexUnlock(&cache.lock);
+}
+
+bool WRC__resolveCacheFallback(WRC_Stream* ctx)
+{
+	struct WRC__Resolve* res = &ctx->resolve;
+
+	if(!res->fromCache || !WRC__failedBeforeAudio(ctx))
+		return false;
+
+	WRC__mutexLock(&cache.lock);
+	int idx = findAnyEntry(res->url);
+	if(idx >= 0)
+	{
+		removeEntry(idx);
+		saveFile();
+	}
+	WRC__mutexUnlock(&cache.lock);
+
+	strcpy(ctx->url, res->url);
+	res->fromCache = false;
+	return true;
+}
+
+void WRC__endResolve(WRC_Stream* ctx)
+{
+	struct WRC__Resolve* res = &ctx->resolve;
+
+	if(res->url != NULL)
+	{
+		strcpy(ctx->url, res->url);
+		free(res->url);
+		res->url = NULL;
+	}
+	res->fromCache = false;
+	res->stored = false;
+}
+
+int WRC_EnableResolveCache(int ttlSeconds, const char* filePath)
+{
+	char* path = NULL;
+	if(ttlSeconds > 0 && filePath != NULL)
+	{
+		path = copyStr(filePath);
+		if(path == NULL)
+		{
+			eprintf("WRC_EnableResolveCache(): Out of Memory!\n");
+			return 0;
+		}
+	}
+
+	WRC__mutexLock(&cache.lock);
+
+	clearEntries();
+	free(cache.path);
+	cache.path = path;
+	cache.enabled = (ttlSeconds > 0);
+	cache.ttlSeconds = ttlSeconds;
+	if(cache.path != NULL)
+	{
+		loadFile();
+	}
+
+	WRC__mutexUnlock(&cache.lock);
+	return 1;
+}
@@ -0,0 +1,108 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// lock-free ring buffer for exactly one producer thread and one consumer thread
+
+#include "internal.h"
+
+bool WRC__ringInit(struct WRC__SpscRing* ring, size_t size)
+{
+	size_t realSize = 1024;
+	while(realSize < size)
+	{
+		realSize *= 2;
+	}
+
+	ring->buf = malloc(realSize);
+	if(ring->buf == NULL)
+	{
+		eprintf("WRC__ringInit(): Out of Memory!\n");
+		ring->size = 0;
+		return false;
+	}
+
+	ring->size = realSize;
+	ring->writePos = 0;
+	ring->readPos = 0;
+
+	return true;
+}
+
+void WRC__ringDestroy(struct WRC__SpscRing* ring)
+{
+	free(ring->buf);
+	ring->buf = NULL;
+	ring->size = 0;
+	ring->writePos = 0;
+	ring->readPos = 0;
+}
+
+size_t WRC__ringFill(struct WRC__SpscRing* ring)
+{
+	return WRC__loadAcquire(&ring->writePos) - WRC__loadAcquire(&ring->readPos);
+}
+
+size_t WRC__ringWrite(struct WRC__SpscRing* ring, const void* data, size_t size)
+{
+	size_t writePos = ring->writePos; // only we modify it
+	size_t freeSpace = ring->size - (writePos - WRC__loadAcquire(&ring->readPos));
+
+	if(size > freeSpace)
+		size = freeSpace;
+
+	size_t idx = writePos & (ring->size - 1);
+	size_t firstPart = ring->size - idx;
+	if(firstPart > size)
+		firstPart = size;
+
+	memcpy(ring->buf + idx, data, firstPart);
+	memcpy(ring->buf, (const unsigned char*)data + firstPart, size - firstPart);
+
+	// the release makes sure the data is visible to the consumer before the new position
+	WRC__storeRelease(&ring->writePos, writePos + size);
+
+	return size;
+}
+
+size_t WRC__ringPeek(struct WRC__SpscRing* ring, void** data)
+{
+	size_t readPos = ring->readPos; // only we modify it
+	size_t fill = WRC__loadAcquire(&ring->writePos) - readPos;
+
+	size_t idx = readPos & (ring->size - 1);
+	size_t contiguous = ring->size - idx;
+
+	*data = ring->buf + idx;
+	return (fill < contiguous) ? fill : contiguous;
+}
+
+void WRC__ringConsume(struct WRC__SpscRing* ring, size_t size)
+{
+	// the release makes sure we're done reading before the producer may overwrite it
+	WRC__storeRelease(&ring->readPos, ring->readPos + size);
+}
+
+size_t WRC__ringRead(struct WRC__SpscRing* ring, void* data, size_t size)
+{
+	size_t ret = 0;
+	while(ret < size)
+	{
+		void* src;
+		size_t avail = WRC__ringPeek(ring, &src);
+		if(avail == 0)
+			break;
+
+		if(avail > size - ret)
+			avail = size - ret;
+
+		memcpy((unsigned char*)data + ret, src, avail);
+		WRC__ringConsume(ring, avail);
+		ret += avail;
+	}
+	return ret;
+}
@@ -16,24 +16,30 @@
 
 #define eprintf(...) fprintf(stderr, __VA_ARGS__)
 
-static void playbackCB_SDL(void* userdata, int16_t* samples, size_t numSamples)
+struct PlayerState
 {
-	SDL_AudioDeviceID* dev = userdata;
+	WRC_Stream* stream;
+	SDL_AudioDeviceID dev;
+	int numChannels;
+};
 
-	size_t decSize = numSamples*sizeof(int16_t);
+// called by SDL from its audio thread whenever the device needs more samples
+static void audioCallback_SDL(void* userdata, Uint8* stream, int len)
+{
+	struct PlayerState* ps = userdata;
 
-	if(SDL_QueueAudio(*dev, samples, decSize) != 0)
-	{
-		eprintf("SDL_QueueAudio(%d, buf, %zd) failed: %s\n", *dev, decSize, SDL_GetError());
-	}
+	size_t numFrames = len / (ps->numChannels * sizeof(int16_t));
+	// fills whatever isn't available with silence, see WRC_SetPullMode() below
+	WRC_ReadSamples(ps->stream, (int16_t*)stream, numFrames, 0);
 }
 
 static int initAudioCB_SDL(void* userdata, int sampleRate, int numChannels)
 {
-	SDL_AudioDeviceID* oldDev = userdata;
-	if(*oldDev != 0)
+	struct PlayerState* ps = userdata;
+	if(ps->dev != 0)
 	{
-		SDL_CloseAudioDevice(*oldDev);
+		SDL_CloseAudioDevice(ps->dev);
+		ps->dev = 0;
 	}
 
 	SDL_AudioSpec want, have;
@@ -44,7 +50,8 @@ static int initAudioCB_SDL(void* userdata, int sampleRate, int numChannels)
 	want.format = AUDIO_S16;
 	want.channels = numChannels;
 	want.samples = 4096;
-	want.callback = NULL; // I wanna use SDL_QueueAudio()
+	want.callback = audioCallback_SDL;
+	want.userdata = ps;
 	dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
 
 	if(dev == 0)
@@ -53,7 +60,8 @@ static int initAudioCB_SDL(void* userdata, int sampleRate, int numChannels)
 		return 0;
 	}
 
-	*oldDev = dev;
+	ps->dev = dev;
+	ps->numChannels = numChannels;
 
 	SDL_PauseAudioDevice(dev, 0);
 
@@ -92,18 +100,30 @@ int main(int argc, char** argv)
 
 	WRC_Init();
 
-	SDL_AudioDeviceID audioDev = 0;
-	WRC_Stream* stream = WRC_CreateStream(url, playbackCB_SDL, initAudioCB_SDL, &audioDev);
-
-	WRC_SetMetadataCallbacks(stream, stationInfoCB_SDL,  currentTitleCB_SDL);
-
-	WRC_SetErrorReportingCallback(stream, reportErrorCB_SDL);
+	struct PlayerState ps = { NULL, 0, 0 };
+	// no playback callback, SDL's audio callback fetches the samples with WRC_ReadSamples()
+	WRC_Stream* stream = WRC_CreateStream(url, NULL, initAudioCB_SDL, &ps);
 
 	if(stream != NULL)
 	{
+		ps.stream = stream;
+
+		WRC_SetMetadataCallbacks(stream, stationInfoCB_SDL,  currentTitleCB_SDL);
+
+		WRC_SetErrorReportingCallback(stream, reportErrorCB_SDL);
+
+		// buffer 500ms before starting playback, fill underruns with silence
+		WRC_SetPullMode(stream, 500, 0, 1);
+
+		// always 48kHz stereo, so the audio device doesn't need to be reopened
+		// when the format of the stream changes
+		WRC_SetFixedOutput(stream, 48000, 2, WRC_RESAMPLE_MEDIUM);
+
 		WRC_StartStreaming(stream);
 
-		if(audioDev != 0) SDL_CloseAudioDevice(audioDev);
+		if(ps.dev != 0) SDL_CloseAudioDevice(ps.dev);
+
+		WRC_CleanupStream(stream);
 	}
 
 	WRC_Shutdown();
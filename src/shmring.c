@@ -0,0 +1,560 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// shared memory sink (see WRC_SetSharedMemorySink()): the decoded samples are written
+// into a ring buffer in a memfd that another process maps with WRC_OpenShmReader().
+// The ring contains records (a WRC__ShmRecord header and its payload, 8 byte aligned)
+// for the samples, format changes and metadata, so the reader gets them in the same
+// order as the callbacks would. Records never wrap around, if one doesn't fit before
+// the end of the ring the rest is filled with a padding record.
+// Like ring.c the positions are only modified by one side each, so neither side needs a
+// lock or a syscall. The writer side has a lock though, because the metadata is written
+// by the network thread and the samples maybe by the decoder or playout thread.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for memfd_create()
+#endif
+
+#include "internal.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define WRC__SHM_MAGIC 0x50435257 // "WRCP"
+#define WRC__SHM_VERSION 1
+// the data starts at this offset, so it's page aligned
+#define WRC__SHM_HEADER_SIZE 4096
+#define WRC__SHM_MIN_SIZE (64*1024)
+
+// how often the writer checks if the reader made room
+#define WRC__SHM_POLL_MS 2
+// how long the writer waits at most for room for the WRC_SHM_END record,
+// the stream has ended already so it shouldn't wait for a reader that's gone
+#define WRC__SHM_END_WAIT_MS 1000
+
+// fills the rest of the ring when a record doesn't fit before its end, skipped by the reader
+#define WRC__SHM_PAD 0
+
+#define WRC__SHM_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+// at the start of the shared memory
+struct WRC__ShmHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t posSize; // sizeof(size_t), reader and writer must agree on it
+	uint32_t unused;
+	uint64_t size; // of the data after the header, a power of two
+
+	// like struct WRC__SpscRing, but the positions are in bytes of records
+	char pad0[WRC__CACHELINE_SIZE];
+	size_t writePos; // only modified by the writer
+	char pad1[WRC__CACHELINE_SIZE];
+	size_t readPos; // only modified by the reader
+	char pad2[WRC__CACHELINE_SIZE];
+};
+
+struct WRC__ShmRecord
+{
+	uint32_t type; // WRC_SHM_* or WRC__SHM_PAD
+	uint32_t size; // of the payload, the next record starts at the next multiple of 8
+};
+
+#define WRC__SHM_RECORD_SIZE sizeof(struct WRC__ShmRecord)
+
+// payload of WRC_SHM_FORMAT
+struct WRC__ShmFormat
+{
+	int32_t sampleRate;
+	int32_t numChannels;
+	int32_t format;
+};
+
+struct WRC__ShmReader
+{
+	struct WRC__ShmHeader* hdr;
+	unsigned char* data;
+	size_t size;
+	size_t mapSize;
+
+	size_t frameSize; // of the samples, from the last WRC_SHM_FORMAT record
+	// the record returned by the last WRC_ShmReaderNext(), 0 if it has been released
+	size_t curSize; // including header and alignment
+	uint32_t curType;
+	uint32_t curPayload;
+	size_t curOffset; // bytes of a WRC_SHM_SAMPLES record that have been released already
+};
+
+static bool isPowerOfTwo(uint64_t x)
+{
+	return x != 0 && (x & (x - 1)) == 0;
+}
+
+// ######## writer side ########
+
+// finds room for a record of at least minSize bytes (including its header) at writePos,
+// the lock must be held. returns where it starts and sets *avail to how many bytes
+// there are until the end of the ring or the reader's position.
+// waits for the reader to make room until timeoutMs (< 0 for no limit) or WRC_StopStreaming().
+static unsigned char* reserve(WRC_Stream* ctx, size_t minSize, size_t* avail, int timeoutMs)
+{
+	struct WRC__ShmSink* s = &ctx->shm;
+	uint64_t start = WRC__timeMs();
+
+	for(;;)
+	{
+		size_t writePos = s->hdr->writePos;
+		size_t used = writePos - WRC__loadAcquire(&s->hdr->readPos);
+		size_t space = (used < s->size) ? s->size - used : 0;
+		size_t idx = writePos & (s->size - 1);
+		size_t toEnd = s->size - idx;
+
+		if(toEnd < minSize && space >= toEnd)
+		{
+			// doesn't fit before the end, so pad that and continue at the beginning.
+			// everything is 8 byte aligned, so there's always room for the record header
+			struct WRC__ShmRecord pad = { WRC__SHM_PAD, (uint32_t)(toEnd - WRC__SHM_RECORD_SIZE) };
+			memcpy(s->data + idx, &pad, sizeof(pad));
+			WRC__storeRelease(&s->hdr->writePos, writePos + toEnd);
+			continue;
+		}
+
+		size_t contiguous = (space < toEnd) ? space : toEnd;
+		if(contiguous >= minSize)
+		{
+			*avail = contiguous;
+			return s->data + idx;
+		}
+
+		if(ctx->userAbort || (timeoutMs >= 0 && WRC__timeMs() - start >= (uint64_t)timeoutMs))
+		{
+			return NULL;
+		}
+		// the reader is in another process, so there's nothing to wait on
+		WRC__sleepMs(WRC__SHM_POLL_MS);
+	}
+}
+
+// makes a record reserved at rec visible to the reader
+static void commitRecord(struct WRC__ShmSink* s, unsigned char* rec, uint32_t type, size_t size)
+{
+	struct WRC__ShmRecord hdr = { type, (uint32_t)size };
+	memcpy(rec, &hdr, sizeof(hdr));
+	WRC__storeRelease(&s->hdr->writePos, s->hdr->writePos + WRC__SHM_RECORD_SIZE + WRC__SHM_ALIGN(size));
+}
+
+static void writeRecord(WRC_Stream* ctx, uint32_t type, const void* payload, size_t size, int timeoutMs)
+{
+	struct WRC__ShmSink* s = &ctx->shm;
+
+	if(s->hdr == NULL)
+		return;
+
+	size_t recSize = WRC__SHM_RECORD_SIZE + WRC__SHM_ALIGN(size);
+	if(recSize > s->size / 4)
+	{
+		// can only be metadata that is much longer than anything sane, so just leave it out
+		return;
+	}
+
+	WRC__mutexLock(&s->lock);
+	size_t avail;
+	unsigned char* rec = reserve(ctx, recSize, &avail, timeoutMs);
+	if(rec != NULL)
+	{
+		if(size > 0)
+			memcpy(rec + WRC__SHM_RECORD_SIZE, payload, size);
+		commitRecord(s, rec, type, size);
+	}
+	WRC__mutexUnlock(&s->lock);
+}
+
+void* WRC__shmAcquire(WRC_Stream* ctx, size_t maxFrames, size_t* numFrames)
+{
+	struct WRC__ShmSink* s = &ctx->shm;
+	size_t frameSize = ctx->outChannels * WRC__sampleSize(ctx->outFormat);
+
+	*numFrames = 0;
+
+	// kept locked until WRC__shmCommit(), so no metadata gets in between
+	WRC__mutexLock(&s->lock);
+	size_t avail;
+	unsigned char* rec = reserve(ctx, WRC__SHM_RECORD_SIZE + WRC__SHM_ALIGN(frameSize), &avail, -1);
+	if(rec == NULL)
+	{
+		WRC__mutexUnlock(&s->lock);
+		return NULL;
+	}
+
+	size_t n = (avail - WRC__SHM_RECORD_SIZE) / frameSize;
+	*numFrames = (n < maxFrames) ? n : maxFrames;
+	s->pending = rec;
+	return rec + WRC__SHM_RECORD_SIZE;
+}
+
+void WRC__shmCommit(WRC_Stream* ctx, size_t numFrames)
+{
+	struct WRC__ShmSink* s = &ctx->shm;
+
+	if(numFrames > 0)
+	{
+		size_t frameSize = ctx->outChannels * WRC__sampleSize(ctx->outFormat);
+		commitRecord(s, s->pending, WRC_SHM_SAMPLES, numFrames * frameSize);
+	}
+	s->pending = NULL;
+	WRC__mutexUnlock(&s->lock);
+}
+
+void WRC__shmFormat(WRC_Stream* ctx)
+{
+	struct WRC__ShmSink* s = &ctx->shm;
+	struct WRC__ShmFormat fmt = { ctx->outRate, ctx->outChannels, ctx->outFormat };
+
+	s->bytesPerSec = (size_t)ctx->outRate * ctx->outChannels * WRC__sampleSize(ctx->outFormat);
+	writeRecord(ctx, WRC_SHM_FORMAT, &fmt, sizeof(fmt), -1);
+}
+
+void WRC__shmTitle(WRC_Stream* ctx, const char* title)
+{
+	writeRecord(ctx, WRC_SHM_TITLE, title, strlen(title) + 1, -1);
+}
+
+void WRC__shmStationInfo(WRC_Stream* ctx)
+{
+	// the four strings one after another, missing ones are empty
+	const char* strs[4] = { ctx->icyName, ctx->icyGenre, ctx->icyDescription, ctx->icyURL };
+	size_t size = 0;
+	for(int i=0; i < 4; ++i)
+	{
+		size += (strs[i] != NULL) ? strlen(strs[i]) + 1 : 1;
+	}
+
+	char* payload = malloc(size);
+	if(payload == NULL)
+		return;
+
+	char* p = payload;
+	for(int i=0; i < 4; ++i)
+	{
+		size_t len = 0;
+		if(strs[i] != NULL)
+		{
+			len = strlen(strs[i]);
+			memcpy(p, strs[i], len);
+		}
+		p[len] = '\0';
+		p += len + 1;
+	}
+
+	writeRecord(ctx, WRC_SHM_STATION_INFO, payload, size, -1);
+	free(payload);
+}
+
+void WRC__shmEnd(WRC_Stream* ctx)
+{
+	writeRecord(ctx, WRC_SHM_END, NULL, 0, WRC__SHM_END_WAIT_MS);
+}
+
+int WRC__shmBufferedMs(WRC_Stream* ctx)
+{
+	struct WRC__ShmSink* s = &ctx->shm;
+
+	if(s->bytesPerSec == 0)
+		return 0;
+
+	// the record headers are counted as well, that's less than 1%
+	size_t fill = WRC__loadAcquire(&s->hdr->writePos) - WRC__loadAcquire(&s->hdr->readPos);
+	return (int)((uint64_t)fill * 1000 / s->bytesPerSec);
+}
+
+void WRC__cleanupShm(WRC_Stream* ctx)
+{
+	struct WRC__ShmSink* s = &ctx->shm;
+
+	if(s->hdr == NULL)
+		return;
+
+#ifndef _WIN32
+	munmap(s->hdr, WRC__SHM_HEADER_SIZE + s->size);
+	close(s->fd);
+#endif
+	WRC__mutexDestroy(&s->lock);
+	memset(s, 0, sizeof(*s));
+}
+
+int WRC_SetSharedMemorySink(WRC_Stream* stream, size_t size, int* fd)
+{
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetSharedMemorySink(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	WRC__cleanupShm(stream);
+
+	if(size == 0)
+		return 1;
+
+	if(stream->initAudioCB == NULL)
+	{
+		eprintf("WRC_SetSharedMemorySink(): the stream has no initAudioFn!\n");
+		return 0;
+	}
+
+	if(stream->pcmBuf.pull)
+	{
+		eprintf("WRC_SetSharedMemorySink(): can't be used with WRC_SetPullMode()!\n");
+		return 0;
+	}
+
+#ifdef __linux__
+	size_t ringSize = WRC__SHM_MIN_SIZE;
+	while(ringSize < size && ringSize < (size_t)UINT32_MAX)
+	{
+		ringSize *= 2;
+	}
+
+	int memFd = memfd_create("wrclient-pcm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(memFd < 0)
+	{
+		eprintf("WRC_SetSharedMemorySink(): memfd_create() failed!\n");
+		return 0;
+	}
+
+	size_t mapSize = WRC__SHM_HEADER_SIZE + ringSize;
+	if(ftruncate(memFd, (off_t)mapSize) != 0)
+	{
+		eprintf("WRC_SetSharedMemorySink(): couldn't allocate %zu bytes!\n", mapSize);
+		close(memFd);
+		return 0;
+	}
+#ifdef F_ADD_SEALS
+	// so the reader can't make our mapping invalid by truncating it
+	fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+
+	void* mem = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+	if(mem == MAP_FAILED)
+	{
+		eprintf("WRC_SetSharedMemorySink(): mmap() failed!\n");
+		close(memFd);
+		return 0;
+	}
+
+	struct WRC__ShmSink* s = &stream->shm;
+	s->hdr = (struct WRC__ShmHeader*)mem;
+	s->data = (unsigned char*)mem + WRC__SHM_HEADER_SIZE;
+	s->size = ringSize;
+	s->fd = memFd;
+	WRC__mutexInit(&s->lock);
+
+	// the memory is zeroed, so only the rest of the header must be set
+	s->hdr->magic = WRC__SHM_MAGIC;
+	s->hdr->version = WRC__SHM_VERSION;
+	s->hdr->posSize = sizeof(size_t);
+	s->hdr->size = ringSize;
+
+	*fd = memFd;
+	return 1;
+#else
+	(void)fd;
+	eprintf("WRC_SetSharedMemorySink(): not supported on this platform!\n");
+	return 0;
+#endif // __linux__
+}
+
+// ######## reader side ########
+
+WRC_ShmReader* WRC_OpenShmReader(int fd)
+{
+#ifndef _WIN32
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < WRC__SHM_HEADER_SIZE)
+	{
+		eprintf("WRC_OpenShmReader(): fd is not a shared memory sink!\n");
+		return NULL;
+	}
+
+	size_t mapSize = (size_t)st.st_size;
+	void* mem = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mem == MAP_FAILED)
+	{
+		eprintf("WRC_OpenShmReader(): mmap() failed!\n");
+		return NULL;
+	}
+
+	struct WRC__ShmHeader* hdr = (struct WRC__ShmHeader*)mem;
+	if(hdr->magic != WRC__SHM_MAGIC || hdr->version != WRC__SHM_VERSION
+	   || hdr->posSize != sizeof(size_t) || !isPowerOfTwo(hdr->size)
+	   || hdr->size > mapSize - WRC__SHM_HEADER_SIZE)
+	{
+		eprintf("WRC_OpenShmReader(): fd is not a shared memory sink of this version of libwrclient!\n");
+		munmap(mem, mapSize);
+		return NULL;
+	}
+
+	WRC_ShmReader* ret = calloc(1, sizeof(WRC_ShmReader));
+	if(ret == NULL)
+	{
+		munmap(mem, mapSize);
+		return NULL;
+	}
+
+	ret->hdr = hdr;
+	ret->data = (unsigned char*)mem + WRC__SHM_HEADER_SIZE;
+	ret->size = (size_t)hdr->size;
+	ret->mapSize = mapSize;
+	return ret;
+#else
+	(void)fd;
+	eprintf("WRC_OpenShmReader(): not supported on this platform!\n");
+	return NULL;
+#endif
+}
+
+// consumes the record at readPos
+static void releaseRecord(WRC_ShmReader* reader, size_t recSize)
+{
+	WRC__storeRelease(&reader->hdr->readPos, reader->hdr->readPos + recSize);
+	reader->curSize = 0;
+	reader->curOffset = 0;
+}
+
+// the string at *p, NULL if it's empty. returns false if it isn't terminated before end
+static bool nextString(const char** p, const char* end, const char** str)
+{
+	const char* strEnd = memchr(*p, '\0', end - *p);
+	if(strEnd == NULL)
+		return false;
+
+	*str = (strEnd == *p) ? NULL : *p;
+	*p = strEnd + 1;
+	return true;
+}
+
+int WRC_ShmReaderNext(WRC_ShmReader* reader, WRC_ShmEvent* event)
+{
+	memset(event, 0, sizeof(*event));
+
+	for(;;)
+	{
+		size_t readPos = reader->hdr->readPos;
+		size_t fill = WRC__loadAcquire(&reader->hdr->writePos) - readPos;
+		if(fill == 0)
+			return 0;
+
+		// the writer might be a sandboxed process, so don't trust it
+		size_t idx = readPos & (reader->size - 1);
+		size_t toEnd = reader->size - idx;
+		if(fill > reader->size || fill < WRC__SHM_RECORD_SIZE)
+			return -1;
+
+		struct WRC__ShmRecord rec;
+		memcpy(&rec, reader->data + idx, sizeof(rec));
+		size_t recSize = WRC__SHM_RECORD_SIZE + WRC__SHM_ALIGN((size_t)rec.size);
+		if(recSize > toEnd || recSize > fill)
+			return -1;
+
+		const unsigned char* payload = reader->data + idx + WRC__SHM_RECORD_SIZE;
+
+		switch(rec.type)
+		{
+			case WRC__SHM_PAD:
+				releaseRecord(reader, recSize);
+				continue;
+
+			case WRC_SHM_SAMPLES:
+				if(reader->frameSize == 0 || rec.size % reader->frameSize != 0)
+					return -1;
+				event->samples = payload + reader->curOffset;
+				event->numFrames = (rec.size - reader->curOffset) / reader->frameSize;
+				break;
+
+			case WRC_SHM_FORMAT:
+			{
+				struct WRC__ShmFormat fmt;
+				if(rec.size != sizeof(fmt))
+					return -1;
+				memcpy(&fmt, payload, sizeof(fmt));
+				if(fmt.sampleRate <= 0 || fmt.numChannels <= 0 || fmt.numChannels >= WRC__MAX_CHANNELS
+				   || (fmt.format != WRC_FMT_S16 && fmt.format != WRC_FMT_S32 && fmt.format != WRC_FMT_F32))
+					return -1;
+				event->sampleRate = fmt.sampleRate;
+				event->numChannels = fmt.numChannels;
+				event->format = fmt.format;
+				// the following samples are in this format
+				reader->frameSize = fmt.numChannels * WRC__sampleSize(fmt.format);
+				break;
+			}
+
+			case WRC_SHM_TITLE:
+				if(rec.size == 0 || payload[rec.size - 1] != '\0')
+					return -1;
+				event->title = (const char*)payload;
+				break;
+
+			case WRC_SHM_STATION_INFO:
+			{
+				const char* p = (const char*)payload;
+				const char* end = p + rec.size;
+				if(!nextString(&p, end, &event->name) || !nextString(&p, end, &event->genre)
+				   || !nextString(&p, end, &event->description) || !nextString(&p, end, &event->url))
+					return -1;
+				break;
+			}
+
+			case WRC_SHM_END:
+				break;
+
+			default:
+				// from a newer version, skip it
+				releaseRecord(reader, recSize);
+				continue;
+		}
+
+		event->type = (int)rec.type;
+		reader->curSize = recSize;
+		reader->curType = rec.type;
+		reader->curPayload = rec.size;
+		return 1;
+	}
+}
+
+void WRC_ShmReaderRelease(WRC_ShmReader* reader, size_t numFrames)
+{
+	if(reader->curSize == 0)
+		return;
+
+	if(reader->curType == WRC_SHM_SAMPLES)
+	{
+		size_t remaining = (reader->curPayload - reader->curOffset) / reader->frameSize;
+		if(numFrames < remaining)
+		{
+			// the rest of the record is returned by the next WRC_ShmReaderNext()
+			reader->curOffset += numFrames * reader->frameSize;
+			return;
+		}
+	}
+
+	releaseRecord(reader, reader->curSize);
+}
+
+void WRC_CloseShmReader(WRC_ShmReader* reader)
+{
+	if(reader == NULL)
+		return;
+
+#ifndef _WIN32
+	munmap(reader->hdr, reader->mapSize);
+#endif
+	free(reader);
+}
@@ -0,0 +1,625 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// hot-standby connection (see WRC_SetStandby()): while a stream is playing, a second
+// connection to the same stream (or a mirror) is opened. Its data is read all the time
+// (so the server doesn't drop it), the ICY metadata is stripped and only the newest
+// audio is kept, from the last MP3 frame or Ogg page on. If the primary connection
+// stalls (or drops), the standby connection takes over: its headers are parsed, the
+// decoder drops what's left of the old connection's last frame and continues with
+// the kept audio, then curlWriteFun() gets the data.
+// This needs a curl multi handle, so it's driven by group.c and async.c.
+
+#include "internal.h"
+
+// how long to wait before connecting again after the standby connection failed
+#define WRC__STANDBY_RETRY_MS 1000
+// returned by the frame parsers if there's not enough data to tell
+#define WRC__NEED_MORE ((size_t)-1)
+
+// the length of the MPEG audio frame that starts at p, 0 if there is none. if prev isn't NULL,
+// it's the frame before, then this one must have the same version, layer and sample rate
+static size_t mpegFrameLength(const unsigned char* p, size_t size, const unsigned char* prev)
+{
+	static const short bitrates[2][3][15] = {
+		{ // MPEG 1, layer I, II, III
+			{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+			{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+			{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+		},
+		{ // MPEG 2 and 2.5
+			{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+		},
+	};
+	static const long sampleRates[3] = { 44100, 48000, 32000 };
+
+	if((size >= 1 && p[0] != 0xFF) || (size >= 2 && (p[1] & 0xE0) != 0xE0))
+		return 0;
+	if(size < 4)
+		return WRC__NEED_MORE;
+
+	int version = (p[1] >> 3) & 3; // 0: MPEG 2.5, 1: reserved, 2: MPEG 2, 3: MPEG 1
+	int layer = 4 - ((p[1] >> 1) & 3); // 4: reserved
+	int bitrateIdx = p[2] >> 4; // 0 is "free format", we can't tell its length
+	int rateIdx = (p[2] >> 2) & 3;
+	if(version == 1 || layer == 4 || bitrateIdx == 0 || bitrateIdx == 15 || rateIdx == 3)
+		return 0;
+	if(prev != NULL && (((p[1] ^ prev[1]) & 0xFE) != 0 || ((p[2] ^ prev[2]) & 0x0C) != 0))
+		return 0;
+
+	long bitrate = bitrates[version == 3 ? 0 : 1][layer-1][bitrateIdx] * 1000L;
+	long rate = sampleRates[rateIdx] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+	int padding = (p[2] >> 1) & 1;
+
+	if(layer == 1)
+		return (12 * bitrate / rate + padding) * 4;
+	if(layer == 3 && version != 3)
+		return 72 * bitrate / rate + padding;
+	return 144 * bitrate / rate + padding;
+}
+
+static uint32_t readLE32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// the length of the Ogg page that starts at p, 0 if there is none. if prev isn't NULL, it's the
+// page before, then this one must belong to the same logical stream (or start a new one)
+static size_t oggPageLength(const unsigned char* p, size_t size, const unsigned char* prev)
+{
+	if(memcmp(p, "OggS", size < 4 ? size : 4) != 0)
+		return 0;
+	if(size < 27)
+		return WRC__NEED_MORE;
+	if(p[4] != 0 || (p[5] & ~7) != 0)
+		return 0; // version 0, only the continued, BOS and EOS flags
+	if(prev != NULL && readLE32(p + 14) != readLE32(prev + 14) && (p[5] & 2) == 0)
+		return 0;
+
+	size_t numSegments = p[26];
+	if(size < 27 + numSegments)
+		return WRC__NEED_MORE;
+
+	size_t len = 27 + numSegments;
+	for(size_t i=0; i < numSegments; ++i)
+		len += p[27 + i];
+	return len;
+}
+
+static size_t frameLength(struct WRC__Standby* sb, const unsigned char* p, size_t size, const unsigned char* prev)
+{
+	if(sb->contentType == WRC_CONTENT_OGGVORBIS)
+		return oggPageLength(p, size, prev);
+	return mpegFrameLength(p, size, prev);
+}
+
+// called for each complete Ogg page, keeps the header pages of the current logical stream
+static void oggPageDone(struct WRC__Standby* sb, const unsigned char* page, size_t len)
+{
+	if(page[5] & 2)
+	{
+		// BOS, a new logical stream starts with its headers
+		sb->oggHeadersLen = 0;
+		sb->oggInHeaders = true;
+	}
+	if(!sb->oggInHeaders)
+		return;
+
+	// the header pages have granule position 0, -1 if no packet ends on it
+	uint32_t granuleLow = readLE32(page + 6);
+	uint32_t granuleHigh = readLE32(page + 10);
+	if(!(granuleLow == 0 && granuleHigh == 0) && !(granuleLow == 0xFFFFFFFFu && granuleHigh == 0xFFFFFFFFu))
+	{
+		sb->oggInHeaders = false;
+		return;
+	}
+
+	if(sb->oggHeadersLen + len > sb->oggHeadersSize)
+	{
+		size_t newSize = sb->oggHeadersLen + len + 4096;
+		char* headers = (newSize <= WRC__STANDBY_AUDIO_SIZE) ? realloc(sb->oggHeaders, newSize) : NULL;
+		if(headers == NULL)
+		{
+			// can't be used until the next logical stream starts
+			sb->oggHeadersLen = 0;
+			sb->oggInHeaders = false;
+			return;
+		}
+		sb->oggHeaders = headers;
+		sb->oggHeadersSize = newSize;
+	}
+	memcpy(sb->oggHeaders + sb->oggHeadersLen, page, len);
+	sb->oggHeadersLen += len;
+}
+
+// drops the audio at the beginning of sb->audio up to the newest frame (or page) that's known
+// to be one, because it's followed by another one (or it follows the one before)
+static void alignAudio(struct WRC__Standby* sb)
+{
+	const unsigned char* audio = (const unsigned char*)sb->audio;
+	size_t pos = 0;
+
+	while(pos < sb->audioLen)
+	{
+		size_t rem = sb->audioLen - pos;
+		size_t len = frameLength(sb, audio + pos, rem, NULL);
+		if(len == 0)
+		{
+			++pos;
+			sb->aligned = false;
+			continue;
+		}
+		if(len == WRC__NEED_MORE || len >= rem)
+			break; // incomplete, this is where the decoder would start
+
+		size_t next = frameLength(sb, audio + pos + len, rem - len, audio + pos);
+		if(next == WRC__NEED_MORE)
+			break;
+		if(next == 0)
+		{
+			// it wasn't a frame after all (or the data after it is broken)
+			++pos;
+			sb->aligned = false;
+			continue;
+		}
+
+		if(sb->contentType == WRC_CONTENT_OGGVORBIS)
+			oggPageDone(sb, audio + pos, len);
+		pos += len;
+		sb->aligned = true;
+	}
+
+	// after this there's room for more: the biggest frame or page (and the beginning of
+	// the next one) is smaller than WRC__STANDBY_AUDIO_SIZE
+	memmove(sb->audio, sb->audio + pos, sb->audioLen - pos);
+	sb->audioLen -= pos;
+
+	sb->ready = sb->aligned && (sb->contentType != WRC_CONTENT_OGGVORBIS || sb->oggHeadersLen > 0);
+}
+
+static void addAudio(struct WRC__Standby* sb, const char* data, size_t size)
+{
+	while(size > 0)
+	{
+		size_t n = WRC__STANDBY_AUDIO_SIZE - sb->audioLen;
+		if(n > size)
+			n = size;
+		memcpy(sb->audio + sb->audioLen, data, n);
+		sb->audioLen += n;
+		data += n;
+		size -= n;
+
+		alignAudio(sb);
+	}
+}
+
+// the value of a header line if it's called name, otherwise NULL
+static const char* headerValue(const char* line, size_t len, const char* name)
+{
+	size_t nameLen = strlen(name);
+	if(len < nameLen || strncasecmp(line, name, nameLen) != 0)
+		return NULL;
+
+	line += nameLen;
+	while(*line == ' ' || *line == '\t')
+		++line;
+	return line;
+}
+
+// true if str (up to its line break) is value
+static bool valueIs(const char* str, const char* value)
+{
+	size_t len = strlen(value);
+	return strncasecmp(str, value, len) == 0 && (str[len] == '\r' || str[len] == '\n' || str[len] == '\0');
+}
+
+// what the standby connection needs to know itself, WRC__handleHeaderLine()
+// parses all of them when it takes over
+static void parseHeaderLine(struct WRC__Standby* sb, const char* line, size_t len)
+{
+	const char* str;
+	if((str = headerValue(line, len, "content-type:")))
+	{
+		if(valueIs(str, "audio/mpeg"))
+			sb->contentType = WRC_CONTENT_MP3;
+		else if(valueIs(str, "application/ogg") || valueIs(str, "audio/ogg"))
+			sb->contentType = WRC_CONTENT_OGGVORBIS;
+	}
+	else if((str = headerValue(line, len, "icy-metaint:")))
+	{
+		sb->icyMetaInt = atoi(str);
+	}
+}
+
+// collects the ICY header some servers send in the body (see curlWriteFun()) with the
+// other header lines. returns how much of data belonged to it, or -1 if it's too big
+static long collectIcyHeader(struct WRC__Standby* sb, const char* data, size_t size)
+{
+	size_t pos = 0;
+	while(pos < size)
+	{
+		if(sb->headerLinesLen == WRC__STANDBY_HEADER_SIZE)
+			return -1;
+		sb->headerLines[sb->headerLinesLen++] = data[pos++];
+
+		if(sb->headerLinesLen >= 4 && memcmp(sb->headerLines + sb->headerLinesLen - 4, "\r\n\r\n", 4) == 0)
+		{
+			sb->icyHeaderInBody = false;
+			break;
+		}
+	}
+
+	if(!sb->icyHeaderInBody)
+	{
+		const char* line = sb->headerLines;
+		const char* end = sb->headerLines + sb->headerLinesLen;
+		while(line < end)
+		{
+			const char* lineEnd = memchr(line, '\n', end - line);
+			lineEnd = (lineEnd != NULL) ? lineEnd+1 : end;
+			parseHeaderLine(sb, line, lineEnd - line);
+			line = lineEnd;
+		}
+	}
+	return (long)pos;
+}
+
+static size_t standbyWriteFun(void* data, size_t size, size_t nmemb, void* context)
+{
+	const size_t dataSize = size*nmemb;
+	WRC_Stream* ctx = (WRC_Stream*)context;
+	struct WRC__Standby* sb = &ctx->standby;
+
+	long respCode = 0;
+	curl_easy_getinfo(sb->curl, CURLINFO_RESPONSE_CODE, &respCode);
+	if(respCode != 0 && (respCode < 200 || respCode >= 300))
+	{
+		// an error page, try again later
+		return 0;
+	}
+
+	const char* pos = data;
+	const char* end = pos + dataSize;
+
+	if(!sb->gotData)
+	{
+		sb->gotData = true;
+		sb->icyHeaderInBody = dataSize >= strlen("ICY 200 OK") && memcmp(data, "ICY 200 OK", strlen("ICY 200 OK")) == 0;
+	}
+	if(sb->icyHeaderInBody)
+	{
+		long n = collectIcyHeader(sb, pos, dataSize);
+		if(n < 0)
+			return 0;
+		pos += n;
+	}
+	if(sb->icyHeaderInBody)
+	{
+		return dataSize;
+	}
+	if(sb->contentType == WRC_CONTENT_UNKNOWN)
+	{
+		// we can't tell where the frames are, so it can't take over
+		return 0;
+	}
+
+	// like demuxIcyMetadata() in main.c
+	while(pos < end)
+	{
+		if(sb->icyMetaBytesMissing > 0)
+		{
+			int n = sb->icyMetaBytesMissing;
+			if(n > end - pos)
+				n = end - pos;
+
+			// kept until it's complete, in case it takes over in between
+			memcpy(sb->icyMetadata + sb->icyMetaBytesWritten, pos, n);
+			sb->icyMetaBytesWritten += n;
+			sb->icyMetaBytesMissing -= n;
+			pos += n;
+		}
+		else if(sb->icyMetaInt > 0 && sb->dataReadSinceLastIcyMeta >= sb->icyMetaInt)
+		{
+			sb->icyMetaBytesMissing = ((const unsigned char*)pos)[0] * 16;
+			sb->icyMetaBytesWritten = 0;
+			sb->dataReadSinceLastIcyMeta = 0;
+			++pos;
+		}
+		else
+		{
+			size_t n = end - pos;
+			if(sb->icyMetaInt > 0 && n > (size_t)(sb->icyMetaInt - sb->dataReadSinceLastIcyMeta))
+				n = sb->icyMetaInt - sb->dataReadSinceLastIcyMeta;
+
+			addAudio(sb, pos, n);
+			sb->dataReadSinceLastIcyMeta += n;
+			pos += n;
+		}
+	}
+
+	return dataSize;
+}
+
+static size_t standbyHeaderFun(char* buffer, size_t size, size_t nitems, void* context)
+{
+	size_t dataSize = size*nitems;
+	WRC_Stream* ctx = (WRC_Stream*)context;
+	struct WRC__Standby* sb = &ctx->standby;
+
+	long respCode = 0;
+	curl_easy_getinfo(sb->curl, CURLINFO_RESPONSE_CODE, &respCode);
+	if(respCode >= 200 && respCode < 300 && sb->headerLinesLen + dataSize <= WRC__STANDBY_HEADER_SIZE)
+	{
+		// all lines are parsed (with WRC__handleHeaderLine()) once the standby connection is used
+		memcpy(sb->headerLines + sb->headerLinesLen, buffer, dataSize);
+		sb->headerLinesLen += dataSize;
+		parseHeaderLine(sb, sb->headerLines + sb->headerLinesLen - dataSize, dataSize);
+	}
+	return dataSize;
+}
+
+static const char* standbyURL(WRC_Stream* ctx)
+{
+	if(ctx->standby.mirrorURL != NULL)
+		return ctx->standby.mirrorURL;
+	if(ctx->playlistMirror != NULL)
+		return ctx->playlistMirror;
+	return ctx->url;
+}
+
+static bool startStandby(WRC_Stream* ctx, CURLM* multi)
+{
+	struct WRC__Standby* sb = &ctx->standby;
+
+	CURL* curl = WRC__createEasyHandle(ctx, standbyURL(ctx), &sb->headers);
+	if(curl == NULL)
+	{
+		sb->retryAt = WRC__timeMs() + WRC__STANDBY_RETRY_MS;
+		return false;
+	}
+
+	// our own callbacks until it takes over, CURLOPT_PRIVATE stays ctx
+	// so the drivers find the stream for it
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, standbyWriteFun);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, standbyHeaderFun);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+
+	sb->curl = curl;
+	sb->multi = multi;
+	sb->ready = false;
+	sb->headerLinesLen = 0;
+	sb->gotData = false;
+	sb->icyHeaderInBody = false;
+	sb->contentType = WRC_CONTENT_UNKNOWN;
+	sb->icyMetaInt = 0;
+	sb->icyMetaBytesMissing = 0;
+	sb->icyMetaBytesWritten = 0;
+	sb->dataReadSinceLastIcyMeta = 0;
+	sb->audioLen = 0;
+	sb->aligned = false;
+	sb->oggHeadersLen = 0;
+	sb->oggInHeaders = false;
+
+	curl_multi_add_handle(multi, curl);
+	return true;
+}
+
+void WRC__stopStandby(WRC_Stream* ctx)
+{
+	struct WRC__Standby* sb = &ctx->standby;
+
+	if(sb->curl != NULL)
+	{
+		curl_multi_remove_handle(sb->multi, sb->curl);
+		curl_easy_cleanup(sb->curl);
+		sb->curl = NULL;
+	}
+	if(sb->headers != NULL)
+	{
+		curl_slist_free_all(sb->headers);
+		sb->headers = NULL;
+	}
+	sb->ready = false;
+	sb->failingOver = false;
+}
+
+// replaces the primary connection with the standby connection
+static void failover(WRC_Stream* ctx, CURLM* multi)
+{
+	struct WRC__Standby* sb = &ctx->standby;
+
+	sb->failoverStart = ctx->lastDataTime;
+	sb->failingOver = true;
+
+	curl_multi_remove_handle(multi, ctx->curl); // might have been removed already, that's ok
+	curl_easy_cleanup(ctx->curl);
+	if(ctx->headers != NULL)
+		curl_slist_free_all(ctx->headers);
+
+	// like a reconnect, so the decoder and the station info are kept
+	WRC__beginConnectionSwitch(ctx);
+
+	ctx->curl = sb->curl;
+	ctx->headers = sb->headers;
+	sb->curl = NULL;
+	sb->headers = NULL;
+	sb->ready = false;
+
+	WRC__setStreamCallbacks(ctx, ctx->curl);
+
+	// parse the headers we got for the standby connection
+	WRC__handleHeaderLines(ctx, sb->headerLines, sb->headerLinesLen);
+	sb->headerLinesLen = 0;
+
+	ctx->lastDataTime = WRC__timeMs();
+	if(ctx->streamState != WRC__STREAM_FRESH)
+		return; // unsupported content-type, that was reported
+
+	// the old connection's last frame (or page) is incomplete, the decoder must not
+	// glue the new data to it
+	if(ctx->discardInput != NULL)
+		ctx->discardInput(ctx);
+
+	// curlWriteFun() continues with the ICY metadata where standbyWriteFun() stopped
+	ctx->dataReadSinceLastIcyMeta = sb->dataReadSinceLastIcyMeta;
+	ctx->icyMetaBytesMissing = sb->icyMetaBytesMissing;
+	ctx->icyMetaBytesWritten = sb->icyMetaBytesWritten;
+	memcpy(ctx->icyMetadata, sb->icyMetadata, sb->icyMetaBytesWritten);
+
+	bool oggHeaders = false;
+#ifdef WRC_OGG
+	// unless the decoder has its logical stream already (same server or a relay of it),
+	// it needs the header pages first
+	oggHeaders = ctx->contentType == WRC_CONTENT_OGGVORBIS
+	             && (ctx->ogg.state != WRC_OGGDEC_STREAMDEC
+	                 || (uint32_t)ctx->ogg.os.serialno != readLE32((unsigned char*)sb->audio + 14));
+#endif
+
+	// the data curl hands to curlWriteFun() from now on continues the audio that was kept,
+	// which starts on a frame (or page)
+	ctx->streamState = WRC__STREAM_MUSIC;
+	if(!WRC__beginMusic(ctx))
+	{
+		// not the stream anymore, curlWriteFun() aborts the transfer, like a failed reconnect
+		if(ctx->streamState == WRC__STREAM_MUSIC)
+			ctx->streamState = WRC__STREAM_FRESH;
+		return;
+	}
+	if(oggHeaders && !WRC__decodeMusic(ctx, sb->oggHeaders, sb->oggHeadersLen))
+		return; // curlWriteFun() aborts the transfer
+	WRC__decodeMusic(ctx, sb->audio, sb->audioLen);
+}
+
+void WRC__standbyCheck(WRC_Stream* ctx, CURLM* multi)
+{
+	struct WRC__Standby* sb = &ctx->standby;
+
+	// a prefetched stream that hasn't been started yet doesn't need one (see warm.c),
+	// neither does HLS, it has its own retries (see hls.c)
+	if(!sb->enabled || ctx->userAbort || ctx->curl == NULL || ctx->warm.holding || ctx->hls.session != NULL)
+		return;
+
+	uint64_t now = WRC__timeMs();
+
+	if(sb->curl == NULL)
+	{
+		// only open the standby connection once the primary one works
+		if(ctx->streamState == WRC__STREAM_MUSIC && !ctx->reconnecting && now >= sb->retryAt)
+		{
+			startStandby(ctx, multi);
+		}
+		return;
+	}
+
+	// a transfer paused by flow control or waiting for a reconnect doesn't get data, but hasn't stalled
+	if(sb->ready && ctx->streamState == WRC__STREAM_MUSIC && !ctx->flowPaused && !ctx->reconnectPending
+	   && now - ctx->lastDataTime >= (uint64_t)sb->stallMs)
+	{
+		failover(ctx, multi);
+	}
+}
+
+bool WRC__standbyTakeOver(WRC_Stream* ctx, CURLM* multi)
+{
+	struct WRC__Standby* sb = &ctx->standby;
+
+	if(!sb->ready || ctx->userAbort || ctx->streamState != WRC__STREAM_MUSIC)
+		return false;
+
+	failover(ctx, multi);
+	return true;
+}
+
+void WRC__standbyFinished(WRC_Stream* ctx)
+{
+	// the server closed the standby connection, or connecting failed. open a new one in a while.
+	WRC__stopStandby(ctx);
+	ctx->standby.retryAt = WRC__timeMs() + WRC__STANDBY_RETRY_MS;
+}
+
+void WRC__failoverDone(WRC_Stream* ctx)
+{
+	struct WRC__Standby* sb = &ctx->standby;
+
+	sb->failingOver = false;
+	++sb->failovers;
+	sb->lastFailoverMs = WRC__timeMs() - sb->failoverStart;
+
+	if(sb->failoverCB != NULL)
+	{
+		sb->failoverCB(ctx->userdata, (int)sb->lastFailoverMs);
+	}
+}
+
+void WRC__cleanupStandby(WRC_Stream* ctx)
+{
+	struct WRC__Standby* sb = &ctx->standby;
+
+	free(sb->mirrorURL);
+	free(sb->headerLines);
+	free(sb->icyMetadata);
+	free(sb->audio);
+	free(sb->oggHeaders);
+	sb->mirrorURL = NULL;
+	sb->headerLines = NULL;
+	sb->icyMetadata = NULL;
+	sb->audio = NULL;
+	sb->oggHeaders = NULL;
+	sb->oggHeadersSize = 0;
+	sb->enabled = false;
+}
+
+int WRC_SetStandby(WRC_Stream* stream, int stallMs, const char* mirrorURL, WRC_failoverCB failoverFn)
+{
+	struct WRC__Standby* sb = &stream->standby;
+
+	if(stream->curl != NULL)
+	{
+		eprintf("WRC_SetStandby(): must be called before streaming starts!\n");
+		return 0;
+	}
+
+	// like the stream URL
+	if(mirrorURL != NULL && strlen(mirrorURL) > sizeof(stream->url)-1)
+	{
+		eprintf("WRC_SetStandby(): URL too long!\n");
+		return 0;
+	}
+
+	// the memory is only needed while it's enabled, most streams don't use it
+	WRC__cleanupStandby(stream);
+	if(stallMs <= 0)
+	{
+		return 1;
+	}
+
+	sb->headerLines = malloc(WRC__STANDBY_HEADER_SIZE);
+	sb->icyMetadata = malloc(256*16);
+	sb->audio = malloc(WRC__STANDBY_AUDIO_SIZE);
+	if(mirrorURL != NULL)
+	{
+		sb->mirrorURL = malloc(strlen(mirrorURL) + 1);
+		if(sb->mirrorURL != NULL)
+			strcpy(sb->mirrorURL, mirrorURL);
+	}
+	if(sb->headerLines == NULL || sb->icyMetadata == NULL || sb->audio == NULL
+	   || (mirrorURL != NULL && sb->mirrorURL == NULL))
+	{
+		WRC__cleanupStandby(stream);
+		eprintf("WRC_SetStandby(): Out of Memory!\n");
+		return 0;
+	}
+
+	sb->enabled = true;
+	sb->stallMs = stallMs;
+	sb->failoverCB = failoverFn;
+
+	return 1;
+}
@@ -0,0 +1,357 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// Benchmark for curlWriteFun() and its ICY metadata demuxer: feeds a synthetic stream
+// in chunks of different sizes (like curl would) for different icy-metaint values and
+// reports the throughput. The audio that arrives at the decoder and the titles are
+// checked against what was sent, so with --check (which uses all kinds of odd chunk
+// sizes, so metadata, its length byte and the ICY header are split between calls,
+// and all the ways a decoder can take the audio) this is also a test.
+//
+// usage: bench_icydemux [--check]
+
+#include "../main.c"
+
+#include "testutil.h"
+
+// audio byte i is pattern[i % PATTERN_LEN]
+#define PATTERN_LEN 4093
+static unsigned char pattern[PATTERN_LEN];
+
+struct Body
+{
+	char* data;
+	size_t len;
+	size_t audioLen;
+	int numTitles;
+};
+
+// what's checked while the body is fed to curlWriteFun()
+static struct
+{
+	size_t audioPos;
+	int titleIdx;
+	bool failed;
+} check;
+
+// the title is "Title <idx>", every 8th one is long (so it's split even with big chunks)
+static int formatTitle(char* buf, size_t bufSize, int idx)
+{
+	if(idx % 8 == 7)
+	{
+		char filler[1201];
+		memset(filler, 'x', 1200);
+		filler[1200] = '\0';
+		return snprintf(buf, bufSize, "Title %d %s", idx, filler);
+	}
+	return snprintf(buf, bufSize, "Title %d", idx);
+}
+
+// a title after every 4th interval, the others have no metadata (length byte 0)
+static void createBody(struct Body* b, int metaInt, size_t audioLen)
+{
+	size_t numIntervals = (metaInt > 0) ? audioLen / metaInt + 1 : 1;
+	b->data = malloc(audioLen + numIntervals*(1 + 1300));
+	b->len = 0;
+	b->audioLen = audioLen;
+	b->numTitles = 0;
+
+	size_t audioPos = 0;
+	for(size_t i=0; audioPos < audioLen; ++i)
+	{
+		size_t n = audioLen - audioPos;
+		if(metaInt > 0 && n > (size_t)metaInt)
+			n = metaInt;
+
+		for(size_t j=0; j<n; ++j)
+		{
+			b->data[b->len++] = pattern[(audioPos + j) % PATTERN_LEN];
+		}
+		audioPos += n;
+
+		if(metaInt > 0 && n == (size_t)metaInt)
+		{
+			if(i % 4 == 0)
+			{
+				char title[1400];
+				formatTitle(title, sizeof(title), b->numTitles++);
+				char* meta = b->data + b->len + 1;
+				int metaLen = sprintf(meta, "StreamTitle='%s';StreamUrl='';", title);
+				int blocks = (metaLen + 15) / 16;
+				memset(meta + metaLen, 0, blocks*16 - metaLen);
+				b->data[b->len] = blocks;
+				b->len += 1 + blocks*16;
+			}
+			else
+			{
+				b->data[b->len++] = 0;
+			}
+		}
+	}
+}
+
+// used as ctx->decode, so only the demuxer is measured
+static bool checkAudio(WRC_Stream* ctx, void* data, size_t size)
+{
+	const unsigned char* d = data;
+	while(size > 0)
+	{
+		size_t off = check.audioPos % PATTERN_LEN;
+		size_t n = PATTERN_LEN - off;
+		if(n > size)
+			n = size;
+		if(memcmp(d, pattern + off, n) != 0)
+		{
+			if(!check.failed)
+				eprintf("wrong audio data at %zu!\n", check.audioPos);
+			check.failed = true;
+		}
+		check.audioPos += n;
+		d += n;
+		size -= n;
+	}
+	return true;
+}
+
+// how the "decoder" takes the audio, see demuxIcyMetadata()
+enum DecoderInput {
+	INPUT_DECODE, // one span per chunk, like the decoder thread
+	INPUT_INGEST, // piece by piece, like MP3
+	INPUT_BUFFER // written into its input buffer, like Ogg
+};
+
+static char* inputBuf;
+static size_t inputBufSize;
+
+static bool checkIngest(WRC_Stream* ctx, const void* data, size_t size)
+{
+	return checkAudio(ctx, (void*)data, size);
+}
+
+static char* checkIngestBuffer(WRC_Stream* ctx, size_t size)
+{
+	if(size > inputBufSize)
+	{
+		free(inputBuf);
+		inputBuf = malloc(size);
+		inputBufSize = size;
+	}
+	// so a piece that isn't written shows up
+	memset(inputBuf, 0xAA, size);
+	return inputBuf;
+}
+
+static void checkIngestWrote(WRC_Stream* ctx, size_t size)
+{
+	checkAudio(ctx, inputBuf, size);
+}
+
+static void titleCB(void* userdata, const char* title)
+{
+	char expected[1400];
+	formatTitle(expected, sizeof(expected), check.titleIdx);
+	if(strcmp(title, expected) != 0)
+	{
+		if(!check.failed)
+			eprintf("got title \"%.40s\", expected \"%.40s\"!\n", title, expected);
+		check.failed = true;
+	}
+	++check.titleIdx;
+}
+
+static void playbackCB(void* userdata, int16_t* samples, size_t numSamples) {}
+
+static int initAudioCB(void* userdata, int sampleRate, int numChannels)
+{
+	return 1;
+}
+
+// feeds body to curlWriteFun() in chunks of chunkSize, with the header either from curl
+// (i.e. WRC__handleHeaderLine()) or in the body ("ICY 200 OK", like SHOUTcast 1.x does it).
+// Returns the time it took in seconds or -1 if something was wrong
+static double feed(const struct Body* body, int metaInt, size_t chunkSize, bool icyHeaderInBody,
+                   enum DecoderInput input)
+{
+	WRC_Stream* ctx = WRC_CreateStream("http://localhost/", playbackCB, initAudioCB, NULL);
+	WRC_SetMetadataCallbacks(ctx, NULL, titleCB);
+	// with ingest, decode(ctx, NULL, 0) is called for each chunk
+	ctx->decode = checkAudio;
+	if(input != INPUT_DECODE)
+	{
+		ctx->ingest = checkIngest;
+	}
+	if(input == INPUT_BUFFER)
+	{
+		ctx->ingestBuffer = checkIngestBuffer;
+		ctx->ingestWrote = checkIngestWrote;
+	}
+
+	char header[128];
+	size_t headerLen = 0;
+	if(icyHeaderInBody)
+	{
+		headerLen = snprintf(header, sizeof(header), "ICY 200 OK\r\nicy-name:bench\r\n"
+		                     "icy-metaint:%d\r\n\r\n", metaInt);
+	}
+	else
+	{
+		snprintf(header, sizeof(header), "icy-metaint: %d\r\n", metaInt);
+		WRC__handleHeaderLine(ctx, header, strlen(header));
+	}
+
+	memset(&check, 0, sizeof(check));
+
+	char* buf = malloc(chunkSize < 16 ? 16 : chunkSize);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t total = headerLen + body->len;
+	for(size_t pos=0; pos < total; )
+	{
+		size_t n = chunkSize;
+		if(pos == 0 && n < headerLen && n < 16)
+			n = 16; // curlWriteFun() looks for "ICY 200 OK" in the first call only
+		if(n > total - pos)
+			n = total - pos;
+
+		// curl's buffer, so it's not the same memory every time
+		for(size_t i=0; i<n; )
+		{
+			size_t p = pos + i;
+			size_t len = (p < headerLen) ? WRC__min(headerLen - p, n - i) : n - i;
+			memcpy(buf + i, (p < headerLen) ? header + p : body->data + p - headerLen, len);
+			i += len;
+		}
+		if(curlWriteFun(buf, 1, n, ctx) != n)
+		{
+			eprintf("curlWriteFun() failed at %zu!\n", pos);
+			check.failed = true;
+			break;
+		}
+		pos += n;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(buf);
+	WRC_CleanupStream(ctx);
+
+	if(check.audioPos != body->audioLen || check.titleIdx != body->numTitles)
+	{
+		if(!check.failed)
+			eprintf("got %zu bytes of audio and %d titles, expected %zu and %d!\n",
+			        check.audioPos, check.titleIdx, body->audioLen, body->numTitles);
+		check.failed = true;
+	}
+	if(check.failed)
+		return -1.0;
+
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static bool runCheck(void)
+{
+	static const int metaInts[] = { 1, 2, 16, 100, 8192, 16000 };
+	static const size_t chunkSizes[] = { 1, 2, 3, 7, 16, 17, 100, 1000, 1460, 4096, 16384, 65536 };
+	static const char* inputNames[] = { "decode", "ingest", "buffer" };
+	bool ok = true;
+
+	for(size_t m=0; m < sizeof(metaInts)/sizeof(metaInts[0]); ++m)
+	{
+		struct Body body;
+		createBody(&body, metaInts[m], metaInts[m] < 100 ? 20000 : 300000);
+
+		for(size_t c=0; c < sizeof(chunkSizes)/sizeof(chunkSizes[0]); ++c)
+		{
+			for(int inBody=0; inBody<2; ++inBody)
+			{
+				for(int input=INPUT_DECODE; input <= INPUT_BUFFER; ++input)
+				{
+					if(feed(&body, metaInts[m], chunkSizes[c], inBody, input) < 0.0)
+					{
+						eprintf("  with metaint %d, chunk size %zu, %s header, %s\n", metaInts[m],
+						        chunkSizes[c], inBody ? "ICY" : "HTTP", inputNames[input]);
+						ok = false;
+					}
+				}
+			}
+		}
+		free(body.data);
+	}
+	printf("%s\n", ok ? "OK" : "FAILED");
+	return ok;
+}
+
+static bool runBenchmark(void)
+{
+	// 0 means no icy-metaint header, i.e. no metadata
+	static const int metaInts[] = { 0, 8192, 16000, 32768 };
+	static const size_t chunkSizes[] = { 64, 512, 1460, 4096, 16384, 65536 };
+	const size_t audioLen = 64*1024*1024;
+	bool ok = true;
+
+	printf("throughput in MB/s (best of 5 runs of %zu MB)\n", audioLen / (1024*1024));
+	printf("metaint \\ chunk size");
+	for(size_t c=0; c < sizeof(chunkSizes)/sizeof(chunkSizes[0]); ++c)
+		printf("%9zu", chunkSizes[c]);
+	printf("\n");
+
+	for(size_t m=0; m < sizeof(metaInts)/sizeof(metaInts[0]); ++m)
+	{
+		struct Body body;
+		createBody(&body, metaInts[m], audioLen);
+		printf("%19d", metaInts[m]);
+
+		for(size_t c=0; c < sizeof(chunkSizes)/sizeof(chunkSizes[0]); ++c)
+		{
+			double best = -1.0;
+			for(int run=0; run<5; ++run)
+			{
+				double t = feed(&body, metaInts[m], chunkSizes[c], false, INPUT_DECODE);
+				if(t < 0.0)
+				{
+					ok = false;
+					break;
+				}
+				if(best < 0.0 || t < best)
+					best = t;
+			}
+			if(best > 0.0)
+				printf("%9.0f", body.len / best / (1024*1024));
+			else
+				printf("%9s", best < 0.0 ? "FAILED" : "-");
+			fflush(stdout);
+		}
+		printf("\n");
+		free(body.data);
+	}
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	bool checkOnly = (argc > 1 && strcmp(argv[1], "--check") == 0);
+	if(argc > 2 || (argc == 2 && !checkOnly))
+	{
+		eprintf("usage: %s [--check]\n", argv[0]);
+		return 1;
+	}
+
+	for(int i=0; i<PATTERN_LEN; ++i)
+	{
+		pattern[i] = (i*131 + (i >> 5)) & 0xFF;
+	}
+
+	if(!WRC_Init())
+		return 1;
+
+	bool ok = checkOnly ? runCheck() : runBenchmark();
+
+	WRC_Shutdown();
+	free(inputBuf);
+	return ok ? 0 : 1;
+}
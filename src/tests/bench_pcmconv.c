@@ -0,0 +1,145 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// Benchmark for the float => int16 conversions and dot products in pcmconv.c:
+// every version this CPU can run, in million samples (or dot products) per second.
+// The blocks have the size of the usual Vorbis blocks, so the data is in the L1 cache.
+//
+// usage: bench_pcmconv
+
+#include "../pcmconv.c"
+
+#include "testutil.h"
+
+#include <time.h>
+
+#define NUM_FRAMES 1024
+#define NUM_CHANNELS 3
+// how long each measurement runs
+#define BENCH_SECONDS 0.3
+
+struct Kernel
+{
+	const char* name;
+	WRC__convertFun convert;
+	WRC__dotFun dot;
+};
+
+static float srcBuf[NUM_CHANNELS][NUM_FRAMES];
+static int16_t dst[NUM_CHANNELS*NUM_FRAMES];
+static volatile float dotSink;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// in million samples per second
+static double benchConvert(const struct Kernel* k, int numChannels)
+{
+	float* src[NUM_CHANNELS] = { srcBuf[0], srcBuf[1], srcBuf[2] };
+	long iterations = 0;
+	double start = now();
+	double elapsed;
+	do
+	{
+		for(int i=0; i < 100; ++i)
+			k->convert(dst, src, numChannels, NUM_FRAMES);
+		iterations += 100;
+		elapsed = now() - start;
+	}
+	while(elapsed < BENCH_SECONDS);
+
+	return iterations * (double)NUM_FRAMES * numChannels / elapsed / 1e6;
+}
+
+// in million dot products (i.e. resampled samples) per second
+static double benchDot(const struct Kernel* k, int taps)
+{
+	const float* a = srcBuf[0];
+	const float* b = srcBuf[1];
+	long iterations = 0;
+	double start = now();
+	double elapsed;
+	do
+	{
+		float sum = 0.0f;
+		for(int i=0; i + taps <= NUM_FRAMES; ++i)
+			sum += k->dot(a + i, b + (i & 255), taps);
+		dotSink = sum;
+		iterations += NUM_FRAMES - taps + 1;
+		elapsed = now() - start;
+	}
+	while(elapsed < BENCH_SECONDS);
+
+	return iterations / elapsed / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+	struct Kernel kernels[4];
+	int numKernels = 0;
+
+	kernels[numKernels++] = (struct Kernel){ "scalar", convertScalar, dotScalar };
+#ifdef WRC__PCMCONV_X86
+	if(cpuHasSSE2())
+	{
+		kernels[numKernels++] = (struct Kernel){ "SSE2", convertSSE2, dotSSE2 };
+	}
+	if(cpuHasAVX2())
+	{
+		kernels[numKernels++] = (struct Kernel){ "AVX2", convertAVX2, dotAVX2 };
+	}
+#endif
+#ifdef WRC__PCMCONV_NEON
+	kernels[numKernels++] = (struct Kernel){ "NEON", convertNEON, dotNEON };
+#endif
+
+	for(int c=0; c < NUM_CHANNELS; ++c)
+	{
+		for(int i=0; i < NUM_FRAMES; ++i)
+			srcBuf[c][i] = ((i*7919 + c*104729) % 20001 - 10000) / 10000.0f;
+	}
+
+	printf("float => int16, million samples/s (%d frames per call)\n", NUM_FRAMES);
+	printf("%-10s %12s %12s %12s\n", "", "mono", "stereo", "3 channels");
+	double scalar[NUM_CHANNELS];
+	for(int k=0; k < numKernels; ++k)
+	{
+		printf("%-10s", kernels[k].name);
+		for(int c=1; c <= NUM_CHANNELS; ++c)
+		{
+			double r = benchConvert(&kernels[k], c);
+			if(k == 0)
+				scalar[c-1] = r;
+			printf(" %6.0f %4.1fx", r, r / scalar[c-1]);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	printf("\ndot products for the resampler, million/s\n");
+	printf("%-10s %12s %12s %12s\n", "", "8 taps", "16 taps", "32 taps");
+	for(int k=0; k < numKernels; ++k)
+	{
+		printf("%-10s", kernels[k].name);
+		for(int t=0; t < 3; ++t)
+		{
+			double r = benchDot(&kernels[k], 8 << t);
+			if(k == 0)
+				scalar[t] = r;
+			printf(" %6.1f %4.1fx", r, r / scalar[t]);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// Benchmark for the resampler of WRC_SetFixedOutput(): resamples decoded stereo float
+// samples (like they come from the decoders) for each quality level and some common
+// conversions, all the way to the int16 samples for playbackFn.
+//
+// usage: bench_resample
+
+#include "internal.h"
+
+#include "testutil.h"
+
+#include <math.h>
+#include <time.h>
+
+// per WRC__resample() call, like a decoded MP3 frame or Vorbis block
+#define NUM_FRAMES 1152
+// how long each measurement runs, the best of BENCH_RUNS is shown
+#define BENCH_SECONDS 0.2
+#define BENCH_RUNS 3
+
+static float left[NUM_FRAMES], right[NUM_FRAMES];
+static uint64_t numOutSamples;
+
+static void playbackCB(void* userdata, int16_t* samples, size_t numSamples)
+{
+	numOutSamples += numSamples;
+}
+
+static int initAudioCB(void* userdata, int sampleRate, int numChannels)
+{
+	return 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// returns how many times faster than realtime it is, 0 on error
+static double bench(int quality, int inRate, int inChannels, int outRate, int outChannels)
+{
+	WRC_Stream* ctx = WRC_CreateStream("http://localhost/", playbackCB, initAudioCB, NULL);
+	if(ctx == NULL || !WRC_SetFixedOutput(ctx, outRate, outChannels, quality))
+		return 0.0;
+
+	// like a decoder that found the stream's format
+	ctx->sampleRate = inRate;
+	ctx->numChannels = inChannels;
+	if(!WRC__initAudio(ctx))
+	{
+		WRC_CleanupStream(ctx);
+		return 0.0;
+	}
+
+	float* planar[2] = { left, right };
+	uint64_t numInFrames = 0;
+	numOutSamples = 0;
+	double start = now();
+	double elapsed;
+	do
+	{
+		for(int i=0; i < 100; ++i)
+		{
+			if(!WRC__resample(ctx, planar, NULL, NUM_FRAMES))
+			{
+				WRC_CleanupStream(ctx);
+				return 0.0;
+			}
+		}
+		numInFrames += 100*NUM_FRAMES;
+		elapsed = now() - start;
+	}
+	while(elapsed < BENCH_SECONDS);
+
+	WRC_CleanupStream(ctx);
+
+	// the filter keeps a few input samples back
+	double expected = (double)numInFrames * outRate / inRate * outChannels;
+	if(fabs(numOutSamples - expected) > 64.0 * outChannels)
+	{
+		eprintf("got %llu samples instead of %.0f!\n", (unsigned long long)numOutSamples, expected);
+		return 0.0;
+	}
+
+	return numInFrames / elapsed / inRate;
+}
+
+int main(int argc, char** argv)
+{
+	static const struct { int inRate, inChannels, outRate, outChannels; } conversions[] = {
+		{ 44100, 2, 48000, 2 },
+		{ 48000, 2, 44100, 2 },
+		{ 22050, 2, 48000, 2 },
+		{ 44100, 2, 48000, 1 },
+		{ 44100, 1, 48000, 2 },
+	};
+	static const char* qualityNames[] = { "FAST", "MEDIUM", "BEST" };
+	const int numConversions = sizeof(conversions)/sizeof(conversions[0]);
+
+	for(int i=0; i < NUM_FRAMES; ++i)
+	{
+		left[i] = 0.5f * sinf(i * 0.0627f);
+		right[i] = 0.5f * sinf(i * 0.0311f + 1.0f);
+	}
+
+	if(!WRC_Init())
+		return 1;
+
+	printf("times faster than realtime (one stream on one core, best of %d)\n", BENCH_RUNS);
+	printf("%-24s", "");
+	for(int q=WRC_RESAMPLE_FAST; q <= WRC_RESAMPLE_BEST; ++q)
+		printf("%10s", qualityNames[q]);
+	printf("\n");
+
+	bool ok = true;
+	for(int c=0; c < numConversions; ++c)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "%d/%d => %d/%d", conversions[c].inRate, conversions[c].inChannels,
+		         conversions[c].outRate, conversions[c].outChannels);
+		printf("%-24s", name);
+		for(int q=WRC_RESAMPLE_FAST; q <= WRC_RESAMPLE_BEST; ++q)
+		{
+			double r = 0.0;
+			for(int run=0; run < BENCH_RUNS; ++run)
+			{
+				double t = bench(q, conversions[c].inRate, conversions[c].inChannels,
+				                 conversions[c].outRate, conversions[c].outChannels);
+				ok = ok && t > 0.0;
+				if(t > r)
+					r = t;
+			}
+			printf("%10.0f", r);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	WRC_Shutdown();
+	return ok ? 0 : 1;
+}
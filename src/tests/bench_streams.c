@@ -0,0 +1,498 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// Benchmark for WRC_StreamGroup: plays 10, 100 and 1000 streams at once from a tiny
+// local ICY server and reports how much CPU time and resident memory each stream costs.
+// The server runs in a child process, so only the client side is measured.
+//
+// usage: bench_streams [-d seconds] [-g numGroups] [-m] [numStreams ...]
+//   -d: how long each measurement runs (default 5)
+//   -g: spread the streams over this many groups (and threads), default 1
+//   -m: use WRC_SetMetadataOnly(), i.e. don't decode the audio
+
+#define _DEFAULT_SOURCE
+#include "testutil.h"
+#include "webradioclient.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// the server sends silent MPEG1 layer III frames, 128kbit/s, 44.1kHz stereo (no padding)
+#define FRAME_SIZE 417
+#define BYTES_PER_MS 16
+// ICY metadata after every 20 frames, a title in every 10th of them
+#define METAINT (20*FRAME_SIZE)
+#define TITLE_EVERY 10
+
+#define MAX_GROUPS 64
+
+static char responseHeader[256];
+static size_t responseHeaderLen;
+
+// ********** the server (in the child process) **********
+
+struct Client
+{
+	int fd;
+	bool streaming; // request received, now sending the response
+	size_t reqLen;
+	char req[2048];
+	uint64_t startTime;
+	uint64_t sent; // bytes of the response, including the header
+};
+
+// the stream repeats after TITLE_EVERY metadata intervals
+static char* period;
+static size_t periodLen;
+
+static void createPeriod(void)
+{
+	static const char title[] = "StreamTitle='Benchmark';";
+	size_t titleLen = (sizeof(title) + 15) / 16 * 16;
+
+	responseHeaderLen = snprintf(responseHeader, sizeof(responseHeader),
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: audio/mpeg\r\n"
+		"icy-name: bench_streams\r\n"
+		"icy-genre: silence\r\n"
+		"icy-metaint: %d\r\n"
+		"\r\n", METAINT);
+
+	periodLen = TITLE_EVERY*(METAINT + 1) + titleLen;
+	period = calloc(1, periodLen);
+
+	char* p = period;
+	for(int i=0; i<TITLE_EVERY; ++i)
+	{
+		for(int f=0; f<METAINT/FRAME_SIZE; ++f)
+		{
+			// the rest of the frame (side info and main data) is 0, that's silence
+			static const unsigned char hdr[4] = { 0xFF, 0xFB, 0x90, 0x64 };
+			memcpy(p + f*FRAME_SIZE, hdr, 4);
+		}
+		p += METAINT;
+		if(i == 0)
+		{
+			*p++ = titleLen / 16;
+			memcpy(p, title, sizeof(title) - 1);
+			p += titleLen;
+		}
+		else
+		{
+			*p++ = 0; // no new metadata
+		}
+	}
+}
+
+// sends the part of the response that's due by now, false if the client is gone
+static bool sendStream(struct Client* c, uint64_t now)
+{
+	const size_t hdrLen = responseHeaderLen;
+	// like most servers: a burst of one second of audio on connect, then realtime
+	uint64_t due = hdrLen + (now - c->startTime + 1000)*BYTES_PER_MS;
+
+	while(c->sent < due)
+	{
+		const char* data;
+		size_t len;
+		if(c->sent < hdrLen)
+		{
+			data = responseHeader + c->sent;
+			len = hdrLen - c->sent;
+		}
+		else
+		{
+			size_t pos = (c->sent - hdrLen) % periodLen;
+			data = period + pos;
+			len = periodLen - pos;
+		}
+		if(len > due - c->sent)
+			len = due - c->sent;
+
+		ssize_t n = send(c->fd, data, len, MSG_NOSIGNAL);
+		if(n < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		c->sent += n;
+	}
+	return true;
+}
+
+// handles readable client sockets, false if the client is gone
+static bool readRequest(struct Client* c, uint64_t now)
+{
+	char* buf = c->req + c->reqLen;
+	size_t bufSize = sizeof(c->req) - 1 - c->reqLen;
+	if(c->streaming)
+	{
+		// the client doesn't send anything after the request, so it closed the connection
+		buf = c->req;
+		bufSize = sizeof(c->req);
+	}
+
+	ssize_t n = recv(c->fd, buf, bufSize, 0);
+	if(n <= 0)
+	{
+		return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	}
+	if(c->streaming)
+		return true;
+
+	c->reqLen += n;
+	c->req[c->reqLen] = '\0';
+	if(strstr(c->req, "\r\n\r\n") != NULL)
+	{
+		c->streaming = true;
+		c->startTime = now;
+	}
+	else if(c->reqLen == sizeof(c->req) - 1)
+	{
+		return false; // whatever that is
+	}
+	return true;
+}
+
+static void runServer(int listenFd, int maxClients)
+{
+	struct Client* clients = calloc(maxClients, sizeof(struct Client));
+	struct pollfd* pfds = calloc(maxClients + 1, sizeof(struct pollfd));
+	int numClients = 0;
+
+	createPeriod();
+	fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+	for(;;)
+	{
+		pfds[0].fd = listenFd;
+		pfds[0].events = POLLIN;
+		for(int i=0; i<numClients; ++i)
+		{
+			pfds[i+1].fd = clients[i].fd;
+			pfds[i+1].events = POLLIN;
+		}
+		poll(pfds, numClients + 1, 10);
+
+		uint64_t now = testTimeMs();
+
+		for(int i=numClients-1; i>=0; --i)
+		{
+			struct Client* c = &clients[i];
+			bool ok = true;
+			if(pfds[i+1].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				ok = readRequest(c, now);
+			}
+			if(ok && c->streaming)
+			{
+				ok = sendStream(c, now);
+			}
+			if(!ok)
+			{
+				close(c->fd);
+				clients[i] = clients[--numClients];
+			}
+		}
+
+		while(numClients < maxClients)
+		{
+			int fd = accept(listenFd, NULL, NULL);
+			if(fd < 0)
+				break;
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			memset(&clients[numClients], 0, sizeof(struct Client));
+			clients[numClients++].fd = fd;
+		}
+	}
+}
+
+// ********** the client (the part that's measured) **********
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t numSamples;
+static int numStarted; // streams that got their audio format
+static int numFinished;
+
+static void playbackCB(void* userdata, int16_t* samples, size_t num)
+{
+	pthread_mutex_lock(&statsLock);
+	numSamples += num;
+	pthread_mutex_unlock(&statsLock);
+}
+
+static int initAudioCB(void* userdata, int sampleRate, int numChannels)
+{
+	pthread_mutex_lock(&statsLock);
+	++numStarted;
+	pthread_mutex_unlock(&statsLock);
+	return 1;
+}
+
+static void titleCB(void* userdata, const char* title)
+{
+	// only for metadata-only streams, so they've got something to do
+	if(*(bool*)userdata == false)
+	{
+		pthread_mutex_lock(&statsLock);
+		++numStarted;
+		pthread_mutex_unlock(&statsLock);
+		*(bool*)userdata = true;
+	}
+}
+
+static void finishedCB(void* userdata, int result)
+{
+	pthread_mutex_lock(&statsLock);
+	++numFinished;
+	pthread_mutex_unlock(&statsLock);
+}
+
+static void* groupThread(void* arg)
+{
+	WRC_RunStreamGroup((WRC_StreamGroup*)arg);
+	return NULL;
+}
+
+// resident memory in bytes
+static size_t residentMemory(void)
+{
+	size_t size = 0, resident = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+	if(f != NULL)
+	{
+		if(fscanf(f, "%zu %zu", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+		return resident * sysconf(_SC_PAGESIZE);
+	}
+	// no /proc, the peak is better than nothing
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	return ru.ru_maxrss;
+#else
+	return (size_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+static double cpuSeconds(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+	       + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static bool runBenchmark(const char* url, int numStreams, int numGroups, int seconds, bool metadataOnly)
+{
+	if(numGroups > numStreams)
+		numGroups = numStreams;
+
+	numSamples = 0;
+	numStarted = numFinished = 0;
+
+	size_t rssBefore = residentMemory();
+
+	WRC_StreamGroup* groups[MAX_GROUPS];
+	pthread_t threads[MAX_GROUPS];
+	for(int i=0; i<numGroups; ++i)
+	{
+		groups[i] = WRC_CreateStreamGroup(finishedCB);
+		if(groups[i] == NULL || pthread_create(&threads[i], NULL, groupThread, groups[i]) != 0)
+		{
+			eprintf("couldn't create stream group!\n");
+			exit(1);
+		}
+	}
+
+	WRC_Stream** streams = calloc(numStreams, sizeof(WRC_Stream*));
+	bool* gotTitle = calloc(numStreams, sizeof(bool));
+	for(int i=0; i<numStreams; ++i)
+	{
+		streams[i] = WRC_CreateStream(url, playbackCB, initAudioCB, &gotTitle[i]);
+		if(streams[i] == NULL)
+		{
+			eprintf("couldn't create stream!\n");
+			exit(1);
+		}
+		if(metadataOnly)
+		{
+			WRC_SetMetadataOnly(streams[i], 1);
+			WRC_SetMetadataCallbacks(streams[i], NULL, titleCB);
+		}
+		WRC_AddStreamToGroup(groups[i % numGroups], streams[i]);
+	}
+
+	// wait until all of them are playing (the titles take a few seconds)
+	uint64_t deadline = testTimeMs() + 10000 + numStreams*10;
+	int started = 0, finished = 0;
+	do
+	{
+		usleep(50*1000);
+		pthread_mutex_lock(&statsLock);
+		started = numStarted;
+		finished = numFinished;
+		pthread_mutex_unlock(&statsLock);
+	}
+	while(started + finished < numStreams && testTimeMs() < deadline);
+
+	// after the burst on connect
+	usleep(1500*1000);
+
+	pthread_mutex_lock(&statsLock);
+	uint64_t samplesBefore = numSamples;
+	pthread_mutex_unlock(&statsLock);
+	double cpuBefore = cpuSeconds();
+	uint64_t timeBefore = testTimeMs();
+
+	usleep(seconds*1000*1000);
+
+	double cpu = cpuSeconds() - cpuBefore;
+	double wall = (testTimeMs() - timeBefore) / 1000.0;
+	pthread_mutex_lock(&statsLock);
+	uint64_t samples = numSamples - samplesBefore;
+	finished = numFinished;
+	pthread_mutex_unlock(&statsLock);
+	size_t rss = residentMemory();
+
+	double rssPerStream = rss > rssBefore ? (double)(rss - rssBefore) / numStreams / 1024.0 : 0.0;
+	printf("%6d streams %4d started %4d failed | CPU %7.2f%% total, %6.3f%% per stream"
+	       " | RSS %8.1f MB, %7.1f KB per stream",
+	       numStreams, started, finished, 100.0*cpu/wall, 100.0*cpu/wall/numStreams,
+	       rss / (1024.0*1024.0), rssPerStream);
+	if(!metadataOnly)
+	{
+		// 44.1kHz stereo
+		printf(" | %5.1f%% realtime", 100.0*samples / (wall*44100*2*numStreams));
+	}
+	printf("\n");
+	fflush(stdout);
+
+	for(int i=0; i<numGroups; ++i)
+	{
+		WRC_StopStreamGroup(groups[i]);
+		pthread_join(threads[i], NULL);
+		WRC_CleanupStreamGroup(groups[i]);
+	}
+	for(int i=0; i<numStreams; ++i)
+	{
+		WRC_CleanupStream(streams[i]);
+	}
+	free(streams);
+	free(gotTitle);
+
+	return started == numStreams && finished == 0;
+}
+
+int main(int argc, char** argv)
+{
+	int counts[16];
+	int numCounts = 0;
+	int seconds = 5;
+	int numGroups = 1;
+	bool metadataOnly = false;
+
+	for(int i=1; i<argc; ++i)
+	{
+		if(strcmp(argv[i], "-d") == 0 && i+1 < argc)
+			seconds = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-g") == 0 && i+1 < argc)
+			numGroups = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-m") == 0)
+			metadataOnly = true;
+		else if(atoi(argv[i]) > 0 && numCounts < 16)
+			counts[numCounts++] = atoi(argv[i]);
+		else
+		{
+			eprintf("usage: %s [-d seconds] [-g numGroups] [-m] [numStreams ...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(numCounts == 0)
+	{
+		counts[0] = 10;
+		counts[1] = 100;
+		counts[2] = 1000;
+		numCounts = 3;
+	}
+	if(numGroups < 1 || numGroups > MAX_GROUPS || seconds < 1)
+	{
+		eprintf("invalid arguments!\n");
+		return 1;
+	}
+
+	int maxStreams = 0;
+	for(int i=0; i<numCounts; ++i)
+	{
+		if(counts[i] > maxStreams)
+			maxStreams = counts[i];
+	}
+
+	// every stream needs a socket here and one in the server
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)maxStreams + 64)
+	{
+		rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (rlim_t)maxStreams + 64)
+		              ? (rlim_t)maxStreams + 64 : rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if(rl.rlim_cur < (rlim_t)maxStreams + 64)
+			eprintf("WARNING: only %d file descriptors allowed, streams will fail!\n", (int)rl.rlim_cur);
+	}
+
+	int port = 0;
+	int listenFd = testListen(&port);
+	if(listenFd < 0)
+		return 1;
+
+	pid_t server = fork();
+	if(server < 0)
+	{
+		perror("fork()");
+		return 1;
+	}
+	if(server == 0)
+	{
+		runServer(listenFd, maxStreams);
+		_exit(0);
+	}
+	close(listenFd);
+
+	char url[64];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/stream", port);
+
+	if(!WRC_Init())
+	{
+		kill(server, SIGTERM);
+		return 1;
+	}
+
+	printf("%d group(s), %s, %d seconds each\n", numGroups,
+	       metadataOnly ? "metadata only" : "decoding", seconds);
+
+	bool ok = true;
+	for(int i=0; i<numCounts; ++i)
+	{
+		ok = runBenchmark(url, counts[i], numGroups, seconds, metadataOnly) && ok;
+	}
+
+	WRC_Shutdown();
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,454 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// Plays a live HLS stream from a local server: its playlist has a sliding window of
+// WINDOW segments that moves on by one segment every SEGMENT_MS. The segments are
+// alternately MPEG-TS and packed audio (with an ID3 tag) with silent MPEG frames,
+// and the first download of one of them fails. Checks that
+// * the playlist is reloaded often enough to keep up with the server's window, but not
+//   much more often than every half target duration,
+// * playback starts 3 segments before the end of the window and downloads every
+//   following segment once, in order (the prefetched ones are downloaded in parallel, so
+//   their requests might arrive in any order), and only after it showed up in the playlist,
+// * the failed segment is retried after a delay and the stream goes on after it,
+// * the audio of all segments is decoded.
+// The times are measured by the server and only compared with its own schedule with
+// generous bounds, so a slow or busy machine doesn't make the test fail.
+
+#define _DEFAULT_SOURCE
+#include "testutil.h"
+#include "webradioclient.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define SEGMENT_MS 1000 // also the target duration
+#define WINDOW 4
+// MPEG1 layer III, 128kbit/s, 44.1kHz, stereo: 38 frames are about one second
+#define FRAME_SIZE 417
+#define FRAMES_PER_SEGMENT 38
+#define SAMPLES_PER_FRAME (1152*2)
+// of the segments that are played, this one (counted from 0) fails once
+#define FAILING_SEGMENT 2
+// WRC__HLS_RETRY_MS in hls.c
+#define RETRY_MS 1000
+#define PREFETCH 2
+#define TEST_MS 6500
+
+#define MAX_REQUESTS 256
+
+#define TS_PACKET_SIZE 188
+#define AUDIO_PID 0x100
+#define PMT_PID 0x1000
+
+struct Request
+{
+	uint64_t timeMs; // since the server started
+	bool playlist;
+	long seq; // for segments
+	long lastSeqInPlaylist; // the newest segment the server had announced by then
+	int status;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	int listenFd;
+	uint64_t startMs;
+	struct Request requests[MAX_REQUESTS];
+	int numRequests;
+	long lastAnnounced; // -1 until the playlist was loaded once
+	long firstSeq; // -1 until the first segment was requested
+	bool failed; // the failing segment failed already
+} server;
+
+static uint64_t samplesDecoded;
+
+// all segments are the same
+static unsigned char tsSegment[64*1024];
+static size_t tsSegmentLen;
+static unsigned char rawSegment[FRAMES_PER_SEGMENT*FRAME_SIZE + 10];
+static size_t rawSegmentLen;
+
+static long mediaSequence(uint64_t ms)
+{
+	return (long)(ms / SEGMENT_MS);
+}
+
+static void putFrames(unsigned char* dst)
+{
+	memset(dst, 0, FRAMES_PER_SEGMENT*FRAME_SIZE);
+	for(int f=0; f < FRAMES_PER_SEGMENT; ++f)
+	{
+		// the rest of the frame is 0, which is silence
+		static const unsigned char hdr[4] = { 0xFF, 0xFB, 0x90, 0x64 };
+		memcpy(dst + f*FRAME_SIZE, hdr, 4);
+	}
+}
+
+// one TS packet with the payload (at most 184 bytes, the rest is filled by the adaptation field)
+static size_t tsPacket(unsigned char* pkt, int pid, bool unitStart, int* cc, const unsigned char* payload, size_t len)
+{
+	size_t stuffing = 184 - len;
+	pkt[0] = 0x47;
+	pkt[1] = (unitStart ? 0x40 : 0) | (pid >> 8);
+	pkt[2] = pid & 0xff;
+	pkt[3] = (stuffing > 0 ? 0x30 : 0x10) | (*cc & 0x0f);
+	*cc += 1;
+
+	unsigned char* p = pkt + 4;
+	if(stuffing > 0)
+	{
+		*p++ = stuffing - 1; // adaptation_field_length
+		if(stuffing > 1)
+		{
+			*p++ = 0; // no flags
+			memset(p, 0xff, stuffing - 2);
+			p += stuffing - 2;
+		}
+	}
+	memcpy(p, payload, len);
+	return TS_PACKET_SIZE;
+}
+
+// PAT, PMT and one PES packet with the frames. The CRCs of the tables are 0,
+// the client doesn't check them.
+static size_t createTsSegment(unsigned char* buf)
+{
+	size_t len = 0;
+	int patCC = 0, pmtCC = 0, audioCC = 0;
+
+	static const unsigned char pat[] = {
+		0, // pointer field
+		0x00, 0xB0, 13, 0x00, 0x01, 0xC1, 0x00, 0x00,
+		0x00, 0x01, 0xE0 | (PMT_PID >> 8), PMT_PID & 0xff, // program 1
+		0, 0, 0, 0
+	};
+	len += tsPacket(buf + len, 0, true, &patCC, pat, sizeof(pat));
+
+	static const unsigned char pmt[] = {
+		0,
+		0x02, 0xB0, 18, 0x00, 0x01, 0xC1, 0x00, 0x00,
+		0xE0 | (AUDIO_PID >> 8), AUDIO_PID & 0xff, 0xF0, 0x00, // PCR PID, no program info
+		0x03, 0xE0 | (AUDIO_PID >> 8), AUDIO_PID & 0xff, 0xF0, 0x00, // MPEG-1 audio
+		0, 0, 0, 0
+	};
+	len += tsPacket(buf + len, PMT_PID, true, &pmtCC, pmt, sizeof(pmt));
+
+	unsigned char pes[14 + FRAMES_PER_SEGMENT*FRAME_SIZE];
+	size_t pesLen = sizeof(pes) - 6;
+	static const unsigned char pesHdr[14] = {
+		0x00, 0x00, 0x01, 0xC0, 0, 0, 0x80, 0x80, 5, // with PTS
+		0x21, 0x00, 0x01, 0x00, 0x01
+	};
+	memcpy(pes, pesHdr, sizeof(pesHdr));
+	pes[4] = pesLen >> 8;
+	pes[5] = pesLen & 0xff;
+	putFrames(pes + 14);
+
+	for(size_t pos=0; pos < sizeof(pes); pos += 184)
+	{
+		size_t n = (sizeof(pes) - pos < 184) ? sizeof(pes) - pos : 184;
+		len += tsPacket(buf + len, AUDIO_PID, pos == 0, &audioCC, pes + pos, n);
+	}
+	return len;
+}
+
+// packed audio: an (empty) ID3 tag and the frames
+static size_t createRawSegment(unsigned char* buf)
+{
+	static const unsigned char id3[10] = { 'I', 'D', '3', 4, 0, 0, 0, 0, 0, 0 };
+	memcpy(buf, id3, sizeof(id3));
+	putFrames(buf + sizeof(id3));
+	return sizeof(id3) + FRAMES_PER_SEGMENT*FRAME_SIZE;
+}
+
+static void* handleConnection(void* arg)
+{
+	int fd = (int)(intptr_t)arg;
+	char path[256];
+	if(!testReadRequest(fd, path, sizeof(path)))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&server.lock);
+	uint64_t now = testTimeMs() - server.startMs;
+	long mediaSeq = mediaSequence(now);
+	struct Request* req = NULL;
+	if(server.numRequests < MAX_REQUESTS)
+	{
+		req = &server.requests[server.numRequests++];
+		req->timeMs = now;
+		req->lastSeqInPlaylist = server.lastAnnounced;
+	}
+
+	long seq = -1;
+	char ext[4] = "";
+	int status = 200;
+	if(strcmp(path, "/live.m3u8") == 0)
+	{
+		server.lastAnnounced = mediaSeq + WINDOW - 1;
+	}
+	else if(sscanf(path, "/seg%ld.%3s", &seq, ext) != 2 || seq > server.lastAnnounced)
+	{
+		status = 404; // or not in the playlist yet
+	}
+	else
+	{
+		if(server.firstSeq < 0)
+			server.firstSeq = seq;
+		if(seq == server.firstSeq + FAILING_SEGMENT && !server.failed)
+		{
+			server.failed = true;
+			status = 503;
+		}
+	}
+	if(req != NULL)
+	{
+		req->playlist = (seq < 0 && status == 200);
+		req->seq = seq;
+		req->status = status;
+	}
+	pthread_mutex_unlock(&server.lock);
+
+	if(status != 200)
+	{
+		testSendResponse(fd, status, "text/plain", "error", 5);
+	}
+	else if(seq < 0)
+	{
+		char playlist[1024];
+		int len = snprintf(playlist, sizeof(playlist), "#EXTM3U\n#EXT-X-VERSION:3\n"
+		                   "#EXT-X-TARGETDURATION:%d\n#EXT-X-MEDIA-SEQUENCE:%ld\n",
+		                   SEGMENT_MS / 1000, mediaSeq);
+		for(long s=mediaSeq; s < mediaSeq + WINDOW; ++s)
+		{
+			// every other segment is packed audio
+			len += snprintf(playlist + len, sizeof(playlist) - len, "#EXTINF:%d.0,\nseg%ld.%s\n",
+			                SEGMENT_MS / 1000, s, (s % 2 == 0) ? "ts" : "mp3");
+		}
+		testSendResponse(fd, 200, "application/vnd.apple.mpegurl", playlist, len);
+	}
+	else if(strcmp(ext, "ts") == 0)
+	{
+		testSendResponse(fd, 200, "video/mp2t", tsSegment, tsSegmentLen);
+	}
+	else
+	{
+		testSendResponse(fd, 200, "audio/mpeg", rawSegment, rawSegmentLen);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void* serverThread(void* arg)
+{
+	for(;;)
+	{
+		int fd = accept(server.listenFd, NULL, NULL);
+		if(fd < 0)
+			break; // shut down by main()
+
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, handleConnection, (void*)(intptr_t)fd) == 0)
+			pthread_detach(thread);
+		else
+			close(fd);
+	}
+	return NULL;
+}
+
+// ********** the client **********
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void playbackCB(void* userdata, int16_t* samples, size_t numSamples)
+{
+	pthread_mutex_lock(&statsLock);
+	samplesDecoded += numSamples;
+	pthread_mutex_unlock(&statsLock);
+}
+
+static int initAudioCB(void* userdata, int sampleRate, int numChannels)
+{
+	return sampleRate == 44100 && numChannels == 2;
+}
+
+static void reportErrorCB(void* userdata, int errorCode, const char* errormsg)
+{
+	eprintf("stream error %d: %s\n", errorCode, errormsg);
+}
+
+static void* streamThread(void* arg)
+{
+	WRC_StartStreaming((WRC_Stream*)arg);
+	return NULL;
+}
+
+static int numFailures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { eprintf(__VA_ARGS__); eprintf("\n"); ++numFailures; } } while(0)
+
+static void checkRequests(const WRC_StreamStats* stats)
+{
+	uint64_t lastPlaylistMs = 0;
+	int numPlaylists = 0;
+	long startSeq = -1;
+	long maxSeq = -1;
+	int timesRequested[MAX_REQUESTS] = { 0 }; // from startSeq on
+	int failedRequests = 0;
+	int retriedRequests = 0;
+	long failedSeq = -1;
+	uint64_t failedMs = 0;
+
+	for(int i=0; i < server.numRequests; ++i)
+	{
+		const struct Request* r = &server.requests[i];
+		if(r->playlist)
+		{
+			if(numPlaylists > 0)
+			{
+				// after the target duration if it changed, otherwise after half of it. Late is
+				// ok as long as the server didn't move on by more than two segments in between
+				uint64_t interval = r->timeMs - lastPlaylistMs;
+				CHECK(interval >= SEGMENT_MS/4, "playlist reloaded after only %d ms", (int)interval);
+				CHECK(mediaSequence(r->timeMs) - mediaSequence(lastPlaylistMs) <= 2,
+				      "playlist reloaded after %d ms, the server moved on by more than two segments", (int)interval);
+			}
+			lastPlaylistMs = r->timeMs;
+			++numPlaylists;
+			continue;
+		}
+
+		CHECK(r->seq >= 0, "request for something unknown");
+		CHECK(r->seq <= r->lastSeqInPlaylist, "segment %ld requested before it was in the playlist (up to %ld)",
+		      r->seq, r->lastSeqInPlaylist);
+
+		if(startSeq < 0)
+		{
+			// the window had segments first-1 .. first+2 then, it starts 3 before the end
+			startSeq = r->lastSeqInPlaylist - 2;
+			maxSeq = startSeq - 1;
+		}
+		if(r->seq == failedSeq)
+		{
+			// the next segments might've been requested in between
+			++retriedRequests;
+			// it must wait a bit, the timer might fire early by a millisecond
+			CHECK(r->timeMs - failedMs >= RETRY_MS - 10, "segment retried after only %d ms",
+			      (int)(r->timeMs - failedMs));
+		}
+		else if(r->seq < startSeq || r->seq >= startSeq + MAX_REQUESTS)
+		{
+			CHECK(false, "segment %ld requested, but it started with %ld", r->seq, startSeq);
+		}
+		else
+		{
+			CHECK(r->seq > maxSeq - PREFETCH && r->seq <= maxSeq + PREFETCH, "segment %ld requested after %ld",
+			      r->seq, maxSeq);
+			++timesRequested[r->seq - startSeq];
+			if(r->seq > maxSeq)
+				maxSeq = r->seq;
+		}
+		if(r->status == 503)
+		{
+			++failedRequests;
+			failedSeq = r->seq;
+			failedMs = r->timeMs;
+		}
+	}
+
+	for(long seq=startSeq; seq <= maxSeq; ++seq)
+	{
+		CHECK(timesRequested[seq - startSeq] == 1, "segment %ld requested %d times", seq,
+		      timesRequested[seq - startSeq]);
+	}
+
+	CHECK(numPlaylists >= 3, "playlist loaded only %d times", numPlaylists);
+	CHECK(failedRequests == 1 && retriedRequests == 1, "the failing segment was requested %d more times",
+	      retriedRequests);
+	CHECK(stats->hlsSegmentRetries == 1, "%lu retries in the stats", stats->hlsSegmentRetries);
+
+	// it must keep up with the live stream after the retry, i.e. the segments it downloads
+	// must not fall out of the window
+	long played = maxSeq + 1 - startSeq;
+	CHECK(played > FAILING_SEGMENT + 1, "only %ld segments downloaded", played);
+	CHECK(maxSeq > server.lastAnnounced - WINDOW, "segment %ld was the last one requested, but %ld is the newest",
+	      maxSeq, server.lastAnnounced);
+	// the ones that were still being downloaded when it stopped aren't counted
+	CHECK(stats->hlsSegments <= (unsigned long)played && stats->hlsSegments + PREFETCH >= (unsigned long)played,
+	      "%lu segments in the stats, but %ld requested", stats->hlsSegments, played);
+
+	// all downloaded ones must've been decoded, but the last ones maybe not completely
+	uint64_t minSamples = (uint64_t)(stats->hlsSegments - 1) * FRAMES_PER_SEGMENT * SAMPLES_PER_FRAME;
+	CHECK(samplesDecoded >= minSamples, "%llu samples decoded, expected at least %llu",
+	      (unsigned long long)samplesDecoded, (unsigned long long)minSamples);
+}
+
+int main(int argc, char** argv)
+{
+	tsSegmentLen = createTsSegment(tsSegment);
+	rawSegmentLen = createRawSegment(rawSegment);
+
+	pthread_mutex_init(&server.lock, NULL);
+	server.lastAnnounced = -1;
+	server.firstSeq = -1;
+
+	int port = 0;
+	server.listenFd = testListen(&port);
+	if(server.listenFd < 0)
+		return 1;
+
+	// start in the middle of a segment, so the reloads aren't in sync with the server
+	server.startMs = testTimeMs() - 5*SEGMENT_MS - SEGMENT_MS/2;
+
+	pthread_t srvThread;
+	pthread_create(&srvThread, NULL, serverThread, NULL);
+
+	if(!WRC_Init())
+		return 1;
+
+	char url[64];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/live.m3u8", port);
+	WRC_Stream* stream = WRC_CreateStream(url, playbackCB, initAudioCB, NULL);
+	WRC_SetErrorReportingCallback(stream, reportErrorCB);
+	WRC_SetHlsPrefetch(stream, PREFETCH, 0);
+
+	pthread_t strThread;
+	pthread_create(&strThread, NULL, streamThread, stream);
+
+	usleep(TEST_MS * 1000);
+
+	// the stats only once it stopped, so they match the server's requests
+	WRC_StopStreaming(stream);
+	pthread_join(strThread, NULL);
+
+	WRC_StreamStats stats;
+	WRC_GetStreamStats(stream, &stats);
+	pthread_mutex_lock(&server.lock);
+	pthread_mutex_lock(&statsLock);
+	checkRequests(&stats);
+	pthread_mutex_unlock(&statsLock);
+	pthread_mutex_unlock(&server.lock);
+
+	WRC_CleanupStream(stream);
+	WRC_Shutdown();
+
+	shutdown(server.listenFd, SHUT_RDWR);
+	close(server.listenFd);
+	pthread_join(srvThread, NULL);
+
+	printf("%s\n", numFailures == 0 ? "OK" : "FAILED");
+	return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// Checks that convertScalar() and every SIMD version in pcmconv.c this CPU can run give
+// exactly the int16 samples of referenceSample(): for 1-3 channels, every length from 0
+// to 70 frames (so all the remainders after the SIMD loops), unaligned source and
+// destination pointers and samples that are out of range, infinite or NaN.
+// The dot products for the resampler are compared with dotScalar() (not bit-exact,
+// they add in a different order).
+
+#include "../pcmconv.c"
+
+#include "testutil.h"
+
+#include <float.h>
+#include <math.h>
+
+#define MAX_FRAMES 70
+#define MAX_CHANNELS 3
+// dst gets this many guard samples before and after the output
+#define GUARD 8
+#define GUARD_VAL 0x5A5A
+
+struct Kernel
+{
+	const char* name;
+	WRC__convertFun convert;
+	WRC__dotFun dot;
+};
+
+static int numFailures;
+
+static uint32_t rndState = 12345;
+
+static uint32_t rnd(void)
+{
+	// xorshift32, so the test is the same on every run
+	rndState ^= rndState << 13;
+	rndState ^= rndState >> 17;
+	rndState ^= rndState << 5;
+	return rndState;
+}
+
+// what convertSample() is supposed to do, without relying on float => int conversions
+// of values that don't fit
+static int16_t referenceSample(float f)
+{
+	if(isnan(f))
+		return 0;
+	float x = f*32767.0f + 0.5f;
+	if(x >= 32767.0f)
+		return 32767;
+	if(x <= -32768.0f)
+		return -32768;
+	return (int16_t)truncf(x);
+}
+
+static void referenceConvert(int16_t* dst, float** src, int numChannels, int numFrames)
+{
+	for(int i=0; i < numFrames; ++i)
+	{
+		for(int c=0; c < numChannels; ++c)
+			dst[i*numChannels + c] = referenceSample(src[c][i]);
+	}
+}
+
+static float rndSample(void)
+{
+	static const float specials[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 0.5f, -0.5f, 1.0f/32767.0f, -1.0f/32767.0f,
+		1.5f/32767.0f, -1.5f/32767.0f, 0.5f/32767.0f, -0.5f/32767.0f, // .5 after the multiplication
+		1.00001f, -1.00001f, 1.0001f, -1.0001f, 2.0f, -2.0f, 65536.0f, -65536.0f,
+		1e10f, -1e10f, FLT_MAX, -FLT_MAX, FLT_MIN, -FLT_MIN, 1e-40f, -1e-40f,
+		INFINITY, -INFINITY, NAN, -NAN
+	};
+
+	uint32_t r = rnd();
+	if(r % 4 == 0)
+	{
+		return specials[(r >> 8) % (sizeof(specials)/sizeof(specials[0]))];
+	}
+	// mostly in -1.0 .. 1.0, some a bit out of it
+	return ((int32_t)(r >> 8) - (1 << 23)) / (float)(1 << 23) * 1.1f;
+}
+
+static void checkConvert(const struct Kernel* k, int numChannels, int numFrames, int srcOffset, int dstOffset)
+{
+	// +4 for the offsets
+	float srcBuf[MAX_CHANNELS][MAX_FRAMES + 4];
+	int16_t expected[GUARD + MAX_CHANNELS*MAX_FRAMES + 4 + GUARD];
+	int16_t got[GUARD + MAX_CHANNELS*MAX_FRAMES + 4 + GUARD];
+	float* src[MAX_CHANNELS];
+
+	for(int c=0; c < numChannels; ++c)
+	{
+		src[c] = srcBuf[c] + srcOffset;
+		for(int i=0; i < numFrames; ++i)
+			src[c][i] = rndSample();
+	}
+	for(size_t i=0; i < sizeof(got)/sizeof(got[0]); ++i)
+		expected[i] = got[i] = GUARD_VAL;
+
+	referenceConvert(expected + GUARD + dstOffset, src, numChannels, numFrames);
+	k->convert(got + GUARD + dstOffset, src, numChannels, numFrames);
+
+	if(memcmp(expected, got, sizeof(got)) != 0)
+	{
+		for(size_t i=0; i < sizeof(got)/sizeof(got[0]); ++i)
+		{
+			if(expected[i] != got[i])
+			{
+				int idx = (int)i - GUARD - dstOffset;
+				eprintf("%s: %d channels, %d frames, src+%d, dst+%d: sample %d is %d instead of %d",
+				        k->name, numChannels, numFrames, srcOffset, dstOffset, idx, got[i], expected[i]);
+				if(idx >= 0 && idx < numChannels*numFrames)
+					eprintf(" (from %g)\n", src[idx % numChannels][idx / numChannels]);
+				else
+					eprintf(" (written outside of dst)\n");
+				break;
+			}
+		}
+		++numFailures;
+	}
+}
+
+static void checkDot(const struct Kernel* k, int n, int offset)
+{
+	float a[32 + 4], b[32 + 4];
+	float sumAbs = 0.0f;
+	for(int i=0; i < n; ++i)
+	{
+		a[offset + i] = ((int32_t)(rnd() >> 8) - (1 << 23)) / (float)(1 << 23);
+		b[offset + i] = ((int32_t)(rnd() >> 8) - (1 << 23)) / (float)(1 << 23);
+		sumAbs += fabsf(a[offset + i] * b[offset + i]);
+	}
+
+	float expected = dotScalar(a + offset, b + offset, n);
+	float got = k->dot(a + offset, b + offset, n);
+	if(fabsf(expected - got) > sumAbs * 1e-6f)
+	{
+		eprintf("%s: dot product of %d floats (+%d) is %g instead of %g\n", k->name, n, offset, got, expected);
+		++numFailures;
+	}
+}
+
+static void checkKernel(const struct Kernel* k)
+{
+	int failuresBefore = numFailures;
+
+	for(int numChannels=1; numChannels <= MAX_CHANNELS; ++numChannels)
+	{
+		for(int numFrames=0; numFrames <= MAX_FRAMES; ++numFrames)
+		{
+			for(int srcOffset=0; srcOffset < 4; ++srcOffset)
+			{
+				for(int dstOffset=0; dstOffset < 4; ++dstOffset)
+				{
+					checkConvert(k, numChannels, numFrames, srcOffset, dstOffset);
+				}
+			}
+		}
+	}
+
+	// the resampler's filters have 8, 16 or 32 taps
+	for(int n=8; n <= 32; n += 8)
+	{
+		for(int offset=0; offset < 4; ++offset)
+		{
+			checkDot(k, n, offset);
+		}
+	}
+	printf("%-10s %s\n", k->name, numFailures == failuresBefore ? "OK" : "FAILED");
+}
+
+// the values that are easy to get wrong, so they don't depend on rndSample()
+static void checkSpecials(void)
+{
+	static const struct { float in; int16_t out; } cases[] = {
+		{ 0.0f, 0 }, { 1.0f, 32767 }, { -1.0f, -32766 }, { 2.0f, 32767 }, { -2.0f, -32768 },
+		{ 1e10f, 32767 }, { -1e10f, -32768 }, { FLT_MAX, 32767 }, { -FLT_MAX, -32768 },
+		{ INFINITY, 32767 }, { -INFINITY, -32768 }, { NAN, 0 }, { -NAN, 0 }
+	};
+	for(size_t i=0; i < sizeof(cases)/sizeof(cases[0]); ++i)
+	{
+		if(referenceSample(cases[i].in) != cases[i].out)
+		{
+			eprintf("reference: %g is %d instead of %d\n", cases[i].in, referenceSample(cases[i].in), cases[i].out);
+			++numFailures;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	struct Kernel kernels[5];
+	int numKernels = 0;
+
+	checkSpecials();
+
+	kernels[numKernels++] = (struct Kernel){ "scalar", convertScalar, dotScalar };
+#ifdef WRC__PCMCONV_X86
+	if(cpuHasSSE2())
+	{
+		kernels[numKernels++] = (struct Kernel){ "SSE2", convertSSE2, dotSSE2 };
+	}
+	if(cpuHasAVX2())
+	{
+		kernels[numKernels++] = (struct Kernel){ "AVX2", convertAVX2, dotAVX2 };
+	}
+#endif
+#ifdef WRC__PCMCONV_NEON
+	kernels[numKernels++] = (struct Kernel){ "NEON", convertNEON, dotNEON };
+#endif
+
+	// and whatever is used on this CPU
+	WRC__initPcmConv();
+	kernels[numKernels++] = (struct Kernel){ "dispatched", WRC__floatToInt16, WRC__dotProduct };
+
+	for(int i=0; i < numKernels; ++i)
+	{
+		checkKernel(&kernels[i]);
+	}
+
+	return numFailures == 0 ? 0 : 1;
+}
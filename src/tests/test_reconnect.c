@@ -0,0 +1,183 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// Reconnects with WRC_SetDecoderThread(): a local server sends a burst of MPEG frames
+// and closes the connection while the decoder thread (slowed down by playbackCB) still
+// has most of them in its ring. The next connection is Ogg instead (so the decoder is
+// replaced), the one after that MPEG again, then the server is gone. Checks that
+// * the stream reconnected twice and then gave up,
+// * the audio that was buffered when the connections dropped was decoded, i.e. the
+//   decoder thread finished with the old decoder before it was replaced.
+
+#define _DEFAULT_SOURCE
+#include "testutil.h"
+#include "webradioclient.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+// MPEG1 layer III, 128kbit/s, 44.1kHz, stereo
+#define FRAME_SIZE 417
+#define SAMPLES_PER_FRAME (1152*2)
+// much more than the decoder thread's ring holds
+#define RING_SIZE (32*1024)
+#define FRAMES_PER_CONNECTION 300
+// the decoder might need a frame to sync and keep the last one back
+#define MAX_FRAMES_LOST 2
+#define TIMEOUT_MS 20000
+
+static const struct
+{
+	const char* contentType;
+	int numFrames; // of MPEG audio, 0 for some Ogg data
+} connections[] = {
+	{ "audio/mpeg", FRAMES_PER_CONNECTION },
+	{ "application/ogg", 0 },
+	{ "audio/mpeg", FRAMES_PER_CONNECTION },
+	// after that: 404
+};
+#define NUM_CONNECTIONS (int)(sizeof(connections)/sizeof(connections[0]))
+
+static int listenFd;
+static unsigned char frames[FRAMES_PER_CONNECTION*FRAME_SIZE];
+
+static void* serverThread(void* arg)
+{
+	for(int i=0; ; ++i)
+	{
+		int fd = accept(listenFd, NULL, NULL);
+		if(fd < 0)
+			break; // shut down by main()
+
+		char path[256];
+		if(testReadRequest(fd, path, sizeof(path)))
+		{
+			if(i >= NUM_CONNECTIONS)
+			{
+				testSendResponse(fd, 404, "text/plain", "gone", 4);
+			}
+			else if(connections[i].numFrames > 0)
+			{
+				// all at once, so most of it is still in the ring when the connection is closed
+				testSendResponse(fd, 200, connections[i].contentType, frames,
+				                 connections[i].numFrames*FRAME_SIZE);
+			}
+			else
+			{
+				// no Ogg page, so nothing is decoded
+				static const char junk[4096];
+				testSendResponse(fd, 200, connections[i].contentType, junk, sizeof(junk));
+			}
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+// ********** the client **********
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t samplesDecoded;
+static bool streamDone;
+
+static void playbackCB(void* userdata, int16_t* samples, size_t numSamples)
+{
+	// a slow consumer, so the decoder thread lags behind the network thread
+	usleep(500);
+	pthread_mutex_lock(&lock);
+	samplesDecoded += numSamples;
+	pthread_mutex_unlock(&lock);
+}
+
+static int initAudioCB(void* userdata, int sampleRate, int numChannels)
+{
+	return sampleRate == 44100 && numChannels == 2;
+}
+
+static void* streamThread(void* arg)
+{
+	WRC_StartStreaming((WRC_Stream*)arg);
+	pthread_mutex_lock(&lock);
+	streamDone = true;
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+static int numFailures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { eprintf(__VA_ARGS__); eprintf("\n"); ++numFailures; } } while(0)
+
+int main(int argc, char** argv)
+{
+	for(int f=0; f < FRAMES_PER_CONNECTION; ++f)
+	{
+		// the rest of the frame is 0, which is silence
+		static const unsigned char hdr[4] = { 0xFF, 0xFB, 0x90, 0x64 };
+		memcpy(frames + f*FRAME_SIZE, hdr, 4);
+	}
+
+	int port = 0;
+	listenFd = testListen(&port);
+	if(listenFd < 0)
+		return 1;
+
+	pthread_t srvThread;
+	pthread_create(&srvThread, NULL, serverThread, NULL);
+
+	if(!WRC_Init())
+		return 1;
+
+	char url[64];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/stream", port);
+	WRC_Stream* stream = WRC_CreateStream(url, playbackCB, initAudioCB, NULL);
+	WRC_SetDecoderThread(stream, RING_SIZE, "test_reconnect", -1);
+	WRC_SetReconnectPolicy(stream, 2, 50, 100, 0);
+
+	pthread_t strThread;
+	pthread_create(&strThread, NULL, streamThread, stream);
+
+	uint64_t deadline = testTimeMs() + TIMEOUT_MS;
+	bool done = false;
+	while(!done && testTimeMs() < deadline)
+	{
+		usleep(10*1000);
+		pthread_mutex_lock(&lock);
+		done = streamDone;
+		pthread_mutex_unlock(&lock);
+	}
+	CHECK(done, "the stream didn't give up after the server was gone");
+
+	WRC_StopStreaming(stream);
+	pthread_join(strThread, NULL);
+
+	WRC_StreamStats stats;
+	WRC_GetStreamStats(stream, &stats);
+	CHECK(stats.reconnects == NUM_CONNECTIONS - 1, "reconnected %lu times", stats.reconnects);
+	CHECK(stats.decoderRingStalls > 0, "the ring never ran full");
+
+	uint64_t maxSamples = 0;
+	for(int i=0; i < NUM_CONNECTIONS; ++i)
+		maxSamples += (uint64_t)connections[i].numFrames * SAMPLES_PER_FRAME;
+	uint64_t minSamples = maxSamples - 2 * MAX_FRAMES_LOST * SAMPLES_PER_FRAME;
+	CHECK(samplesDecoded >= minSamples && samplesDecoded <= maxSamples,
+	      "%llu samples decoded, expected %llu", (unsigned long long)samplesDecoded,
+	      (unsigned long long)maxSamples);
+
+	WRC_CleanupStream(stream);
+	WRC_Shutdown();
+
+	shutdown(listenFd, SHUT_RDWR);
+	close(listenFd);
+	pthread_join(srvThread, NULL);
+
+	printf("%s\n", numFailures == 0 ? "OK" : "FAILED");
+	return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,300 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// WRC_SetStandby() with a local server: the first connection sends some MPEG frames
+// (and the beginning of one more) and then stalls. The other connections (the standby
+// connections) send frames in realtime-ish, starting in the middle of a frame, with ICY
+// metadata whose title counts the metadata blocks. Checks that
+// * the stream failed over to the standby connection once,
+// * the standby connection was read until then, i.e. the first title after the failover
+//   is about as new as the audio the server was sending at that time,
+// * the ICY metadata continued seamlessly, i.e. each block's title was received in order,
+//   even if the failover happened in the middle of one,
+// * the audio of the standby connection was decoded.
+
+#define _DEFAULT_SOURCE
+#include "testutil.h"
+#include "webradioclient.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+// MPEG1 layer III, 128kbit/s, 44.1kHz, stereo
+#define FRAME_SIZE 417
+#define SAMPLES_PER_FRAME (1152*2)
+#define PRIMARY_FRAMES 40
+#define STALL_MS 1500
+// the standby connections send a frame every FRAME_MS
+#define FRAME_MS 10
+// not a multiple of FRAME_SIZE, so metadata blocks are split between sends
+#define ICY_METAINT 2000
+#define MAX_BLOCKS 1024
+#define TEST_MS 4000
+// how much older than the failover the first title after it may be (a block is sent
+// about every 50ms, a paused standby connection would have one from right after it connected)
+#define MAX_STALE_MS 500
+
+static int listenFd;
+static bool stopServer;
+static unsigned char frame[FRAME_SIZE];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// when the first standby connection sent each metadata block
+static uint64_t blockSentTime[MAX_BLOCKS];
+
+static bool serverStopped(void)
+{
+	pthread_mutex_lock(&lock);
+	bool stopped = stopServer;
+	pthread_mutex_unlock(&lock);
+	return stopped;
+}
+
+static bool sendAll(int fd, const void* data, size_t len)
+{
+	const char* d = data;
+	while(len > 0)
+	{
+		ssize_t n = send(fd, d, len, MSG_NOSIGNAL);
+		if(n <= 0)
+			return false;
+		d += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void sendPrimary(int fd)
+{
+	static const char header[] = "HTTP/1.0 200 OK\r\nContent-Type: audio/mpeg\r\n\r\n";
+	if(!sendAll(fd, header, strlen(header)))
+		return;
+	for(int f=0; f < PRIMARY_FRAMES; ++f)
+	{
+		if(!sendAll(fd, frame, FRAME_SIZE))
+			return;
+	}
+	// the decoder must drop this when the standby connection takes over
+	sendAll(fd, frame, FRAME_SIZE / 3);
+
+	while(!serverStopped())
+		usleep(10*1000);
+}
+
+static void sendStandby(int fd, bool first)
+{
+	char header[128];
+	snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: audio/mpeg\r\n"
+	         "icy-metaint: %d\r\n\r\n", ICY_METAINT);
+	if(!sendAll(fd, header, strlen(header)))
+		return;
+
+	// starts with the end of a frame, like a server that sends from its ring buffer
+	size_t framePos = FRAME_SIZE / 2;
+	int audioSinceMeta = 0;
+	for(int block=0; block < MAX_BLOCKS && !serverStopped(); )
+	{
+		unsigned char buf[2*FRAME_SIZE];
+		size_t len = 0;
+		// one frame of audio, with the metadata that belongs in between
+		for(int n=0; n < FRAME_SIZE; ++n)
+		{
+			if(audioSinceMeta == ICY_METAINT)
+			{
+				char meta[64] = { 0 };
+				snprintf(meta, sizeof(meta), "StreamTitle='block %d';", block);
+				buf[len++] = sizeof(meta) / 16;
+				memcpy(buf + len, meta, sizeof(meta));
+				len += sizeof(meta);
+				audioSinceMeta = 0;
+
+				pthread_mutex_lock(&lock);
+				if(first)
+					blockSentTime[block] = testTimeMs();
+				pthread_mutex_unlock(&lock);
+				++block;
+			}
+			buf[len++] = frame[framePos];
+			framePos = (framePos + 1) % FRAME_SIZE;
+			++audioSinceMeta;
+		}
+		if(!sendAll(fd, buf, len))
+			return;
+		usleep(FRAME_MS*1000);
+	}
+}
+
+static void* connectionThread(void* arg)
+{
+	int fd = (int)(intptr_t)arg;
+	static int numConnections;
+
+	char path[256];
+	if(testReadRequest(fd, path, sizeof(path)))
+	{
+		pthread_mutex_lock(&lock);
+		int connection = numConnections++;
+		pthread_mutex_unlock(&lock);
+
+		if(connection == 0)
+			sendPrimary(fd);
+		else
+			sendStandby(fd, connection == 1);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void* serverThread(void* arg)
+{
+	pthread_t threads[16];
+	int numThreads = 0;
+	for(;;)
+	{
+		int fd = accept(listenFd, NULL, NULL);
+		if(fd < 0)
+			break; // shut down by main()
+		if(numThreads == 16)
+		{
+			close(fd);
+			continue;
+		}
+		pthread_create(&threads[numThreads++], NULL, connectionThread, (void*)(intptr_t)fd);
+	}
+	for(int i=0; i < numThreads; ++i)
+		pthread_join(threads[i], NULL);
+	return NULL;
+}
+
+// ********** the client **********
+
+static uint64_t samplesDecoded;
+static uint64_t samplesAtFailover;
+static uint64_t failoverTime;
+static int numFailovers;
+// the blocks of the titles received after the failover, -1 for a title that isn't one
+static int titleBlocks[MAX_BLOCKS];
+static int numTitles;
+
+static void playbackCB(void* userdata, int16_t* samples, size_t numSamples)
+{
+	pthread_mutex_lock(&lock);
+	samplesDecoded += numSamples;
+	pthread_mutex_unlock(&lock);
+}
+
+static int initAudioCB(void* userdata, int sampleRate, int numChannels)
+{
+	return sampleRate == 44100 && numChannels == 2;
+}
+
+static void titleCB(void* userdata, const char* title)
+{
+	int block = -1;
+	if(sscanf(title, "block %d", &block) != 1)
+		block = -1;
+	pthread_mutex_lock(&lock);
+	if(numTitles < MAX_BLOCKS)
+		titleBlocks[numTitles++] = block;
+	pthread_mutex_unlock(&lock);
+}
+
+static void failoverCB(void* userdata, int latencyMs)
+{
+	pthread_mutex_lock(&lock);
+	++numFailovers;
+	failoverTime = testTimeMs();
+	samplesAtFailover = samplesDecoded;
+	pthread_mutex_unlock(&lock);
+}
+
+static void* streamThread(void* arg)
+{
+	WRC_StartStreaming((WRC_Stream*)arg);
+	return NULL;
+}
+
+static int numFailures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { eprintf(__VA_ARGS__); eprintf("\n"); ++numFailures; } } while(0)
+
+int main(int argc, char** argv)
+{
+	// the rest of the frame is 0, which is silence
+	static const unsigned char hdr[4] = { 0xFF, 0xFB, 0x90, 0x64 };
+	memcpy(frame, hdr, 4);
+
+	int port = 0;
+	listenFd = testListen(&port);
+	if(listenFd < 0)
+		return 1;
+
+	pthread_t srvThread;
+	pthread_create(&srvThread, NULL, serverThread, NULL);
+
+	if(!WRC_Init())
+		return 1;
+
+	char url[64];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/stream", port);
+	WRC_Stream* stream = WRC_CreateStream(url, playbackCB, initAudioCB, NULL);
+	WRC_SetMetadataCallbacks(stream, NULL, titleCB);
+	WRC_SetStandby(stream, STALL_MS, NULL, failoverCB);
+
+	pthread_t strThread;
+	pthread_create(&strThread, NULL, streamThread, stream);
+
+	usleep(TEST_MS*1000);
+
+	WRC_StopStreaming(stream);
+	pthread_join(strThread, NULL);
+
+	WRC_StreamStats stats;
+	WRC_GetStreamStats(stream, &stats);
+	CHECK(stats.failovers == 1 && numFailovers == 1, "%lu failovers, the callback was called %d times",
+	      stats.failovers, numFailovers);
+
+	pthread_mutex_lock(&lock);
+	CHECK(numTitles > 0, "no titles received");
+	if(numTitles > 0)
+	{
+		int first = titleBlocks[0];
+		CHECK(first >= 0 && first < MAX_BLOCKS && blockSentTime[first] + MAX_STALE_MS >= failoverTime,
+		      "the first title after the failover was block %d, sent %lld ms before it", first,
+		      (first >= 0 && first < MAX_BLOCKS) ? (long long)(failoverTime - blockSentTime[first]) : -1LL);
+	}
+	for(int i=1; i < numTitles; ++i)
+	{
+		CHECK(titleBlocks[i] == titleBlocks[i-1] + 1, "title %d was block %d, after block %d",
+		      i, titleBlocks[i], titleBlocks[i-1]);
+	}
+	pthread_mutex_unlock(&lock);
+
+	CHECK(samplesAtFailover >= (PRIMARY_FRAMES - 2) * (uint64_t)SAMPLES_PER_FRAME,
+	      "%llu samples decoded before the failover", (unsigned long long)samplesAtFailover);
+	// it ran for TEST_MS - STALL_MS at least, minus some for connecting etc
+	uint64_t minFrames = (TEST_MS - STALL_MS) / FRAME_MS / 4;
+	CHECK(samplesDecoded - samplesAtFailover >= minFrames * SAMPLES_PER_FRAME,
+	      "only %llu samples decoded after the failover", (unsigned long long)(samplesDecoded - samplesAtFailover));
+
+	WRC_CleanupStream(stream);
+	WRC_Shutdown();
+
+	pthread_mutex_lock(&lock);
+	stopServer = true;
+	pthread_mutex_unlock(&lock);
+	shutdown(listenFd, SHUT_RDWR);
+	close(listenFd);
+	pthread_join(srvThread, NULL);
+
+	printf("%s\n", numFailures == 0 ? "OK" : "FAILED");
+	return numFailures == 0 ? 0 : 1;
+}
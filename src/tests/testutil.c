@@ -0,0 +1,102 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+#define _DEFAULT_SOURCE
+#include "testutil.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+uint64_t testTimeMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+int testListen(int* port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		perror("socket()");
+		return -1;
+	}
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0; // any free one
+
+	socklen_t addrLen = sizeof(addr);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0
+	   || getsockname(fd, (struct sockaddr*)&addr, &addrLen) != 0)
+	{
+		perror("creating the test server's socket failed");
+		close(fd);
+		return -1;
+	}
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+bool testReadRequest(int fd, char* path, size_t pathSize)
+{
+	char req[4096];
+	size_t len = 0;
+	while(len < sizeof(req) - 1)
+	{
+		ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if(n <= 0)
+			return false;
+		len += n;
+		req[len] = '\0';
+		if(strstr(req, "\r\n\r\n") != NULL)
+			break;
+	}
+
+	if(strncmp(req, "GET ", 4) != 0)
+		return false;
+	const char* start = req + 4;
+	const char* end = strchr(start, ' ');
+	if(end == NULL || (size_t)(end - start) >= pathSize)
+		return false;
+	memcpy(path, start, end - start);
+	path[end - start] = '\0';
+	return true;
+}
+
+static bool sendAll(int fd, const void* data, size_t len)
+{
+	const char* d = data;
+	while(len > 0)
+	{
+		ssize_t n = send(fd, d, len, MSG_NOSIGNAL);
+		if(n <= 0)
+			return false;
+		d += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool testSendResponse(int fd, int status, const char* contentType, const void* body, size_t len)
+{
+	char header[256];
+	int headerLen = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\n"
+	                         "Content-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+	                         status, (status == 200) ? "OK" : "Error", contentType, len);
+	return sendAll(fd, header, headerLen) && sendAll(fd, body, len);
+}
@@ -0,0 +1,38 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// helpers shared by the tests and benchmarks in this directory (POSIX only)
+
+#ifndef SRC_TESTS_TESTUTIL_H_
+#define SRC_TESTS_TESTUTIL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef eprintf
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+// milliseconds from CLOCK_MONOTONIC
+uint64_t testTimeMs(void);
+
+// creates a listening TCP socket on 127.0.0.1 with a port chosen by the OS,
+// which is written to *port. Returns the socket or -1 on error
+int testListen(int* port);
+
+// reads an HTTP request from fd (a blocking socket) and writes the path from its
+// "GET <path> HTTP/1.x" line to path. Returns false if that failed
+bool testReadRequest(int fd, char* path, size_t pathSize);
+
+// sends a complete HTTP response with the given status code and body, the server
+// closes the connection afterwards. Returns false if sending failed
+bool testSendResponse(int fd, int status, const char* contentType, const void* body, size_t len);
+
+#endif /* SRC_TESTS_TESTUTIL_H_ */
@@ -0,0 +1,279 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// thin wrappers around the threading primitives of the platform (pthreads or win32)
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for pthread_setname_np() and pthread_setaffinity_np()
+#endif
+
+#include "internal.h"
+
+#ifndef _WIN32
+#include <time.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#endif
+
+// the platform's thread functions have a different signature than ours
+struct WRC__ThreadStart
+{
+	void (*threadFun)(void* arg);
+	void* arg;
+};
+
+#ifdef _WIN32
+
+void WRC__mutexInit(WRC__Mutex* mutex)
+{
+	InitializeCriticalSection(mutex);
+}
+
+void WRC__mutexDestroy(WRC__Mutex* mutex)
+{
+	DeleteCriticalSection(mutex);
+}
+
+void WRC__mutexLock(WRC__Mutex* mutex)
+{
+	EnterCriticalSection(mutex);
+}
+
+void WRC__mutexUnlock(WRC__Mutex* mutex)
+{
+	LeaveCriticalSection(mutex);
+}
+
+void WRC__condInit(WRC__Cond* cond)
+{
+	InitializeConditionVariable(cond);
+}
+
+void WRC__condDestroy(WRC__Cond* cond)
+{
+	// nothing to do
+}
+
+void WRC__condSignal(WRC__Cond* cond)
+{
+	WakeConditionVariable(cond);
+}
+
+void WRC__condBroadcast(WRC__Cond* cond)
+{
+	WakeAllConditionVariable(cond);
+}
+
+bool WRC__condWait(WRC__Cond* cond, WRC__Mutex* mutex, int timeoutMs)
+{
+	return SleepConditionVariableCS(cond, mutex, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs) != 0;
+}
+
+static DWORD WINAPI threadStartFun(LPVOID arg)
+{
+	struct WRC__ThreadStart start = *(struct WRC__ThreadStart*)arg;
+	free(arg);
+	start.threadFun(start.arg);
+	return 0;
+}
+
+bool WRC__threadCreate(WRC__Thread* thread, void (*threadFun)(void* arg), void* arg)
+{
+	struct WRC__ThreadStart* start = malloc(sizeof(struct WRC__ThreadStart));
+	if(start == NULL)
+		return false;
+
+	start->threadFun = threadFun;
+	start->arg = arg;
+
+	*thread = CreateThread(NULL, 0, threadStartFun, start, 0, NULL);
+	if(*thread == NULL)
+	{
+		free(start);
+		return false;
+	}
+	return true;
+}
+
+void WRC__threadJoin(WRC__Thread thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+void WRC__threadSetName(WRC__Thread thread, const char* name)
+{
+	// SetThreadDescription() only exists on Windows 10 and wants a wide string, don't bother
+}
+
+void WRC__threadSetAffinity(WRC__Thread thread, int cpu)
+{
+	if(cpu >= 0 && cpu < (int)(sizeof(DWORD_PTR)*8))
+	{
+		SetThreadAffinityMask(thread, (DWORD_PTR)1 << cpu);
+	}
+}
+
+uint64_t WRC__timeMs(void)
+{
+	return GetTickCount64();
+}
+
+void WRC__sleepMs(int ms)
+{
+	Sleep(ms);
+}
+
+#else // pthreads
+
+void WRC__mutexInit(WRC__Mutex* mutex)
+{
+	pthread_mutex_init(mutex, NULL);
+}
+
+void WRC__mutexDestroy(WRC__Mutex* mutex)
+{
+	pthread_mutex_destroy(mutex);
+}
+
+void WRC__mutexLock(WRC__Mutex* mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+void WRC__mutexUnlock(WRC__Mutex* mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+void WRC__condInit(WRC__Cond* cond)
+{
+#ifdef __APPLE__
+	pthread_cond_init(cond, NULL); // no pthread_condattr_setclock(), see WRC__condWait()
+#else
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+#endif
+}
+
+void WRC__condDestroy(WRC__Cond* cond)
+{
+	pthread_cond_destroy(cond);
+}
+
+void WRC__condSignal(WRC__Cond* cond)
+{
+	pthread_cond_signal(cond);
+}
+
+void WRC__condBroadcast(WRC__Cond* cond)
+{
+	pthread_cond_broadcast(cond);
+}
+
+bool WRC__condWait(WRC__Cond* cond, WRC__Mutex* mutex, int timeoutMs)
+{
+	if(timeoutMs < 0)
+	{
+		return pthread_cond_wait(cond, mutex) == 0;
+	}
+
+	struct timespec ts;
+#ifdef __APPLE__
+	ts.tv_sec = timeoutMs / 1000;
+	ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+	return pthread_cond_timedwait_relative_np(cond, mutex, &ts) != ETIMEDOUT;
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeoutMs / 1000;
+	ts.tv_nsec += (timeoutMs % 1000) * 1000000L;
+	if(ts.tv_nsec >= 1000000000L)
+	{
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(cond, mutex, &ts) != ETIMEDOUT;
+#endif
+}
+
+static void* threadStartFun(void* arg)
+{
+	struct WRC__ThreadStart start = *(struct WRC__ThreadStart*)arg;
+	free(arg);
+	start.threadFun(start.arg);
+	return NULL;
+}
+
+bool WRC__threadCreate(WRC__Thread* thread, void (*threadFun)(void* arg), void* arg)
+{
+	struct WRC__ThreadStart* start = malloc(sizeof(struct WRC__ThreadStart));
+	if(start == NULL)
+		return false;
+
+	start->threadFun = threadFun;
+	start->arg = arg;
+
+	if(pthread_create(thread, NULL, threadStartFun, start) != 0)
+	{
+		free(start);
+		return false;
+	}
+	return true;
+}
+
+void WRC__threadJoin(WRC__Thread thread)
+{
+	pthread_join(thread, NULL);
+}
+
+void WRC__threadSetName(WRC__Thread thread, const char* name)
+{
+#ifdef __linux__
+	char buf[16]; // linux doesn't allow more than 15 chars + terminating \0
+	WRC__snprintf(buf, sizeof(buf), "%s", name);
+	pthread_setname_np(thread, buf);
+#endif
+}
+
+void WRC__threadSetAffinity(WRC__Thread thread, int cpu)
+{
+#ifdef __linux__
+	if(cpu >= 0 && cpu < CPU_SETSIZE)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(thread, sizeof(set), &set);
+	}
+#endif
+}
+
+uint64_t WRC__timeMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+void WRC__sleepMs(int ms)
+{
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR)
+	{
+		// interrupted by a signal, sleep the rest
+	}
+}
+
+#endif // _WIN32
@@ -0,0 +1,367 @@
+/*
+ * libwrclient - webradio client library
+ *
+ * Copyright (C) 2015-2017 Masterbrain Bytes GmbH & Co. KG
+ *
+ * Released under MIT license, see LICENSE.txt
+ */
+
+// WRC_WarmPool: prefetched streams are connected in the background by a
+// WRC_StreamGroup running in the pool's own thread. Once the content-type is known
+// and the ICY metadata is split off, the compressed audio is held back (instead of
+// being decoded) until WRC_StartStreaming() is called, then the transfer is paused
+// until then. Starting a prefetched stream just feeds the held data to the decoder
+// and resumes the transfer, the stream keeps running in the pool's thread.
+
+#include "internal.h"
+
+// how long WRC_StartStreaming() waits for the pool's thread at once
+#define WRC__WARM_WAIT_MS 100
+// assumed bitrate (in kbit/s) if the server doesn't send icy-br
+#define WRC__WARM_DEFAULT_KBPS 320
+// Ogg headers alone can be several KB, so hold at least this many bytes
+#define WRC__WARM_MIN_HELD 32768
+
+struct WRC__WarmPool
+{
+	WRC_StreamGroup* group;
+	WRC__Thread thread;
+	int maxStreams;
+	int idleTimeoutMs;
+
+	// protects the following and the activate, evicting, done and result members
+	// of the streams' struct WRC__Warm
+	WRC__Mutex lock;
+	WRC__Cond cond; // signaled when a stream is done
+	// prefetched streams that haven't been started yet, newest first, linked by warm.next
+	WRC_Stream* waiting;
+	int numWaiting;
+};
+
+static void poolThreadFun(void* arg)
+{
+	WRC_WarmPool* pool = (WRC_WarmPool*)arg;
+	WRC_RunStreamGroup(pool->group);
+}
+
+// pool->lock must be locked
+static void unlinkWaiting(WRC_WarmPool* pool, WRC_Stream* ctx)
+{
+	WRC_Stream** prev = &pool->waiting;
+	while(*prev != NULL)
+	{
+		if(*prev == ctx)
+		{
+			*prev = ctx->warm.next;
+			ctx->warm.next = NULL;
+			--pool->numWaiting;
+			return;
+		}
+		prev = &(*prev)->warm.next;
+	}
+}
+
+// pool->lock must be locked
+static void evict(WRC_WarmPool* pool, WRC_Stream* ctx)
+{
+	unlinkWaiting(pool, ctx);
+	ctx->warm.evicting = true;
+	// not WRC_StopStreaming(): if the pool's thread has finished the stream already
+	// (and is about to call WRC__warmStreamFinished()), userAbort must stay unset
+	WRC__stopGroupStream(ctx);
+}
+
+static void freeHeld(struct WRC__Warm* w)
+{
+	free(w->held);
+	w->held = NULL;
+	w->heldLen = 0;
+	w->heldCap = 0;
+	free(w->title);
+	w->title = NULL;
+}
+
+bool WRC__warmHold(WRC_Stream* ctx, void* data, size_t size)
+{
+	struct WRC__Warm* w = &ctx->warm;
+
+	if(w->maxHeld == 0)
+	{
+		// the headers are parsed by now
+		int kbps = (ctx->icyBitrate > 0) ? ctx->icyBitrate : WRC__WARM_DEFAULT_KBPS;
+		w->maxHeld = (size_t)w->bufferMs * kbps / 8;
+		if(w->maxHeld < WRC__WARM_MIN_HELD)
+			w->maxHeld = WRC__WARM_MIN_HELD;
+	}
+
+	if(w->heldLen + size > w->heldCap)
+	{
+		size_t cap = w->heldCap ? w->heldCap : 16384;
+		while(cap < w->heldLen + size)
+			cap *= 2;
+
+		unsigned char* held = realloc(w->held, cap);
+		if(held == NULL)
+		{
+			WRC__errorReset(ctx, WRC_ERR_GENERIC, "Out of Memory when prefetching the stream!");
+			return false;
+		}
+		w->held = held;
+		w->heldCap = cap;
+	}
+
+	memcpy(w->held + w->heldLen, data, size);
+	w->heldLen += size;
+	return true;
+}
+
+void WRC__warmHoldTitle(WRC_Stream* ctx, const char* title)
+{
+	size_t len = strlen(title);
+	free(ctx->warm.title);
+	ctx->warm.title = malloc(len+1);
+	if(ctx->warm.title != NULL)
+		memcpy(ctx->warm.title, title, len+1);
+}
+
+// called in the pool's thread: passes the held data on, the stream plays from now on
+static void activate(WRC_Stream* ctx)
+{
+	struct WRC__Warm* w = &ctx->warm;
+
+	w->holding = false;
+
+	if(w->stationInfoPending)
+	{
+		w->stationInfoPending = false;
+		WRC__sendStationInfo(ctx);
+	}
+	if(w->title != NULL)
+	{
+		WRC__sendTitle(ctx, w->title);
+	}
+
+	if(w->heldLen > 0 && !WRC__decodeMusic(ctx, w->held, w->heldLen))
+	{
+		// the error has been reported, curlWriteFun() aborts the transfer once it's resumed
+		ctx->streamState = WRC__STREAM_ABORT_ERROR;
+	}
+	freeHeld(w);
+
+	if(w->paused)
+	{
+		w->paused = false;
+		// this might call curlWriteFun() right away with the data curl kept for us
+		curl_easy_pause(ctx->curl, CURLPAUSE_CONT);
+	}
+}
+
+void WRC__warmCheck(WRC_Stream* ctx)
+{
+	struct WRC__Warm* w = &ctx->warm;
+	WRC_WarmPool* pool = w->pool;
+
+	if(pool == NULL || !w->holding)
+		return;
+
+	WRC__mutexLock(&pool->lock);
+	bool activateNow = w->activate;
+	if(!activateNow && !w->evicting && pool->idleTimeoutMs > 0
+	   && WRC__timeMs() - w->prefetchTime >= (uint64_t)pool->idleTimeoutMs)
+	{
+		evict(pool, ctx);
+	}
+	WRC__mutexUnlock(&pool->lock);
+
+	if(activateNow)
+	{
+		activate(ctx);
+	}
+}
+
+void WRC__warmStreamFinished(WRC_Stream* ctx, int result)
+{
+	struct WRC__Warm* w = &ctx->warm;
+	WRC_WarmPool* pool = w->pool;
+
+	freeHeld(w);
+	w->holding = false;
+	w->paused = false;
+	w->stationInfoPending = false;
+	w->maxHeld = 0;
+
+	WRC__mutexLock(&pool->lock);
+	unlinkWaiting(pool, ctx);
+	w->done = true;
+	w->result = result;
+	if(!w->activate)
+	{
+		// failed or evicted before it was started, WRC_StartStreaming() starts it like
+		// any other stream then (also if the pool is gone by then)
+		w->pool = NULL;
+	}
+	WRC__condBroadcast(&pool->cond);
+	WRC__mutexUnlock(&pool->lock);
+}
+
+// waits until the pool's thread is done with the stream and detaches it from the pool,
+// returns the result of the stream
+static int waitUntilDone(WRC_WarmPool* pool, WRC_Stream* ctx)
+{
+	WRC__mutexLock(&pool->lock);
+	while(!ctx->warm.done)
+	{
+		WRC__condWait(&pool->cond, &pool->lock, WRC__WARM_WAIT_MS);
+	}
+	ctx->warm.pool = NULL;
+	WRC__mutexUnlock(&pool->lock);
+
+	return ctx->warm.result;
+}
+
+int WRC__startWarmStream(WRC_Stream* ctx, bool* started)
+{
+	WRC_WarmPool* pool = ctx->warm.pool;
+
+	WRC__mutexLock(&pool->lock);
+	bool usable = !ctx->warm.done && !ctx->warm.evicting;
+	if(usable)
+	{
+		unlinkWaiting(pool, ctx);
+		ctx->warm.activate = true;
+	}
+	WRC__mutexUnlock(&pool->lock);
+
+	if(usable)
+	{
+		// makes the pool's thread call WRC__warmCheck()
+		WRC__wakeupGroup(pool->group);
+	}
+
+	int ret = waitUntilDone(pool, ctx);
+
+	// if the stream failed or was evicted before it was started, it must be started normally
+	*started = usable;
+	return ret;
+}
+
+void WRC__cancelWarmStream(WRC_Stream* ctx)
+{
+	WRC_WarmPool* pool = ctx->warm.pool;
+
+	WRC__mutexLock(&pool->lock);
+	if(!ctx->warm.done && !ctx->warm.evicting && !ctx->warm.activate)
+	{
+		evict(pool, ctx);
+	}
+	WRC__mutexUnlock(&pool->lock);
+
+	waitUntilDone(pool, ctx);
+}
+
+WRC_WarmPool* WRC_CreateWarmPool(int maxStreams, int idleTimeoutMs)
+{
+	if(maxStreams <= 0)
+	{
+		eprintf("WRC_CreateWarmPool(): maxStreams must be > 0!\n");
+		return NULL;
+	}
+
+	WRC_WarmPool* ret = calloc(1, sizeof(struct WRC__WarmPool));
+	if(ret == NULL)
+	{
+		eprintf("WRC_CreateWarmPool(): Out of Memory!\n");
+		return NULL;
+	}
+
+	ret->group = WRC_CreateStreamGroup(NULL);
+	if(ret->group == NULL)
+	{
+		free(ret);
+		return NULL;
+	}
+
+	ret->maxStreams = maxStreams;
+	ret->idleTimeoutMs = idleTimeoutMs;
+	WRC__mutexInit(&ret->lock);
+	WRC__condInit(&ret->cond);
+
+	if(!WRC__threadCreate(&ret->thread, poolThreadFun, ret))
+	{
+		eprintf("WRC_CreateWarmPool(): Creating the thread failed!\n");
+		WRC__condDestroy(&ret->cond);
+		WRC__mutexDestroy(&ret->lock);
+		WRC_CleanupStreamGroup(ret->group);
+		free(ret);
+		return NULL;
+	}
+	WRC__threadSetName(ret->thread, "wrc-prefetch");
+
+	return ret;
+}
+
+int WRC_Prefetch(WRC_WarmPool* pool, WRC_Stream* stream, int bufferMs)
+{
+	if(stream->group != NULL || stream->curl != NULL || stream->async != NULL || stream->warm.pool != NULL)
+	{
+		eprintf("WRC_Prefetch(): stream is already streaming or prefetched!\n");
+		return 0;
+	}
+	if(bufferMs <= 0)
+	{
+		eprintf("WRC_Prefetch(): bufferMs must be > 0!\n");
+		return 0;
+	}
+
+	struct WRC__Warm* w = &stream->warm;
+	w->bufferMs = bufferMs;
+	w->maxHeld = 0;
+	w->holding = true;
+	w->prefetchTime = WRC__timeMs();
+	w->activate = false;
+	w->evicting = false;
+	w->done = false;
+	w->result = 0;
+
+	WRC__mutexLock(&pool->lock);
+	w->pool = pool;
+	if(pool->numWaiting >= pool->maxStreams)
+	{
+		// make room by evicting the stream that has been waiting the longest
+		WRC_Stream* oldest = pool->waiting;
+		while(oldest->warm.next != NULL)
+			oldest = oldest->warm.next;
+		evict(pool, oldest);
+	}
+	w->next = pool->waiting;
+	pool->waiting = stream;
+	++pool->numWaiting;
+	WRC__mutexUnlock(&pool->lock);
+
+	if(!WRC_AddStreamToGroup(pool->group, stream))
+	{
+		WRC__mutexLock(&pool->lock);
+		unlinkWaiting(pool, stream);
+		w->pool = NULL;
+		WRC__mutexUnlock(&pool->lock);
+		w->holding = false;
+		return 0;
+	}
+
+	return 1;
+}
+
+void WRC_CleanupWarmPool(WRC_WarmPool* pool)
+{
+	if(pool == NULL)
+		return;
+
+	// aborts all streams of the pool
+	WRC_StopStreamGroup(pool->group);
+	WRC__threadJoin(pool->thread);
+
+	WRC_CleanupStreamGroup(pool->group);
+	WRC__condDestroy(&pool->cond);
+	WRC__mutexDestroy(&pool->lock);
+	free(pool);
+}
@@ -33,6 +33,18 @@ extern "C" {
 struct WRC__Stream;
 typedef struct WRC__Stream WRC_Stream;
 
+// a group of streams that are all streamed by the same thread, see WRC_CreateStreamGroup()
+struct WRC__StreamGroup;
+typedef struct WRC__StreamGroup WRC_StreamGroup;
+
+// streams connected in the background so they start right away, see WRC_CreateWarmPool()
+struct WRC__WarmPool;
+typedef struct WRC__WarmPool WRC_WarmPool;
+
+// reads the samples of WRC_SetSharedMemorySink() in another process, see WRC_OpenShmReader()
+struct WRC__ShmReader;
+typedef struct WRC__ShmReader WRC_ShmReader;
+
 enum
 {
 	WRC_ERR_NOERROR = 0,
@@ -44,12 +56,171 @@ enum
 	WRC_ERR_GENERIC = 255 // some other error
 };
 
+// for WRC_GetPollInfo() and WRC_OnSocketEvent()
+#ifdef _WIN32
+typedef uintptr_t WRC_Socket; // a SOCKET
+#else
+typedef int WRC_Socket;
+#endif
+
+enum
+{
+	WRC_POLL_IN = 1,  // wait until the socket is readable
+	WRC_POLL_OUT = 2, // wait until the socket is writable
+	WRC_POLL_ERR = 4  // only passed to WRC_OnSocketEvent(): an error happened on the socket
+};
+
+typedef struct WRC_PollFd
+{
+	WRC_Socket fd;
+	int events; // WRC_POLL_IN and/or WRC_POLL_OUT
+} WRC_PollFd;
+
+typedef struct WRC_PollInfo
+{
+	// the sockets of the stream, there's no fixed limit (HLS prefetching, standby and
+	// racing connections all add some). fds belongs to the stream and is valid until
+	// the next call to WRC_OnSocketEvent(), WRC_OnTimeout() or WRC_CleanupStream()
+	int numFds;
+	const WRC_PollFd* fds;
+	// call WRC_OnTimeout() after this many milliseconds if none of the sockets had an event
+	// before, -1 if there is no timeout
+	int timeoutMs;
+} WRC_PollInfo;
+
+// returned by WRC_OnSocketEvent() and WRC_OnTimeout() as long as the stream is running
+#define WRC_STILL_STREAMING (-1)
+
+// statistics about a stream, see WRC_GetStreamStats()
+typedef struct WRC_StreamStats
+{
+	// WRC_SetDecoderThread(): size of the ring buffer for compressed data,
+	// the max number of bytes that were in it at once and how often the network
+	// thread had to wait because the decoder thread didn't keep up and the ring was full
+	size_t decoderRingSize;
+	size_t decoderRingHighWater;
+	unsigned long decoderRingStalls;
+
+	// WRC_SetJitterBuffer() and WRC_SetPullMode(): how many milliseconds of audio are currently buffered,
+	// how often it ran empty and for how long playback stalled because of that in total
+	// (until the buffer was filled up to targetMs again)
+	int jitterBufferMs;
+	unsigned long jitterBufferUnderruns;
+	uint64_t jitterBufferStalledMs;
+
+	// WRC_SetReconnectPolicy(): how often the stream recovered from a dropped connection,
+	// how many connection attempts that took in total and how long the last recovery
+	// took (from the drop until data arrived again)
+	unsigned long reconnects;
+	unsigned long reconnectAttempts;
+	uint64_t lastRecoveryMs;
+
+	// WRC_SetFlowControl(): how often receiving data was paused because the consumer
+	// had enough and for how long in total
+	unsigned long flowPauses;
+	uint64_t flowPausedMs;
+
+	// WRC_SetStandby(): how often the standby connection took over and how long the
+	// last failover took (from the last data of the old connection until the first
+	// data of the standby connection was decoded)
+	unsigned long failovers;
+	uint64_t lastFailoverMs;
+
+	// WRC_SetOutputProvider(): how many frames were thrown away because acquireFn had no room
+	uint64_t outputDroppedFrames;
+
+	// WRC_SetDriftCompensation(): the estimated drift between the server's clock and
+	// the consumer's clock (positive if the consumer is slower), the currently applied
+	// change of the resampling ratio (both in ppm) and the smoothed buffer level it's based on
+	double driftPpm;
+	double driftCorrectionPpm;
+	int driftBufferMs;
+
+	// HLS streams (see WRC_SetHlsPrefetch()): how many segments were downloaded,
+	// how many downloads were retried, how many segments are downloaded or waiting
+	// to be decoded right now, and how long the last segment's download took
+	// (and on average, weighted towards the recent ones)
+	unsigned long hlsSegments;
+	unsigned long hlsSegmentRetries;
+	int hlsPrefetched;
+	uint64_t hlsLastSegmentMs;
+	uint64_t hlsAvgSegmentMs;
+} WRC_StreamStats;
+
+// the types of WRC_ShmEvent
+enum
+{
+	WRC_SHM_SAMPLES = 1,      // samples, numFrames interleaved frames in the last format
+	WRC_SHM_FORMAT = 2,       // what would've been passed to initAudioFn
+	WRC_SHM_TITLE = 3,        // what would've been passed to currentTitleFn
+	WRC_SHM_STATION_INFO = 4, // what would've been passed to stationInfoFn
+	WRC_SHM_END = 5           // WRC_StartStreaming() returned, if it's started again
+	                          // a WRC_SHM_FORMAT event comes before the samples
+};
+
+// returned by WRC_ShmReaderNext(), the pointers point into the shared memory
+// and are valid until WRC_ShmReaderRelease()
+typedef struct WRC_ShmEvent
+{
+	int type; // WRC_SHM_*, only the fields for it are set
+
+	// WRC_SHM_SAMPLES
+	const void* samples;
+	size_t numFrames;
+
+	// WRC_SHM_FORMAT
+	int sampleRate;
+	int numChannels;
+	int format; // WRC_FMT_*
+
+	// WRC_SHM_TITLE
+	const char* title;
+
+	// WRC_SHM_STATION_INFO, NULL if the server didn't send it
+	const char* name;
+	const char* genre;
+	const char* description;
+	const char* url;
+} WRC_ShmEvent;
+
 // the following types are for callbacks provided by the user
 // void* userdata is the userdata provided to WRC_CreateStream()
 
 // called whenever fresh samples are available
 typedef void (*WRC_playbackCB)(void* userdata, int16_t* samples, size_t numSamples);
 
+// sample formats for WRC_SetOutputFormat()
+enum
+{
+	WRC_FMT_S16 = 0, // int16_t, the default
+	WRC_FMT_S32 = 1, // int32_t
+	WRC_FMT_F32 = 2  // float, -1.0 .. 1.0
+};
+
+// used by WRC_SetOutputProvider(): return memory for up to maxFrames frames (one sample
+// for each channel) of interleaved samples in the output format and set *numFrames to
+// how many frames fit there (may be less than maxFrames, e.g. at the end of your ring
+// buffer). Return NULL if you have no room, then the samples are thrown away.
+typedef void* (*WRC_acquireOutputCB)(void* userdata, size_t maxFrames, size_t* numFrames);
+
+// used by WRC_SetOutputProvider(): numFrames frames (maybe 0) have been written to data,
+// the memory returned by the last call of acquireFn
+typedef void (*WRC_commitOutputCB)(void* userdata, void* data, size_t numFrames);
+
+// quality levels for WRC_SetFixedOutput(), from cheapest to best
+enum
+{
+	WRC_RESAMPLE_FAST = 0,
+	WRC_RESAMPLE_MEDIUM = 1,
+	WRC_RESAMPLE_BEST = 2
+};
+
+// used instead of WRC_playbackCB with WRC_SetOutputFormat(): the samples are in the
+// format set there. if they're interleaved, data[0] contains numFrames*numChannels
+// samples, if they're planar, data[0] .. data[numChannels-1] contain numFrames samples
+// of one channel each.
+typedef void (*WRC_playbackFmtCB)(void* userdata, void* const* data, size_t numFrames);
+
 // called on start and whenever samplerate and/or number of channels change.
 // return 0 if you can't support that format to abort further decoding of the current stream
 typedef int (*WRC_initAudioCB)(void* userdata, int sampleRate, int numChannels);
@@ -67,17 +238,95 @@ typedef void (*WRC_currentTitleCB)(void* userdata, const char* currentTitle);
 // errorCode will be one of WRC_ERR_* from above
 typedef void (*WRC_reportErrorCB)(void* userdata, int errorCode, const char* errormsg);
 
+// used by WRC_SetFlowControl(): return how many milliseconds of audio you have queued
+// for playback (like SDL_GetQueuedAudioSize() converted to milliseconds).
+// may be called from the thread receiving the data while playbackCB is called
+// from another one (see WRC_SetDecoderThread() and WRC_SetJitterBuffer())
+typedef int (*WRC_queuedMsCB)(void* userdata);
+
+// used by WRC_SetStandby(): called from the thread receiving the data after the
+// standby connection took over, latencyMs is how long no data arrived
+typedef void (*WRC_failoverCB)(void* userdata, int latencyMs);
+
+// codecs in WRC_ProbeResult
+enum
+{
+	WRC_CODEC_UNKNOWN = 0,
+	WRC_CODEC_MP3 = 1, // MPEG audio (usually layer 3)
+	WRC_CODEC_VORBIS = 2
+};
+
+// passed to WRC_probeResultCB, the strings are only valid during the call
+// and are NULL if the server didn't send them
+typedef struct WRC_ProbeResult
+{
+	const char* url; // the URL passed to WRC_ProbeStations()
+	const char* streamURL; // the URL of the stream itself, e.g. from the playlist at url
+	int viaPlaylist; // 1 if url was a playlist
+
+	// WRC_ERR_NOERROR if the format was found, otherwise what went wrong
+	int error;
+	const char* errorMsg; // NULL if error is WRC_ERR_NOERROR
+
+	int codec; // WRC_CODEC_*
+	int sampleRate;
+	int numChannels;
+	// kbit/s, from the first MP3 frame or the nominal bitrate of the Vorbis stream,
+	// otherwise from the icy-br header (0 if unknown)
+	int bitrate;
+
+	const char* contentType;
+	const char* icyName;
+	const char* icyGenre;
+	const char* icyDescription;
+	const char* icyURL;
+	int icyMetaInt; // 0 if the stream doesn't send ICY metadata
+
+	// milliseconds from the start of the connection to the stream (after the playlist,
+	// if any) until DNS was resolved, the TCP connection was established, TLS was set up
+	// and the first byte arrived, -1 if it didn't get that far (or doesn't use TLS)
+	int dnsMs;
+	int connectMs;
+	int tlsMs;
+	int firstByteMs;
+	// milliseconds from starting the probe (including the playlist) until the result
+	int totalMs;
+} WRC_ProbeResult;
+
+// used by WRC_ProbeStations(): called once for each URL, index is its index in urls
+typedef void (*WRC_probeResultCB)(void* userdata, size_t index, const WRC_ProbeResult* result);
+
+// called when a stream that is part of a WRC_StreamGroup stopped streaming.
+// result is what WRC_StartStreaming() would have returned for the stream
+typedef void (*WRC_streamFinishedCB)(void* userdata, int result);
+
 
 
 // Sets up global internal stuff - call this *once* before using the library
 // (after loading it or on startup of your application or whatever)
+// This includes a cache for DNS lookups and TLS sessions that is shared by all
+// streams, so connecting to a server again (or to another stream on the same server)
+// is faster. The streams of a WRC_StreamGroup also reuse each other's connections.
 // Returns 1 on success, 0 on error
 WRC_EXTERN int WRC_Init();
 
 // Clears global internal stuff - call this *once* before unloading the library
-// or before shutting down your application
+// or before shutting down your application, after all streams have been cleaned up
 WRC_EXTERN void WRC_Shutdown();
 
+// Enables a cache (shared by all streams) that remembers where the URL of a stream led
+// to: through its playlist and HTTP redirects to the URL the audio actually came from.
+// The next time a stream with that URL is started, it connects there right away, which
+// saves a request (or several) before the audio starts. If that doesn't work (before
+// any audio arrived), the entry is dropped and the URL is resolved like without the cache.
+// * ttlSeconds: how long an entry is used after the audio last came from it,
+//               0 disables the cache (and forgets the entries)
+// * filePath: if not NULL, the cache is loaded from this file and written to it
+//             (atomically, via filePath.tmp) whenever an entry changes, so it
+//             survives restarts of your application
+// Call this after WRC_Init(). Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_EnableResolveCache(int ttlSeconds, const char* filePath);
+
 // Creates/prepares a new stream for the given URL, but doesn't start streaming.
 // Actual streaming will be started when you call WRC_StartStreaming() with the returned stream.
 // * url: The URL to connect to (*not* a playlist, but the actual http stream,
@@ -106,13 +355,23 @@ WRC_EXTERN WRC_Stream* WRC_CreateStream(const char* url, WRC_playbackCB playback
 WRC_EXTERN void WRC_SetMetadataCallbacks(WRC_Stream* stream, WRC_stationInfoCB stationInfoFn,
                                          WRC_currentTitleCB currentTitleFn);
 
+// Keeps streaming without decoding the audio, for when you only want the titles (e.g. to
+// follow what many stations are playing): the audio data of MP3 streams is just skipped,
+// for Ogg streams only the Vorbis comment headers (at the start of each track) are parsed.
+// Without this, a stream without playbackFn stops right after the station info was sent.
+// initAudioFn and playbackFn are never called, the stream runs until WRC_StopStreaming()
+// (or an error). MP3 streams only have titles if the server sends ICY metadata.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetMetadataOnly(WRC_Stream* stream, int enabled);
+
 // If you set this callback, unrecoverable errors will be reported to you via reportErrorFn.
 WRC_EXTERN void WRC_SetErrorReportingCallback(WRC_Stream* stream, WRC_reportErrorCB reportErrorFn);
 
 // Start streaming. Streams until you call WRC_StopStreaming(), so you probably
 // want to call this in a thread.
 // (Special case: If you passed NULL as playbackFn in WRC_CreateStream(), it returns
-//   right after connecting and calling the stationInfoFn() metadata callback)
+//   right after connecting and calling the stationInfoFn() metadata callback,
+//   unless WRC_SetMetadataOnly() is used)
 // Returns 0 when an error occurs (server not reachable, unsupported format, ...)
 // Returns 1 if there was no error and streaming stopped only because you called
 //   WRC_StopStreaming(). After that you may call WRC_StartStreaming() with the same
@@ -126,6 +385,335 @@ WRC_EXTERN void WRC_StopStreaming(WRC_Stream* stream);
 // free()s all resources hold by the stream and the stream object itself.
 WRC_EXTERN void WRC_CleanupStream(WRC_Stream* stream);
 
+// Decode the stream in a separate thread: The thread receiving the data from the
+// network then only handles ICY metadata and puts the compressed audio data into
+// a ring buffer the decoder thread reads from, so a slow decoder or playbackFn
+// can't keep it from receiving data in time.
+// playbackFn and initAudioFn are then called from the decoder thread.
+// * ringSize: Size of that ring buffer in bytes, 0 for the default (256KB)
+//             If the decoder thread doesn't keep up and the ring is full, the
+//             network thread has to wait.
+// * threadName: Name for the decoder thread (shown in debuggers, top, ...), may be NULL.
+// * cpu: The CPU (core) the decoder thread should run on, -1 to let the OS decide.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetDecoderThread(WRC_Stream* stream, size_t ringSize, const char* threadName, int cpu);
+
+// Buffer the decoded audio before passing it to playbackFn, so short hiccups of the
+// network don't become audible dropouts: playbackFn isn't called before targetMs
+// milliseconds of audio are buffered, and then it's called from a separate playout
+// thread with the samples at the pace of the samplerate (a bit ahead of time,
+// so you should still have a small buffer of your own).
+// If the buffer runs empty anyway, playback waits until it's filled to targetMs again.
+// * targetMs: How much audio to buffer before playback (re)starts, 0 to disable the buffer
+// * maxMs: How much audio is buffered at most, 0 for 2*targetMs. When the buffer is full,
+//          the decoder waits (and with it receiving data, unless WRC_SetDecoderThread() is used).
+// initAudioFn is called after all samples in the old format have been played.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetJitterBuffer(WRC_Stream* stream, int targetMs, int maxMs);
+
+// Instead of getting the decoded samples pushed to playbackFn, fetch them yourself
+// with WRC_ReadSamples() whenever your audio device wants them, so the device's clock
+// drives playback. You may pass NULL as playbackFn to WRC_CreateStream() then
+// (but initAudioFn is still needed to tell you about the format).
+// The samples are buffered like with WRC_SetJitterBuffer():
+// * targetMs: WRC_ReadSamples() only returns samples once this much audio is buffered
+//             (also after an underrun), 0 to return them as soon as they're decoded
+// * maxMs: How much audio is buffered at most (for 48kHz stereo, formats with more
+//          samples per second get less), 0 for 2*targetMs (or 500 if targetMs is 0).
+//          When the buffer is full, the decoder waits.
+// * fillSilence: If 1, WRC_ReadSamples() fills the part of dst it couldn't read with
+//                silence, so you can pass dst to the audio device as it is.
+// When the format changes, initAudioFn is called after you've read all samples
+// in the old format.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetPullMode(WRC_Stream* stream, int targetMs, int maxMs, int fillSilence);
+
+// Pull mode only (see WRC_SetPullMode()): Reads up to numFrames frames (one sample
+// for each channel) into dst, which must have room for numFrames*numChannels samples.
+// The samples are int16_t, or in the format set with WRC_SetOutputFormat() (but always
+// interleaved).
+// Waits up to timeoutMs milliseconds for enough samples, with timeoutMs == 0 it doesn't
+// wait and never takes a lock, so it may be called from a realtime audio thread.
+// Must only be called from one thread at a time.
+// Returns the number of frames read, if that's less than numFrames the rest of dst
+// has been filled with silence if you asked for that in WRC_SetPullMode().
+// Until initAudioFn has been called the number of channels isn't known, so then
+// only numFrames samples (as many frames for one channel) are cleared.
+WRC_EXTERN size_t WRC_ReadSamples(WRC_Stream* stream, void* dst, size_t numFrames, int timeoutMs);
+
+// Get the decoded samples as int32_t (WRC_FMT_S32) or float (WRC_FMT_F32) instead of int16_t,
+// and/or with one array per channel (planar != 0) instead of interleaved.
+// Vorbis is decoded to float anyway, with WRC_FMT_F32 nothing is lost by converting it,
+// and with planar WRC_FMT_F32 the decoder's arrays are passed to you without copying them
+// (unless WRC_SetJitterBuffer() is used). MP3 is decoded right to the requested format.
+// playbackFn is called instead of the playbackFn passed to WRC_CreateStream(),
+// it may be NULL with WRC_SetPullMode() or if you only want the metadata.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetOutputFormat(WRC_Stream* stream, int format, int planar, WRC_playbackFmtCB playbackFn);
+
+// Instead of getting the samples passed to playbackFn, let the library write them
+// into your memory (e.g. your audio ring buffer): before writing, it calls acquireFn to
+// ask you where, afterwards commitFn to tell you how much it wrote. The samples are
+// interleaved (even if WRC_SetOutputFormat() asks for planar ones), in the format set
+// with WRC_SetOutputFormat() and with the samplerate and channels last passed to initAudioFn.
+// Unless WRC_SetJitterBuffer(), WRC_SetFixedOutput(), WRC_SetDriftCompensation() or
+// WRC_SetCallbackBlockSize() are used, the decoders write right into your memory without
+// any copy in between. Not used with WRC_SetPullMode().
+// Pass NULL for both to use playbackFn again.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetOutputProvider(WRC_Stream* stream, WRC_acquireOutputCB acquireFn,
+                                     WRC_commitOutputCB commitFn);
+
+// Writes the samples into a ring buffer in shared memory (a memfd, Linux only) instead
+// of passing them to playbackFn, for playing them in another process (e.g. when the
+// decoding runs in a sandbox): pass *fd to it (e.g. with SCM_RIGHTS, it's close-on-exec)
+// and read them there with WRC_OpenShmReader(), without any syscalls or copies.
+// Format changes, titles and station info are written into the ring as well, at the
+// position of the samples that were written before, so they're still in the right order
+// (but like with the callbacks, WRC_SetDecoderThread() and WRC_SetJitterBuffer() delay
+// the samples, so the metadata comes earlier by that amount).
+// The callbacks are still called, initAudioFn must be set but doesn't have to do anything.
+// When the ring is full, the stream waits for the reader (like for a playbackFn that blocks).
+// Works with everything except WRC_SetPullMode(). Like WRC_SetOutputProvider() the decoders
+// write right into the ring unless WRC_SetJitterBuffer(), WRC_SetFixedOutput(),
+// WRC_SetDriftCompensation() or WRC_SetCallbackBlockSize() are used. The fill level of
+// the ring is used by WRC_SetFlowControl() and WRC_SetDriftCompensation() without a queuedFn.
+// * size: of the ring in bytes (rounded up to a power of two, at least 64KB), 0 disables it
+// * fd: set to the file descriptor of the memfd, it's valid until size 0 is set or the
+//       stream is cleaned up. The ring is kept over several WRC_StartStreaming() calls.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetSharedMemorySink(WRC_Stream* stream, size_t size, int* fd);
+
+// For the process reading from WRC_SetSharedMemorySink(): maps the ring of the fd,
+// which can be closed afterwards. Only reader and writer must use the same version of
+// libwrclient, the reader doesn't need WRC_Init().
+// Returns NULL on error, otherwise a WRC_ShmReader that must be freed with WRC_CloseShmReader()
+WRC_EXTERN WRC_ShmReader* WRC_OpenShmReader(int fd);
+
+// Sets event to the next event from the ring without removing it, so calling this again
+// returns the same event until it's released with WRC_ShmReaderRelease().
+// Doesn't block or take a lock, so it can be called from a realtime audio thread
+// (poll it like you'd poll WRC_ReadSamples()). Must only be called from one thread at a time.
+// Returns 1 if there was an event, 0 if the ring is empty and -1 if its content is corrupt.
+WRC_EXTERN int WRC_ShmReaderNext(WRC_ShmReader* reader, WRC_ShmEvent* event);
+
+// Removes the event last returned by WRC_ShmReaderNext() from the ring, so the writer can
+// reuse its memory. For WRC_SHM_SAMPLES only numFrames frames are removed, the next
+// WRC_ShmReaderNext() returns the rest of them. numFrames is ignored for other events.
+WRC_EXTERN void WRC_ShmReaderRelease(WRC_ShmReader* reader, size_t numFrames);
+
+WRC_EXTERN void WRC_CloseShmReader(WRC_ShmReader* reader);
+
+// Always get the samples with this samplerate and number of channels: initAudioFn is
+// only called once per WRC_StartStreaming() with this format, and when the stream's format
+// changes (e.g. at a track boundary of a chained Ogg stream) the samples are resampled
+// and their channels converted instead, so you don't have to reopen your audio device.
+// Mono is played on all channels, when there are more channels than you want only the
+// first ones are used (the front left and right ones for stereo), or the average for mono.
+// * sampleRate: the samplerate you want, 0 to disable this again (the default)
+// * quality: WRC_RESAMPLE_FAST, WRC_RESAMPLE_MEDIUM or WRC_RESAMPLE_BEST,
+//            the better the quality, the longer the filter (8, 16 or 32 taps).
+//            Streams that already have sampleRate aren't filtered at all.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetFixedOutput(WRC_Stream* stream, int sampleRate, int numChannels, int quality);
+
+// Compensates the drift between the clock of the server (the encoder's samplerate)
+// and the clock of your audio device, so the amount of buffered audio stays at targetMs
+// even in sessions that last for hours, instead of slowly running empty or piling up.
+// The drift is estimated from how much audio is buffered and the samples are resampled
+// with a ratio that differs by up to maxPpm (a few ppm most of the time) from the
+// nominal one, which isn't audible. Uses the resampler of WRC_SetFixedOutput(), if that
+// isn't used the format passed to initAudioFn is the stream's format like without this.
+// * targetMs: how much audio should be buffered, 0 to disable this (the default)
+// * maxPpm: the ratio is changed by at most this many millionths, e.g. 200
+// * queuedFn: tells the library how much audio you have queued (like for
+//             WRC_SetFlowControl()), it's called from the thread decoding the stream.
+//             May be NULL if you use WRC_SetJitterBuffer() or WRC_SetPullMode(),
+//             then their buffer is used, with WRC_SetPullMode() that's the best choice.
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetDriftCompensation(WRC_Stream* stream, int targetMs, int maxPpm, WRC_queuedMsCB queuedFn);
+
+// Sets how many frames (one sample for each channel) playbackFn gets at once:
+// smaller outputs of the decoder (e.g. 1152 frames per MP3 frame, often less because
+// of the ICY metadata) are collected until there are at least minSize frames, bigger
+// ones are split into blocks of at most maxSize frames. Fewer, bigger calls cost less,
+// smaller ones give less latency. When the stream or its format ends the last block
+// may be smaller. Not used with WRC_SetPullMode(), there you decide yourself.
+// * minSize, maxSize: the block size in frames, or in milliseconds if inMs is 1.
+//                     minSize 0 disables this (the default)
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetCallbackBlockSize(WRC_Stream* stream, int minSize, int maxSize, int inMs);
+
+// Reconnect automatically when the connection of a stream that was already playing
+// drops (or the server closes it), instead of reporting WRC_ERR_UNAVAILABLE.
+// The decoder and the audio format are kept, so initAudioFn isn't called again
+// unless the format changed, and stationInfoFn only if the station info changed.
+// With WRC_SetJitterBuffer() or WRC_SetPullMode() short drops might not even be audible.
+// The n-th attempt is made after initialDelayMs * 2^(n-1) milliseconds (at most maxDelayMs).
+// * maxAttempts: Give up (and report the error) after this many failed attempts in a row,
+//                -1 for no limit, 0 to disable reconnects (the default)
+// * jitterPercent: Randomly changes each delay by up to this many percent (0-100), so
+//                  the listeners of a restarted server don't all come back at the same time
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetReconnectPolicy(WRC_Stream* stream, int maxAttempts, int initialDelayMs,
+                                      int maxDelayMs, int jitterPercent);
+
+// Flow control: Many servers send several seconds of audio at once when connecting,
+// some send faster than realtime. To keep that from piling up in your playback
+// queue (or in the buffer of WRC_SetJitterBuffer() or WRC_SetPullMode()), receiving
+// data is paused while more than highMs milliseconds of audio are queued, and resumed
+// once less than lowMs are queued. While the transfer is paused that's checked every
+// 100ms with WRC_StreamGroup and WRC_BeginStreaming(), but only about once per second
+// with WRC_StartStreaming(), so leave some room between the two.
+// * highMs: Pause when more than this is queued, 0 to disable flow control
+// * lowMs: Resume when less than this is queued, must be smaller than highMs
+// * queuedFn: Tells the library how much you have queued. May be NULL if you use
+//             WRC_SetJitterBuffer() or WRC_SetPullMode(), then their buffer is used.
+// Pausing doesn't block the thread, so this also works well with WRC_StreamGroup and
+// WRC_BeginStreaming().
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetFlowControl(WRC_Stream* stream, int highMs, int lowMs, WRC_queuedMsCB queuedFn);
+
+// Keeps a second ("standby") connection to the stream open while it's playing.
+// Its data is received (and thrown away) all the time, so it's current when it's needed
+// and the server doesn't drop it - it needs as much bandwidth as the stream itself.
+// If the stream doesn't get any data for stallMs milliseconds (or the connection
+// drops), the standby connection takes over right away and a new standby connection
+// is opened. The decoder is kept (like with WRC_SetReconnectPolicy()), the switch
+// happens on an MP3 frame or Ogg page boundary. Only works for MP3 and Ogg streams.
+// * stallMs: switch after this long without data, 0 to disable (the default)
+// * mirrorURL: the URL for the standby connection. If NULL, the second stream URL
+//              from the playlist is used (if any), otherwise the stream's URL.
+// * failoverFn: called after each failover with how long it took, may be NULL
+// Works with WRC_StartStreaming() (which then uses its own WRC_StreamGroup internally),
+// WRC_StreamGroup and WRC_BeginStreaming().
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetStandby(WRC_Stream* stream, int stallMs, const char* mirrorURL,
+                              WRC_failoverCB failoverFn);
+
+// Playlists (PLS, M3U, XSPF, ASX) often list several servers for the same stream.
+// If connecting to the first one fails (or it doesn't send audio), the next one is
+// tried. With this, the first numParallel of them are connected to at the same time
+// and the one that delivers audio first is played, the other connections are closed.
+// * numParallel: 1 (the default) to try them one after another, at most 4
+// Works with WRC_StartStreaming() (which then uses its own WRC_StreamGroup internally),
+// WRC_StreamGroup and WRC_BeginStreaming().
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetMirrorRace(WRC_Stream* stream, int numParallel);
+
+// If the stream's URL turns out to be an HLS playlist (m3u8 with #EXT-X- tags), its
+// segments are streamed: a live playlist is reloaded as the spec says, and up to
+// numSegments (1 to 8, default 3) of the next segments are downloaded in parallel
+// ahead of the one that's decoded, over the same connections when the server allows it.
+// A segment download that takes longer than segmentTimeoutMs is retried (0 for the
+// default: three times the playlist's target duration, at least 10 seconds).
+// Only MPEG audio (MPEG-TS or packed audio) is supported, not AAC or encrypted segments.
+// Works with WRC_StartStreaming(), WRC_StreamGroup and WRC_BeginStreaming().
+// Must be called before streaming starts. Returns 1 on success, otherwise 0.
+WRC_EXTERN int WRC_SetHlsPrefetch(WRC_Stream* stream, int numSegments, int segmentTimeoutMs);
+
+// Fills *stats with statistics about the stream. May be called from any thread,
+// but the values might be slightly outdated then.
+WRC_EXTERN void WRC_GetStreamStats(WRC_Stream* stream, WRC_StreamStats* stats);
+
+// The following functions allow streaming without blocking a thread, driven by
+// your own event loop (epoll, libuv, ...), so all callbacks are called from your thread.
+
+// Starts streaming, like WRC_StartStreaming(), but returns right away.
+// Afterwards, use WRC_GetPollInfo() to find out what to wait for, and call
+// WRC_OnSocketEvent() or WRC_OnTimeout() when it happens.
+// Returns 1 on success, 0 on error (e.g. the stream is already streaming)
+WRC_EXTERN int WRC_BeginStreaming(WRC_Stream* stream);
+
+// Tells you which sockets your event loop should wait on for which events, and
+// after what time WRC_OnTimeout() should be called.
+// Call this again after each call to WRC_OnSocketEvent() or WRC_OnTimeout() and
+// update your event loop accordingly: sockets come and go (e.g. when reconnecting
+// or following a playlist).
+WRC_EXTERN void WRC_GetPollInfo(WRC_Stream* stream, WRC_PollInfo* info);
+
+// Call this when one of the sockets from WRC_GetPollInfo() has an event
+// (events is a combination of WRC_POLL_*).
+// Returns WRC_STILL_STREAMING as long as the stream is running; once it stopped
+// (because of an error or WRC_StopStreaming()) it returns what WRC_StartStreaming()
+// would have returned.
+WRC_EXTERN int WRC_OnSocketEvent(WRC_Stream* stream, WRC_Socket fd, int events);
+
+// Call this when the timeout from WRC_GetPollInfo() expired.
+// Returns the same as WRC_OnSocketEvent()
+WRC_EXTERN int WRC_OnTimeout(WRC_Stream* stream);
+
+// Creates a group that streams any number of streams from one thread, so you don't
+// need a thread per stream (like with WRC_StartStreaming()).
+// * finishedFn: Will be called (with the userdata of the stream) whenever a stream
+//               of the group stopped streaming, because of an error or because you
+//               called WRC_StopStreaming() for it. Afterwards the stream isn't part of
+//               the group anymore and may be added again or cleaned up. May be NULL.
+// Returns NULL on error, otherwise a WRC_StreamGroup object.
+WRC_EXTERN WRC_StreamGroup* WRC_CreateStreamGroup(WRC_streamFinishedCB finishedFn);
+
+// Adds the stream to the group and starts streaming it in WRC_RunStreamGroup()'s thread,
+// so all callbacks of the stream are called from that thread.
+// May be called from any thread, also while WRC_RunStreamGroup() is running.
+// Use WRC_StopStreaming() to stop the stream and remove it from the group again.
+// Returns 1 on success, 0 if the stream is already streaming (in a group or not)
+WRC_EXTERN int WRC_AddStreamToGroup(WRC_StreamGroup* group, WRC_Stream* stream);
+
+// Streams all streams of the group until you call WRC_StopStreamGroup(), so you
+// probably want to call this in a thread. If one thread isn't enough for your
+// streams, create several groups and run each in its own thread.
+// When it returns, all streams of the group have been stopped (and finishedFn has
+// been called for them), but you may add new streams and call it again.
+// Returns 1 after WRC_StopStreamGroup(), 0 on error
+WRC_EXTERN int WRC_RunStreamGroup(WRC_StreamGroup* group);
+
+// Makes WRC_RunStreamGroup() stop all streams of the group and return.
+// May be called from any thread.
+WRC_EXTERN void WRC_StopStreamGroup(WRC_StreamGroup* group);
+
+// free()s all resources hold by the group and the group object itself, but not its streams.
+// Must not be called while WRC_RunStreamGroup() is running.
+WRC_EXTERN void WRC_CleanupStreamGroup(WRC_StreamGroup* group);
+
+// Finds out the format of many streams at once, e.g. to update a station directory:
+// up to maxConcurrent URLs are connected at the same time (in a WRC_StreamGroup),
+// playlists are followed and of each stream only the headers and the audio data up to
+// the first MP3 frame header or the Vorbis identification header are read.
+// Blocks until all URLs are done, resultFn is called from this thread for each of them
+// (in the order they finish, which isn't the order of urls).
+// * timeoutMs: give up on a connection (and report WRC_ERR_UNAVAILABLE) after this long,
+//              0 for no limit
+// Returns 1 if all URLs were probed, 0 on error (no resultFn was called then).
+WRC_EXTERN int WRC_ProbeStations(const char* const* urls, size_t numURLs, int maxConcurrent,
+                                 int timeoutMs, WRC_probeResultCB resultFn, void* userdata);
+
+// Creates a pool for prefetching streams (see WRC_Prefetch()), e.g. the stations
+// next to the current one in your UI, so switching to them is instant.
+// The pool has its own thread that connects the streams.
+// * maxStreams: How many prefetched streams that haven't been started are kept at most.
+//               If there are more, the one that was prefetched first is stopped.
+// * idleTimeoutMs: Prefetched streams that haven't been started after this long are
+//                  stopped, 0 to keep them until they're evicted by newer ones.
+// Returns NULL on error, otherwise a WRC_WarmPool object.
+WRC_EXTERN WRC_WarmPool* WRC_CreateWarmPool(int maxStreams, int idleTimeoutMs);
+
+// Connects the stream in the background: the playlist (if any) is resolved, the
+// stream is connected and up to bufferMs milliseconds of audio are received (the
+// amount is based on the bitrate sent by the server), then receiving is paused.
+// No callbacks are called until you start the stream with WRC_StartStreaming(),
+// which then starts playing right away (the held back audio is decoded at once).
+// Unlike usual WRC_StartStreaming() still blocks until the stream stops, but the
+// stream is received in the pool's thread, so all callbacks are called from there.
+// If the stream was stopped in the meantime (evicted, connection failed) WRC_StartStreaming()
+// just streams it normally. Errors while prefetching are reported to reportErrorFn.
+// Don't use WRC_AddStreamToGroup() or WRC_BeginStreaming() for prefetched streams.
+// Returns 1 on success, 0 on error (e.g. the stream is already streaming)
+WRC_EXTERN int WRC_Prefetch(WRC_WarmPool* pool, WRC_Stream* stream, int bufferMs);
+
+// Stops all streams of the pool and free()s all resources hold by the pool.
+// Must not be called while WRC_StartStreaming() runs for one of its streams.
+WRC_EXTERN void WRC_CleanupWarmPool(WRC_WarmPool* pool);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif